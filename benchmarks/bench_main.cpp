@@ -0,0 +1,25 @@
+#include "gravity_bench.h"
+
+#include <cstring>
+
+int main(int argc, char** argv)
+{
+    // Run all the benchmarks or the ones whose names start with command line arguments
+    for (auto &benchmark: Benchmarks())
+    {
+        bool run = argc < 2;
+
+        for (int i = 1; i < argc; ++i)
+        {
+            run = run || std::strncmp(benchmark.first, argv[i], std::strlen(argv[i])) == 0;
+        }
+
+        if (run)
+        {
+            std::cout << "[" << benchmark.first << "]\n";
+            benchmark.second();
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,1236 @@
+#pragma once
+
+#include "sg.h"
+#include "transform.h"
+#include "bvh.h"
+#include "culling.h"
+#include "position_index.h"
+#include "render_queue.h"
+#include "instancing.h"
+#include "lod.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <random>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using Clock = std::chrono::high_resolution_clock;
+
+// Benchmark registry
+inline std::vector<std::pair<char const *, void (*)()>> &Benchmarks()
+{
+    static std::vector<std::pair<char const *, void (*)()>> benchmarks;
+    return benchmarks;
+}
+
+struct BenchmarkRegistrar
+{
+    BenchmarkRegistrar(char const *name, void (*func)())
+    {
+        Benchmarks().emplace_back(name, func);
+    }
+};
+
+#define BENCHMARK(name) \
+    static void Benchmark_##name(); \
+    static BenchmarkRegistrar g_registrar_##name(#name, &Benchmark_##name); \
+    static void Benchmark_##name()
+
+// Elapsed time in nanoseconds
+inline double ElapsedNs(Clock::time_point start, Clock::time_point end)
+{
+    return static_cast<double>(std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count());
+}
+
+// Busy wait for a given number of nanoseconds
+inline void Spin(double ns)
+{
+    auto start = Clock::now();
+    while (ElapsedNs(start, Clock::now()) < ns);
+}
+
+template<typename SceneGraph>
+class BasicBenchParameterFactory : public SceneGraph::ParameterFactory
+{
+public:
+    std::map<std::string, Gravity::Parameter> GetParameterSet(std::uint32_t const &) const override
+    {
+        std::map<std::string, Gravity::Parameter> params;
+        params.emplace("type", 5);
+        params.emplace("float_value", 3.8f);
+        return params;
+    }
+};
+
+using BenchParameterFactory = BasicBenchParameterFactory<Gravity::DefaultSceneGraph>;
+
+// Time other threads wait for node and registry locks while observers run
+BENCHMARK(LockHoldTime)
+{
+    int const kNumEdits = 2000;
+    // Observer cost
+    double const kObserverNs = 20000.0;
+
+    std::unique_ptr<Gravity::DefaultSceneGraph> sg(Gravity::CreateDefaultSceneGraph(new BenchParameterFactory));
+
+    sg->RegisterOnNodeParameterChangeCallback([kObserverNs](Gravity::DefaultSceneGraph::Node *, std::string const &)
+                                              { Spin(kObserverNs); });
+    sg->RegisterOnNodeCreateCallback([kObserverNs](Gravity::DefaultSceneGraph::Node *)
+                                     { Spin(kObserverNs); }, {1});
+
+    auto node = sg->CreateNode(0);
+
+    std::atomic<bool> done(false);
+
+    // Writer edits the node and creates nodes, observers run on this thread
+    std::thread writer([&]()
+                       {
+                           for (int i = 0; i < kNumEdits; ++i)
+                           {
+                               node->SetValue("type", i);
+                               sg->DeleteNode(sg->CreateNode(1));
+                           }
+
+                           done = true;
+                       });
+
+    // Reader measures how long it takes to get through the locks
+    double node_total = 0.0, node_max = 0.0;
+    double registry_total = 0.0, registry_max = 0.0;
+    int samples = 0;
+
+    while (!done)
+    {
+        auto start = Clock::now();
+        node->GetValue<int>("float_value");
+        auto middle = Clock::now();
+        sg->DeleteNode(sg->CreateNode(2));
+        auto end = Clock::now();
+
+        node_total += ElapsedNs(start, middle);
+        node_max = std::max(node_max, ElapsedNs(start, middle));
+        registry_total += ElapsedNs(middle, end);
+        registry_max = std::max(registry_max, ElapsedNs(middle, end));
+        ++samples;
+
+        std::this_thread::yield();
+    }
+
+    writer.join();
+
+    std::cout << "  node lock wait:     mean " << node_total / samples << " ns, max " << node_max << " ns\n";
+    std::cout << "  registry lock wait: mean " << registry_total / samples << " ns, max " << registry_max << " ns\n";
+}
+
+// Render thread reads while the game thread writes: locked reads versus reads of the published front buffer
+BENCHMARK(FrontBufferReads)
+{
+    int const kNumNodes = 1000;
+    int const kNumFrames = 200;
+
+    std::unique_ptr<Gravity::DefaultSceneGraph> sg(Gravity::CreateDefaultSceneGraph(new BenchParameterFactory));
+
+    std::vector<Gravity::DefaultSceneGraph::Node *> nodes;
+    for (int i = 0; i < kNumNodes; ++i)
+        nodes.push_back(sg->CreateNode(0));
+
+    sg->SwapBuffers();
+
+    for (int front = 0; front < 2; ++front)
+    {
+        std::atomic<bool> done(false);
+
+        // Game thread updates every node each frame and publishes it
+        std::thread writer([&]()
+                           {
+                               for (int frame = 0; frame < kNumFrames; ++frame)
+                               {
+                                   for (auto node: nodes)
+                                       node->SetValue("float_value", static_cast<float>(frame));
+
+                                   sg->SwapBuffers();
+                               }
+
+                               done = true;
+                           });
+
+        double total = 0.0;
+        std::uint64_t reads = 0;
+        float sum = 0.f;
+
+        while (!done)
+        {
+            auto start = Clock::now();
+
+            if (front)
+            {
+                Gravity::DefaultSceneGraph::FrontReader reader(*sg);
+
+                for (auto node: nodes)
+                    sum += reader.GetValue<float>(node, "float_value");
+            }
+            else
+            {
+                for (auto node: nodes)
+                    sum += node->GetValue<float>("float_value");
+            }
+
+            total += ElapsedNs(start, Clock::now());
+            reads += nodes.size();
+        }
+
+        writer.join();
+
+        std::cout << (front ? "  front buffer read: " : "  locked read:       ") << total / reads << " ns per value"
+                  << (sum < 0.f ? "\n" : "\n");
+    }
+
+    for (auto node: nodes)
+        sg->DeleteNode(node);
+}
+
+// Snapshot cost depends on the number of changes since the previous one, not on the scene size
+BENCHMARK(Snapshot)
+{
+    int const kNumNodes = 100000;
+
+    std::unique_ptr<Gravity::DefaultSceneGraph> sg(Gravity::CreateDefaultSceneGraph(new BenchParameterFactory));
+
+    std::vector<Gravity::DefaultSceneGraph::Node *> nodes;
+    for (int i = 0; i < kNumNodes; ++i)
+        nodes.push_back(sg->CreateNode(0));
+
+    auto start = Clock::now();
+    auto snapshot = sg->TakeSnapshot();
+    std::cout << "  initial snapshot of " << snapshot.GetSize() << " nodes: " << ElapsedNs(start, Clock::now()) / 1e6
+              << " ms\n";
+
+    for (int num_changes: {10, 1000, 100000})
+    {
+        for (int i = 0; i < num_changes; ++i)
+            nodes[(i * 7919) % kNumNodes]->SetValue("float_value", static_cast<float>(i));
+
+        start = Clock::now();
+        snapshot = sg->TakeSnapshot();
+        std::cout << "  snapshot after " << num_changes << " changes: " << ElapsedNs(start, Clock::now()) / 1e6
+                  << " ms\n";
+    }
+
+    for (auto node: nodes)
+        sg->DeleteNode(node);
+}
+
+// Many small tasks making a few edits each: direct edits versus command buffers submitted in bulk
+BENCHMARK(CommandBuffers)
+{
+    int const kNumNodes = 1000;
+    int const kNumTasks = 256;
+    int const kEditsPerTask = 8;
+
+    std::unique_ptr<Gravity::DefaultSceneGraph> sg(Gravity::CreateDefaultSceneGraph(new BenchParameterFactory));
+
+    int notifications = 0;
+    sg->RegisterOnNodeChangeSetCallback([&notifications](Gravity::DefaultSceneGraph::Node *,
+                                                         Gravity::DefaultSceneGraph::ChangeSet const &)
+                                        { ++notifications; });
+
+    std::vector<Gravity::DefaultSceneGraph::Node *> nodes;
+    for (int i = 0; i < kNumNodes; ++i)
+        nodes.push_back(sg->CreateNode(0));
+
+    auto target = [&nodes](int task, int edit)
+    { return nodes[(task * 31 + edit * 7) % nodes.size()]; };
+
+    auto start = Clock::now();
+
+    for (int task = 0; task < kNumTasks; ++task)
+    {
+        for (int edit = 0; edit < kEditsPerTask; ++edit)
+            target(task, edit)->SetValue("float_value", static_cast<float>(edit));
+    }
+
+    std::cout << "  direct edits:    " << ElapsedNs(start, Clock::now()) / (kNumTasks * kEditsPerTask)
+              << " ns per edit, " << notifications << " notifications\n";
+
+    notifications = 0;
+    std::vector<Gravity::DefaultSceneGraph::CommandBuffer> buffers(kNumTasks);
+    std::vector<Gravity::DefaultSceneGraph::CommandBuffer *> submission;
+
+    start = Clock::now();
+
+    for (int task = 0; task < kNumTasks; ++task)
+    {
+        for (int edit = 0; edit < kEditsPerTask; ++edit)
+            buffers[task].SetValue(target(task, edit), "float_value", static_cast<float>(edit));
+
+        submission.push_back(&buffers[task]);
+    }
+
+    sg->Submit(submission);
+
+    std::cout << "  command buffers: " << ElapsedNs(start, Clock::now()) / (kNumTasks * kEditsPerTask)
+              << " ns per edit, " << notifications << " notifications\n";
+
+    for (auto node: nodes)
+        sg->DeleteNode(node);
+}
+
+// Per operation cost and node footprint of the locking scene graph compared to the single threaded one
+template<typename SceneGraph>
+static void MeasureThreadingPolicy(char const *name)
+{
+    int const kNumNodes = 1000;
+    int const kNumOps = 1000000;
+
+    SceneGraph sg(new BasicBenchParameterFactory<SceneGraph>);
+
+    std::vector<typename SceneGraph::Node *> nodes;
+    for (int i = 0; i < kNumNodes; ++i)
+        nodes.push_back(sg.CreateNode(0));
+
+    auto start = Clock::now();
+
+    for (int i = 0; i < kNumOps; ++i)
+        nodes[i % kNumNodes]->SetValue("float_value", static_cast<float>(i));
+
+    auto set_ns = ElapsedNs(start, Clock::now()) / kNumOps;
+
+    float sum = 0.f;
+    start = Clock::now();
+
+    for (int i = 0; i < kNumOps; ++i)
+        sum += nodes[i % kNumNodes]->template GetValue<float>("float_value");
+
+    auto get_ns = ElapsedNs(start, Clock::now()) / kNumOps;
+
+    start = Clock::now();
+
+    for (int i = 0; i < kNumOps / 10; ++i)
+        sg.DeleteNode(sg.CreateNode(0));
+
+    auto create_ns = ElapsedNs(start, Clock::now()) / (kNumOps / 10);
+
+    std::cout << "  " << name << ": node " << sizeof(typename SceneGraph::Node) << " bytes, SetValue " << set_ns
+              << " ns, GetValue " << get_ns << " ns, CreateNode + DeleteNode " << create_ns << " ns (" << sum
+              << ")\n";
+
+    for (auto node: nodes)
+        sg.DeleteNode(node);
+}
+
+BENCHMARK(ThreadingPolicy)
+{
+    MeasureThreadingPolicy<Gravity::DefaultSceneGraph>("multi threaded ");
+    MeasureThreadingPolicy<Gravity::SingleThreadedSceneGraph>("single threaded");
+}
+
+// Full traversals of a 1M node hierarchy: flattened arrays compared to following node links
+BENCHMARK(Hierarchy)
+{
+    std::size_t const kNumNodes = 1000000;
+
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    SceneGraph sg(new BasicBenchParameterFactory<SceneGraph>);
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+        nodes.push_back(sg.CreateNode(0));
+
+    // Random tree, parents are picked among earlier nodes
+    std::mt19937 rng(42);
+
+    auto start = Clock::now();
+
+    for (std::size_t i = 1; i < kNumNodes; ++i)
+        sg.SetParent(nodes[i], nodes[std::uniform_int_distribution<std::size_t>(0, i - 1)(rng)]);
+
+    std::cout << "  SetParent:           " << ElapsedNs(start, Clock::now()) / (kNumNodes - 1) << " ns per node\n";
+
+    start = Clock::now();
+    auto &hierarchy = sg.GetHierarchy();
+    std::cout << "  flatten:             " << ElapsedNs(start, Clock::now()) / 1e6 << " ms\n";
+
+    // Depth of every node
+    std::vector<std::uint32_t> depths(kNumNodes);
+
+    start = Clock::now();
+
+    auto parents = hierarchy.GetParentIndices();
+    for (std::size_t i = 0; i < parents.GetSize(); ++i)
+        depths[i] = parents[i] == SceneGraph::kNoParent ? 0 : depths[parents[i]] + 1;
+
+    std::uint64_t flat_sum = 0;
+    for (auto depth: depths)
+        flat_sum += depth;
+
+    std::cout << "  flattened traversal: " << ElapsedNs(start, Clock::now()) / 1e6 << " ms\n";
+
+    start = Clock::now();
+
+    std::uint64_t linked_sum = 0;
+    std::vector<std::pair<SceneGraph::Node *, std::uint32_t>> stack{{nodes[0], 0}};
+
+    while (!stack.empty())
+    {
+        auto top = stack.back();
+        stack.pop_back();
+        linked_sum += top.second;
+
+        for (auto child = top.first->GetFirstChild(); child; child = child->GetNextSibling())
+            stack.emplace_back(child, top.second + 1);
+    }
+
+    std::cout << "  linked traversal:    " << ElapsedNs(start, Clock::now()) / 1e6 << " ms"
+              << (flat_sum == linked_sum ? "" : " (mismatch)") << "\n";
+
+    start = Clock::now();
+    sg.DeleteSubtree(nodes[0]);
+    std::cout << "  DeleteSubtree:       " << ElapsedNs(start, Clock::now()) / kNumNodes << " ns per node\n";
+}
+
+class TransformBenchParameterFactory : public Gravity::SingleThreadedSceneGraph::ParameterFactory
+{
+public:
+    std::map<std::string, Gravity::Parameter> GetParameterSet(std::uint32_t const &type) const override
+    {
+        std::map<std::string, Gravity::Parameter> params;
+        params.emplace("local", Gravity::Matrix4::Identity());
+
+        if (type == 1)
+            params.emplace("bounds", Gravity::Aabb{{-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f}});
+
+        return params;
+    }
+};
+
+// World transform update of a 1M node scene where 1% of nodes move per frame
+BENCHMARK(TransformUpdate)
+{
+    std::size_t const kNumNodes = 1000000;
+    std::size_t const kNumMoved = kNumNodes / 100;
+    int const kNumFrames = 20;
+
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    SceneGraph sg(new TransformBenchParameterFactory);
+    Gravity::TransformSystem<SceneGraph> transforms(sg, "local");
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+        nodes.push_back(sg.CreateNode(0));
+
+    std::mt19937 rng(42);
+
+    for (std::size_t i = 1; i < kNumNodes; ++i)
+        sg.SetParent(nodes[i], nodes[std::uniform_int_distribution<std::size_t>(0, i - 1)(rng)]);
+
+    // Flatten the hierarchy beforehand
+    sg.GetHierarchy();
+
+    auto start = Clock::now();
+    transforms.Update();
+    std::cout << "  full update:        " << ElapsedNs(start, Clock::now()) / 1e6 << " ms\n";
+
+    double total_ns = 0.0;
+    std::size_t total_updated = 0;
+    std::uniform_int_distribution<std::size_t> pick(0, kNumNodes - 1);
+
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        for (std::size_t i = 0; i < kNumMoved; ++i)
+        {
+            auto offset = static_cast<float>(frame);
+            nodes[pick(rng)]->SetValue("local", Gravity::Matrix4::Translation(Gravity::Vector3{offset, 0.f, 0.f}));
+        }
+
+        start = Clock::now();
+        total_updated += transforms.Update();
+        total_ns += ElapsedNs(start, Clock::now());
+    }
+
+    std::cout << "  incremental update: " << total_ns / kNumFrames / 1e6 << " ms per frame, "
+              << total_updated / kNumFrames << " transforms recomputed\n";
+}
+
+// Transform update of a 1M node scene moving as a whole on different numbers of threads
+static void MeasureParallelTransformUpdate(char const *name, std::size_t (*parent)(std::size_t))
+{
+    std::size_t const kNumNodes = 1000000;
+    int const kNumFrames = 10;
+
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    SceneGraph sg(new TransformBenchParameterFactory);
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+    {
+        nodes.push_back(sg.CreateNode(0));
+
+        if (i > 0)
+            sg.SetParent(nodes[i], nodes[parent(i)]);
+    }
+
+    std::cout << "  " << name << ":";
+
+    for (std::size_t num_threads: {1u, 2u, 4u})
+    {
+        Gravity::TaskPool pool(num_threads);
+        Gravity::TransformSystem<SceneGraph> transforms(sg, "local", Gravity::LocalTransform::kMatrix,
+                                                        num_threads > 1 ? &pool : nullptr);
+        transforms.Update();
+
+        double total_ns = 0.0;
+
+        for (int frame = 0; frame < kNumFrames; ++frame)
+        {
+            auto offset = static_cast<float>(frame);
+            nodes[0]->SetValue("local", Gravity::Matrix4::Translation(Gravity::Vector3{offset, 0.f, 0.f}));
+
+            auto start = Clock::now();
+            transforms.Update();
+            total_ns += ElapsedNs(start, Clock::now());
+        }
+
+        std::cout << " " << num_threads << " threads " << total_ns / kNumFrames / 1e6 << " ms;";
+    }
+
+    std::cout << "\n";
+}
+
+BENCHMARK(ParallelTransformUpdate)
+{
+    std::cout << "  hardware threads: " << std::thread::hardware_concurrency() << "\n";
+    // Root with 999 children having 1000 children each
+    MeasureParallelTransformUpdate("wide", [](std::size_t i) -> std::size_t
+    { return i < 1000 ? 0 : 1 + (i - 1000) / 1000; });
+    // Root with 1000 chains of 1000 nodes
+    MeasureParallelTransformUpdate("deep", [](std::size_t i) -> std::size_t
+    { return i <= 1000 ? 0 : i - 1000; });
+}
+
+// Incremental maintenance and queries of a hierarchy over 200k nodes compared to a linear scan
+BENCHMARK(BoundingVolumeHierarchy)
+{
+    std::size_t const kNumNodes = 200000;
+    std::size_t const kNumMoved = kNumNodes / 100;
+    int const kNumFrames = 10;
+    int const kNumQueries = 1000;
+
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    SceneGraph sg(new TransformBenchParameterFactory);
+    Gravity::TransformSystem<SceneGraph> transforms(sg, "local");
+    Gravity::BoundingVolumeHierarchy<SceneGraph> bvh(sg, "bounds", &transforms);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coordinate(-500.f, 500.f);
+    auto random_point = [&]()
+    { return Gravity::Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}; };
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+    {
+        nodes.push_back(sg.CreateNode(1));
+        nodes.back()->SetValue("local", Gravity::Matrix4::Translation(random_point()));
+    }
+
+    transforms.Update();
+
+    auto start = Clock::now();
+    bvh.Update();
+    std::cout << "  build:         " << ElapsedNs(start, Clock::now()) / 1e6 << " ms, cost " << bvh.GetCost() << "\n";
+
+    double total_ns = 0.0;
+
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        // Nodes drift a little
+        for (std::size_t i = 0; i < kNumMoved; ++i)
+        {
+            auto node = nodes[std::uniform_int_distribution<std::size_t>(0, kNumNodes - 1)(rng)];
+            auto matrix = node->GetValue<Gravity::Matrix4>("local");
+            matrix.m_data[12] += coordinate(rng) * 0.01f;
+            node->SetValue("local", matrix);
+        }
+
+        transforms.Update();
+
+        start = Clock::now();
+        bvh.Update();
+        total_ns += ElapsedNs(start, Clock::now());
+    }
+
+    std::cout << "  update (1%):   " << total_ns / kNumFrames / 1e6 << " ms per frame, cost " << bvh.GetCost()
+              << "\n";
+
+    std::vector<Gravity::Aabb> boxes;
+    std::vector<Gravity::Sphere> spheres;
+    std::vector<Gravity::Ray> rays;
+
+    for (int i = 0; i < kNumQueries; ++i)
+    {
+        auto c = random_point();
+        boxes.push_back(Gravity::Aabb{{c.m_x - 10.f, c.m_y - 10.f, c.m_z - 10.f}, {c.m_x + 10.f, c.m_y + 10.f, c.m_z + 10.f}});
+        spheres.push_back(Gravity::Sphere{random_point(), 10.f});
+        rays.push_back(Gravity::Ray{random_point(), random_point()});
+    }
+
+    std::size_t hits = 0;
+    auto count = [&hits](SceneGraph::Node *)
+    { ++hits; };
+
+    start = Clock::now();
+    for (auto &box: boxes)
+        bvh.QueryBox(box, count);
+    std::cout << "  box query:     " << ElapsedNs(start, Clock::now()) / kNumQueries << " ns (" << hits << " hits)\n";
+
+    hits = 0;
+    start = Clock::now();
+    for (auto &sphere: spheres)
+        bvh.QuerySphere(sphere, count);
+    std::cout << "  sphere query:  " << ElapsedNs(start, Clock::now()) / kNumQueries << " ns (" << hits << " hits)\n";
+
+    hits = 0;
+    start = Clock::now();
+    for (auto &ray: rays)
+        bvh.QueryRay(ray, 1.f, [&hits](SceneGraph::Node *, float)
+        { ++hits; });
+    std::cout << "  ray query:     " << ElapsedNs(start, Clock::now()) / kNumQueries << " ns (" << hits << " hits)\n";
+
+    // Linear scan over the same bounds
+    std::vector<Gravity::Aabb> bounds;
+    for (auto node: nodes)
+        bounds.push_back(bvh.GetBounds(node));
+
+    hits = 0;
+    start = Clock::now();
+    for (int i = 0; i < kNumQueries / 10; ++i)
+    {
+        for (auto &b: bounds)
+            hits += Gravity::Overlaps(b, boxes[i]) ? 1 : 0;
+    }
+    std::cout << "  box scan:      " << ElapsedNs(start, Clock::now()) / (kNumQueries / 10) << " ns (" << hits
+              << " hits)\n";
+}
+
+// Frustum culling of 2M boxes against 4 views: SIMD scan on 1, 2 and 4 threads and the BVH walk
+BENCHMARK(FrustumCulling)
+{
+    std::size_t const kNumBoxes = 2000000;
+    std::size_t const kNumNodes = 200000;
+    int const kNumViews = 4;
+    int const kNumFrames = 10;
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coordinate(-500.f, 500.f);
+    auto random_point = [&]()
+    { return Gravity::Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}; };
+
+    // Perspective projection looking down -z, 60 degrees field of view, 300 units deep
+    auto n = 0.5f, f = 300.f, t = 1.f / std::tan(0.5236f);
+    Gravity::Matrix4 projection{{t, 0.f, 0.f, 0.f,
+                                 0.f, t, 0.f, 0.f,
+                                 0.f, 0.f, (f + n) / (n - f), -1.f,
+                                 0.f, 0.f, 2.f * f * n / (n - f), 0.f}};
+
+    std::vector<Gravity::Frustum> views;
+    for (int view = 0; view < kNumViews; ++view)
+    {
+        auto eye = random_point();
+        views.push_back(Gravity::Frustum::FromMatrix(
+                projection * Gravity::Matrix4::Translation(Gravity::Vector3{-eye.m_x, -eye.m_y, -eye.m_z})));
+    }
+
+    Gravity::AabbArray boxes;
+    for (std::size_t i = 0; i < kNumBoxes; ++i)
+    {
+        auto c = random_point();
+        boxes.PushBack(Gravity::Aabb{{c.m_x - 0.5f, c.m_y - 0.5f, c.m_z - 0.5f}, {c.m_x + 0.5f, c.m_y + 0.5f, c.m_z + 0.5f}});
+    }
+
+    std::vector<std::uint32_t> visible(kNumBoxes);
+
+    for (std::size_t num_threads: {1, 2, 4})
+    {
+        Gravity::TaskPool pool(num_threads);
+        std::size_t grain = 16384;
+        std::size_t num_visible = 0;
+
+        auto start = Clock::now();
+        for (int frame = 0; frame < kNumFrames; ++frame)
+        {
+            for (auto &view: views)
+            {
+                std::atomic<std::size_t> count(0);
+                pool.ParallelFor((kNumBoxes + grain - 1) / grain, 1, [&](std::size_t begin, std::size_t end)
+                {
+                    std::size_t size = 0;
+                    auto out = visible.data() + begin * grain;
+                    Gravity::CullBoxes(view, boxes, begin * grain, std::min(end * grain, kNumBoxes),
+                                       [&](std::size_t index)
+                                       { out[size++] = static_cast<std::uint32_t>(index); });
+                    count += size;
+                });
+                num_visible += count;
+            }
+        }
+
+        std::cout << "  scan, " << num_threads << " thread(s): " << ElapsedNs(start, Clock::now()) / kNumFrames /
+                                                                   kNumViews / 1e6
+                  << " ms per view (" << num_visible / kNumFrames / kNumViews << " visible of " << kNumBoxes
+                  << ")\n";
+    }
+
+    // Scalar reference
+    std::size_t num_visible = 0;
+    auto start = Clock::now();
+    for (auto &view: views)
+    {
+        for (std::size_t i = 0; i < kNumBoxes; ++i)
+            num_visible += view.Classify(boxes.Get(i)) != Gravity::Containment::kOutside ? 1 : 0;
+    }
+    std::cout << "  scalar scan:       " << ElapsedNs(start, Clock::now()) / kNumViews / 1e6 << " ms per view ("
+              << num_visible / kNumViews << " visible)\n";
+
+    // Culler over scene graph nodes
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    SceneGraph sg(new TransformBenchParameterFactory);
+    Gravity::TransformSystem<SceneGraph> transforms(sg, "local");
+    Gravity::BoundingVolumeHierarchy<SceneGraph> bvh(sg, "bounds", &transforms);
+    Gravity::FrustumCuller<SceneGraph> culler(bvh);
+
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+        sg.CreateNode(1)->SetValue("local", Gravity::Matrix4::Translation(random_point()));
+
+    transforms.Update();
+    bvh.Update();
+
+    std::vector<SceneGraph::Node *> nodes;
+    num_visible = 0;
+    start = Clock::now();
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        for (auto &view: views)
+        {
+            culler.Cull(view, nodes);
+            num_visible += nodes.size();
+        }
+    }
+    std::cout << "  culler scan:       " << ElapsedNs(start, Clock::now()) / kNumFrames / kNumViews / 1e6
+              << " ms per view (" << num_visible / kNumFrames / kNumViews << " visible of " << kNumNodes << ")\n";
+
+    num_visible = 0;
+    start = Clock::now();
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        for (auto &view: views)
+        {
+            culler.CullHierarchy(view, nodes);
+            num_visible += nodes.size();
+        }
+    }
+    std::cout << "  culler hierarchy:  " << ElapsedNs(start, Clock::now()) / kNumFrames / kNumViews / 1e6
+              << " ms per view (" << num_visible / kNumFrames / kNumViews << " visible of " << kNumNodes << ")\n";
+}
+
+// Nearest hit ray casts against 200K nodes: single rays, packets of coherent rays and a linear scan
+BENCHMARK(Raycast)
+{
+    std::size_t const kNumNodes = 200000;
+    std::size_t const kGridSize = 64;
+
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    using Hit = Gravity::BoundingVolumeHierarchy<SceneGraph>::Hit;
+    SceneGraph sg(new TransformBenchParameterFactory);
+    Gravity::TransformSystem<SceneGraph> transforms(sg, "local");
+    Gravity::BoundingVolumeHierarchy<SceneGraph> bvh(sg, "bounds", &transforms);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coordinate(-500.f, 500.f);
+
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+        sg.CreateNode(1)->SetValue("local", Gravity::Matrix4::Translation(
+                Gravity::Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}));
+
+    transforms.Update();
+    bvh.Update();
+
+    // Grid of rays from a camera outside of the scene, like picking or visibility probes
+    std::vector<Gravity::Ray> rays;
+    for (std::size_t y = 0; y < kGridSize; ++y)
+    {
+        for (std::size_t x = 0; x < kGridSize; ++x)
+        {
+            rays.push_back(Gravity::Ray{Gravity::Vector3{0.f, 0.f, 1000.f},
+                                        Gravity::Vector3{(x - kGridSize / 2.f) * 0.01f, (y - kGridSize / 2.f) * 0.01f,
+                                                         -1.f}});
+        }
+    }
+
+    std::vector<Hit> hits(rays.size());
+    std::size_t num_hit = 0;
+
+    auto start = Clock::now();
+    for (std::size_t i = 0; i < rays.size(); ++i)
+        num_hit += bvh.Raycast(rays[i], 2000.f, hits[i]) ? 1 : 0;
+    std::cout << "  single:      " << ElapsedNs(start, Clock::now()) / rays.size() << " ns per ray (" << num_hit
+              << " of " << rays.size() << " hit)\n";
+
+    num_hit = 0;
+    start = Clock::now();
+    bvh.RaycastPacket(rays.data(), rays.size(), 2000.f, hits.data());
+    auto elapsed = ElapsedNs(start, Clock::now());
+    for (auto &hit: hits)
+        num_hit += hit.m_node ? 1 : 0;
+    std::cout << "  packet of " << Gravity::RayPacket::kSize << ": " << elapsed / rays.size() << " ns per ray ("
+              << num_hit << " hit)\n";
+
+    std::vector<Hit> all;
+    std::size_t num_all = 0;
+    start = Clock::now();
+    for (auto &ray: rays)
+    {
+        bvh.RaycastAll(ray, 2000.f, all);
+        num_all += all.size();
+    }
+    std::cout << "  all hits:    " << ElapsedNs(start, Clock::now()) / rays.size() << " ns per ray (" << num_all
+              << " hits)\n";
+
+    // Linear scan over the same bounds for a few rays
+    auto &bounds = bvh.GetWorldBounds();
+    num_hit = 0;
+    start = Clock::now();
+    for (std::size_t i = 0; i < 64; ++i)
+    {
+        auto inv_direction = Gravity::GetInverseDirection(rays[i * 64]);
+        auto nearest = 2000.f;
+        float t;
+
+        for (std::size_t object = 0; object < bounds.GetSize(); ++object)
+        {
+            if (Gravity::Intersect(bounds.Get(object), rays[i * 64], inv_direction, nearest, t))
+                nearest = t;
+        }
+
+        num_hit += nearest < 2000.f ? 1 : 0;
+    }
+    std::cout << "  linear scan: " << ElapsedNs(start, Clock::now()) / 64 << " ns per ray (" << num_hit << " hit)\n";
+}
+
+class PositionBenchParameterFactory : public Gravity::SingleThreadedSceneGraph::ParameterFactory
+{
+public:
+    std::map<std::string, Gravity::Parameter> GetParameterSet(std::uint32_t const &) const override
+    {
+        std::map<std::string, Gravity::Parameter> params;
+        params.emplace("position", Gravity::Vector3{0.f, 0.f, 0.f});
+        return params;
+    }
+};
+
+// Radius and nearest neighbour queries over 200K node positions, 4096 queries per frame
+BENCHMARK(PositionIndex)
+{
+    std::size_t const kNumNodes = 200000;
+    std::size_t const kNumMoved = kNumNodes / 100;
+    std::size_t const kNumQueries = 4096;
+    int const kNumFrames = 10;
+
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    using Index = Gravity::PositionIndex<SceneGraph>;
+    SceneGraph sg(new PositionBenchParameterFactory);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coordinate(-500.f, 500.f);
+    auto random_point = [&]()
+    { return Gravity::Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}; };
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+    {
+        nodes.push_back(sg.CreateNode(1 + i % 4));
+        nodes.back()->SetValue("position", random_point());
+    }
+
+    Index index(sg, "position", 40.f);
+
+    auto start = Clock::now();
+    index.Update();
+    std::cout << "  build:            " << ElapsedNs(start, Clock::now()) / 1e6 << " ms\n";
+
+    double total_ns = 0.0;
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        for (std::size_t i = 0; i < kNumMoved; ++i)
+        {
+            auto node = nodes[std::uniform_int_distribution<std::size_t>(0, kNumNodes - 1)(rng)];
+            auto p = node->GetValue<Gravity::Vector3>("position");
+            node->SetValue("position", Gravity::Vector3{p.m_x + coordinate(rng) * 0.01f, p.m_y, p.m_z});
+        }
+
+        start = Clock::now();
+        index.Update();
+        total_ns += ElapsedNs(start, Clock::now());
+    }
+
+    std::cout << "  update (1%):      " << total_ns / kNumFrames / 1e6 << " ms per frame\n";
+
+    std::vector<Gravity::Vector3> centers;
+    for (std::size_t i = 0; i < kNumQueries; ++i)
+        centers.push_back(random_point());
+
+    Gravity::Span<Gravity::Vector3 const> batch(centers.data(), centers.size());
+    std::vector<Index::Neighbour> found;
+    std::size_t num_found = 0;
+
+    start = Clock::now();
+    for (auto &center: centers)
+    {
+        index.FindInRadius(center, 20.f, found);
+        num_found += found.size();
+    }
+    std::cout << "  radius 20:        " << ElapsedNs(start, Clock::now()) / kNumQueries << " ns per query ("
+              << num_found / kNumQueries << " found)\n";
+
+    num_found = 0;
+    start = Clock::now();
+    for (auto &center: centers)
+    {
+        index.FindInRadius(center, 20.f, found, {2});
+        num_found += found.size();
+    }
+    std::cout << "  radius 20, typed: " << ElapsedNs(start, Clock::now()) / kNumQueries << " ns per query ("
+              << num_found / kNumQueries << " found)\n";
+
+    start = Clock::now();
+    for (auto &center: centers)
+        index.FindNearest(center, 8, found);
+    std::cout << "  nearest 8:        " << ElapsedNs(start, Clock::now()) / kNumQueries << " ns per query\n";
+
+    for (std::size_t num_threads: {1, 2, 4})
+    {
+        Gravity::TaskPool pool(num_threads);
+        Index parallel_index(sg, "position", 40.f, &pool);
+        parallel_index.Update();
+
+        Index::BatchResult result;
+        parallel_index.FindNearest(batch, 8, result);
+
+        start = Clock::now();
+        for (int frame = 0; frame < kNumFrames; ++frame)
+            parallel_index.FindInRadius(batch, 20.f, result);
+        auto radius_ns = ElapsedNs(start, Clock::now()) / kNumFrames;
+
+        start = Clock::now();
+        for (int frame = 0; frame < kNumFrames; ++frame)
+            parallel_index.FindNearest(batch, 8, result);
+        auto nearest_ns = ElapsedNs(start, Clock::now()) / kNumFrames;
+
+        std::cout << "  batch, " << num_threads << " thread(s): radius " << radius_ns / 1e6 << " ms, nearest "
+                  << nearest_ns / 1e6 << " ms per " << kNumQueries << " queries\n";
+    }
+
+    // Brute force over the same positions for a few queries
+    std::vector<Gravity::Vector3> positions;
+    for (auto node: nodes)
+        positions.push_back(node->GetValue<Gravity::Vector3>("position"));
+
+    num_found = 0;
+    start = Clock::now();
+    for (std::size_t i = 0; i < 64; ++i)
+    {
+        for (auto &p: positions)
+        {
+            auto dx = p.m_x - centers[i].m_x, dy = p.m_y - centers[i].m_y, dz = p.m_z - centers[i].m_z;
+            num_found += dx * dx + dy * dy + dz * dz <= 400.f ? 1 : 0;
+        }
+    }
+    std::cout << "  brute force:      " << ElapsedNs(start, Clock::now()) / 64 << " ns per query (" << num_found / 64
+              << " found)\n";
+}
+
+// Render queue extraction of 1M draw items: keys from parameters, radix sort against std::sort
+BENCHMARK(RenderQueue)
+{
+    std::size_t const kNumNodes = 100000;
+    std::size_t const kNumItems = 1000000;
+    int const kNumFrames = 10;
+
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    using Queue = Gravity::RenderQueue<SceneGraph>;
+    SceneGraph sg(new PositionBenchParameterFactory);
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coordinate(-500.f, 500.f);
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+    {
+        nodes.push_back(sg.CreateNode(1 + i % 16));
+        nodes.back()->SetValue("position", Gravity::Vector3{coordinate(rng), coordinate(rng), coordinate(rng)});
+    }
+
+    // Visible list as produced by culling several views
+    std::vector<SceneGraph::Node *> visible;
+    for (std::size_t i = 0; i < kNumItems; ++i)
+        visible.push_back(nodes[std::uniform_int_distribution<std::size_t>(0, kNumNodes - 1)(rng)]);
+
+    // Material from the node type, then quantized depth
+    auto make_key = [](SceneGraph::Node *node)
+    {
+        auto depth = node->GetValue<Gravity::Vector3>("position").m_z + 500.f;
+        return static_cast<std::uint64_t>(node->GetType()) << 32 | static_cast<std::uint32_t>(depth * 1000.f);
+    };
+
+    Gravity::Span<SceneGraph::Node *const> span(visible.data(), visible.size());
+
+    for (std::size_t num_threads: {1, 2, 4})
+    {
+        Gravity::TaskPool pool(num_threads);
+        Queue queue(&pool);
+        queue.Extract(span, make_key);
+
+        auto start = Clock::now();
+        for (int frame = 0; frame < kNumFrames; ++frame)
+            queue.Extract(span, make_key);
+        std::cout << "  extract, " << num_threads << " thread(s): " << ElapsedNs(start, Clock::now()) / kNumFrames / 1e6
+                  << " ms\n";
+    }
+
+    // Sorting precomputed keys only
+    std::vector<Queue::DrawItem> items;
+    for (auto node: visible)
+        items.push_back(Queue::DrawItem{make_key(node), node});
+
+    Queue queue;
+    std::uint64_t key_index = 0;
+    auto by_index = [&items, &key_index](SceneGraph::Node *)
+    { return items[key_index++].m_key; };
+
+    double total_ns = 0.0;
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        key_index = 0;
+        auto start = Clock::now();
+        queue.Extract(span, by_index);
+        total_ns += ElapsedNs(start, Clock::now());
+    }
+    std::cout << "  radix sort only:     " << total_ns / kNumFrames / 1e6 << " ms\n";
+
+    total_ns = 0.0;
+    std::vector<Queue::DrawItem> sorted;
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        sorted = items;
+        auto start = Clock::now();
+        std::stable_sort(sorted.begin(), sorted.end(), [](Queue::DrawItem const &a, Queue::DrawItem const &b)
+        { return a.m_key < b.m_key; });
+        total_ns += ElapsedNs(start, Clock::now());
+    }
+    std::cout << "  std::stable_sort:    " << total_ns / kNumFrames / 1e6 << " ms\n";
+
+    total_ns = 0.0;
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        sorted = items;
+        auto start = Clock::now();
+        std::sort(sorted.begin(), sorted.end(), [](Queue::DrawItem const &a, Queue::DrawItem const &b)
+        { return a.m_key < b.m_key; });
+        total_ns += ElapsedNs(start, Clock::now());
+    }
+    std::cout << "  std::sort:           " << total_ns / kNumFrames / 1e6 << " ms\n";
+}
+
+class InstanceBenchParameterFactory : public Gravity::SingleThreadedSceneGraph::ParameterFactory
+{
+public:
+    std::map<std::string, Gravity::Parameter> GetParameterSet(std::uint32_t const &) const override
+    {
+        std::map<std::string, Gravity::Parameter> params;
+        params.emplace("local", Gravity::Matrix4::Identity());
+        params.emplace("mesh", std::uint32_t(0));
+        params.emplace("material", std::uint32_t(0));
+        return params;
+    }
+};
+
+// Instancing groups of 200K nodes in 64 groups: 1% of nodes move and 0.1% change material per frame
+BENCHMARK(InstanceGroups)
+{
+    std::size_t const kNumNodes = 200000;
+    std::size_t const kNumMoved = kNumNodes / 100;
+    std::size_t const kNumRegrouped = kNumNodes / 1000;
+    int const kNumFrames = 20;
+
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    SceneGraph sg(new InstanceBenchParameterFactory);
+    Gravity::TransformSystem<SceneGraph> transforms(sg, "local");
+
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<std::uint32_t> pick_value(0, 7);
+    std::uniform_int_distribution<std::size_t> pick(0, kNumNodes - 1);
+    std::uniform_real_distribution<float> coordinate(-500.f, 500.f);
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+    {
+        nodes.push_back(sg.CreateNode(0));
+        nodes.back()->SetValue("mesh", pick_value(rng));
+        nodes.back()->SetValue("material", pick_value(rng));
+    }
+
+    transforms.Update();
+
+    Gravity::InstanceGroups<SceneGraph, std::uint32_t> groups(sg, {"mesh", "material"}, &transforms);
+
+    auto start = Clock::now();
+    groups.Update();
+    std::cout << "  initial grouping:   " << ElapsedNs(start, Clock::now()) / 1e6 << " ms ("
+              << groups.GetNumGroups() << " groups)\n";
+
+    double total_ns = 0.0;
+    std::size_t total_changed = 0;
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        for (std::size_t i = 0; i < kNumMoved; ++i)
+            nodes[pick(rng)]->SetValue("local", Gravity::Matrix4::Translation(
+                    Gravity::Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}));
+
+        for (std::size_t i = 0; i < kNumRegrouped; ++i)
+            nodes[pick(rng)]->SetValue("material", pick_value(rng));
+
+        transforms.Update();
+
+        start = Clock::now();
+        total_changed += groups.Update();
+        total_ns += ElapsedNs(start, Clock::now());
+    }
+    std::cout << "  incremental update: " << total_ns / kNumFrames / 1e6 << " ms (" << total_changed / kNumFrames
+              << " changes)\n";
+
+    // Rebuilding groups from scratch every frame
+    total_ns = 0.0;
+    std::map<std::pair<std::uint32_t, std::uint32_t>, std::vector<Gravity::Matrix4>> buckets;
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        start = Clock::now();
+        for (auto &bucket: buckets)
+            bucket.second.clear();
+
+        for (auto node: nodes)
+        {
+            auto key = std::make_pair(node->GetValue<std::uint32_t>("mesh"), node->GetValue<std::uint32_t>("material"));
+            buckets[key].push_back(transforms.GetWorldTransform(node));
+        }
+        total_ns += ElapsedNs(start, Clock::now());
+    }
+    std::cout << "  rebuild:            " << total_ns / kNumFrames / 1e6 << " ms\n";
+}
+
+class LodBenchParameterFactory : public Gravity::SingleThreadedSceneGraph::ParameterFactory
+{
+public:
+    std::map<std::string, Gravity::Parameter> GetParameterSet(std::uint32_t const &) const override
+    {
+        std::map<std::string, Gravity::Parameter> params;
+        params.emplace("bounds", Gravity::Aabb{{-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f}});
+        params.emplace("lod", Gravity::LodThresholds{{0.2f, 0.05f, 0.01f}});
+        params.emplace("lod_level", std::uint32_t(0));
+        return params;
+    }
+};
+
+// Level of detail selection of 200K nodes against two cameras moving every frame
+BENCHMARK(LodSelection)
+{
+    std::size_t const kNumNodes = 200000;
+    int const kNumFrames = 20;
+
+    using SceneGraph = Gravity::SingleThreadedSceneGraph;
+    using Selector = Gravity::LodSelector<SceneGraph>;
+    SceneGraph sg(new LodBenchParameterFactory);
+    Gravity::BoundingVolumeHierarchy<SceneGraph> bvh(sg, "bounds");
+
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<float> coordinate(-500.f, 500.f);
+    std::uniform_real_distribution<float> extent(0.5f, 5.f);
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (std::size_t i = 0; i < kNumNodes; ++i)
+    {
+        Gravity::Vector3 c{coordinate(rng), coordinate(rng), coordinate(rng)};
+        auto e = extent(rng);
+        nodes.push_back(sg.CreateNode(0));
+        nodes.back()->SetValue("bounds", Gravity::Aabb{{c.m_x - e, c.m_y - e, c.m_z - e}, {c.m_x + e, c.m_y + e, c.m_z + e}});
+    }
+
+    bvh.Update();
+
+    // Cameras flying along the x axis
+    auto make_views = [](int frame)
+    {
+        auto x = -400.f + 40.f * static_cast<float>(frame);
+        return std::vector<Gravity::LodView>{Gravity::LodView{{x, 0.f, 0.f}, 1.7f},
+                                             Gravity::LodView{{-x, 100.f, 0.f}, 1.7f}};
+    };
+
+    for (std::size_t num_threads: {1, 2, 4})
+    {
+        Gravity::TaskPool pool(num_threads);
+        Selector selector(sg, bvh, "lod", 0.1f, &pool);
+        selector.Update();
+
+        std::vector<Selector::LodChange> changes;
+        double total_ns = 0.0;
+        std::size_t total_changed = 0;
+        for (int frame = 0; frame < kNumFrames; ++frame)
+        {
+            auto views = make_views(frame);
+            auto start = Clock::now();
+            selector.Select(Gravity::Span<Gravity::LodView const>(views.data(), views.size()), changes);
+            total_ns += ElapsedNs(start, Clock::now());
+            total_changed += changes.size();
+        }
+        std::cout << "  select, " << num_threads << " thread(s): " << total_ns / kNumFrames / 1e6 << " ms ("
+                  << total_changed / kNumFrames << " changes)\n";
+    }
+
+    // Per node parameters: reading bounds and thresholds, writing levels through SetValue
+    double total_ns = 0.0;
+    for (int frame = 0; frame < kNumFrames; ++frame)
+    {
+        auto views = make_views(frame);
+        auto start = Clock::now();
+        for (auto node: nodes)
+        {
+            auto box = node->GetValue<Gravity::Aabb>("bounds");
+            auto thresholds = node->GetValue<Gravity::LodThresholds>("lod");
+            auto previous = node->GetValue<std::uint32_t>("lod_level");
+            auto center = box.GetCenter();
+            auto dx = box.m_max.m_x - box.m_min.m_x, dy = box.m_max.m_y - box.m_min.m_y;
+            auto dz = box.m_max.m_z - box.m_min.m_z;
+            auto radius = 0.5f * std::sqrt(dx * dx + dy * dy + dz * dz);
+
+            auto size = 0.f;
+            for (auto &view: views)
+            {
+                auto px = center.m_x - view.m_position.m_x, py = center.m_y - view.m_position.m_y;
+                auto pz = center.m_z - view.m_position.m_z;
+                size = std::max(size, radius * view.m_scale / std::sqrt(px * px + py * py + pz * pz));
+            }
+
+            std::uint32_t level = 0;
+            for (std::uint32_t k = 0; k < 3; ++k)
+                level += size < thresholds.m_sizes[k] * (previous > k ? 1.1f : 0.9f) ? 1 : 0;
+
+            if (level != previous)
+                node->SetValue("lod_level", level);
+        }
+        total_ns += ElapsedNs(start, Clock::now());
+    }
+    std::cout << "  per node parameters: " << total_ns / kNumFrames / 1e6 << " ms\n";
+}
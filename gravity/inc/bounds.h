@@ -0,0 +1,438 @@
+/**
+    \file bounds.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing bounding volume types used by Gravity spatial queries.
+ */
+#pragma once
+
+#include "matrix.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <limits>
+#include <vector>
+
+namespace Gravity
+{
+    /// Axis aligned bounding box.
+    struct Aabb
+    {
+        Vector3 m_min;
+        Vector3 m_max;
+
+        /// Return the box containing nothing (growing it by any box gives that box).
+        static Aabb Empty()
+        {
+            auto inf = std::numeric_limits<float>::infinity();
+            return Aabb{{inf, inf, inf}, {-inf, -inf, -inf}};
+        }
+
+        /// Check if the box contains nothing.
+        bool IsEmpty() const
+        { return m_min.m_x > m_max.m_x || m_min.m_y > m_max.m_y || m_min.m_z > m_max.m_z; }
+
+        /// Return the center of the box.
+        Vector3 GetCenter() const
+        {
+            return Vector3{(m_min.m_x + m_max.m_x) * 0.5f, (m_min.m_y + m_max.m_y) * 0.5f,
+                           (m_min.m_z + m_max.m_z) * 0.5f};
+        }
+
+        /// Return the surface area of the box (zero for an empty box).
+        float GetSurfaceArea() const
+        {
+            if (IsEmpty())
+                return 0.f;
+
+            auto dx = m_max.m_x - m_min.m_x, dy = m_max.m_y - m_min.m_y, dz = m_max.m_z - m_min.m_z;
+            return 2.f * (dx * dy + dy * dz + dz * dx);
+        }
+
+        /// Grow the box to contain a point.
+        void Grow(Vector3 const &p)
+        {
+            m_min = Vector3{std::min(m_min.m_x, p.m_x), std::min(m_min.m_y, p.m_y), std::min(m_min.m_z, p.m_z)};
+            m_max = Vector3{std::max(m_max.m_x, p.m_x), std::max(m_max.m_y, p.m_y), std::max(m_max.m_z, p.m_z)};
+        }
+
+        /// Grow the box to contain another box.
+        void Grow(Aabb const &box)
+        {
+            Grow(box.m_min);
+            Grow(box.m_max);
+        }
+    };
+
+    /// Return the box containing both boxes.
+    inline Aabb Union(Aabb const &a, Aabb const &b)
+    {
+        auto result = a;
+        result.Grow(b);
+        return result;
+    }
+
+    /// Check if two boxes are equal.
+    inline bool operator==(Aabb const &a, Aabb const &b)
+    {
+        return a.m_min.m_x == b.m_min.m_x && a.m_min.m_y == b.m_min.m_y && a.m_min.m_z == b.m_min.m_z &&
+               a.m_max.m_x == b.m_max.m_x && a.m_max.m_y == b.m_max.m_y && a.m_max.m_z == b.m_max.m_z;
+    }
+
+    /// Return the box containing a box transformed by a matrix.
+    inline Aabb Transform(Matrix4 const &m, Aabb const &box)
+    {
+        if (box.IsEmpty())
+            return box;
+
+        // Transform the center and project the extents onto the axes
+        auto c = m.TransformPoint(box.GetCenter());
+        auto ex = (box.m_max.m_x - box.m_min.m_x) * 0.5f;
+        auto ey = (box.m_max.m_y - box.m_min.m_y) * 0.5f;
+        auto ez = (box.m_max.m_z - box.m_min.m_z) * 0.5f;
+
+        auto &d = m.m_data;
+        Vector3 e{std::abs(d[0]) * ex + std::abs(d[4]) * ey + std::abs(d[8]) * ez,
+                  std::abs(d[1]) * ex + std::abs(d[5]) * ey + std::abs(d[9]) * ez,
+                  std::abs(d[2]) * ex + std::abs(d[6]) * ey + std::abs(d[10]) * ez};
+
+        return Aabb{{c.m_x - e.m_x, c.m_y - e.m_y, c.m_z - e.m_z}, {c.m_x + e.m_x, c.m_y + e.m_y, c.m_z + e.m_z}};
+    }
+
+    /// Check if two boxes overlap.
+    inline bool Overlaps(Aabb const &a, Aabb const &b)
+    {
+        return a.m_min.m_x <= b.m_max.m_x && b.m_min.m_x <= a.m_max.m_x &&
+               a.m_min.m_y <= b.m_max.m_y && b.m_min.m_y <= a.m_max.m_y &&
+               a.m_min.m_z <= b.m_max.m_z && b.m_min.m_z <= a.m_max.m_z;
+    }
+
+    /// Sphere.
+    struct Sphere
+    {
+        Vector3 m_center;
+        float m_radius;
+    };
+
+    /// Check if a box and a sphere overlap.
+    inline bool Overlaps(Aabb const &box, Sphere const &sphere)
+    {
+        auto &c = sphere.m_center;
+        auto dx = std::max(std::max(box.m_min.m_x - c.m_x, 0.f), c.m_x - box.m_max.m_x);
+        auto dy = std::max(std::max(box.m_min.m_y - c.m_y, 0.f), c.m_y - box.m_max.m_y);
+        auto dz = std::max(std::max(box.m_min.m_z - c.m_z, 0.f), c.m_z - box.m_max.m_z);
+        return dx * dx + dy * dy + dz * dz <= sphere.m_radius * sphere.m_radius;
+    }
+
+    /// Ray (the direction does not have to be normalized, distances are measured in its lengths).
+    struct Ray
+    {
+        Vector3 m_origin;
+        Vector3 m_direction;
+
+        /// Return the point at a given distance.
+        Vector3 GetPoint(float t) const
+        {
+            return Vector3{m_origin.m_x + m_direction.m_x * t, m_origin.m_y + m_direction.m_y * t,
+                           m_origin.m_z + m_direction.m_z * t};
+        }
+    };
+
+    /// Return component-wise inverse of the ray direction used by Intersect.
+    inline Vector3 GetInverseDirection(Ray const &ray)
+    {
+        return Vector3{1.f / ray.m_direction.m_x, 1.f / ray.m_direction.m_y, 1.f / ray.m_direction.m_z};
+    }
+
+    /// \brief Intersect a ray with a box (slab test).
+    /// \param inv_direction Inverse ray direction (see GetInverseDirection).
+    /// \param t_max Maximum distance along the ray.
+    /// \param t Distance at which the ray enters the box (zero if the origin is inside).
+    /// \return true if the ray hits the box within [0, t_max].
+    inline bool Intersect(Aabb const &box, Ray const &ray, Vector3 const &inv_direction, float t_max, float &t)
+    {
+        auto tx0 = (box.m_min.m_x - ray.m_origin.m_x) * inv_direction.m_x;
+        auto tx1 = (box.m_max.m_x - ray.m_origin.m_x) * inv_direction.m_x;
+        auto ty0 = (box.m_min.m_y - ray.m_origin.m_y) * inv_direction.m_y;
+        auto ty1 = (box.m_max.m_y - ray.m_origin.m_y) * inv_direction.m_y;
+        auto tz0 = (box.m_min.m_z - ray.m_origin.m_z) * inv_direction.m_z;
+        auto tz1 = (box.m_max.m_z - ray.m_origin.m_z) * inv_direction.m_z;
+
+        auto t_enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.f));
+        auto t_exit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::min(std::max(tz0, tz1), t_max));
+
+        t = t_enter;
+        return t_enter <= t_exit;
+    }
+
+    /**
+        \brief Rays intersected with a box at once: eight with AVX, four otherwise.
+
+        Rays are stored as a structure of arrays, unused lanes have a negative maximum distance and never hit.
+     */
+    struct RayPacket
+    {
+#if defined(GRAVITY_AVX)
+        static std::size_t const kSize = 8;
+#else
+        static std::size_t const kSize = 4;
+#endif
+
+        /// Origins and inverse directions (see GetInverseDirection) per axis
+        alignas(32) float m_origin[3][kSize];
+        alignas(32) float m_inv_direction[3][kSize];
+        /// Maximum distances along the rays
+        alignas(32) float m_t_max[kSize];
+
+        /// Fill a lane with a ray.
+        void Set(std::size_t lane, Ray const &ray, float t_max)
+        {
+            auto inv_direction = GetInverseDirection(ray);
+            m_origin[0][lane] = ray.m_origin.m_x;
+            m_origin[1][lane] = ray.m_origin.m_y;
+            m_origin[2][lane] = ray.m_origin.m_z;
+            m_inv_direction[0][lane] = inv_direction.m_x;
+            m_inv_direction[1][lane] = inv_direction.m_y;
+            m_inv_direction[2][lane] = inv_direction.m_z;
+            m_t_max[lane] = t_max;
+        }
+
+        /// Make a lane unused.
+        void Clear(std::size_t lane)
+        {
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                m_origin[axis][lane] = 0.f;
+                m_inv_direction[axis][lane] = 1.f;
+            }
+
+            m_t_max[lane] = -1.f;
+        }
+    };
+
+    /// \brief Intersect rays of a packet with a box, the same test as Intersect for a single ray.
+    /// \param t Receives distances at which the rays enter the box.
+    /// \return Bit mask of lanes whose rays hit the box.
+    inline unsigned Intersect(Aabb const &box, RayPacket const &packet, float *t)
+    {
+        float const min[3] = {box.m_min.m_x, box.m_min.m_y, box.m_min.m_z};
+        float const max[3] = {box.m_max.m_x, box.m_max.m_y, box.m_max.m_z};
+
+#if defined(GRAVITY_AVX)
+        __m256 t_in[3], t_out[3];
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            auto origin = _mm256_load_ps(packet.m_origin[axis]);
+            auto inv_direction = _mm256_load_ps(packet.m_inv_direction[axis]);
+            auto t0 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(min[axis]), origin), inv_direction);
+            auto t1 = _mm256_mul_ps(_mm256_sub_ps(_mm256_set1_ps(max[axis]), origin), inv_direction);
+            t_in[axis] = _mm256_min_ps(t0, t1);
+            t_out[axis] = _mm256_max_ps(t0, t1);
+        }
+
+        auto t_enter = _mm256_max_ps(_mm256_max_ps(t_in[0], t_in[1]),
+                                     _mm256_max_ps(t_in[2], _mm256_setzero_ps()));
+        auto t_exit = _mm256_min_ps(_mm256_min_ps(t_out[0], t_out[1]),
+                                    _mm256_min_ps(t_out[2], _mm256_load_ps(packet.m_t_max)));
+
+        _mm256_storeu_ps(t, t_enter);
+        return static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(t_enter, t_exit, _CMP_LE_OQ)));
+#elif defined(GRAVITY_SSE)
+        __m128 t_in[3], t_out[3];
+
+        for (int axis = 0; axis < 3; ++axis)
+        {
+            auto origin = _mm_load_ps(packet.m_origin[axis]);
+            auto inv_direction = _mm_load_ps(packet.m_inv_direction[axis]);
+            auto t0 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(min[axis]), origin), inv_direction);
+            auto t1 = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(max[axis]), origin), inv_direction);
+            t_in[axis] = _mm_min_ps(t0, t1);
+            t_out[axis] = _mm_max_ps(t0, t1);
+        }
+
+        auto t_enter = _mm_max_ps(_mm_max_ps(t_in[0], t_in[1]), _mm_max_ps(t_in[2], _mm_setzero_ps()));
+        auto t_exit = _mm_min_ps(_mm_min_ps(t_out[0], t_out[1]), _mm_min_ps(t_out[2], _mm_load_ps(packet.m_t_max)));
+
+        _mm_storeu_ps(t, t_enter);
+        return static_cast<unsigned>(_mm_movemask_ps(_mm_cmple_ps(t_enter, t_exit)));
+#else
+        unsigned mask = 0;
+
+        for (std::size_t lane = 0; lane < RayPacket::kSize; ++lane)
+        {
+            float t_enter = 0.f, t_exit = packet.m_t_max[lane];
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                auto t0 = (min[axis] - packet.m_origin[axis][lane]) * packet.m_inv_direction[axis][lane];
+                auto t1 = (max[axis] - packet.m_origin[axis][lane]) * packet.m_inv_direction[axis][lane];
+                t_enter = std::max(t_enter, std::min(t0, t1));
+                t_exit = std::min(t_exit, std::max(t0, t1));
+            }
+
+            t[lane] = t_enter;
+
+            if (t_enter <= t_exit)
+                mask |= 1u << lane;
+        }
+
+        return mask;
+#endif
+    }
+
+    /// Plane: points p with dot(m_normal, p) + m_distance >= 0 are in front of it.
+    struct Plane
+    {
+        Vector3 m_normal;
+        float m_distance;
+
+        /// Return signed distance to a point scaled by the length of the normal.
+        float GetDistance(Vector3 const &p) const
+        { return m_normal.m_x * p.m_x + m_normal.m_y * p.m_y + m_normal.m_z * p.m_z + m_distance; }
+    };
+
+    /// Relation of a box to a volume.
+    enum class Containment
+    {
+        kOutside,
+        kIntersecting,
+        kInside
+    };
+
+    /// View frustum: the volume in front of all six planes.
+    struct Frustum
+    {
+        /// Left, right, bottom, top, near and far planes
+        Plane m_planes[6];
+
+        /// \brief Extract the frustum from a view-projection matrix.
+        /// \details Clip space is assumed to be -w <= x, y, z <= w, planes are not normalized.
+        static Frustum FromMatrix(Matrix4 const &m)
+        {
+            // Rows of the matrix
+            auto row = [&m](int i)
+            { return Plane{{m.m_data[i], m.m_data[4 + i], m.m_data[8 + i]}, m.m_data[12 + i]}; };
+
+            auto combine = [](Plane const &a, Plane const &b, float sign)
+            {
+                return Plane{{a.m_normal.m_x + sign * b.m_normal.m_x, a.m_normal.m_y + sign * b.m_normal.m_y,
+                              a.m_normal.m_z + sign * b.m_normal.m_z}, a.m_distance + sign * b.m_distance};
+            };
+
+            auto w = row(3);
+            return Frustum{{combine(w, row(0), 1.f), combine(w, row(0), -1.f), combine(w, row(1), 1.f),
+                            combine(w, row(1), -1.f), combine(w, row(2), 1.f), combine(w, row(2), -1.f)}};
+        }
+
+        /// \brief Classify a box against the frustum.
+        /// \details Conservative: boxes outside of the frustum near its edges might be reported as intersecting.
+        Containment Classify(Aabb const &box) const
+        {
+            auto result = Containment::kInside;
+
+            for (auto &plane: m_planes)
+            {
+                // The corners farthest along and against the normal
+                auto &n = plane.m_normal;
+                Vector3 positive{n.m_x >= 0.f ? box.m_max.m_x : box.m_min.m_x,
+                                 n.m_y >= 0.f ? box.m_max.m_y : box.m_min.m_y,
+                                 n.m_z >= 0.f ? box.m_max.m_z : box.m_min.m_z};
+
+                if (plane.GetDistance(positive) < 0.f)
+                    return Containment::kOutside;
+
+                Vector3 negative{n.m_x >= 0.f ? box.m_min.m_x : box.m_max.m_x,
+                                 n.m_y >= 0.f ? box.m_min.m_y : box.m_max.m_y,
+                                 n.m_z >= 0.f ? box.m_min.m_z : box.m_max.m_z};
+
+                if (plane.GetDistance(negative) < 0.f)
+                    result = Containment::kIntersecting;
+            }
+
+            return result;
+        }
+    };
+
+    /**
+        \brief Array of boxes stored as separate arrays of coordinates.
+
+        Coordinate arrays are padded to a multiple of kPadding elements, so SIMD code can load whole registers
+        past the last box (the padding holds zeros and has to be masked out).
+     */
+    class AabbArray
+    {
+    public:
+        /// Arrays are padded to a multiple of this number of elements.
+        static std::size_t const kPadding = 8;
+
+        AabbArray()
+                : m_size(0)
+        {
+        }
+
+        /// Return the number of boxes.
+        std::size_t GetSize() const
+        { return m_size; }
+
+        /// Return a box.
+        Aabb Get(std::size_t index) const
+        {
+            return Aabb{{m_coordinates[0][index], m_coordinates[1][index], m_coordinates[2][index]},
+                        {m_coordinates[3][index], m_coordinates[4][index], m_coordinates[5][index]}};
+        }
+
+        /// Replace a box.
+        void Set(std::size_t index, Aabb const &box)
+        {
+            m_coordinates[0][index] = box.m_min.m_x;
+            m_coordinates[1][index] = box.m_min.m_y;
+            m_coordinates[2][index] = box.m_min.m_z;
+            m_coordinates[3][index] = box.m_max.m_x;
+            m_coordinates[4][index] = box.m_max.m_y;
+            m_coordinates[5][index] = box.m_max.m_z;
+        }
+
+        /// Add a box to the end.
+        void PushBack(Aabb const &box)
+        {
+            Resize(m_size + 1);
+            Set(m_size - 1, box);
+        }
+
+        /// Remove the last box.
+        void PopBack()
+        {
+            Set(m_size - 1, Aabb{{0.f, 0.f, 0.f}, {0.f, 0.f, 0.f}});
+            --m_size;
+        }
+
+        /// Return minimum coordinates along an axis (0 to 2).
+        float const *GetMin(int axis) const
+        { return m_coordinates[axis].data(); }
+
+        /// Return maximum coordinates along an axis (0 to 2).
+        float const *GetMax(int axis) const
+        { return m_coordinates[3 + axis].data(); }
+
+    private:
+        void Resize(std::size_t size)
+        {
+            auto padded = (size + kPadding - 1) / kPadding * kPadding;
+
+            if (padded > m_coordinates[0].size())
+            {
+                for (auto &coordinates: m_coordinates)
+                    coordinates.resize(std::max(padded, 2 * coordinates.size()), 0.f);
+            }
+
+            m_size = size;
+        }
+
+        /// Minimum x, y, z and maximum x, y, z coordinates
+        std::vector<float> m_coordinates[6];
+        /// Number of boxes
+        std::size_t m_size;
+    };
+}
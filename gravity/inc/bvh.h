@@ -0,0 +1,961 @@
+/**
+    \file bvh.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing bounding volume hierarchy over Gravity scene graph nodes.
+
+    The hierarchy follows scene graph changes incrementally: it inserts and removes leaves as nodes come and go,
+    refits boxes of moved nodes and only rebuilds itself when refitting has degraded its quality.
+ */
+#pragma once
+
+#include "bounds.h"
+#include "callback_list.h"
+#include "sg.h"
+#include "transform.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace Gravity
+{
+    /**
+        \brief Stack of node indices used by hierarchy traversals.
+
+        Keeps first entries in place and only allocates for unusually deep hierarchies.
+     */
+    class TraversalStack
+    {
+    public:
+        TraversalStack()
+                : m_size(0)
+        {
+        }
+
+        void Push(std::uint32_t index)
+        {
+            if (m_size < kInlineSize)
+                m_inline[m_size] = index;
+            else
+                m_overflow.push_back(index);
+
+            ++m_size;
+        }
+
+        std::uint32_t Pop()
+        {
+            --m_size;
+
+            if (m_size < kInlineSize)
+                return m_inline[m_size];
+
+            auto index = m_overflow.back();
+            m_overflow.pop_back();
+            return index;
+        }
+
+        bool IsEmpty() const
+        { return m_size == 0; }
+
+    private:
+        static std::size_t const kInlineSize = 64;
+
+        std::uint32_t m_inline[kInlineSize];
+        std::vector<std::uint32_t> m_overflow;
+        std::size_t m_size;
+    };
+
+    /**
+        \brief Bounding volume hierarchy over scene graph nodes having a bounds parameter.
+
+        Bounds are kept in a designated parameter of type Aabb. Given a transform system the bounds are in local
+        space of the node and the hierarchy keeps them transformed by world transforms of nodes, otherwise they
+        are taken as they are. Every leaf holds a single node.
+
+        Update() applies changes made since the previous update: leaves of created and deleted nodes are inserted
+        and removed, boxes of nodes whose bounds or world transforms have changed are refitted. The work is
+        proportional to the number of changes. Refitting lets the quality of the hierarchy degrade, so once its
+        surface area heuristic cost exceeds the cost right after the last build by the rebuild threshold, the
+        hierarchy is rebuilt from scratch with binned SAH.
+
+        World bounds are kept in a structure of arrays (see GetWorldBounds) so passes like culling can test them
+        in bulk with SIMD.
+
+        Queries reflect the state as of the last update and can run concurrently with each other.
+     */
+    template<typename SceneGraph>
+    class BoundingVolumeHierarchy
+    {
+    public:
+        using Key = typename SceneGraph::KeyType;
+        using Node = typename SceneGraph::Node;
+        using NodeType = typename SceneGraph::NodeTypeType;
+
+        /// Node hit by a ray and the distance at which the ray enters its bounds.
+        struct Hit
+        {
+            Node *m_node;
+            float m_distance;
+        };
+
+        /// Index of a missing node.
+        static std::uint32_t const kInvalid = 0xffffffff;
+
+        /// \brief Create the hierarchy over nodes having a given bounds parameter.
+        /// \param transforms Transform system providing world transforms or nullptr if bounds are in world space.
+        /// The transform system has to be updated before the hierarchy.
+        BoundingVolumeHierarchy(SceneGraph &sg, Key const &key, TransformSystem<SceneGraph> const *transforms = nullptr)
+                : m_sg(sg), m_key(key), m_transforms(transforms), m_poller(sg), m_num_transform_updates(0)
+                , m_root(kInvalid), m_internal_area(0.0), m_built_cost(0.f), m_rebuild_threshold(1.5f)
+        {
+        }
+
+        BoundingVolumeHierarchy(BoundingVolumeHierarchy const &) = delete;
+
+        BoundingVolumeHierarchy &operator=(BoundingVolumeHierarchy const &) = delete;
+
+        /// Set the ratio of the current cost to the cost after the last build which triggers the rebuild.
+        void SetRebuildThreshold(float threshold)
+        { m_rebuild_threshold = threshold; }
+
+        /// \brief Return the surface area heuristic cost of the hierarchy.
+        /// \details The cost is the total surface area of internal nodes relative to the area of the root.
+        float GetCost() const
+        {
+            if (m_root == kInvalid)
+                return 0.f;
+
+            auto root_area = m_nodes[m_root].m_bounds.GetSurfaceArea();
+            return root_area > 0.f ? static_cast<float>(m_internal_area / root_area) : 0.f;
+        }
+
+        /// Return the number of nodes in the hierarchy.
+        std::size_t GetSize() const
+        { return m_objects.size(); }
+
+        /// Return nodes in the hierarchy in the order of GetWorldBounds().
+        Span<Node *const> GetNodes() const
+        { return Span<Node *const>(m_object_nodes.data(), m_object_nodes.size()); }
+
+        /// Return world bounds of nodes as of the last update.
+        AabbArray const &GetWorldBounds() const
+        { return m_world; }
+
+        /// Check if a node is in the hierarchy.
+        bool Contains(Node const *node) const
+        { return m_index.find(node) != m_index.cend(); }
+
+        /// \brief Return world bounds of a node as of the last update.
+        /// \details If the node is not in the hierarchy std::runtime_error is thrown.
+        Aabb GetBounds(Node const *node) const
+        {
+            auto iter = m_index.find(node);
+
+            if (iter == m_index.cend())
+                throw std::runtime_error("The node is not in the hierarchy");
+
+            return m_world.Get(iter->second);
+        }
+
+        /// \brief Apply scene changes made since the previous update.
+        /// \details Meant to be called by the writer between frames, it must not run concurrently with changes of
+        /// the scene structure or with queries.
+        /// \return The number of nodes whose world bounds have been recomputed.
+        std::size_t Update()
+        {
+            m_poller.Collect(m_changes);
+
+            m_dirty.clear();
+            m_inserted.clear();
+
+            // Deletions go first, addresses of deleted nodes might have been reused by created ones
+            for (auto node: m_changes.m_deleted)
+            {
+                auto iter = m_index.find(node);
+
+                if (iter != m_index.cend())
+                    RemoveObject(iter->second);
+            }
+
+            for (auto &change: m_changes.m_nodes)
+            {
+                auto node = change.m_node;
+
+                if (change.m_created)
+                {
+                    if (node->HasValue(m_key))
+                        AddObject(node);
+
+                    continue;
+                }
+
+                for (auto &key: m_changes.GetChangeSet(change))
+                {
+                    if (!(key == m_key))
+                        continue;
+
+                    auto iter = m_index.find(node);
+
+                    if (iter != m_index.cend())
+                    {
+                        m_objects[iter->second].m_local = node->template GetValue<Aabb>(m_key);
+                        MarkDirty(iter->second);
+                    }
+                }
+            }
+
+            CollectMovedObjects();
+
+            // Nodes created since the hierarchy has been restructured get their indices from the rebuild
+            if (m_transforms)
+                m_sg.GetHierarchy();
+
+            for (auto index: m_dirty)
+            {
+                auto &object = m_objects[index];
+                auto world = ComputeWorldBounds(index);
+                object.m_dirty = false;
+                m_world.Set(index, world);
+
+                if (object.m_leaf == kInvalid || m_nodes[object.m_leaf].m_bounds == world)
+                    continue;
+
+                m_nodes[object.m_leaf].m_bounds = world;
+                Refit(m_nodes[object.m_leaf].m_parent);
+            }
+
+            // Large batches of new nodes are cheaper to build from scratch
+            if (m_inserted.size() > m_objects.size() / 4)
+            {
+                Rebuild();
+            }
+            else
+            {
+                for (auto index: m_inserted)
+                    InsertLeaf(index);
+
+                if (GetCost() > m_built_cost * m_rebuild_threshold)
+                    Rebuild();
+            }
+
+            return m_dirty.size();
+        }
+
+        /// Rebuild the hierarchy from scratch with binned surface area heuristic.
+        void Rebuild()
+        {
+            m_nodes.clear();
+            m_free_nodes.clear();
+            m_root = kInvalid;
+            m_internal_area = 0.0;
+
+            if (m_objects.empty())
+            {
+                m_built_cost = 0.f;
+                return;
+            }
+
+            m_build_objects.resize(m_objects.size());
+            m_centroids.resize(m_objects.size());
+
+            for (std::uint32_t index = 0; index < m_objects.size(); ++index)
+            {
+                m_build_objects[index] = index;
+                m_centroids[index] = m_world.Get(index).GetCenter();
+            }
+
+            m_nodes.reserve(2 * m_objects.size() - 1);
+
+            std::vector<BuildTask> tasks{BuildTask{0, static_cast<std::uint32_t>(m_objects.size()), kInvalid, 0}};
+
+            while (!tasks.empty())
+            {
+                auto task = tasks.back();
+                tasks.pop_back();
+
+                auto index = static_cast<std::uint32_t>(m_nodes.size());
+                m_nodes.push_back(TreeNode{Aabb::Empty(), task.m_parent, {kInvalid, kInvalid}, kInvalid});
+
+                if (task.m_parent == kInvalid)
+                    m_root = index;
+                else
+                    m_nodes[task.m_parent].m_children[task.m_slot] = index;
+
+                if (task.m_end - task.m_begin == 1)
+                {
+                    auto object = m_build_objects[task.m_begin];
+                    m_nodes[index].m_bounds = m_world.Get(object);
+                    m_nodes[index].m_object = object;
+                    m_objects[object].m_leaf = index;
+                    continue;
+                }
+
+                auto bounds = Aabb::Empty();
+                for (auto i = task.m_begin; i < task.m_end; ++i)
+                    bounds.Grow(m_world.Get(m_build_objects[i]));
+
+                m_nodes[index].m_bounds = bounds;
+                m_internal_area += bounds.GetSurfaceArea();
+
+                auto middle = Split(task.m_begin, task.m_end);
+                tasks.push_back(BuildTask{middle, task.m_end, index, 1});
+                tasks.push_back(BuildTask{task.m_begin, middle, index, 0});
+            }
+
+            m_built_cost = GetCost();
+        }
+
+        /// Call visitor(node) for every node whose bounds overlap a box.
+        template<typename Visitor>
+        void QueryBox(Aabb const &box, Visitor &&visitor) const
+        {
+            Traverse([&box](Aabb const &bounds)
+                     { return Overlaps(bounds, box); }, visitor);
+        }
+
+        /// Call visitor(node) for every node whose bounds overlap a sphere.
+        template<typename Visitor>
+        void QuerySphere(Sphere const &sphere, Visitor &&visitor) const
+        {
+            Traverse([&sphere](Aabb const &bounds)
+                     { return Overlaps(bounds, sphere); }, visitor);
+        }
+
+        /// \brief Call visitor(node, t) for every node whose bounds are hit by a ray within [0, t_max].
+        /// \details t is the distance at which the ray enters the bounds, nodes are visited in no particular order.
+        template<typename Visitor>
+        void QueryRay(Ray const &ray, float t_max, Visitor &&visitor) const
+        {
+            if (m_root == kInvalid)
+                return;
+
+            auto inv_direction = GetInverseDirection(ray);
+
+            TraversalStack stack;
+            stack.Push(m_root);
+
+            while (!stack.IsEmpty())
+            {
+                auto &node = m_nodes[stack.Pop()];
+                float t;
+
+                if (!Intersect(node.m_bounds, ray, inv_direction, t_max, t))
+                    continue;
+
+                if (node.m_object != kInvalid)
+                {
+                    visitor(m_object_nodes[node.m_object], t);
+                }
+                else
+                {
+                    stack.Push(node.m_children[1]);
+                    stack.Push(node.m_children[0]);
+                }
+            }
+        }
+
+        /// \brief Find the nearest node whose bounds are hit by a ray within [0, t_max].
+        /// \param hit Receives the node and the distance, the node is nullptr if nothing is hit.
+        /// \param types Types of nodes to consider or empty set to consider nodes of all types.
+        /// \return true if a node is hit.
+        bool Raycast(Ray const &ray, float t_max, Hit &hit, std::set<NodeType> const &types = {}) const
+        {
+            TypeFilter<NodeType> const filter(types);
+            hit = Hit{nullptr, t_max};
+
+            if (m_root == kInvalid)
+                return false;
+
+            auto inv_direction = GetInverseDirection(ray);
+
+            TraversalStack stack;
+            stack.Push(m_root);
+
+            while (!stack.IsEmpty())
+            {
+                auto &node = m_nodes[stack.Pop()];
+                float t;
+
+                // Nodes behind the nearest hit so far are skipped
+                if (!Intersect(node.m_bounds, ray, inv_direction, hit.m_distance, t))
+                    continue;
+
+                if (node.m_object == kInvalid)
+                {
+                    PushChildren(stack, node, ray.m_direction);
+                    continue;
+                }
+
+                auto object_node = m_object_nodes[node.m_object];
+
+                if (filter.Matches(object_node->GetType()))
+                    hit = Hit{object_node, t};
+            }
+
+            return hit.m_node != nullptr;
+        }
+
+        /// \brief Find all nodes whose bounds are hit by a ray within [0, t_max].
+        /// \param hits Receives the hits sorted by distance, it is cleared first.
+        /// \param types Types of nodes to consider or empty set to consider nodes of all types.
+        void RaycastAll(Ray const &ray, float t_max, std::vector<Hit> &hits, std::set<NodeType> const &types = {}) const
+        {
+            TypeFilter<NodeType> const filter(types);
+
+            hits.clear();
+
+            QueryRay(ray, t_max, [&hits, &filter](Node *node, float t)
+            {
+                if (filter.Matches(node->GetType()))
+                    hits.push_back(Hit{node, t});
+            });
+
+            std::sort(hits.begin(), hits.end(), [](Hit const &a, Hit const &b)
+            { return a.m_distance < b.m_distance; });
+        }
+
+        /// \brief Find the nearest hits of a batch of rays, see Raycast.
+        /// \details Rays are traversed in packets of RayPacket::kSize, so coherent rays (picking around a cursor,
+        /// visibility probes from a point) share the traversal. The first ray of a packet decides the order in
+        /// which children are visited.
+        /// \param hits Receives count hits, hits[i] is the nearest hit of rays[i].
+        void RaycastPacket(Ray const *rays, std::size_t count, float t_max, Hit *hits,
+                           std::set<NodeType> const &types = {}) const
+        {
+            TypeFilter<NodeType> const filter(types);
+
+            for (std::size_t first = 0; first < count; first += RayPacket::kSize)
+            {
+                RayPacket packet;
+
+                for (std::size_t lane = 0; lane < RayPacket::kSize; ++lane)
+                {
+                    if (first + lane < count)
+                    {
+                        packet.Set(lane, rays[first + lane], t_max);
+                        hits[first + lane] = Hit{nullptr, t_max};
+                    }
+                    else
+                    {
+                        packet.Clear(lane);
+                    }
+                }
+
+                if (m_root == kInvalid)
+                    continue;
+
+                TraversalStack stack;
+                stack.Push(m_root);
+
+                while (!stack.IsEmpty())
+                {
+                    auto &node = m_nodes[stack.Pop()];
+                    float t[RayPacket::kSize];
+                    auto mask = Intersect(node.m_bounds, packet, t);
+
+                    if (!mask)
+                        continue;
+
+                    if (node.m_object == kInvalid)
+                    {
+                        PushChildren(stack, node, rays[first].m_direction);
+                        continue;
+                    }
+
+                    auto object_node = m_object_nodes[node.m_object];
+
+                    if (!filter.Matches(object_node->GetType()))
+                        continue;
+
+                    // Hit rays stop looking behind the node
+                    for (std::size_t lane = 0; mask; ++lane, mask >>= 1)
+                    {
+                        if (mask & 1u)
+                        {
+                            packet.m_t_max[lane] = t[lane];
+                            hits[first + lane] = Hit{object_node, t[lane]};
+                        }
+                    }
+                }
+            }
+        }
+
+        /// \brief Call visitor(node) for every node whose bounds are inside or intersect a frustum.
+        /// \details Subtrees entirely inside the frustum are visited without further tests.
+        template<typename Visitor>
+        void QueryFrustum(Frustum const &frustum, Visitor &&visitor) const
+        {
+            if (m_root == kInvalid)
+                return;
+
+            TraversalStack stack;
+            stack.Push(m_root);
+
+            while (!stack.IsEmpty())
+            {
+                auto index = stack.Pop();
+                auto &node = m_nodes[index];
+                auto containment = frustum.Classify(node.m_bounds);
+
+                if (containment == Containment::kOutside)
+                    continue;
+
+                if (node.m_object != kInvalid)
+                {
+                    visitor(m_object_nodes[node.m_object]);
+                }
+                else if (containment == Containment::kInside)
+                {
+                    Traverse(index, [](Aabb const &)
+                    { return true; }, visitor);
+                }
+                else
+                {
+                    stack.Push(node.m_children[1]);
+                    stack.Push(node.m_children[0]);
+                }
+            }
+        }
+
+        /// \brief Call visitor(node) for every node of the given types whose bounds are inside or intersect a frustum.
+        /// \param types Types of nodes to visit or empty set to visit nodes of all types.
+        template<typename Visitor>
+        void QueryFrustum(Frustum const &frustum, std::set<NodeType> const &types, Visitor &&visitor) const
+        {
+            TypeFilter<NodeType> const filter(types);
+
+            QueryFrustum(frustum, [&filter, &visitor](Node *node)
+            {
+                if (filter.Matches(node->GetType()))
+                    visitor(node);
+            });
+        }
+
+    private:
+        /// Hierarchy node, leaves reference an object.
+        struct TreeNode
+        {
+            Aabb m_bounds;
+            std::uint32_t m_parent;
+            std::uint32_t m_children[2];
+            std::uint32_t m_object;
+        };
+
+        /// Scene graph node in the hierarchy (its node and world bounds are kept in separate arrays).
+        struct Object
+        {
+            /// Bounds parameter value
+            Aabb m_local;
+            /// Leaf or kInvalid if the object has not been inserted yet
+            std::uint32_t m_leaf;
+            /// Set if world bounds have to be recomputed
+            bool m_dirty;
+        };
+
+        /// Subtree to build: objects [m_begin, m_end) of m_build_objects and the slot in the parent.
+        struct BuildTask
+        {
+            std::uint32_t m_begin;
+            std::uint32_t m_end;
+            std::uint32_t m_parent;
+            std::uint32_t m_slot;
+        };
+
+        /// Number of bins used by Split.
+        static int const kNumBins = 16;
+
+        /// Visit leaves whose bounds pass the overlap test.
+        template<typename Overlap, typename Visitor>
+        void Traverse(Overlap &&overlap, Visitor &&visitor) const
+        {
+            if (m_root != kInvalid)
+                Traverse(m_root, overlap, visitor);
+        }
+
+        /// Visit leaves of a subtree whose bounds pass the overlap test.
+        template<typename Overlap, typename Visitor>
+        void Traverse(std::uint32_t root, Overlap &&overlap, Visitor &&visitor) const
+        {
+            TraversalStack stack;
+            stack.Push(root);
+
+            while (!stack.IsEmpty())
+            {
+                auto &node = m_nodes[stack.Pop()];
+
+                if (!overlap(node.m_bounds))
+                    continue;
+
+                if (node.m_object != kInvalid)
+                {
+                    visitor(m_object_nodes[node.m_object]);
+                }
+                else
+                {
+                    stack.Push(node.m_children[1]);
+                    stack.Push(node.m_children[0]);
+                }
+            }
+        }
+
+        /// Push children of a node so that the one ahead along a direction is popped first.
+        void PushChildren(TraversalStack &stack, TreeNode const &node, Vector3 const &direction) const
+        {
+            auto a = m_nodes[node.m_children[0]].m_bounds.GetCenter();
+            auto b = m_nodes[node.m_children[1]].m_bounds.GetCenter();
+            auto along = (b.m_x - a.m_x) * direction.m_x + (b.m_y - a.m_y) * direction.m_y +
+                         (b.m_z - a.m_z) * direction.m_z;
+            auto nearest = along >= 0.f ? 0 : 1;
+
+            stack.Push(node.m_children[1 - nearest]);
+            stack.Push(node.m_children[nearest]);
+        }
+
+        /// Mark objects of nodes moved by the last transform update as dirty.
+        void CollectMovedObjects()
+        {
+            if (!m_transforms || m_transforms->GetUpdateCount() == m_num_transform_updates)
+                return;
+
+            // Ranges only describe the last update, refresh everything if some have been missed
+            if (m_transforms->GetUpdateCount() != m_num_transform_updates + 1)
+            {
+                for (std::uint32_t index = 0; index < m_objects.size(); ++index)
+                    MarkDirty(index);
+            }
+            else
+            {
+                auto &hierarchy = m_sg.GetHierarchy();
+
+                for (auto &range: m_transforms->GetUpdatedRanges())
+                {
+                    for (auto i = range.first; i < range.second; ++i)
+                    {
+                        auto iter = m_index.find(hierarchy.GetNode(i));
+
+                        if (iter != m_index.cend())
+                            MarkDirty(iter->second);
+                    }
+                }
+            }
+
+            m_num_transform_updates = m_transforms->GetUpdateCount();
+        }
+
+        void MarkDirty(std::uint32_t index)
+        {
+            if (m_objects[index].m_dirty)
+                return;
+
+            m_objects[index].m_dirty = true;
+            m_dirty.push_back(index);
+        }
+
+        /// \brief Transform local bounds of an object by the world transform of its node.
+        /// \details Nodes the transform system has not seen yet keep their local bounds, its next update reports
+        /// them as moved.
+        Aabb ComputeWorldBounds(std::uint32_t index) const
+        {
+            auto &local = m_objects[index].m_local;
+            auto node = m_object_nodes[index];
+
+            if (!m_transforms || !m_transforms->HasWorldTransform(node))
+                return local;
+
+            return Transform(m_transforms->GetWorldTransform(node), local);
+        }
+
+        /// Start tracking a node (it is inserted into the tree once its world bounds are known).
+        void AddObject(Node *node)
+        {
+            auto index = static_cast<std::uint32_t>(m_objects.size());
+            m_objects.push_back(Object{node->template GetValue<Aabb>(m_key), kInvalid, false});
+            m_object_nodes.push_back(node);
+            m_world.PushBack(Aabb::Empty());
+            m_index.emplace(node, index);
+            m_inserted.push_back(index);
+            MarkDirty(index);
+        }
+
+        /// Stop tracking an object, the last object takes its index.
+        void RemoveObject(std::uint32_t index)
+        {
+            if (m_objects[index].m_leaf != kInvalid)
+                RemoveLeaf(m_objects[index].m_leaf);
+
+            m_index.erase(m_object_nodes[index]);
+
+            if (index + 1 != m_objects.size())
+            {
+                m_objects[index] = m_objects.back();
+                m_object_nodes[index] = m_object_nodes.back();
+                m_world.Set(index, m_world.Get(m_objects.size() - 1));
+                m_index[m_object_nodes[index]] = index;
+
+                if (m_objects[index].m_leaf != kInvalid)
+                    m_nodes[m_objects[index].m_leaf].m_object = index;
+            }
+
+            m_objects.pop_back();
+            m_object_nodes.pop_back();
+            m_world.PopBack();
+        }
+
+        std::uint32_t AllocateNode()
+        {
+            if (!m_free_nodes.empty())
+            {
+                auto index = m_free_nodes.back();
+                m_free_nodes.pop_back();
+                return index;
+            }
+
+            m_nodes.push_back(TreeNode());
+            return static_cast<std::uint32_t>(m_nodes.size() - 1);
+        }
+
+        /// \brief Insert the leaf of an object next to the sibling which increases the cost the least.
+        /// \details Descends greedily comparing the cost of pairing with the current node against the cost of
+        /// descending into each of its children.
+        void InsertLeaf(std::uint32_t object)
+        {
+            auto leaf = AllocateNode();
+            auto box = m_world.Get(object);
+            m_nodes[leaf] = TreeNode{box, kInvalid, {kInvalid, kInvalid}, object};
+            m_objects[object].m_leaf = leaf;
+
+            if (m_root == kInvalid)
+            {
+                m_root = leaf;
+                return;
+            }
+
+            auto sibling = m_root;
+
+            while (m_nodes[sibling].m_object == kInvalid)
+            {
+                auto &node = m_nodes[sibling];
+                auto area = node.m_bounds.GetSurfaceArea();
+                auto combined = Union(node.m_bounds, box).GetSurfaceArea();
+
+                // Cost of pairing here and the increase of areas of ancestors when descending
+                auto cost = 2.f * combined;
+                auto inheritance = 2.f * (combined - area);
+
+                float child_cost[2];
+
+                for (int i = 0; i < 2; ++i)
+                {
+                    auto &child = m_nodes[node.m_children[i]];
+                    auto grown = Union(child.m_bounds, box).GetSurfaceArea();
+                    child_cost[i] = (child.m_object == kInvalid ? grown - child.m_bounds.GetSurfaceArea() : grown) +
+                                    inheritance;
+                }
+
+                if (cost < child_cost[0] && cost < child_cost[1])
+                    break;
+
+                sibling = node.m_children[child_cost[0] <= child_cost[1] ? 0 : 1];
+            }
+
+            auto old_parent = m_nodes[sibling].m_parent;
+            auto parent = AllocateNode();
+            m_nodes[parent] = TreeNode{Union(m_nodes[sibling].m_bounds, box), old_parent, {sibling, leaf}, kInvalid};
+            m_internal_area += m_nodes[parent].m_bounds.GetSurfaceArea();
+
+            m_nodes[sibling].m_parent = parent;
+            m_nodes[leaf].m_parent = parent;
+
+            if (old_parent == kInvalid)
+            {
+                m_root = parent;
+            }
+            else
+            {
+                auto &children = m_nodes[old_parent].m_children;
+                children[children[0] == sibling ? 0 : 1] = parent;
+                Refit(old_parent);
+            }
+        }
+
+        /// Remove a leaf, its sibling takes the place of their parent.
+        void RemoveLeaf(std::uint32_t leaf)
+        {
+            m_free_nodes.push_back(leaf);
+
+            if (leaf == m_root)
+            {
+                m_root = kInvalid;
+                return;
+            }
+
+            auto parent = m_nodes[leaf].m_parent;
+            auto grandparent = m_nodes[parent].m_parent;
+            auto &children = m_nodes[parent].m_children;
+            auto sibling = children[children[0] == leaf ? 1 : 0];
+
+            m_internal_area -= m_nodes[parent].m_bounds.GetSurfaceArea();
+            m_free_nodes.push_back(parent);
+            m_nodes[sibling].m_parent = grandparent;
+
+            if (grandparent == kInvalid)
+            {
+                m_root = sibling;
+            }
+            else
+            {
+                auto &grandchildren = m_nodes[grandparent].m_children;
+                grandchildren[grandchildren[0] == parent ? 0 : 1] = sibling;
+                Refit(grandparent);
+            }
+        }
+
+        /// Recompute boxes of a node and its ancestors until they stop changing.
+        void Refit(std::uint32_t index)
+        {
+            while (index != kInvalid)
+            {
+                auto &node = m_nodes[index];
+                auto bounds = Union(m_nodes[node.m_children[0]].m_bounds, m_nodes[node.m_children[1]].m_bounds);
+
+                if (bounds == node.m_bounds)
+                    return;
+
+                m_internal_area += bounds.GetSurfaceArea() - node.m_bounds.GetSurfaceArea();
+                node.m_bounds = bounds;
+                index = node.m_parent;
+            }
+        }
+
+        /// \brief Partition objects [begin, end) of m_build_objects picking the split with the lowest binned SAH cost.
+        /// \return The first object of the second part.
+        std::uint32_t Split(std::uint32_t begin, std::uint32_t end)
+        {
+            auto centroid_bounds = Aabb::Empty();
+            for (auto i = begin; i < end; ++i)
+                centroid_bounds.Grow(m_centroids[m_build_objects[i]]);
+
+            float extent[3] = {centroid_bounds.m_max.m_x - centroid_bounds.m_min.m_x,
+                               centroid_bounds.m_max.m_y - centroid_bounds.m_min.m_y,
+                               centroid_bounds.m_max.m_z - centroid_bounds.m_min.m_z};
+            float minimum[3] = {centroid_bounds.m_min.m_x, centroid_bounds.m_min.m_y, centroid_bounds.m_min.m_z};
+
+            auto axis = extent[0] > extent[1] ? (extent[0] > extent[2] ? 0 : 2) : (extent[1] > extent[2] ? 1 : 2);
+            auto middle = begin + (end - begin) / 2;
+
+            auto coordinate = [this, axis](std::uint32_t object)
+            {
+                auto &c = m_centroids[object];
+                return axis == 0 ? c.m_x : (axis == 1 ? c.m_y : c.m_z);
+            };
+
+            // All centroids coincide
+            if (extent[axis] <= 0.f)
+                return middle;
+
+            auto scale = kNumBins / extent[axis];
+            auto bin_of = [&](std::uint32_t object)
+            { return std::min(static_cast<int>((coordinate(object) - minimum[axis]) * scale), kNumBins - 1); };
+
+            Aabb bin_bounds[kNumBins];
+            std::uint32_t bin_counts[kNumBins] = {};
+
+            for (auto &bounds: bin_bounds)
+                bounds = Aabb::Empty();
+
+            for (auto i = begin; i < end; ++i)
+            {
+                auto bin = bin_of(m_build_objects[i]);
+                bin_bounds[bin].Grow(m_world.Get(m_build_objects[i]));
+                ++bin_counts[bin];
+            }
+
+            // Costs of splits after each bin, right parts accumulated first
+            float right_cost[kNumBins];
+            auto right = Aabb::Empty();
+            std::uint32_t right_count = 0;
+
+            for (auto bin = kNumBins - 1; bin > 0; --bin)
+            {
+                right.Grow(bin_bounds[bin]);
+                right_count += bin_counts[bin];
+                right_cost[bin - 1] = right.GetSurfaceArea() * right_count;
+            }
+
+            auto left = Aabb::Empty();
+            std::uint32_t left_count = 0;
+            auto best_cost = std::numeric_limits<float>::max();
+            auto best_bin = -1;
+
+            for (auto bin = 0; bin < kNumBins - 1; ++bin)
+            {
+                left.Grow(bin_bounds[bin]);
+                left_count += bin_counts[bin];
+
+                auto cost = left.GetSurfaceArea() * left_count + right_cost[bin];
+
+                if (left_count > 0 && left_count < end - begin && cost < best_cost)
+                {
+                    best_cost = cost;
+                    best_bin = bin;
+                }
+            }
+
+            if (best_bin < 0)
+            {
+                std::nth_element(m_build_objects.begin() + begin, m_build_objects.begin() + middle,
+                                 m_build_objects.begin() + end, [&](std::uint32_t a, std::uint32_t b)
+                                 { return coordinate(a) < coordinate(b); });
+                return middle;
+            }
+
+            auto split = std::partition(m_build_objects.begin() + begin, m_build_objects.begin() + end,
+                                        [&](std::uint32_t object)
+                                        { return bin_of(object) <= best_bin; });
+
+            return static_cast<std::uint32_t>(split - m_build_objects.begin());
+        }
+
+        /// Scene graph
+        SceneGraph &m_sg;
+        /// Bounds parameter
+        Key m_key;
+        /// Transform system or nullptr
+        TransformSystem<SceneGraph> const *m_transforms;
+        /// Poller of scene changes and the number of transform updates as of the last update
+        typename SceneGraph::ChangePoller m_poller;
+        std::uint64_t m_num_transform_updates;
+        /// Changes since the last update
+        typename SceneGraph::ChangeLog m_changes;
+        /// Tree nodes, free tree nodes and the root
+        std::vector<TreeNode> m_nodes;
+        std::vector<std::uint32_t> m_free_nodes;
+        std::uint32_t m_root;
+        /// Objects, their nodes and world bounds and their indices by nodes
+        std::vector<Object> m_objects;
+        std::vector<Node *> m_object_nodes;
+        AabbArray m_world;
+        std::unordered_map<Node const *, std::uint32_t> m_index;
+        /// Objects to recompute and to insert
+        std::vector<std::uint32_t> m_dirty;
+        std::vector<std::uint32_t> m_inserted;
+        /// Total surface area of internal nodes (maintained incrementally)
+        double m_internal_area;
+        /// Cost after the last build and the ratio to it triggering the rebuild
+        float m_built_cost;
+        float m_rebuild_threshold;
+        /// Build buffers
+        std::vector<std::uint32_t> m_build_objects;
+        std::vector<Vector3> m_centroids;
+    };
+
+    template<typename SceneGraph>
+    std::uint32_t const BoundingVolumeHierarchy<SceneGraph>::kInvalid;
+
+    using DefaultBoundingVolumeHierarchy = BoundingVolumeHierarchy<DefaultSceneGraph>;
+}
@@ -0,0 +1,701 @@
+/**
+    \file callback_list.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing callback containers used by Gravity scene graph.
+
+    Callback containers are read on every scene edit while being modified only when observers come and go.
+    The containers in this file are optimized for this pattern: readers never lock, writers copy.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <type_traits>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "threading.h"
+
+namespace Gravity
+{
+    /**
+        \brief Value with lock-free reads and copy-on-write modification.
+
+        Writers serialize on a mutex, copy current value, modify the copy and publish it atomically.
+        Readers pin the value they have loaded via ReadGuard and access it without any locking. Values
+        replaced by writers are retired and disposed as soon as writer observes no active readers.
+
+        The specialization for policies which are not thread safe (see threading.h) does no atomic operations.
+     */
+    template<typename T, typename ThreadingPolicy = MultiThreaded, bool kThreadSafe = ThreadingPolicy::kThreadSafe>
+    class CopyOnWrite
+    {
+    public:
+        /**
+            \brief Read access to the currently published value.
+
+            The value stays alive and immutable for the lifetime of the guard.
+         */
+        class ReadGuard
+        {
+        public:
+            /// Pin the value currently published by the owner.
+            explicit ReadGuard(CopyOnWrite const &owner)
+                    : m_owner(owner)
+            {
+                // Readers counter has to be visible before the value is loaded, otherwise the writer
+                // might dispose the value we are about to read.
+                m_owner.m_readers.fetch_add(1);
+                m_value = m_owner.m_value.load();
+            }
+
+            ~ReadGuard()
+            {
+                m_owner.m_readers.fetch_sub(1);
+            }
+
+            ReadGuard(ReadGuard const &) = delete;
+
+            ReadGuard &operator=(ReadGuard const &) = delete;
+
+            T const &operator*() const
+            { return *m_value; }
+
+            T const *operator->() const
+            { return m_value; }
+
+        private:
+            /// Owning container
+            CopyOnWrite const &m_owner;
+            /// Pinned value
+            T const *m_value;
+        };
+
+        CopyOnWrite()
+                : m_value(new T), m_readers(0)
+        {
+        }
+
+        ~CopyOnWrite()
+        {
+            delete m_value.load();
+
+            for (auto value: m_retired) delete value;
+        }
+
+        CopyOnWrite(CopyOnWrite const &) = delete;
+
+        CopyOnWrite &operator=(CopyOnWrite const &) = delete;
+
+        /// \brief Modify the value.
+        /// \details The functor receives a copy of the current value and the copy gets published once the
+        /// functor returns. Concurrent readers keep seeing the old value until they release it.
+        /// \param func A functor accepting T reference.
+        template<typename Func>
+        void Modify(Func &&func)
+        {
+            std::unique_lock<typename ThreadingPolicy::Mutex> lock(m_writer_mutex);
+
+            std::unique_ptr<T> next(new T(*m_value.load()));
+
+            func(*next);
+
+            // Publish new value and retire the old one
+            m_retired.push_back(m_value.exchange(next.release()));
+
+            // Nobody can be reading retired values if there are no readers right after the exchange:
+            // any reader arriving later loads the new value.
+            if (m_readers.load() == 0)
+            {
+                for (auto value: m_retired) delete value;
+
+                m_retired.clear();
+            }
+        }
+
+    private:
+        /// Currently published value
+        std::atomic<T *> m_value;
+        /// Number of active readers
+        mutable std::atomic<std::uint32_t> m_readers;
+        /// Writers guard mutex
+        typename ThreadingPolicy::Mutex m_writer_mutex;
+        /// Values replaced by writers but possibly still in use by readers
+        std::vector<T *> m_retired;
+    };
+
+    /**
+        \brief Copy-on-write value accessed by a single thread.
+
+        The value is still replaced by a copy rather than modified in place, as callbacks may modify the list
+        they are being dispatched from. Readers are only counted to know when values replaced during such
+        a dispatch can be disposed, which takes a plain increment.
+     */
+    template<typename T, typename ThreadingPolicy>
+    class CopyOnWrite<T, ThreadingPolicy, false>
+    {
+    public:
+        /// Read access to the currently published value.
+        class ReadGuard
+        {
+        public:
+            /// Pin the value currently published by the owner.
+            explicit ReadGuard(CopyOnWrite const &owner)
+                    : m_owner(owner), m_value(owner.m_value)
+            {
+                ++m_owner.m_readers;
+            }
+
+            ~ReadGuard()
+            {
+                --m_owner.m_readers;
+            }
+
+            ReadGuard(ReadGuard const &) = delete;
+
+            ReadGuard &operator=(ReadGuard const &) = delete;
+
+            T const &operator*() const
+            { return *m_value; }
+
+            T const *operator->() const
+            { return m_value; }
+
+        private:
+            /// Owning container
+            CopyOnWrite const &m_owner;
+            /// Pinned value
+            T const *m_value;
+        };
+
+        CopyOnWrite()
+                : m_value(new T), m_readers(0)
+        {
+        }
+
+        ~CopyOnWrite()
+        {
+            delete m_value;
+
+            for (auto value: m_retired) delete value;
+        }
+
+        CopyOnWrite(CopyOnWrite const &) = delete;
+
+        CopyOnWrite &operator=(CopyOnWrite const &) = delete;
+
+        /// \brief Modify the value.
+        /// \param func A functor accepting T reference.
+        template<typename Func>
+        void Modify(Func &&func)
+        {
+            std::unique_ptr<T> next(new T(*m_value));
+
+            func(*next);
+
+            m_retired.push_back(m_value);
+            m_value = next.release();
+
+            // Values replaced from within a dispatch are disposed once it is over
+            if (m_readers == 0)
+            {
+                for (auto value: m_retired) delete value;
+
+                m_retired.clear();
+            }
+        }
+
+    private:
+        /// Currently published value
+        T *m_value;
+        /// Number of active readers (dispatches nested on the calling thread)
+        mutable std::uint32_t m_readers;
+        /// Values replaced while being read
+        std::vector<T *> m_retired;
+    };
+
+    /**
+        \brief Hash function for node types.
+
+        Enumerations are hashed via their underlying type, everything else is passed to std::hash.
+     */
+    template<typename T, typename Enable = void>
+    struct TypeHash
+    {
+        std::size_t operator()(T const &value) const
+        { return std::hash<T>()(value); }
+    };
+
+    template<typename T>
+    struct TypeHash<T, typename std::enable_if<std::is_enum<T>::value>::type>
+    {
+        std::size_t operator()(T const &value) const
+        { return std::hash<typename std::underlying_type<T>::type>()(value); }
+    };
+
+    /**
+        \brief Set of node types used to filter callbacks.
+
+        Small integral or enumeration values, which is by far the most common case for node types, are kept in a
+        bit mask. Other values fall back to a hash set.
+     */
+    template<typename NodeType>
+    class TypeFilter
+    {
+    public:
+        /// Number of types represented by a bit mask.
+        static std::size_t const kDenseTypes = 64;
+
+        /// Create an empty filter (matching all the types).
+        TypeFilter()
+                : m_dense(0)
+        {
+        }
+
+        /// Create a filter from the set of types.
+        TypeFilter(std::set<NodeType> const &types)
+                : m_dense(0)
+        {
+            for (auto &type: types) Add(type);
+        }
+
+        /// Add type to the filter.
+        void Add(NodeType const &type)
+        {
+            std::size_t index;
+
+            if (GetDenseIndex(type, index))
+                m_dense |= std::uint64_t(1) << index;
+            else
+                m_sparse.insert(type);
+        }
+
+        /// Check if the filter is empty (matching all the types).
+        bool IsEmpty() const
+        { return !m_dense && m_sparse.empty(); }
+
+        /// Check if the filter contains a given type.
+        bool Contains(NodeType const &type) const
+        {
+            std::size_t index;
+
+            if (GetDenseIndex(type, index))
+                return (m_dense >> index) & 1;
+
+            return !m_sparse.empty() && m_sparse.find(type) != m_sparse.cend();
+        }
+
+        /// Check if the filter lets a given type through.
+        bool Matches(NodeType const &type) const
+        { return IsEmpty() || Contains(type); }
+
+        /// Return the bit mask of dense types.
+        std::uint64_t GetDenseMask() const
+        { return m_dense; }
+
+        /// Return the set of sparse types.
+        std::unordered_set<NodeType, TypeHash<NodeType>> const &GetSparseTypes() const
+        { return m_sparse; }
+
+        /// \brief Map a type to the bit index.
+        /// \return false if the type can not be represented by a bit mask.
+        static bool GetDenseIndex(NodeType const &type, std::size_t &index)
+        {
+            return GetDenseIndex(type, index, std::integral_constant<bool, std::is_integral<NodeType>::value ||
+                                                                           std::is_enum<NodeType>::value>());
+        }
+
+    private:
+        static bool GetDenseIndex(NodeType const &type, std::size_t &index, std::true_type)
+        {
+            // Negative values wrap around and end up out of range
+            auto value = static_cast<std::uint64_t>(type);
+            index = static_cast<std::size_t>(value);
+            return value < kDenseTypes;
+        }
+
+        static bool GetDenseIndex(NodeType const &, std::size_t &, std::false_type)
+        {
+            return false;
+        }
+
+        /// Bit mask of small types
+        std::uint64_t m_dense;
+        /// The rest of types
+        std::unordered_set<NodeType, TypeHash<NodeType>> m_sparse;
+    };
+
+    /**
+        \brief Listener callback class
+
+        FilteredCallback wraps callback function and adds a filter
+        functionality to it. It checks the type of the node calling
+        it and matches it versus m_filter. It calls the function if
+        either m_filter is empty (non-filtered) or node type is
+        contained within m_filter
+    */
+    template<typename Func, typename NodeType>
+    struct FilteredCallback
+    {
+        /// Creates a filtered callback from a given function and the set of event types.
+        FilteredCallback(Func func, TypeFilter<NodeType> filter)
+                : m_func(std::move(func)), m_filter(std::move(filter))
+        {
+        }
+
+        /// Call applying a filter.
+        template<typename NodePtr, typename... Args>
+        void operator()(NodePtr node, Args &&... args) const
+        {
+            if (m_filter.Matches(node->GetType()))
+            {
+                m_func(node, std::forward<Args>(args)...);
+            }
+        }
+
+        /// Callback
+        Func m_func;
+        /// Filter
+        TypeFilter<NodeType> m_filter;
+    };
+
+    /**
+        \brief Token identifying a registered callback.
+
+        Subscription is returned by callback registration and can be used to unregister the callback later.
+        Default constructed subscription does not refer to any callback.
+     */
+    class Subscription
+    {
+    public:
+        Subscription()
+                : m_id(0)
+        {
+        }
+
+        explicit Subscription(std::uint64_t id)
+                : m_id(id)
+        {
+        }
+
+        /// Return unique subscription identifier.
+        std::uint64_t GetId() const
+        { return m_id; }
+
+        /// Check if the token refers to a callback.
+        explicit operator bool() const
+        { return m_id != 0; }
+
+        bool operator==(Subscription const &rhs) const
+        { return m_id == rhs.m_id; }
+
+        bool operator!=(Subscription const &rhs) const
+        { return m_id != rhs.m_id; }
+
+    private:
+        /// Subscription identifier (0 means no subscription)
+        std::uint64_t m_id;
+    };
+
+    /**
+        \brief List of filtered callbacks supporting concurrent registration, removal and dispatch.
+
+        Callbacks are kept in a copy-on-write dispatch table, so dispatch never locks. The table is precomputed
+        on registration: for every node type mentioned by any filter it keeps the array of callbacks accepting
+        that type, so dispatch visits only interested callbacks and does no filtering at all. Callbacks can be
+        further restricted to a set of keys, those are indexed by key and only visited for events carrying
+        one of their keys. Locking and atomic reads of the table follow the threading policy.
+
+        Removal only marks the entry dead, which takes constant time and is immediately visible to dispatches in
+        flight. Dead entries are compacted away once they outnumber live ones, which keeps dispatch cost
+        proportional to the number of live callbacks.
+     */
+    template<typename Func, typename NodeType, typename Key, typename ThreadingPolicy = MultiThreaded>
+    class CallbackList
+    {
+    public:
+        CallbackList()
+                : m_dead(0)
+        {
+        }
+
+        CallbackList(CallbackList const &) = delete;
+
+        CallbackList &operator=(CallbackList const &) = delete;
+
+        /// \brief Add a callback identified by a given subscription.
+        /// \param subscription Subscription identifying the callback.
+        /// \param callback Filtered callback.
+        /// \param keys Keys the callback is interested in (empty means all keys).
+        void Add(Subscription const &subscription, FilteredCallback<Func, NodeType> callback,
+                 std::set<Key> const &keys = {})
+        {
+            std::shared_ptr<Entry> entry(new Entry(std::move(callback), keys));
+
+            std::unique_lock<Mutex> lock(m_mutex);
+
+            m_index.emplace(subscription.GetId(), entry.get());
+
+            m_table.Modify([&entry](DispatchTable &table)
+                           {
+                               table.m_entries.push_back(std::move(entry));
+                               table.Rebuild();
+                           });
+        }
+
+        /// \brief Remove a callback identified by a given subscription.
+        /// \details After the call returns the callback is not invoked by any new dispatch, though it might still
+        /// be executing on another thread if the dispatch has been started before.
+        /// \return true if the callback has been found and removed.
+        bool Remove(Subscription const &subscription)
+        {
+            std::unique_lock<Mutex> lock(m_mutex);
+
+            auto iter = m_index.find(subscription.GetId());
+
+            if (iter == m_index.cend())
+                return false;
+
+            iter->second->m_alive.store(false);
+
+            m_index.erase(iter);
+
+            // Compact once dead entries outnumber live ones, amortized constant time per removal
+            if (++m_dead > m_index.size())
+            {
+                m_table.Modify([](DispatchTable &table)
+                               {
+                                   auto &entries = table.m_entries;
+                                   entries.erase(std::remove_if(entries.begin(), entries.end(),
+                                                                [](std::shared_ptr<Entry> const &entry)
+                                                                { return !entry->m_alive.load(); }),
+                                                 entries.end());
+                                   table.Rebuild();
+                               });
+                m_dead = 0;
+            }
+
+            return true;
+        }
+
+        /// Check if there are no live callbacks without locking (dead entries never outnumber live ones).
+        bool IsEmpty() const
+        {
+            typename CopyOnWrite<DispatchTable, ThreadingPolicy>::ReadGuard table(m_table);
+
+            return table->m_entries.empty();
+        }
+
+        /// Return the number of live callbacks.
+        std::size_t GetSize() const
+        {
+            std::unique_lock<Mutex> lock(m_mutex);
+            return m_index.size();
+        }
+
+        /// Invoke a functor for every live callback accepting a given node type.
+        template<typename Visitor>
+        void ForEach(NodeType const &type, Visitor &&visitor) const
+        {
+            typename CopyOnWrite<DispatchTable, ThreadingPolicy>::ReadGuard table(m_table);
+
+            Visit(table->m_any_key.Find(type), visitor);
+        }
+
+        /// Invoke a functor for every live callback ignoring filters.
+        template<typename Visitor>
+        void ForEach(Visitor &&visitor) const
+        {
+            typename CopyOnWrite<DispatchTable, ThreadingPolicy>::ReadGuard table(m_table);
+
+            for (auto &entry: table->m_entries)
+            {
+                if (entry->m_alive.load(std::memory_order_acquire))
+                {
+                    visitor(entry->m_func);
+                }
+            }
+        }
+
+        /// \brief Invoke a functor for every live callback accepting a given node type and key.
+        /// \details Callbacks accepting any key are visited before the ones restricted to particular keys.
+        template<typename Visitor>
+        void ForEach(NodeType const &type, Key const &key, Visitor &&visitor) const
+        {
+            typename CopyOnWrite<DispatchTable, ThreadingPolicy>::ReadGuard table(m_table);
+
+            Visit(table->m_any_key.Find(type), visitor);
+
+            if (!table->m_by_key.empty())
+            {
+                auto iter = table->m_by_key.find(key);
+
+                if (iter != table->m_by_key.cend())
+                    Visit(iter->second.Find(type), visitor);
+            }
+        }
+
+    private:
+        using Mutex = typename ThreadingPolicy::Mutex;
+
+        /// List entry, shared between published tables.
+        struct Entry : FilteredCallback<Func, NodeType>
+        {
+            Entry(FilteredCallback<Func, NodeType> &&callback, std::set<Key> const &keys)
+                    : FilteredCallback<Func, NodeType>(std::move(callback)), m_keys(keys.cbegin(), keys.cend())
+                    , m_alive(true)
+            {
+            }
+
+            /// Keys of interest (empty means all keys)
+            std::vector<Key> m_keys;
+            /// Cleared on removal
+            std::atomic<bool> m_alive;
+        };
+
+        /// Per-type arrays of callbacks.
+        struct TypeTable
+        {
+            TypeTable()
+                    : m_dense_mask(0)
+            {
+            }
+
+            /// Return callbacks accepting a given type.
+            std::vector<Entry *> const &Find(NodeType const &type) const
+            {
+                std::size_t index;
+
+                if (TypeFilter<NodeType>::GetDenseIndex(type, index))
+                {
+                    return (m_dense_mask >> index) & 1 ? m_dense[index] : m_unfiltered;
+                }
+
+                if (!m_sparse.empty())
+                {
+                    auto iter = m_sparse.find(type);
+
+                    if (iter != m_sparse.cend())
+                        return iter->second;
+                }
+
+                return m_unfiltered;
+            }
+
+            /// Compute per-type arrays for a given list of entries.
+            void Build(std::vector<Entry *> const &entries)
+            {
+                // Collect all the types mentioned by filters
+                m_dense_mask = 0;
+                m_sparse.clear();
+
+                for (auto entry: entries)
+                {
+                    m_dense_mask |= entry->m_filter.GetDenseMask();
+
+                    for (auto &type: entry->m_filter.GetSparseTypes())
+                        m_sparse[type];
+                }
+
+                for (auto &callbacks: m_dense) callbacks.clear();
+                m_unfiltered.clear();
+
+                // Distribute callbacks preserving registration order
+                for (auto entry: entries)
+                {
+                    auto &filter = entry->m_filter;
+                    auto all = filter.IsEmpty();
+
+                    if (all)
+                        m_unfiltered.push_back(entry);
+
+                    auto mask = all ? m_dense_mask : filter.GetDenseMask();
+
+                    for (std::size_t i = 0; i < TypeFilter<NodeType>::kDenseTypes; ++i)
+                    {
+                        if ((mask >> i) & 1)
+                            m_dense[i].push_back(entry);
+                    }
+
+                    for (auto &sparse: m_sparse)
+                    {
+                        if (all || filter.Contains(sparse.first))
+                            sparse.second.push_back(entry);
+                    }
+                }
+            }
+
+            /// Callbacks without a filter
+            std::vector<Entry *> m_unfiltered;
+            /// Dense types having dedicated arrays
+            std::uint64_t m_dense_mask;
+            /// Callbacks for dense types
+            std::vector<Entry *> m_dense[TypeFilter<NodeType>::kDenseTypes];
+            /// Callbacks for sparse types
+            std::unordered_map<NodeType, std::vector<Entry *>, TypeHash<NodeType>> m_sparse;
+        };
+
+        /// Published state of the list.
+        struct DispatchTable
+        {
+            /// Recompute type tables from m_entries.
+            void Rebuild()
+            {
+                std::vector<Entry *> any_key;
+                std::unordered_map<Key, std::vector<Entry *>, TypeHash<Key>> by_key;
+
+                for (auto &entry: m_entries)
+                {
+                    if (entry->m_keys.empty())
+                        any_key.push_back(entry.get());
+
+                    for (auto &key: entry->m_keys)
+                        by_key[key].push_back(entry.get());
+                }
+
+                m_any_key.Build(any_key);
+
+                m_by_key.clear();
+
+                for (auto &keyed: by_key)
+                    m_by_key[keyed.first].Build(keyed.second);
+            }
+
+            /// All entries in registration order (owning)
+            std::vector<std::shared_ptr<Entry>> m_entries;
+            /// Callbacks accepting any key
+            TypeTable m_any_key;
+            /// Callbacks restricted to particular keys
+            std::unordered_map<Key, TypeTable, TypeHash<Key>> m_by_key;
+        };
+
+        template<typename Visitor>
+        static void Visit(std::vector<Entry *> const &entries, Visitor &visitor)
+        {
+            for (auto entry: entries)
+            {
+                if (entry->m_alive.load(std::memory_order_acquire))
+                {
+                    visitor(entry->m_func);
+                }
+            }
+        }
+
+        /// Published dispatch table
+        CopyOnWrite<DispatchTable, ThreadingPolicy> m_table;
+        /// Subscription to entry map for constant time removal
+        std::unordered_map<std::uint64_t, Entry *> m_index;
+        /// Number of dead entries still present in m_table
+        std::size_t m_dead;
+        /// Guards m_index and m_dead
+        mutable Mutex m_mutex;
+    };
+}
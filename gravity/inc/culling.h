@@ -0,0 +1,247 @@
+/**
+    \file culling.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing frustum culling of Gravity scene graph nodes.
+
+    Culling tests world bounds kept by the bounding volume hierarchy against a view frustum. Boxes are stored
+    as a structure of arrays, so they are tested eight (AVX) or four (SSE) at a time, scalar code is used
+    otherwise or if DISABLE_SIMD is defined.
+ */
+#pragma once
+
+#include "bounds.h"
+#include "bvh.h"
+#include "callback_list.h"
+#include "matrix.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <set>
+#include <vector>
+
+namespace Gravity
+{
+    /// \brief Call visible(index) for every box [begin, end) of an array which is inside or intersects a frustum.
+    /// \details begin has to be a multiple of AabbArray::kPadding. The test is the same as Frustum::Classify
+    /// reporting anything but Containment::kOutside.
+    template<typename Visible>
+    inline void CullBoxes(Frustum const &frustum, AabbArray const &boxes, std::size_t begin, std::size_t end,
+                          Visible &&visible)
+    {
+        // Coordinates of box corners farthest along normals of planes
+        float const *corners[6][3];
+
+        for (int p = 0; p < 6; ++p)
+        {
+            auto &n = frustum.m_planes[p].m_normal;
+            corners[p][0] = n.m_x >= 0.f ? boxes.GetMax(0) : boxes.GetMin(0);
+            corners[p][1] = n.m_y >= 0.f ? boxes.GetMax(1) : boxes.GetMin(1);
+            corners[p][2] = n.m_z >= 0.f ? boxes.GetMax(2) : boxes.GetMin(2);
+        }
+
+#if defined(GRAVITY_AVX)
+        std::size_t const width = 8;
+        __m256 planes[6][4];
+
+        for (int p = 0; p < 6; ++p)
+        {
+            auto &plane = frustum.m_planes[p];
+            planes[p][0] = _mm256_set1_ps(plane.m_normal.m_x);
+            planes[p][1] = _mm256_set1_ps(plane.m_normal.m_y);
+            planes[p][2] = _mm256_set1_ps(plane.m_normal.m_z);
+            planes[p][3] = _mm256_set1_ps(plane.m_distance);
+        }
+
+        auto zero = _mm256_setzero_ps();
+
+        for (auto i = begin; i < end; i += width)
+        {
+            auto outside = zero;
+
+            for (int p = 0; p < 6; ++p)
+            {
+                auto d = _mm256_mul_ps(planes[p][0], _mm256_loadu_ps(corners[p][0] + i));
+                d = _mm256_add_ps(d, _mm256_mul_ps(planes[p][1], _mm256_loadu_ps(corners[p][1] + i)));
+                d = _mm256_add_ps(d, _mm256_mul_ps(planes[p][2], _mm256_loadu_ps(corners[p][2] + i)));
+                d = _mm256_add_ps(d, planes[p][3]);
+                outside = _mm256_or_ps(outside, _mm256_cmp_ps(d, zero, _CMP_LT_OQ));
+
+                // Side planes reject most boxes, skip the rest once all lanes are out
+                if (p == 1 && _mm256_movemask_ps(outside) == 0xff)
+                    break;
+            }
+
+            auto mask = ~static_cast<unsigned>(_mm256_movemask_ps(outside)) & 0xffu;
+#elif defined(GRAVITY_SSE)
+        std::size_t const width = 4;
+        __m128 planes[6][4];
+
+        for (int p = 0; p < 6; ++p)
+        {
+            auto &plane = frustum.m_planes[p];
+            planes[p][0] = _mm_set1_ps(plane.m_normal.m_x);
+            planes[p][1] = _mm_set1_ps(plane.m_normal.m_y);
+            planes[p][2] = _mm_set1_ps(plane.m_normal.m_z);
+            planes[p][3] = _mm_set1_ps(plane.m_distance);
+        }
+
+        auto zero = _mm_setzero_ps();
+
+        for (auto i = begin; i < end; i += width)
+        {
+            auto outside = zero;
+
+            for (int p = 0; p < 6; ++p)
+            {
+                auto d = _mm_mul_ps(planes[p][0], _mm_loadu_ps(corners[p][0] + i));
+                d = _mm_add_ps(d, _mm_mul_ps(planes[p][1], _mm_loadu_ps(corners[p][1] + i)));
+                d = _mm_add_ps(d, _mm_mul_ps(planes[p][2], _mm_loadu_ps(corners[p][2] + i)));
+                d = _mm_add_ps(d, planes[p][3]);
+                outside = _mm_or_ps(outside, _mm_cmplt_ps(d, zero));
+
+                // Side planes reject most boxes, skip the rest once all lanes are out
+                if (p == 1 && _mm_movemask_ps(outside) == 0xf)
+                    break;
+            }
+
+            auto mask = ~static_cast<unsigned>(_mm_movemask_ps(outside)) & 0xfu;
+#else
+        std::size_t const width = 1;
+
+        for (auto i = begin; i < end; ++i)
+        {
+            unsigned mask = 1;
+
+            for (int p = 0; p < 6; ++p)
+            {
+                auto &plane = frustum.m_planes[p];
+
+                if (plane.GetDistance(Vector3{corners[p][0][i], corners[p][1][i], corners[p][2][i]}) < 0.f)
+                    mask = 0;
+            }
+#endif
+            // Drop lanes past the end (padding)
+            if (end - i < width)
+                mask &= (1u << (end - i)) - 1;
+
+            for (std::size_t lane = 0; mask; ++lane, mask >>= 1)
+            {
+                if (mask & 1u)
+                    visible(i + lane);
+            }
+        }
+    }
+
+    /**
+        \brief Frustum culling of nodes of a bounding volume hierarchy.
+
+        Cull() tests bounds of every node with SIMD, it is split into chunks of kGrainSize nodes running in
+        parallel given a task pool. CullHierarchy() walks the hierarchy instead and skips subtrees outside of the
+        frustum, which is cheaper when a small part of the scene is visible.
+
+        Both reflect the state of the hierarchy as of its last update. A culler keeps its scratch buffers, so
+        views culled concurrently need a culler each.
+     */
+    template<typename SceneGraph>
+    class FrustumCuller
+    {
+    public:
+        using Node = typename SceneGraph::Node;
+        using NodeType = typename SceneGraph::NodeTypeType;
+        using Bvh = BoundingVolumeHierarchy<SceneGraph>;
+
+        /// Number of nodes tested by a task (a multiple of AabbArray::kPadding).
+        static std::size_t const kGrainSize = 16384;
+
+        /// \brief Create the culler over nodes of a hierarchy.
+        /// \param pool Task pool running Cull in parallel or nullptr to cull on the calling thread.
+        explicit FrustumCuller(Bvh const &bvh, TaskPool *pool = nullptr)
+                : m_bvh(bvh), m_pool(pool)
+        {
+        }
+
+        FrustumCuller(FrustumCuller const &) = delete;
+
+        FrustumCuller &operator=(FrustumCuller const &) = delete;
+
+        /// \brief Collect nodes whose bounds are inside or intersect a frustum testing every node.
+        /// \param visible Receives the nodes in the order of BoundingVolumeHierarchy::GetNodes(), it is cleared
+        /// first and its capacity is reused.
+        /// \param types Types of nodes to collect or empty set to collect nodes of all types.
+        void Cull(Frustum const &frustum, std::vector<Node *> &visible, std::set<NodeType> const &types = {})
+        {
+            auto &bounds = m_bvh.GetWorldBounds();
+            auto nodes = m_bvh.GetNodes().GetData();
+            auto count = bounds.GetSize();
+            auto num_chunks = (count + kGrainSize - 1) / kGrainSize;
+            TypeFilter<NodeType> const filter(types);
+
+            visible.clear();
+
+            if (m_candidates.size() < count)
+                m_candidates.resize(count);
+
+            m_chunk_sizes.resize(num_chunks);
+
+            // Every chunk writes its nodes to its own part of m_candidates
+            auto cull = [&](std::size_t begin, std::size_t end)
+            {
+                for (auto chunk = begin; chunk < end; ++chunk)
+                {
+                    auto first = chunk * kGrainSize;
+                    auto out = m_candidates.data() + first;
+                    std::size_t size = 0;
+
+                    CullBoxes(frustum, bounds, first, std::min(first + kGrainSize, count),
+                              [&](std::size_t index)
+                              {
+                                  if (filter.Matches(nodes[index]->GetType()))
+                                      out[size++] = nodes[index];
+                              });
+
+                    m_chunk_sizes[chunk] = size;
+                }
+            };
+
+            if (m_pool)
+                m_pool->ParallelFor(num_chunks, 1, cull);
+            else
+                cull(0, num_chunks);
+
+            for (std::size_t chunk = 0; chunk < num_chunks; ++chunk)
+            {
+                auto first = m_candidates.cbegin() + chunk * kGrainSize;
+                visible.insert(visible.end(), first, first + m_chunk_sizes[chunk]);
+            }
+        }
+
+        /// \brief Collect nodes whose bounds are inside or intersect a frustum walking the hierarchy.
+        /// \param visible Receives the nodes in traversal order, it is cleared first and its capacity is reused.
+        /// \param types Types of nodes to collect or empty set to collect nodes of all types.
+        void CullHierarchy(Frustum const &frustum, std::vector<Node *> &visible,
+                           std::set<NodeType> const &types = {}) const
+        {
+            visible.clear();
+
+            m_bvh.QueryFrustum(frustum, types, [&visible](Node *node)
+            { visible.push_back(node); });
+        }
+
+    private:
+        /// Hierarchy
+        Bvh const &m_bvh;
+        /// Task pool or nullptr
+        TaskPool *m_pool;
+        /// Visible nodes of chunks and their numbers
+        std::vector<Node *> m_candidates;
+        std::vector<std::size_t> m_chunk_sizes;
+    };
+
+    template<typename SceneGraph>
+    std::size_t const FrustumCuller<SceneGraph>::kGrainSize;
+
+    using DefaultFrustumCuller = FrustumCuller<DefaultSceneGraph>;
+}
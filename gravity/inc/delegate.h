@@ -0,0 +1,183 @@
+/**
+    \file delegate.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing allocation-free callable wrapper used for Gravity scene graph callbacks.
+
+    Delegate is a replacement for std::function which never allocates: callable objects are stored in a fixed-size
+    inline buffer and plain function pointers are called directly, bypassing type-erased invocation.
+ */
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace Gravity
+{
+    template<typename Signature>
+    class Delegate;
+
+    /**
+        \brief Callable wrapper with inline storage.
+
+        Delegate can hold a function pointer or a callable object of up to kStorageSize bytes. Attempt to store a
+        larger callable results in compile time error. Plain function pointers and captureless lambdas take a
+        fast path and are invoked without type-erased indirection.
+     */
+    template<typename R, typename... Args>
+    class Delegate<R(Args...)>
+    {
+    public:
+        /// Size of inline storage for callable objects.
+        static std::size_t const kStorageSize = 4 * sizeof(void *);
+
+        using Function = R (*)(Args...);
+
+        Delegate()
+                : m_function(nullptr), m_invoker(&InvokeEmpty), m_manager(nullptr)
+        {
+        }
+
+        Delegate(std::nullptr_t)
+                : Delegate()
+        {
+        }
+
+        /// Construct from a function pointer or a callable object.
+        template<typename Func, typename = typename std::enable_if<!std::is_same<
+                Delegate,
+                typename std::decay<Func>::type>::value>::type>
+        Delegate(Func &&func)
+                : Delegate()
+        {
+            Assign(std::forward<Func>(func), std::is_convertible<Func, Function>());
+        }
+
+        Delegate(Delegate const &rhs)
+                : m_function(rhs.m_function), m_invoker(rhs.m_invoker), m_manager(rhs.m_manager)
+        {
+            if (m_manager)
+                m_manager(Operation::kCopy, &m_storage, &rhs.m_storage);
+        }
+
+        Delegate &operator=(Delegate const &rhs)
+        {
+            if (this != &rhs)
+            {
+                Reset();
+
+                if (rhs.m_manager)
+                    rhs.m_manager(Operation::kCopy, &m_storage, &rhs.m_storage);
+
+                m_function = rhs.m_function;
+                m_invoker = rhs.m_invoker;
+                m_manager = rhs.m_manager;
+            }
+
+            return *this;
+        }
+
+        ~Delegate()
+        {
+            Reset();
+        }
+
+        /// Call the underlying callable.
+        /// \details Calling an empty delegate results in std::bad_function_call exception being thrown.
+        R operator()(Args... args) const
+        {
+            // Fast path: plain function
+            if (m_function)
+                return m_function(std::forward<Args>(args)...);
+
+            return m_invoker(&m_storage, std::forward<Args>(args)...);
+        }
+
+        /// Check if the delegate holds a callable.
+        explicit operator bool() const
+        { return m_function || m_manager; }
+
+    private:
+        enum class Operation
+        {
+            kCopy,
+            kDestroy
+        };
+
+        using Storage = typename std::aligned_storage<kStorageSize, alignof(std::max_align_t)>::type;
+        using Invoker = R (*)(Storage const *, Args &&...);
+        using Manager = void (*)(Operation, Storage *, Storage const *);
+
+        /// Store a function pointer.
+        template<typename Func>
+        void Assign(Func &&func, std::true_type)
+        {
+            m_function = static_cast<Function>(func);
+        }
+
+        /// Store a callable object into inline storage.
+        template<typename Func>
+        void Assign(Func &&func, std::false_type)
+        {
+            using Functor = typename std::decay<Func>::type;
+
+            static_assert(sizeof(Functor) <= kStorageSize, "Callable is too large for Delegate inline storage");
+            static_assert(alignof(Functor) <= alignof(Storage), "Callable alignment is not supported by Delegate");
+
+            new(&m_storage) Functor(std::forward<Func>(func));
+
+            m_invoker = &InvokeFunctor<Functor>;
+            m_manager = &ManageFunctor<Functor>;
+        }
+
+        /// Destroy stored callable.
+        void Reset()
+        {
+            if (m_manager)
+                m_manager(Operation::kDestroy, &m_storage, nullptr);
+
+            m_function = nullptr;
+            m_invoker = &InvokeEmpty;
+            m_manager = nullptr;
+        }
+
+        template<typename Functor>
+        static R InvokeFunctor(Storage const *storage, Args &&... args)
+        {
+            // Callables are allowed to be stateful the same way std::function allows it
+            auto &functor = *reinterpret_cast<Functor *>(const_cast<Storage *>(storage));
+            return functor(std::forward<Args>(args)...);
+        }
+
+        static R InvokeEmpty(Storage const *, Args &&...)
+        {
+            throw std::bad_function_call();
+        }
+
+        template<typename Functor>
+        static void ManageFunctor(Operation operation, Storage *dst, Storage const *src)
+        {
+            switch (operation)
+            {
+                case Operation::kCopy:
+                    new(dst) Functor(*reinterpret_cast<Functor const *>(src));
+                    break;
+                case Operation::kDestroy:
+                    reinterpret_cast<Functor *>(dst)->~Functor();
+                    break;
+            }
+        }
+
+        /// Function pointer (fast path)
+        Function m_function;
+        /// Type-erased call of a stored callable
+        Invoker m_invoker;
+        /// Type-erased copy and destruction of a stored callable
+        Manager m_manager;
+        /// Inline storage for callable objects
+        Storage m_storage;
+    };
+}
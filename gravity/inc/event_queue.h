@@ -0,0 +1,181 @@
+/**
+    \file event_queue.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing lock-free bounded queue used for asynchronous event dispatch.
+
+    The queue is a ring buffer where each cell carries a sequence number telling producers and consumers whether
+    the cell is ready for them. Producers and consumers only contend on a single atomic position each.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+namespace Gravity
+{
+    /**
+        \brief Bounded multi-producer multi-consumer lock-free queue.
+
+        Capacity is rounded up to the power of two. Values pushed as droppable can later be evicted from the head
+        of the queue by TryPopDroppable, which is how producers implement drop-oldest backpressure without
+        touching values which must not be lost.
+     */
+    template<typename T>
+    class BoundedQueue
+    {
+    public:
+        /// Create a queue holding at least capacity values.
+        explicit BoundedQueue(std::size_t capacity)
+                : m_enqueue_pos(0), m_dequeue_pos(0)
+        {
+            std::size_t size = 2;
+            while (size < capacity) size <<= 1;
+
+            m_cells.reset(new Cell[size]);
+            m_mask = size - 1;
+
+            for (std::size_t i = 0; i < size; ++i)
+            {
+                m_cells[i].m_sequence.store(i, std::memory_order_relaxed);
+            }
+        }
+
+        BoundedQueue(BoundedQueue const &) = delete;
+
+        BoundedQueue &operator=(BoundedQueue const &) = delete;
+
+        /// \brief Push the value to the tail of the queue.
+        /// \return false if the queue is full.
+        bool TryPush(T const &value, bool droppable = false)
+        {
+            auto pos = m_enqueue_pos.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                auto &cell = m_cells[pos & m_mask];
+                auto sequence = cell.m_sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos);
+
+                if (diff == 0)
+                {
+                    // The cell is free, try to claim it
+                    if (m_enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        cell.m_value = value;
+                        cell.m_droppable.store(droppable, std::memory_order_relaxed);
+                        cell.m_sequence.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    // The cell still holds the value from the previous lap
+                    return false;
+                }
+                else
+                {
+                    pos = m_enqueue_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /// \brief Pop the value from the head of the queue.
+        /// \return false if the queue is empty.
+        bool TryPop(T &value)
+        {
+            return Pop(value, false);
+        }
+
+        /// \brief Pop the value from the head of the queue if it has been pushed as droppable.
+        /// \return false if the queue is empty or the head value is not droppable.
+        bool TryPopDroppable(T &value)
+        {
+            return Pop(value, true);
+        }
+
+        /// Return the number of values in the queue (approximate if the queue is being modified).
+        std::size_t GetSize() const
+        {
+            auto dequeue_pos = m_dequeue_pos.load(std::memory_order_relaxed);
+            auto enqueue_pos = m_enqueue_pos.load(std::memory_order_relaxed);
+            return enqueue_pos > dequeue_pos ? enqueue_pos - dequeue_pos : 0;
+        }
+
+        /// Return queue capacity.
+        std::size_t GetCapacity() const
+        { return m_mask + 1; }
+
+        /// Return the total number of values pushed so far.
+        std::size_t GetEnqueuePosition() const
+        { return m_enqueue_pos.load(); }
+
+        /// Return the total number of values popped so far.
+        std::size_t GetDequeuePosition() const
+        { return m_dequeue_pos.load(); }
+
+    private:
+        bool Pop(T &value, bool droppable_only)
+        {
+            auto pos = m_dequeue_pos.load(std::memory_order_relaxed);
+
+            for (;;)
+            {
+                auto &cell = m_cells[pos & m_mask];
+                auto sequence = cell.m_sequence.load(std::memory_order_acquire);
+                auto diff = static_cast<std::intptr_t>(sequence) - static_cast<std::intptr_t>(pos + 1);
+
+                if (diff == 0)
+                {
+                    // The flag can not change until someone claims the cell, in which case the exchange fails
+                    if (droppable_only && !cell.m_droppable.load(std::memory_order_relaxed))
+                        return false;
+
+                    if (m_dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    {
+                        value = cell.m_value;
+                        cell.m_sequence.store(pos + m_mask + 1, std::memory_order_release);
+                        return true;
+                    }
+                }
+                else if (diff < 0)
+                {
+                    // The cell has not been filled yet
+                    return false;
+                }
+                else
+                {
+                    pos = m_dequeue_pos.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        /// Queue cell.
+        struct Cell
+        {
+            /// Cell state: equals position when free, position + 1 when filled
+            std::atomic<std::size_t> m_sequence;
+            /// Set if the value can be evicted by TryPopDroppable
+            std::atomic<bool> m_droppable;
+            /// Value
+            T m_value;
+        };
+
+        /// Cache line size used to keep positions apart
+        static std::size_t const kCacheLineSize = 64;
+
+        /// Ring buffer
+        std::unique_ptr<Cell[]> m_cells;
+        /// Capacity - 1
+        std::size_t m_mask;
+        char m_pad0[kCacheLineSize];
+        /// Producers position
+        std::atomic<std::size_t> m_enqueue_pos;
+        char m_pad1[kCacheLineSize];
+        /// Consumers position
+        std::atomic<std::size_t> m_dequeue_pos;
+        char m_pad2[kCacheLineSize];
+    };
+}
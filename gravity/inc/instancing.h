@@ -0,0 +1,358 @@
+/**
+    \file instancing.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing automatic instancing groups of Gravity scene graph nodes.
+
+    Nodes whose instance key parameters (mesh, material and the like) hold equal values are kept in groups
+    with contiguous per-instance arrays, so a renderer can issue one instanced batch per group.
+ */
+#pragma once
+
+#include "matrix.h"
+#include "sg.h"
+#include "span.h"
+#include "transform.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace Gravity
+{
+    /**
+        \brief Groups of scene graph nodes sharing values of instance key parameters.
+
+        Instance key parameters are a designated list of parameters of type Value, nodes having all of them are
+        grouped by their values. Every group keeps its nodes and, given a transform system, their world
+        transforms in contiguous arrays in the same order.
+
+        Update() applies changes made since the previous update: nodes are added to and removed from groups as
+        they come and go, nodes whose instance key parameters have changed move between groups and world
+        transforms of moved nodes are refreshed. Removing a node moves the last node of its group into its slot.
+
+        Groups are never removed, a group whose nodes are all gone stays empty and is reused if its key comes
+        back, so group indices are stable. Every group has a version which changes whenever its arrays do, so
+        per-group GPU buffers only need uploading when it has changed.
+     */
+    template<typename SceneGraph, typename Value>
+    class InstanceGroups
+    {
+    public:
+        using Key = typename SceneGraph::KeyType;
+        using Node = typename SceneGraph::Node;
+
+        /// Index of a missing group.
+        static std::uint32_t const kInvalid = 0xffffffff;
+
+        /// Nodes sharing values of instance key parameters.
+        class Group
+        {
+        public:
+            /// Return values of instance key parameters in the order of keys.
+            Span<Value const> GetKey() const
+            { return Span<Value const>(m_key.data(), m_key.size()); }
+
+            /// Return the number of nodes in the group.
+            std::size_t GetSize() const
+            { return m_nodes.size(); }
+
+            /// Return nodes of the group.
+            Span<Node *const> GetNodes() const
+            { return Span<Node *const>(m_nodes.data(), m_nodes.size()); }
+
+            /// Return world transforms of nodes (empty without a transform system).
+            Span<Matrix4 const> GetTransforms() const
+            { return Span<Matrix4 const>(m_transforms.data(), m_transforms.size()); }
+
+            /// Return the version which changes whenever nodes or transforms change.
+            std::uint64_t GetVersion() const
+            { return m_version; }
+
+        private:
+            friend class InstanceGroups;
+
+            std::vector<Value> m_key;
+            std::vector<Node *> m_nodes;
+            std::vector<Matrix4> m_transforms;
+            std::uint64_t m_version;
+        };
+
+        /// \brief Create groups over given instance key parameters.
+        /// \param keys Instance key parameters, std::runtime_error is thrown if there are none.
+        /// \param transforms Transform system providing world transforms or nullptr to keep nodes only. The
+        /// transform system has to be updated before the groups.
+        InstanceGroups(SceneGraph &sg, std::vector<Key> keys, TransformSystem<SceneGraph> const *transforms = nullptr)
+                : m_sg(sg), m_keys(std::move(keys)), m_transforms(transforms), m_poller(sg)
+                , m_num_transform_updates(0)
+        {
+            if (m_keys.empty())
+                throw std::runtime_error("At least one instance key is required");
+        }
+
+        InstanceGroups(InstanceGroups const &) = delete;
+
+        InstanceGroups &operator=(InstanceGroups const &) = delete;
+
+        /// Return the number of groups (including empty ones).
+        std::size_t GetNumGroups() const
+        { return m_groups.size(); }
+
+        /// Return a group.
+        Group const &GetGroup(std::size_t index) const
+        { return m_groups[index]; }
+
+        /// Return the index of the group of a node or kInvalid if the node is not instanced.
+        std::uint32_t GetGroupIndex(Node const *node) const
+        {
+            auto iter = m_instances.find(node);
+            return iter == m_instances.cend() ? kInvalid : iter->second.m_group;
+        }
+
+        /// \brief Apply scene changes made since the previous update.
+        /// \details Meant to be called by the writer between frames, it must not run concurrently with changes of
+        /// the scene structure.
+        /// \return The number of instances added, removed, regrouped and refreshed.
+        std::size_t Update()
+        {
+            m_poller.Collect(m_changes);
+
+            // Nodes created since the hierarchy has been restructured get their indices from the rebuild
+            if (m_transforms)
+                m_sg.GetHierarchy();
+
+            std::size_t num_changed = 0;
+
+            // Deletions go first, addresses of deleted nodes might have been reused by created ones
+            for (auto node: m_changes.m_deleted)
+            {
+                auto iter = m_instances.find(node);
+
+                if (iter != m_instances.cend())
+                {
+                    RemoveInstance(iter);
+                    ++num_changed;
+                }
+            }
+
+            for (auto &change: m_changes.m_nodes)
+            {
+                auto node = change.m_node;
+
+                if (change.m_created)
+                {
+                    if (HasKey(node))
+                    {
+                        AddInstance(node, FindGroup(node));
+                        ++num_changed;
+                    }
+
+                    continue;
+                }
+
+                auto regroup = false;
+
+                for (auto &key: m_changes.GetChangeSet(change))
+                    regroup = regroup || IsInstanceKey(key);
+
+                auto iter = regroup ? m_instances.find(node) : m_instances.end();
+
+                if (iter == m_instances.end())
+                    continue;
+
+                auto group = FindGroup(node);
+
+                if (group != iter->second.m_group)
+                {
+                    RemoveInstance(iter);
+                    AddInstance(node, group);
+                    ++num_changed;
+                }
+            }
+
+            return num_changed + RefreshTransforms();
+        }
+
+    private:
+        /// Group of a node and its slot there.
+        struct Instance
+        {
+            std::uint32_t m_group;
+            std::uint32_t m_slot;
+        };
+
+        using InstanceMap = std::unordered_map<Node const *, Instance>;
+
+        /// Hash of instance key values.
+        struct KeyHash
+        {
+            std::size_t operator()(std::vector<Value> const &key) const
+            {
+                std::size_t hash = 0;
+
+                for (auto &value: key)
+                    hash ^= std::hash<Value>()(value) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
+
+                return hash;
+            }
+        };
+
+        bool IsInstanceKey(Key const &key) const
+        {
+            for (auto &instance_key: m_keys)
+            {
+                if (instance_key == key)
+                    return true;
+            }
+
+            return false;
+        }
+
+        bool HasKey(Node *node) const
+        {
+            for (auto &key: m_keys)
+            {
+                if (!node->HasValue(key))
+                    return false;
+            }
+
+            return true;
+        }
+
+        /// Return the group of instance key values of a node creating it if needed.
+        std::uint32_t FindGroup(Node *node)
+        {
+            m_key_buffer.clear();
+
+            for (auto &key: m_keys)
+                m_key_buffer.push_back(node->template GetValue<Value>(key));
+
+            auto iter = m_group_index.find(m_key_buffer);
+
+            if (iter != m_group_index.cend())
+                return iter->second;
+
+            auto index = static_cast<std::uint32_t>(m_groups.size());
+            m_groups.push_back(Group());
+            m_groups.back().m_key = m_key_buffer;
+            m_groups.back().m_version = 0;
+            m_group_index.emplace(m_key_buffer, index);
+            return index;
+        }
+
+        void AddInstance(Node *node, std::uint32_t index)
+        {
+            auto &group = m_groups[index];
+            m_instances[node] = Instance{index, static_cast<std::uint32_t>(group.m_nodes.size())};
+            group.m_nodes.push_back(node);
+
+            if (m_transforms)
+                group.m_transforms.push_back(GetWorldTransform(node));
+
+            ++group.m_version;
+        }
+
+        /// \brief Return the world transform of a node.
+        /// \details Nodes the transform system has not seen yet get the identity, its next update reports them as
+        /// moved.
+        Matrix4 GetWorldTransform(Node const *node) const
+        {
+            return m_transforms->HasWorldTransform(node) ? m_transforms->GetWorldTransform(node) : Matrix4::Identity();
+        }
+
+        /// Remove a node from its group, the last node of the group takes its slot.
+        void RemoveInstance(typename InstanceMap::iterator iter)
+        {
+            auto instance = iter->second;
+            auto &group = m_groups[instance.m_group];
+            m_instances.erase(iter);
+
+            if (instance.m_slot + 1 != group.m_nodes.size())
+            {
+                group.m_nodes[instance.m_slot] = group.m_nodes.back();
+                m_instances[group.m_nodes[instance.m_slot]].m_slot = instance.m_slot;
+
+                if (m_transforms)
+                    group.m_transforms[instance.m_slot] = group.m_transforms.back();
+            }
+
+            group.m_nodes.pop_back();
+
+            if (m_transforms)
+                group.m_transforms.pop_back();
+
+            ++group.m_version;
+        }
+
+        /// \brief Copy world transforms of nodes moved by the last transform update.
+        /// \return The number of nodes refreshed.
+        std::size_t RefreshTransforms()
+        {
+            if (!m_transforms || m_transforms->GetUpdateCount() == m_num_transform_updates)
+                return 0;
+
+            std::size_t num_refreshed = 0;
+
+            auto refresh = [this, &num_refreshed](Node const *node, Instance const &instance)
+            {
+                auto &group = m_groups[instance.m_group];
+                group.m_transforms[instance.m_slot] = GetWorldTransform(node);
+                ++group.m_version;
+                ++num_refreshed;
+            };
+
+            // Ranges only describe the last update, refresh everything if some have been missed
+            if (m_transforms->GetUpdateCount() != m_num_transform_updates + 1)
+            {
+                for (auto &instance: m_instances)
+                    refresh(instance.first, instance.second);
+            }
+            else
+            {
+                auto &hierarchy = m_sg.GetHierarchy();
+
+                for (auto &range: m_transforms->GetUpdatedRanges())
+                {
+                    for (auto i = range.first; i < range.second; ++i)
+                    {
+                        auto iter = m_instances.find(hierarchy.GetNode(i));
+
+                        if (iter != m_instances.cend())
+                            refresh(iter->first, iter->second);
+                    }
+                }
+            }
+
+            m_num_transform_updates = m_transforms->GetUpdateCount();
+            return num_refreshed;
+        }
+
+        /// Scene graph
+        SceneGraph &m_sg;
+        /// Instance key parameters
+        std::vector<Key> m_keys;
+        /// Transform system or nullptr
+        TransformSystem<SceneGraph> const *m_transforms;
+        /// Poller of scene changes and the number of transform updates as of the last update
+        typename SceneGraph::ChangePoller m_poller;
+        std::uint64_t m_num_transform_updates;
+        /// Changes since the last update
+        typename SceneGraph::ChangeLog m_changes;
+        /// Groups and their indices by instance key values
+        std::vector<Group> m_groups;
+        std::unordered_map<std::vector<Value>, std::uint32_t, KeyHash> m_group_index;
+        /// Groups and slots of instanced nodes
+        InstanceMap m_instances;
+        /// Instance key values of the node being grouped
+        std::vector<Value> m_key_buffer;
+    };
+
+    template<typename SceneGraph, typename Value>
+    std::uint32_t const InstanceGroups<SceneGraph, Value>::kInvalid;
+
+    using DefaultInstanceGroups = InstanceGroups<DefaultSceneGraph, std::uint32_t>;
+}
@@ -0,0 +1,511 @@
+/**
+    \file lod.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing level of detail selection for Gravity scene graph nodes.
+
+    Selection estimates the screen size of world bounds kept by the bounding volume hierarchy and picks a level
+    of detail per node. Levels are kept in packed arrays following the order of the hierarchy instead of node
+    parameters, so a frame of selection neither locks nor notifies and only reports nodes whose level changed.
+ */
+#pragma once
+
+#include "bounds.h"
+#include "bvh.h"
+#include "matrix.h"
+#include "sg.h"
+#include "span.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace Gravity
+{
+    /**
+        \brief Screen sizes at which a node switches to coarser levels of detail.
+
+        Sizes are fractions of the viewport height covered by the bounding sphere of the node, in decreasing
+        order: level 0 is used down to m_sizes[0], level 1 down to m_sizes[1] and so on. Zero sizes are unused,
+        so a node with fewer levels leaves trailing sizes at zero.
+     */
+    struct LodThresholds
+    {
+        /// Maximum number of levels.
+        static int const kMaxLevels = 4;
+
+        float m_sizes[kMaxLevels - 1];
+    };
+
+    /// Camera used for level of detail selection.
+    struct LodView
+    {
+        /// Camera position
+        Vector3 m_position;
+        /// Vertical projection scale: 1 / tan(fov_y / 2), element [1][1] of a perspective projection matrix.
+        /// Scaling it down biases selection towards coarser levels.
+        float m_scale;
+    };
+
+    /**
+        \brief Level of detail selection for nodes of a bounding volume hierarchy.
+
+        Nodes of the hierarchy having a designated parameter of type LodThresholds take part in selection, others
+        stay at level 0. The screen size of a node is that of the bounding sphere of its world box as seen from
+        the closest of the views.
+
+        Selection uses hysteresis: a node goes to a coarser level once its size falls below the threshold scaled
+        by (1 - hysteresis) and comes back once it grows above the threshold scaled by (1 + hysteresis), so nodes
+        near a threshold do not flicker between levels.
+
+        Select() tests eight (AVX) or four (SSE) nodes at a time, scalar code is used otherwise or if
+        DISABLE_SIMD is defined. It is split into chunks of kGrainSize nodes running in parallel given a task pool.
+     */
+    template<typename SceneGraph>
+    class LodSelector
+    {
+    public:
+        using Key = typename SceneGraph::KeyType;
+        using Node = typename SceneGraph::Node;
+        using Bvh = BoundingVolumeHierarchy<SceneGraph>;
+
+        /// Node whose level of detail has changed.
+        struct LodChange
+        {
+            Node *m_node;
+            std::uint32_t m_level;
+            std::uint32_t m_previous;
+        };
+
+        /// Number of nodes processed by a task (a multiple of AabbArray::kPadding).
+        static std::size_t const kGrainSize = 16384;
+
+        /// \brief Create the selector over nodes of a hierarchy.
+        /// \param key Parameter holding LodThresholds of a node.
+        /// \param hysteresis Relative margin around thresholds in [0, 1), std::runtime_error is thrown otherwise.
+        /// \param pool Task pool running Select in parallel or nullptr to select on the calling thread.
+        LodSelector(SceneGraph &sg, Bvh const &bvh, Key const &key, float hysteresis = 0.1f, TaskPool *pool = nullptr)
+                : m_sg(sg), m_bvh(bvh), m_key(key), m_pool(pool), m_poller(sg)
+        {
+            if (!(hysteresis >= 0.f && hysteresis < 1.f))
+                throw std::runtime_error("Level of detail hysteresis has to be in [0, 1)");
+
+            m_coarser_scale = (1.f - hysteresis) * (1.f - hysteresis);
+            m_finer_scale = (1.f + hysteresis) * (1.f + hysteresis);
+        }
+
+        LodSelector(LodSelector const &) = delete;
+
+        LodSelector &operator=(LodSelector const &) = delete;
+
+        /// Return the level of detail of a node (0 for nodes not taking part in selection).
+        std::uint32_t GetLevel(Node const *node) const
+        {
+            auto iter = m_records.find(node);
+
+            if (iter == m_records.cend())
+                return 0;
+
+            auto slot = iter->second.m_slot;
+            return slot < m_nodes.size() && m_nodes[slot] == node ? m_levels[slot] : iter->second.m_level;
+        }
+
+        /// \brief Return levels of detail in the order of BoundingVolumeHierarchy::GetNodes().
+        /// \details Valid as of the last Update() of the selector.
+        Span<std::uint32_t const> GetLevels() const
+        { return Span<std::uint32_t const>(m_levels.data(), m_nodes.size()); }
+
+        /// \brief Apply scene changes and the order of the hierarchy as of its last update.
+        /// \details Meant to be called by the writer after updating the hierarchy, it must not run concurrently
+        /// with changes of the scene structure.
+        /// \return The number of nodes whose entries in packed arrays have been reloaded.
+        std::size_t Update()
+        {
+            m_poller.Collect(m_changes);
+
+            // Deletions go first, addresses of deleted nodes might have been reused by created ones
+            for (auto node: m_changes.m_deleted)
+            {
+                auto iter = m_records.find(node);
+
+                if (iter != m_records.cend())
+                {
+                    Invalidate(iter->first, iter->second);
+                    m_records.erase(iter);
+                }
+            }
+
+            for (auto &change: m_changes.m_nodes)
+            {
+                auto node = change.m_node;
+                auto reload = change.m_created;
+
+                for (auto &key: m_changes.GetChangeSet(change))
+                    reload = reload || key == m_key;
+
+                if (!reload || !node->HasValue(m_key))
+                    continue;
+
+                auto &record = m_records[node];
+                auto thresholds = node->template GetValue<LodThresholds>(m_key);
+
+                for (int k = 0; k < kNumThresholds; ++k)
+                    record.m_thresholds[k] = thresholds.m_sizes[k] * thresholds.m_sizes[k];
+
+                if (change.m_created)
+                {
+                    record.m_level = 0;
+                    record.m_slot = kInvalid;
+                }
+
+                Invalidate(node, record);
+            }
+
+            return Reorder();
+        }
+
+        /// \brief Select levels of detail for given views.
+        /// \param changes Receives nodes whose level has changed in the order of GetLevels(), it is cleared first
+        /// and its capacity is reused.
+        void Select(Span<LodView const> views, std::vector<LodChange> &changes)
+        {
+            changes.clear();
+
+            if (views.IsEmpty())
+                return;
+
+            // Squared distance over squared scale is what squared radii are compared against
+            m_views.clear();
+
+            for (auto &view: views)
+            {
+                m_views.push_back(view.m_position.m_x);
+                m_views.push_back(view.m_position.m_y);
+                m_views.push_back(view.m_position.m_z);
+                m_views.push_back(1.f / (view.m_scale * view.m_scale));
+            }
+
+            auto count = m_nodes.size();
+            auto num_chunks = (count + kGrainSize - 1) / kGrainSize;
+
+            if (m_chunk_changes.size() < num_chunks)
+                m_chunk_changes.resize(num_chunks);
+
+            auto select = [this](std::size_t begin, std::size_t end)
+            {
+                for (auto chunk = begin; chunk < end; ++chunk)
+                {
+                    auto first = chunk * kGrainSize;
+                    m_chunk_changes[chunk].clear();
+                    SelectRange(first, std::min(first + kGrainSize, m_nodes.size()), m_chunk_changes[chunk]);
+                }
+            };
+
+            if (m_pool)
+                m_pool->ParallelFor(num_chunks, 1, select);
+            else
+                select(0, num_chunks);
+
+            for (std::size_t chunk = 0; chunk < num_chunks; ++chunk)
+                changes.insert(changes.end(), m_chunk_changes[chunk].cbegin(), m_chunk_changes[chunk].cend());
+        }
+
+    private:
+        static int const kNumThresholds = LodThresholds::kMaxLevels - 1;
+        static std::uint32_t const kInvalid = 0xffffffff;
+
+        /// Squared thresholds (zeros without the parameter) of a node, its slot in packed arrays and its level
+        /// as of the time it has left the slot (the packed level is current while the node is in the slot).
+        struct Record
+        {
+            float m_thresholds[kNumThresholds];
+            std::uint32_t m_level;
+            std::uint32_t m_slot;
+        };
+
+        using RecordMap = std::unordered_map<Node const *, Record>;
+
+        /// Force reloading of the packed entry of a node keeping its level.
+        void Invalidate(Node const *node, Record &record)
+        {
+            if (record.m_slot < m_nodes.size() && m_nodes[record.m_slot] == node)
+            {
+                record.m_level = m_levels[record.m_slot];
+                m_nodes[record.m_slot] = nullptr;
+            }
+        }
+
+        /// Reload packed entries whose node differs from the one in the hierarchy.
+        std::size_t Reorder()
+        {
+            auto nodes = m_bvh.GetNodes();
+            auto count = nodes.GetSize();
+            auto padded = (count + AabbArray::kPadding - 1) / AabbArray::kPadding * AabbArray::kPadding;
+
+            // Nodes leaving their slots keep their levels in records before any slot is reloaded
+            for (std::size_t i = 0; i < m_nodes.size(); ++i)
+            {
+                if (!m_nodes[i] || (i < count && m_nodes[i] == nodes[i]))
+                    continue;
+
+                auto iter = m_records.find(m_nodes[i]);
+
+                if (iter != m_records.end())
+                    iter->second.m_level = m_levels[i];
+            }
+
+            m_nodes.resize(count, nullptr);
+            m_levels.resize(padded);
+
+            for (auto &thresholds: m_thresholds)
+                thresholds.resize(padded);
+
+            std::size_t num_reloaded = 0;
+
+            for (std::size_t i = 0; i < count; ++i)
+            {
+                if (m_nodes[i] == nodes[i])
+                    continue;
+
+                m_nodes[i] = nodes[i];
+                ++num_reloaded;
+
+                // Nodes without thresholds get a record too, so their slots are invalidated once they are deleted
+                auto iter = m_records.find(nodes[i]);
+
+                if (iter == m_records.end())
+                    iter = m_records.emplace(nodes[i], Record{{}, 0, kInvalid}).first;
+
+                iter->second.m_slot = static_cast<std::uint32_t>(i);
+                Load(i, iter->second.m_thresholds, iter->second.m_level);
+            }
+
+            // Padding never changes level
+            for (auto i = count; i < padded; ++i)
+                Load(i, nullptr, 0);
+
+            return num_reloaded;
+        }
+
+        void Load(std::size_t index, float const *thresholds, std::uint32_t level)
+        {
+            for (int k = 0; k < kNumThresholds; ++k)
+                m_thresholds[k][index] = thresholds ? thresholds[k] : 0.f;
+
+            m_levels[index] = level;
+        }
+
+        /// Select levels of nodes [begin, end), begin has to be a multiple of AabbArray::kPadding.
+        void SelectRange(std::size_t begin, std::size_t end, std::vector<LodChange> &changes)
+        {
+            auto &bounds = m_bvh.GetWorldBounds();
+            auto num_views = m_views.size() / 4;
+            auto views = m_views.data();
+            auto levels = m_levels.data();
+
+            float const *thresholds[kNumThresholds];
+
+            for (int k = 0; k < kNumThresholds; ++k)
+                thresholds[k] = m_thresholds[k].data();
+
+            float const *min[3] = {bounds.GetMin(0), bounds.GetMin(1), bounds.GetMin(2)};
+            float const *max[3] = {bounds.GetMax(0), bounds.GetMax(1), bounds.GetMax(2)};
+
+#if defined(GRAVITY_AVX)
+            std::size_t const width = 8;
+            std::uint32_t previous_levels[width];
+            auto half = _mm256_set1_ps(0.5f);
+            auto quarter = _mm256_set1_ps(0.25f);
+            auto one = _mm256_set1_ps(1.f);
+            auto coarser_scale = _mm256_set1_ps(m_coarser_scale);
+            auto finer_scale = _mm256_set1_ps(m_finer_scale);
+
+            for (auto i = begin; i < end; i += width)
+            {
+                __m256 center[3];
+                auto radius2 = _mm256_setzero_ps();
+
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    auto lo = _mm256_loadu_ps(min[axis] + i);
+                    auto hi = _mm256_loadu_ps(max[axis] + i);
+                    auto extent = _mm256_sub_ps(hi, lo);
+                    center[axis] = _mm256_mul_ps(_mm256_add_ps(lo, hi), half);
+                    radius2 = _mm256_add_ps(radius2, _mm256_mul_ps(extent, extent));
+                }
+
+                radius2 = _mm256_mul_ps(radius2, quarter);
+
+                // Squared distance over squared scale to the closest view
+                auto distance2 = _mm256_set1_ps(std::numeric_limits<float>::max());
+
+                for (std::size_t v = 0; v < num_views; ++v)
+                {
+                    auto dx = _mm256_sub_ps(center[0], _mm256_broadcast_ss(views + 4 * v));
+                    auto dy = _mm256_sub_ps(center[1], _mm256_broadcast_ss(views + 4 * v + 1));
+                    auto dz = _mm256_sub_ps(center[2], _mm256_broadcast_ss(views + 4 * v + 2));
+                    auto d = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                           _mm256_mul_ps(dz, dz));
+                    distance2 = _mm256_min_ps(distance2, _mm256_mul_ps(d, _mm256_broadcast_ss(views + 4 * v + 3)));
+                }
+
+                std::copy(levels + i, levels + i + width, previous_levels);
+                auto previous = _mm256_cvtepi32_ps(_mm256_loadu_si256(reinterpret_cast<__m256i const *>(levels + i)));
+                auto level = _mm256_setzero_ps();
+
+                for (int k = 0; k < kNumThresholds; ++k)
+                {
+                    // Nodes past the threshold use the margin towards finer levels
+                    auto coarser = _mm256_cmp_ps(previous, _mm256_set1_ps(static_cast<float>(k)), _CMP_GT_OQ);
+                    auto scale = _mm256_blendv_ps(coarser_scale, finer_scale, coarser);
+                    auto limit = _mm256_mul_ps(_mm256_mul_ps(_mm256_loadu_ps(thresholds[k] + i), distance2), scale);
+                    level = _mm256_add_ps(level, _mm256_and_ps(_mm256_cmp_ps(radius2, limit, _CMP_LT_OQ), one));
+                }
+
+                _mm256_storeu_si256(reinterpret_cast<__m256i *>(levels + i), _mm256_cvtps_epi32(level));
+                auto mask = static_cast<unsigned>(_mm256_movemask_ps(_mm256_cmp_ps(level, previous, _CMP_NEQ_OQ)));
+#elif defined(GRAVITY_SSE)
+            std::size_t const width = 4;
+            std::uint32_t previous_levels[width];
+            auto half = _mm_set1_ps(0.5f);
+            auto quarter = _mm_set1_ps(0.25f);
+            auto one = _mm_set1_ps(1.f);
+            auto coarser_scale = _mm_set1_ps(m_coarser_scale);
+            auto finer_scale = _mm_set1_ps(m_finer_scale);
+
+            for (auto i = begin; i < end; i += width)
+            {
+                __m128 center[3];
+                auto radius2 = _mm_setzero_ps();
+
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    auto lo = _mm_loadu_ps(min[axis] + i);
+                    auto hi = _mm_loadu_ps(max[axis] + i);
+                    auto extent = _mm_sub_ps(hi, lo);
+                    center[axis] = _mm_mul_ps(_mm_add_ps(lo, hi), half);
+                    radius2 = _mm_add_ps(radius2, _mm_mul_ps(extent, extent));
+                }
+
+                radius2 = _mm_mul_ps(radius2, quarter);
+
+                // Squared distance over squared scale to the closest view
+                auto distance2 = _mm_set1_ps(std::numeric_limits<float>::max());
+
+                for (std::size_t v = 0; v < num_views; ++v)
+                {
+                    auto dx = _mm_sub_ps(center[0], _mm_set1_ps(views[4 * v]));
+                    auto dy = _mm_sub_ps(center[1], _mm_set1_ps(views[4 * v + 1]));
+                    auto dz = _mm_sub_ps(center[2], _mm_set1_ps(views[4 * v + 2]));
+                    auto d = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+                    distance2 = _mm_min_ps(distance2, _mm_mul_ps(d, _mm_set1_ps(views[4 * v + 3])));
+                }
+
+                std::copy(levels + i, levels + i + width, previous_levels);
+                auto previous = _mm_cvtepi32_ps(_mm_loadu_si128(reinterpret_cast<__m128i const *>(levels + i)));
+                auto level = _mm_setzero_ps();
+
+                for (int k = 0; k < kNumThresholds; ++k)
+                {
+                    // Nodes past the threshold use the margin towards finer levels
+                    auto coarser = _mm_cmpgt_ps(previous, _mm_set1_ps(static_cast<float>(k)));
+                    auto scale = _mm_or_ps(_mm_and_ps(coarser, finer_scale), _mm_andnot_ps(coarser, coarser_scale));
+                    auto limit = _mm_mul_ps(_mm_mul_ps(_mm_loadu_ps(thresholds[k] + i), distance2), scale);
+                    level = _mm_add_ps(level, _mm_and_ps(_mm_cmplt_ps(radius2, limit), one));
+                }
+
+                _mm_storeu_si128(reinterpret_cast<__m128i *>(levels + i), _mm_cvtps_epi32(level));
+                auto mask = static_cast<unsigned>(_mm_movemask_ps(_mm_cmpneq_ps(level, previous)));
+#else
+            std::size_t const width = 1;
+            std::uint32_t previous_levels[width];
+
+            for (auto i = begin; i < end; ++i)
+            {
+                float center[3];
+                auto radius2 = 0.f;
+
+                for (int axis = 0; axis < 3; ++axis)
+                {
+                    auto extent = max[axis][i] - min[axis][i];
+                    center[axis] = (min[axis][i] + max[axis][i]) * 0.5f;
+                    radius2 += extent * extent;
+                }
+
+                radius2 *= 0.25f;
+
+                // Squared distance over squared scale to the closest view
+                auto distance2 = std::numeric_limits<float>::max();
+
+                for (std::size_t v = 0; v < num_views; ++v)
+                {
+                    auto dx = center[0] - views[4 * v];
+                    auto dy = center[1] - views[4 * v + 1];
+                    auto dz = center[2] - views[4 * v + 2];
+                    distance2 = std::min(distance2, (dx * dx + dy * dy + dz * dz) * views[4 * v + 3]);
+                }
+
+                previous_levels[0] = levels[i];
+                std::uint32_t level = 0;
+
+                for (int k = 0; k < kNumThresholds; ++k)
+                {
+                    // Nodes past the threshold use the margin towards finer levels
+                    auto scale = previous_levels[0] > static_cast<std::uint32_t>(k) ? m_finer_scale : m_coarser_scale;
+                    level += radius2 < thresholds[k][i] * distance2 * scale ? 1 : 0;
+                }
+
+                levels[i] = level;
+                unsigned mask = level != previous_levels[0] ? 1 : 0;
+#endif
+                // Drop lanes past the end (padding)
+                if (end - i < width)
+                    mask &= (1u << (end - i)) - 1;
+
+                for (std::size_t lane = 0; mask; ++lane, mask >>= 1)
+                {
+                    if (mask & 1u)
+                        changes.push_back(LodChange{m_nodes[i + lane], levels[i + lane], previous_levels[lane]});
+                }
+            }
+        }
+
+        /// Scene graph and hierarchy
+        SceneGraph &m_sg;
+        Bvh const &m_bvh;
+        /// Parameter holding thresholds
+        Key m_key;
+        /// Task pool or nullptr
+        TaskPool *m_pool;
+        /// Squared hysteresis scales of thresholds
+        float m_coarser_scale;
+        float m_finer_scale;
+        /// Poller of scene changes
+        typename SceneGraph::ChangePoller m_poller;
+        /// Changes since the last update
+        typename SceneGraph::ChangeLog m_changes;
+        /// Records of nodes of the hierarchy and of nodes having thresholds
+        RecordMap m_records;
+        /// Packed arrays in the order of the hierarchy: nodes, levels and squared thresholds (padded)
+        std::vector<Node *> m_nodes;
+        std::vector<std::uint32_t> m_levels;
+        std::vector<float> m_thresholds[kNumThresholds];
+        /// Positions and inverse squared scales of views
+        std::vector<float> m_views;
+        /// Changes of chunks
+        std::vector<std::vector<LodChange>> m_chunk_changes;
+    };
+
+    template<typename SceneGraph>
+    std::size_t const LodSelector<SceneGraph>::kGrainSize;
+
+    template<typename SceneGraph>
+    std::uint32_t const LodSelector<SceneGraph>::kInvalid;
+
+    using DefaultLodSelector = LodSelector<DefaultSceneGraph>;
+}
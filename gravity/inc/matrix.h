@@ -0,0 +1,172 @@
+/**
+    \file matrix.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing vector and matrix types used by Gravity transform system.
+
+    Matrix products are vectorized with AVX or SSE depending on the instruction sets enabled at compile time,
+    scalar code is used otherwise or if DISABLE_SIMD is defined.
+ */
+#pragma once
+
+#include <cstddef>
+
+#ifndef DISABLE_SIMD
+#if defined(__AVX__)
+#define GRAVITY_AVX
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define GRAVITY_SSE
+#include <emmintrin.h>
+#endif
+#endif
+
+namespace Gravity
+{
+    /// Three component vector.
+    struct Vector3
+    {
+        float m_x;
+        float m_y;
+        float m_z;
+    };
+
+    /// Rotation quaternion (m_w is the scalar part).
+    struct Quaternion
+    {
+        float m_x;
+        float m_y;
+        float m_z;
+        float m_w;
+    };
+
+    /// Column-major 4x4 matrix: m_data[column * 4 + row].
+    struct alignas(16) Matrix4
+    {
+        float m_data[16];
+
+        /// Return identity matrix.
+        static Matrix4 Identity()
+        {
+            return Matrix4{{1.f, 0.f, 0.f, 0.f,
+                            0.f, 1.f, 0.f, 0.f,
+                            0.f, 0.f, 1.f, 0.f,
+                            0.f, 0.f, 0.f, 1.f}};
+        }
+
+        /// Return translation matrix.
+        static Matrix4 Translation(Vector3 const &t)
+        {
+            return Matrix4{{1.f, 0.f, 0.f, 0.f,
+                            0.f, 1.f, 0.f, 0.f,
+                            0.f, 0.f, 1.f, 0.f,
+                            t.m_x, t.m_y, t.m_z, 1.f}};
+        }
+
+        /// Transform a point.
+        Vector3 TransformPoint(Vector3 const &p) const
+        {
+            return Vector3{m_data[0] * p.m_x + m_data[4] * p.m_y + m_data[8] * p.m_z + m_data[12],
+                           m_data[1] * p.m_x + m_data[5] * p.m_y + m_data[9] * p.m_z + m_data[13],
+                           m_data[2] * p.m_x + m_data[6] * p.m_y + m_data[10] * p.m_z + m_data[14]};
+        }
+    };
+
+    /// Translation, rotation and scale applied in the order scale, rotation, translation.
+    struct Trs
+    {
+        Vector3 m_translation;
+        Quaternion m_rotation;
+        Vector3 m_scale;
+
+        /// Return the matrix of the transform.
+        Matrix4 ToMatrix() const
+        {
+            auto &q = m_rotation;
+            auto &s = m_scale;
+
+            auto xx = q.m_x * q.m_x, yy = q.m_y * q.m_y, zz = q.m_z * q.m_z;
+            auto xy = q.m_x * q.m_y, xz = q.m_x * q.m_z, yz = q.m_y * q.m_z;
+            auto wx = q.m_w * q.m_x, wy = q.m_w * q.m_y, wz = q.m_w * q.m_z;
+
+            return Matrix4{{(1.f - 2.f * (yy + zz)) * s.m_x, 2.f * (xy + wz) * s.m_x, 2.f * (xz - wy) * s.m_x, 0.f,
+                            2.f * (xy - wz) * s.m_y, (1.f - 2.f * (xx + zz)) * s.m_y, 2.f * (yz + wx) * s.m_y, 0.f,
+                            2.f * (xz + wy) * s.m_z, 2.f * (yz - wx) * s.m_z, (1.f - 2.f * (xx + yy)) * s.m_z, 0.f,
+                            m_translation.m_x, m_translation.m_y, m_translation.m_z, 1.f}};
+        }
+    };
+
+    /// \brief Compute a * b.
+    /// \details out may alias b but not a.
+    inline void Multiply(Matrix4 const &a, Matrix4 const &b, Matrix4 &out)
+    {
+#if defined(GRAVITY_AVX)
+        // Each half of a register computes one column of the result
+        auto a0 = _mm256_broadcast_ps(reinterpret_cast<__m128 const *>(a.m_data));
+        auto a1 = _mm256_broadcast_ps(reinterpret_cast<__m128 const *>(a.m_data + 4));
+        auto a2 = _mm256_broadcast_ps(reinterpret_cast<__m128 const *>(a.m_data + 8));
+        auto a3 = _mm256_broadcast_ps(reinterpret_cast<__m128 const *>(a.m_data + 12));
+
+        for (int column = 0; column < 4; column += 2)
+        {
+            auto b01 = _mm256_loadu_ps(b.m_data + column * 4);
+            auto r = _mm256_mul_ps(a0, _mm256_shuffle_ps(b01, b01, 0x00));
+            r = _mm256_add_ps(r, _mm256_mul_ps(a1, _mm256_shuffle_ps(b01, b01, 0x55)));
+            r = _mm256_add_ps(r, _mm256_mul_ps(a2, _mm256_shuffle_ps(b01, b01, 0xaa)));
+            r = _mm256_add_ps(r, _mm256_mul_ps(a3, _mm256_shuffle_ps(b01, b01, 0xff)));
+            _mm256_storeu_ps(out.m_data + column * 4, r);
+        }
+#elif defined(GRAVITY_SSE)
+        auto a0 = _mm_loadu_ps(a.m_data);
+        auto a1 = _mm_loadu_ps(a.m_data + 4);
+        auto a2 = _mm_loadu_ps(a.m_data + 8);
+        auto a3 = _mm_loadu_ps(a.m_data + 12);
+
+        for (int column = 0; column < 4; ++column)
+        {
+            auto bc = _mm_loadu_ps(b.m_data + column * 4);
+            auto r = _mm_mul_ps(a0, _mm_shuffle_ps(bc, bc, 0x00));
+            r = _mm_add_ps(r, _mm_mul_ps(a1, _mm_shuffle_ps(bc, bc, 0x55)));
+            r = _mm_add_ps(r, _mm_mul_ps(a2, _mm_shuffle_ps(bc, bc, 0xaa)));
+            r = _mm_add_ps(r, _mm_mul_ps(a3, _mm_shuffle_ps(bc, bc, 0xff)));
+            _mm_storeu_ps(out.m_data + column * 4, r);
+        }
+#else
+        for (int column = 0; column < 4; ++column)
+        {
+            float b0 = b.m_data[column * 4], b1 = b.m_data[column * 4 + 1];
+            float b2 = b.m_data[column * 4 + 2], b3 = b.m_data[column * 4 + 3];
+
+            for (int row = 0; row < 4; ++row)
+            {
+                out.m_data[column * 4 + row] = a.m_data[row] * b0 + a.m_data[4 + row] * b1 +
+                                               a.m_data[8 + row] * b2 + a.m_data[12 + row] * b3;
+            }
+        }
+#endif
+    }
+
+    /// Return a * b.
+    inline Matrix4 operator*(Matrix4 const &a, Matrix4 const &b)
+    {
+        Matrix4 out;
+        Multiply(a, b, out);
+        return out;
+    }
+
+    /// \brief Compute world matrices of nodes [begin, end) of a flattened hierarchy.
+    /// \details Parents have to precede their children, world matrices of parents outside of the range have to
+    /// be up to date. Roots have parent index no_parent and their world matrix equals the local one.
+    inline void ComputeWorldMatrices(Matrix4 const *local, std::size_t const *parents, std::size_t no_parent,
+                                     std::size_t begin, std::size_t end, Matrix4 *world)
+    {
+        for (auto index = begin; index < end; ++index)
+        {
+            if (parents[index] == no_parent)
+                world[index] = local[index];
+            else
+                Multiply(world[parents[index]], local[index], world[index]);
+        }
+    }
+}
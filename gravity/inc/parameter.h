@@ -12,9 +12,26 @@
 #include <iostream>
 #include <stdexcept>
 #include <typeindex>
+#include <type_traits>
+#include <utility>
 
 namespace Gravity
 {
+    /**
+        \brief Lightweight type identifier which does not require RTTI.
+
+        Each type gets a unique address of a static variable.
+     */
+    template<typename T>
+    struct TypeId
+    {
+        static void const *Get()
+        {
+            static char const id = 0;
+            return &id;
+        }
+    };
+
     /**
         \brief Interface for type-erasure mechanism.
 
@@ -28,6 +45,13 @@ namespace Gravity
         /// Create a copy of an object.
         virtual Placeholder *Clone() = 0;
 
+        /// Return identifier of an underlying value type.
+        virtual void const *GetTypeId() const = 0;
+
+        /// \brief Copy the value of a placeholder of the same type into this one without reallocation.
+        /// \return false if the value type is not copy assignable.
+        virtual bool AssignFrom(Placeholder const &rhs) = 0;
+
 #ifdef ENABLE_TYPE_LOCK
         /// Return type index of an underlying value.
         /// Requires RTTI.
@@ -62,6 +86,18 @@ namespace Gravity
             return new Holder<T>(m_value);
         }
 
+        /// Return identifier of an underlying value type.
+        void const *GetTypeId() const override
+        {
+            return TypeId<T>::Get();
+        }
+
+        /// Copy the value of a holder of the same type.
+        bool AssignFrom(Placeholder const &rhs) override
+        {
+            return Assign(static_cast<Holder const &>(rhs).m_value, std::is_copy_assignable<T>());
+        }
+
 #ifdef ENABLE_TYPE_LOCK
         /// Return type index of an underlying value.
         /// Requires RTTI.
@@ -72,6 +108,18 @@ namespace Gravity
 #endif
 
         T m_value;
+
+    private:
+        bool Assign(T const &value, std::true_type)
+        {
+            m_value = value;
+            return true;
+        }
+
+        bool Assign(T const &, std::false_type)
+        {
+            return false;
+        }
     };
 
     /**
@@ -102,6 +150,16 @@ namespace Gravity
             m_placeholder = rhs.m_placeholder ? rhs.m_placeholder->Clone() : nullptr;
         }
 
+        /// Take over the value of another parameter.
+        Parameter(Parameter &&rhs)
+                : m_placeholder(rhs.m_placeholder)
+#ifdef ENABLE_TYPE_LOCK
+        , m_type_lock(rhs.m_type_lock)
+#endif
+        {
+            rhs.m_placeholder = nullptr;
+        }
+
         /// Construct from arbitrary value (only enabled for non-derived types, otherwise it masks copy ctor).
         template<typename T, typename = typename std::enable_if<!std::is_base_of<
                 Parameter,
@@ -124,7 +182,16 @@ namespace Gravity
             if (m_type_lock && m_placeholder && (m_placeholder->GetTypeIndex() != std::type_index(typeid(typename std::decay<T>::type))))
                 throw std::bad_cast();
 #endif
-            Placeholder *holder = new Holder<typename std::decay<T>::type>(std::forward<T>(val));
+            using MyType = typename std::decay<T>::type;
+
+            // Assigning the value of the same type does not need a new holder
+            if (m_placeholder && m_placeholder->GetTypeId() == TypeId<MyType>::Get())
+            {
+                AssignInPlace(std::forward<T>(val), std::is_assignable<MyType &, T &&>());
+                return *this;
+            }
+
+            Placeholder *holder = new Holder<MyType>(std::forward<T>(val));
 
             std::swap(m_placeholder, holder);
 
@@ -140,6 +207,12 @@ namespace Gravity
                 || (m_placeholder && !rhs.m_placeholder))
                 throw std::bad_cast();
 #endif
+            // Copying the value of the same type does not need a new holder
+            if (this == &rhs || (m_placeholder && rhs.m_placeholder &&
+                                 m_placeholder->GetTypeId() == rhs.m_placeholder->GetTypeId() &&
+                                 m_placeholder->AssignFrom(*rhs.m_placeholder)))
+                return *this;
+
             auto holder = rhs.m_placeholder ? rhs.m_placeholder->Clone() : nullptr;
 
             std::swap(m_placeholder, holder);
@@ -149,6 +222,26 @@ namespace Gravity
             return *this;
         }
 
+        /// Take over the value of another parameter (no copy is made).
+        Parameter &operator=(Parameter &&rhs)
+        {
+#ifdef ENABLE_TYPE_LOCK
+            if ((m_type_lock && (m_placeholder && rhs.m_placeholder && (rhs.m_placeholder->GetTypeIndex() != m_placeholder->GetTypeIndex())))
+                || (m_placeholder && !rhs.m_placeholder))
+                throw std::bad_cast();
+#endif
+            if (this != &rhs)
+            {
+                delete m_placeholder;
+
+                m_placeholder = rhs.m_placeholder;
+
+                rhs.m_placeholder = nullptr;
+            }
+
+            return *this;
+        }
+
         ~Parameter()
         {
             delete m_placeholder;
@@ -172,6 +265,13 @@ namespace Gravity
             return holder->m_value;
         }
 
+        /// Cast to a type T (see As() above).
+        template<typename T>
+        typename std::decay<T>::type const &As() const
+        {
+            return const_cast<Parameter *>(this)->As<T>();
+        }
+
 #ifdef ENABLE_TYPE_LOCK
         /// Lock the type of the parameter, meaning you can't assign value of a different type
         /// compared to the one currently kept.
@@ -182,6 +282,24 @@ namespace Gravity
 #endif
 
     private:
+        /// Assign the value to the existing holder of the same type.
+        template<typename T>
+        void AssignInPlace(T &&val, std::true_type)
+        {
+            static_cast<Holder<typename std::decay<T>::type> *>(m_placeholder)->m_value = std::forward<T>(val);
+        }
+
+        /// Replace the holder if the type is not assignable.
+        template<typename T>
+        void AssignInPlace(T &&val, std::false_type)
+        {
+            Placeholder *holder = new Holder<typename std::decay<T>::type>(std::forward<T>(val));
+
+            std::swap(m_placeholder, holder);
+
+            delete holder;
+        }
+
         /// Value placeholder
         Placeholder *m_placeholder;
 
@@ -0,0 +1,247 @@
+/**
+    \file persistent_array.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing persistent sparse array used for scene graph snapshots.
+
+    The array is a 32-way radix tree of immutable blocks. Copying the array takes constant time and shares all
+    the blocks, modifying it copies only the blocks on the path to the modified element.
+ */
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+namespace Gravity
+{
+    /**
+        \brief Persistent sparse array of nullable values.
+
+        PersistentArray itself is immutable. Modified versions are produced by Builder, which copies every
+        shared block it touches once and then modifies its own copies in place, so a batch of n modifications
+        costs O(n log32 size). Values have to be default constructible and convertible to bool, default
+        constructed (false) values mark empty elements.
+     */
+    template<typename T>
+    class PersistentArray
+    {
+    public:
+        /// Number of bits of an index resolved at each level of the tree.
+        static std::size_t const kBits = 5;
+        /// Number of children of a block.
+        static std::size_t const kWidth = std::size_t(1) << kBits;
+
+        /// Create an empty array.
+        PersistentArray()
+                : m_levels(1), m_size(0)
+        {
+        }
+
+        /// Return the number of non-empty elements.
+        std::size_t GetSize() const
+        { return m_size; }
+
+        /// Return the element at a given index (empty value if there is none).
+        T const &Get(std::size_t index) const
+        {
+            static T const empty = T();
+
+            if (!m_root || index >= GetCapacity(m_levels))
+                return empty;
+
+            auto block = m_root.get();
+
+            for (auto level = m_levels - 1; level > 0; --level)
+            {
+                block = block->m_children[(index >> (level * kBits)) & (kWidth - 1)].get();
+
+                if (!block)
+                    return empty;
+            }
+
+            return block->m_values[index & (kWidth - 1)];
+        }
+
+        /// Invoke a functor with the index and the value of every non-empty element in index order.
+        template<typename Visitor>
+        void ForEach(Visitor &&visitor) const
+        {
+            if (m_root)
+                Visit(*m_root, m_levels - 1, 0, visitor);
+        }
+
+    private:
+        /// Tree block: inner blocks have children, leaves have values.
+        struct Block
+        {
+            Block(std::uint64_t edit, bool inner)
+                    : m_edit(edit)
+            {
+                if (inner)
+                    m_children.resize(kWidth);
+                else
+                    m_values.resize(kWidth);
+            }
+
+            Block(Block const &rhs, std::uint64_t edit)
+                    : m_edit(edit), m_children(rhs.m_children), m_values(rhs.m_values)
+            {
+            }
+
+            /// Edit number of the builder which created the block
+            std::uint64_t m_edit;
+            /// Children
+            std::vector<std::shared_ptr<Block>> m_children;
+            /// Values
+            std::vector<T> m_values;
+        };
+
+    public:
+        /**
+            \brief Produces a modified copy of an array.
+
+            Blocks copied by the builder are tagged with its unique edit number, which is how it knows they are
+            not shared with any published array and can be modified in place.
+         */
+        class Builder
+        {
+        public:
+            explicit Builder(PersistentArray const &base)
+                    : m_root(base.m_root), m_levels(base.m_levels), m_size(base.m_size), m_edit(GetNextEdit())
+            {
+            }
+
+            /// Set the element at a given index.
+            void Set(std::size_t index, T value)
+            {
+                auto &slot = GetSlot(index);
+
+                m_size += static_cast<bool>(value) - static_cast<bool>(slot);
+                slot = std::move(value);
+            }
+
+            /// Clear the element at a given index.
+            void Erase(std::size_t index)
+            {
+                // Avoid copying blocks if there is nothing to erase
+                if (!Find(index))
+                    return;
+
+                auto &slot = GetSlot(index);
+                slot = T();
+                --m_size;
+            }
+
+            /// Return the array (the builder can keep modifying its own copy afterwards).
+            PersistentArray Build()
+            {
+                PersistentArray result;
+                result.m_root = m_root;
+                result.m_levels = m_levels;
+                result.m_size = m_size;
+
+                // Published blocks must not be modified anymore
+                m_edit = GetNextEdit();
+
+                return result;
+            }
+
+        private:
+            /// Check if there is a non-empty element at a given index.
+            bool Find(std::size_t index) const
+            {
+                PersistentArray array;
+                array.m_root = m_root;
+                array.m_levels = m_levels;
+                return static_cast<bool>(array.Get(index));
+            }
+
+            /// Return writable element at a given index, copying shared blocks on the way.
+            T &GetSlot(std::size_t index)
+            {
+                // Add levels on top until the index fits
+                while (index >= GetCapacity(m_levels))
+                {
+                    std::shared_ptr<Block> root(new Block(m_edit, true));
+                    root->m_children[0] = std::move(m_root);
+                    m_root = std::move(root);
+                    ++m_levels;
+                }
+
+                auto block = MakeWritable(m_root, m_levels == 1);
+
+                for (auto level = m_levels - 1; level > 0; --level)
+                {
+                    block = MakeWritable(block->m_children[(index >> (level * kBits)) & (kWidth - 1)], level == 1);
+                }
+
+                return block->m_values[index & (kWidth - 1)];
+            }
+
+            /// Make sure the block is owned by the builder.
+            Block *MakeWritable(std::shared_ptr<Block> &block, bool leaf)
+            {
+                if (!block)
+                    block.reset(new Block(m_edit, !leaf));
+                else if (block->m_edit != m_edit)
+                    block.reset(new Block(*block, m_edit));
+
+                return block.get();
+            }
+
+            /// Root block
+            std::shared_ptr<Block> m_root;
+            /// Number of levels
+            std::size_t m_levels;
+            /// Number of non-empty elements
+            std::size_t m_size;
+            /// Edit number of blocks owned by the builder
+            std::uint64_t m_edit;
+        };
+
+    private:
+        /// Return the number of elements a tree of a given height can hold.
+        static std::size_t GetCapacity(std::size_t levels)
+        {
+            return levels * kBits >= sizeof(std::size_t) * 8 ? ~std::size_t(0) : std::size_t(1) << (levels * kBits);
+        }
+
+        /// Return unique edit number.
+        static std::uint64_t GetNextEdit()
+        {
+            static std::atomic<std::uint64_t> edit(0);
+            return ++edit;
+        }
+
+        template<typename Visitor>
+        static void Visit(Block const &block, std::size_t level, std::size_t base, Visitor &visitor)
+        {
+            if (level == 0)
+            {
+                for (std::size_t i = 0; i < kWidth; ++i)
+                {
+                    if (block.m_values[i])
+                        visitor(base + i, block.m_values[i]);
+                }
+
+                return;
+            }
+
+            for (std::size_t i = 0; i < kWidth; ++i)
+            {
+                if (block.m_children[i])
+                    Visit(*block.m_children[i], level - 1, base + (i << (level * kBits)), visitor);
+            }
+        }
+
+        /// Root block
+        std::shared_ptr<Block> m_root;
+        /// Number of levels
+        std::size_t m_levels;
+        /// Number of non-empty elements
+        std::size_t m_size;
+    };
+}
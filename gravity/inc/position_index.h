@@ -0,0 +1,581 @@
+/**
+    \file position_index.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing spatial index over positions of Gravity scene graph nodes.
+
+    The index is a hashed uniform grid: nodes are bucketed by the cell their position falls into and only
+    cells overlapping a query are visited. Moving a node within its cell does not touch the grid.
+ */
+#pragma once
+
+#include "callback_list.h"
+#include "matrix.h"
+#include "sg.h"
+#include "span.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <set>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+namespace Gravity
+{
+    /**
+        \brief Spatial index answering radius and k nearest neighbour queries over node positions.
+
+        Positions are kept in a designated parameter of type Vector3 in world space. Update() applies changes
+        made since the previous update, its cost is proportional to the number of created, deleted and moved
+        nodes.
+
+        Queries visit grid cells around the query point, a cell size of about twice the typical query radius
+        keeps the number of cells visited low. They reflect the state as of the last update and can run concurrently
+        with each other, batched queries run in parallel given a task pool.
+     */
+    template<typename SceneGraph>
+    class PositionIndex
+    {
+    public:
+        using Key = typename SceneGraph::KeyType;
+        using Node = typename SceneGraph::Node;
+        using NodeType = typename SceneGraph::NodeTypeType;
+
+        /// Number of batched queries run by a task.
+        static std::size_t const kGrainSize = 64;
+
+        /// Node found by a query and its distance to the query point.
+        struct Neighbour
+        {
+            Node *m_node;
+            float m_distance;
+        };
+
+        /// Results of a batch of queries (buffers are reused by subsequent batches).
+        class BatchResult
+        {
+        public:
+            /// Return the number of queries.
+            std::size_t GetSize() const
+            { return m_offsets.empty() ? 0 : m_offsets.size() - 1; }
+
+            /// Return neighbours found by a query.
+            Span<Neighbour const> Get(std::size_t query) const
+            {
+                return Span<Neighbour const>(m_neighbours.data() + m_offsets[query],
+                                             m_offsets[query + 1] - m_offsets[query]);
+            }
+
+        private:
+            friend class PositionIndex;
+
+            /// Neighbours of all queries, query i owns [m_offsets[i], m_offsets[i + 1])
+            std::vector<Neighbour> m_neighbours;
+            std::vector<std::size_t> m_offsets;
+            /// Neighbours found by parallel tasks
+            std::vector<std::vector<Neighbour>> m_chunks;
+        };
+
+        /// \brief Create the index over nodes having a given position parameter.
+        /// \param cell_size Size of grid cells, std::runtime_error is thrown if it is not positive.
+        /// \param pool Task pool running batched queries in parallel or nullptr to run them on the calling thread.
+        PositionIndex(SceneGraph &sg, Key const &key, float cell_size, TaskPool *pool = nullptr)
+                : m_sg(sg), m_key(key), m_cell_size(cell_size), m_pool(pool), m_poller(sg)
+        {
+            if (!(cell_size > 0.f))
+                throw std::runtime_error("Cell size has to be positive");
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                m_min_cell[axis] = std::numeric_limits<std::int32_t>::max();
+                m_max_cell[axis] = std::numeric_limits<std::int32_t>::min();
+            }
+        }
+
+        PositionIndex(PositionIndex const &) = delete;
+
+        PositionIndex &operator=(PositionIndex const &) = delete;
+
+        /// Return the number of nodes in the index.
+        std::size_t GetSize() const
+        { return m_objects.size(); }
+
+        /// Check if a node is in the index.
+        bool Contains(Node const *node) const
+        { return m_index.find(node) != m_index.cend(); }
+
+        /// \brief Apply scene changes made since the previous update.
+        /// \details Meant to be called by the writer between frames, it must not run concurrently with changes of
+        /// the scene structure or with queries.
+        /// \return The number of nodes added, removed or moved.
+        std::size_t Update()
+        {
+            m_poller.Collect(m_changes);
+
+            std::size_t num_changed = 0;
+
+            // Deletions go first, addresses of deleted nodes might have been reused by created ones
+            for (auto node: m_changes.m_deleted)
+            {
+                auto iter = m_index.find(node);
+
+                if (iter != m_index.cend())
+                {
+                    RemoveObject(iter->second);
+                    ++num_changed;
+                }
+            }
+
+            for (auto &change: m_changes.m_nodes)
+            {
+                auto node = change.m_node;
+
+                if (change.m_created)
+                {
+                    if (node->HasValue(m_key))
+                    {
+                        AddObject(node);
+                        ++num_changed;
+                    }
+
+                    continue;
+                }
+
+                for (auto &key: m_changes.GetChangeSet(change))
+                {
+                    if (!(key == m_key))
+                        continue;
+
+                    auto iter = m_index.find(node);
+
+                    if (iter != m_index.cend())
+                    {
+                        MoveObject(iter->second, node->template GetValue<Vector3>(m_key));
+                        ++num_changed;
+                    }
+                }
+            }
+
+            return num_changed;
+        }
+
+        /// \brief Find nodes within a radius of a point.
+        /// \param result Receives the nodes in no particular order, it is cleared first.
+        /// \param types Types of nodes to find or empty set to find nodes of all types.
+        void FindInRadius(Vector3 const &center, float radius, std::vector<Neighbour> &result,
+                          std::set<NodeType> const &types = {}) const
+        {
+            result.clear();
+            AppendInRadius(center, radius, TypeFilter<NodeType>(types), result);
+        }
+
+        /// \brief Find up to k nodes nearest to a point.
+        /// \param result Receives the nodes nearest first, it is cleared first.
+        /// \param types Types of nodes to find or empty set to find nodes of all types.
+        void FindNearest(Vector3 const &center, std::size_t k, std::vector<Neighbour> &result,
+                         std::set<NodeType> const &types = {}) const
+        {
+            result.clear();
+            AppendNearest(center, k, TypeFilter<NodeType>(types), result);
+        }
+
+        /// Run FindInRadius for a batch of points.
+        void FindInRadius(Span<Vector3 const> centers, float radius, BatchResult &result,
+                          std::set<NodeType> const &types = {}) const
+        {
+            TypeFilter<NodeType> const filter(types);
+
+            RunBatch(centers.GetSize(), result, [&](std::size_t query, std::vector<Neighbour> &out)
+            { AppendInRadius(centers[query], radius, filter, out); });
+        }
+
+        /// Run FindNearest for a batch of points.
+        void FindNearest(Span<Vector3 const> centers, std::size_t k, BatchResult &result,
+                         std::set<NodeType> const &types = {}) const
+        {
+            TypeFilter<NodeType> const filter(types);
+
+            RunBatch(centers.GetSize(), result, [&](std::size_t query, std::vector<Neighbour> &out)
+            { AppendNearest(centers[query], k, filter, out); });
+        }
+
+    private:
+        /// Node in a cell.
+        struct Entry
+        {
+            Vector3 m_position;
+            Node *m_node;
+            NodeType m_type;
+            std::uint32_t m_object;
+        };
+
+        /// Cell of a node and the index of its entry there.
+        struct Object
+        {
+            std::uint64_t m_cell;
+            std::uint32_t m_slot;
+        };
+
+        using Cell = std::vector<Entry>;
+
+        /// Return the cell coordinate of a position coordinate.
+        std::int32_t GetCellCoordinate(float x) const
+        { return static_cast<std::int32_t>(std::floor(x / m_cell_size)); }
+
+        /// \brief Return the hash key of a cell.
+        /// \details Coordinates are wrapped to 21 bits, far apart cells sharing a key only cost extra distance tests.
+        static std::uint64_t GetCellKey(std::int32_t x, std::int32_t y, std::int32_t z)
+        {
+            auto wrap = [](std::int32_t c)
+            { return static_cast<std::uint64_t>(static_cast<std::uint32_t>(c) & 0x1fffffu); };
+
+            return (wrap(x) << 42) | (wrap(y) << 21) | wrap(z);
+        }
+
+        std::uint64_t GetCellKey(Vector3 const &p) const
+        { return GetCellKey(GetCellCoordinate(p.m_x), GetCellCoordinate(p.m_y), GetCellCoordinate(p.m_z)); }
+
+        /// Add a node to the cell of a position.
+        void AddObject(Node *node)
+        {
+            auto index = static_cast<std::uint32_t>(m_objects.size());
+            m_objects.push_back(Object());
+            m_index.emplace(node, index);
+            Insert(index, Entry{node->template GetValue<Vector3>(m_key), node, node->GetType(), index});
+        }
+
+        /// Remove a node, the last object takes its index.
+        void RemoveObject(std::uint32_t index)
+        {
+            auto entry = Erase(index);
+            m_index.erase(entry.m_node);
+
+            if (index + 1 != m_objects.size())
+            {
+                auto last = static_cast<std::uint32_t>(m_objects.size() - 1);
+                m_objects[index] = m_objects[last];
+
+                auto &moved = m_cells[m_objects[index].m_cell][m_objects[index].m_slot];
+                moved.m_object = index;
+                m_index[moved.m_node] = index;
+            }
+
+            m_objects.pop_back();
+        }
+
+        /// Update the position of a node moving it to another cell if needed.
+        void MoveObject(std::uint32_t index, Vector3 const &position)
+        {
+            auto &object = m_objects[index];
+
+            if (GetCellKey(position) == object.m_cell)
+            {
+                m_cells[object.m_cell][object.m_slot].m_position = position;
+                return;
+            }
+
+            auto entry = Erase(index);
+            entry.m_position = position;
+            Insert(index, entry);
+        }
+
+        void Insert(std::uint32_t index, Entry const &entry)
+        {
+            auto &p = entry.m_position;
+            std::int32_t cell[3] = {GetCellCoordinate(p.m_x), GetCellCoordinate(p.m_y), GetCellCoordinate(p.m_z)};
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                m_min_cell[axis] = std::min(m_min_cell[axis], cell[axis]);
+                m_max_cell[axis] = std::max(m_max_cell[axis], cell[axis]);
+            }
+
+            auto key = GetCellKey(cell[0], cell[1], cell[2]);
+            auto &entries = m_cells[key];
+            m_objects[index] = Object{key, static_cast<std::uint32_t>(entries.size())};
+            entries.push_back(entry);
+        }
+
+        /// Take the entry of an object out of its cell, the last entry of the cell takes its slot.
+        Entry Erase(std::uint32_t index)
+        {
+            auto &object = m_objects[index];
+            auto iter = m_cells.find(object.m_cell);
+            auto &entries = iter->second;
+            auto entry = entries[object.m_slot];
+
+            if (object.m_slot + 1 != entries.size())
+            {
+                entries[object.m_slot] = entries.back();
+                m_objects[entries[object.m_slot].m_object].m_slot = object.m_slot;
+            }
+
+            entries.pop_back();
+
+            if (entries.empty())
+                m_cells.erase(iter);
+
+            return entry;
+        }
+
+        static float GetDistanceSq(Vector3 const &a, Vector3 const &b)
+        {
+            auto dx = a.m_x - b.m_x, dy = a.m_y - b.m_y, dz = a.m_z - b.m_z;
+            return dx * dx + dy * dy + dz * dz;
+        }
+
+        /// Call visitor(entry, squared distance) for entries of a cell passing the type filter.
+        template<typename Visitor>
+        void VisitCell(std::int32_t x, std::int32_t y, std::int32_t z, Vector3 const &center,
+                       TypeFilter<NodeType> const &filter, Visitor &&visitor) const
+        {
+            auto iter = m_cells.find(GetCellKey(x, y, z));
+
+            if (iter == m_cells.cend())
+                return;
+
+            for (auto &entry: iter->second)
+            {
+                if (filter.Matches(entry.m_type))
+                    visitor(entry, GetDistanceSq(entry.m_position, center));
+            }
+        }
+
+        void AppendInRadius(Vector3 const &center, float radius, TypeFilter<NodeType> const &filter,
+                            std::vector<Neighbour> &out) const
+        {
+            if (m_objects.empty() || radius < 0.f)
+                return;
+
+            auto radius_sq = radius * radius;
+            auto visitor = [&out, radius_sq](Entry const &entry, float distance_sq)
+            {
+                if (distance_sq <= radius_sq)
+                    out.push_back(Neighbour{entry.m_node, std::sqrt(distance_sq)});
+            };
+
+            float const c[3] = {center.m_x, center.m_y, center.m_z};
+            std::int32_t first[3], last[3];
+            double num_cells = 1.0;
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                first[axis] = std::max(GetCellCoordinateClamped(c[axis] - radius), m_min_cell[axis]);
+                last[axis] = std::min(GetCellCoordinateClamped(c[axis] + radius), m_max_cell[axis]);
+
+                if (first[axis] > last[axis])
+                    return;
+
+                num_cells *= static_cast<double>(last[axis]) - first[axis] + 1;
+            }
+
+            // Large radii are cheaper to answer scanning occupied cells
+            if (num_cells > static_cast<double>(m_cells.size()))
+            {
+                for (auto &cell: m_cells)
+                {
+                    for (auto &entry: cell.second)
+                    {
+                        if (filter.Matches(entry.m_type))
+                            visitor(entry, GetDistanceSq(entry.m_position, center));
+                    }
+                }
+
+                return;
+            }
+
+            for (auto z = first[2]; z <= last[2]; ++z)
+            {
+                for (auto y = first[1]; y <= last[1]; ++y)
+                {
+                    for (auto x = first[0]; x <= last[0]; ++x)
+                        VisitCell(x, y, z, center, filter, visitor);
+                }
+            }
+        }
+
+        /// \brief Append up to k nearest nodes sorted by distance.
+        /// \details Visits rings of cells around the cell of the point until the k-th nearest node found is closer
+        /// than any unvisited cell.
+        void AppendNearest(Vector3 const &center, std::size_t k, TypeFilter<NodeType> const &filter,
+                           std::vector<Neighbour> &out) const
+        {
+            if (m_objects.empty() || k == 0)
+                return;
+
+            // out[begin, end) is a max-heap of squared distances
+            auto begin = out.size();
+            auto farther = [](Neighbour const &a, Neighbour const &b)
+            { return a.m_distance < b.m_distance; };
+
+            auto visitor = [&](Entry const &entry, float distance_sq)
+            {
+                if (out.size() - begin < k)
+                {
+                    out.push_back(Neighbour{entry.m_node, distance_sq});
+                    std::push_heap(out.begin() + begin, out.end(), farther);
+                }
+                else if (distance_sq < out[begin].m_distance)
+                {
+                    std::pop_heap(out.begin() + begin, out.end(), farther);
+                    out.back() = Neighbour{entry.m_node, distance_sq};
+                    std::push_heap(out.begin() + begin, out.end(), farther);
+                }
+            };
+
+            std::int32_t cx = GetCellCoordinate(center.m_x), cy = GetCellCoordinate(center.m_y);
+            std::int32_t cz = GetCellCoordinate(center.m_z);
+            std::int32_t const c[3] = {cx, cy, cz};
+
+            // Distance from the point to the nearest face of its cell
+            auto margin = m_cell_size;
+            float const p[3] = {center.m_x, center.m_y, center.m_z};
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                auto low = p[axis] - static_cast<float>(c[axis]) * m_cell_size;
+                margin = std::min(margin, std::max(std::min(low, m_cell_size - low), 0.f));
+            }
+
+            // Rings beyond this one hold no cells
+            std::int64_t max_ring = 0;
+
+            for (int axis = 0; axis < 3; ++axis)
+            {
+                max_ring = std::max<std::int64_t>(max_ring, static_cast<std::int64_t>(c[axis]) - m_min_cell[axis]);
+                max_ring = std::max<std::int64_t>(max_ring, static_cast<std::int64_t>(m_max_cell[axis]) - c[axis]);
+            }
+
+            for (std::int64_t ring = 0; ring <= max_ring; ++ring)
+            {
+                auto r = static_cast<std::int32_t>(ring);
+
+                // Once rings outgrow the number of occupied cells, start over scanning those
+                if (ring > 0 && static_cast<double>(2 * ring + 1) * (2 * ring + 1) * (2 * ring + 1) >
+                                2.0 * static_cast<double>(m_cells.size()))
+                {
+                    out.resize(begin);
+
+                    for (auto &cell: m_cells)
+                    {
+                        for (auto &entry: cell.second)
+                        {
+                            if (filter.Matches(entry.m_type))
+                                visitor(entry, GetDistanceSq(entry.m_position, center));
+                        }
+                    }
+
+                    break;
+                }
+
+                for (auto dz = -r; dz <= r; ++dz)
+                {
+                    for (auto dy = -r; dy <= r; ++dy)
+                    {
+                        // Inner rows only touch the ring at both ends
+                        auto step = (dz == -r || dz == r || dy == -r || dy == r) ? 1 : std::max(2 * r, 1);
+
+                        for (auto dx = -r; dx <= r; dx += step)
+                            VisitCell(cx + dx, cy + dy, cz + dz, center, filter, visitor);
+                    }
+                }
+
+                // Cells of the next rings are farther than the faces of the visited block of cells
+                auto reach = static_cast<float>(ring) * m_cell_size + margin;
+
+                if (out.size() - begin == k && out[begin].m_distance <= reach * reach)
+                    break;
+            }
+
+            std::sort_heap(out.begin() + begin, out.end(), farther);
+
+            for (auto i = begin; i < out.size(); ++i)
+                out[i].m_distance = std::sqrt(out[i].m_distance);
+        }
+
+        /// Cell coordinate clamped to the range of 32-bit integers.
+        std::int32_t GetCellCoordinateClamped(float x) const
+        {
+            auto c = std::floor(x / m_cell_size);
+            c = std::max(c, static_cast<float>(std::numeric_limits<std::int32_t>::min()));
+            c = std::min(c, static_cast<float>(std::numeric_limits<std::int32_t>::max() / 2));
+            return static_cast<std::int32_t>(c);
+        }
+
+        /// Run query(index, out) appending results of every query of a batch, in parallel given a task pool.
+        template<typename Query>
+        void RunBatch(std::size_t count, BatchResult &result, Query &&query) const
+        {
+            auto num_chunks = (count + kGrainSize - 1) / kGrainSize;
+
+            if (result.m_chunks.size() < num_chunks)
+                result.m_chunks.resize(num_chunks);
+
+            result.m_offsets.resize(count + 1);
+            result.m_offsets[0] = 0;
+
+            // Offsets are relative to the chunk first
+            auto run = [&](std::size_t begin, std::size_t end)
+            {
+                for (auto chunk = begin; chunk < end; ++chunk)
+                {
+                    auto &out = result.m_chunks[chunk];
+                    out.clear();
+
+                    for (auto i = chunk * kGrainSize; i < std::min((chunk + 1) * kGrainSize, count); ++i)
+                    {
+                        query(i, out);
+                        result.m_offsets[i + 1] = out.size();
+                    }
+                }
+            };
+
+            if (m_pool)
+                m_pool->ParallelFor(num_chunks, 1, run);
+            else
+                run(0, num_chunks);
+
+            result.m_neighbours.clear();
+
+            for (std::size_t chunk = 0; chunk < num_chunks; ++chunk)
+            {
+                auto base = result.m_neighbours.size();
+                auto &out = result.m_chunks[chunk];
+                result.m_neighbours.insert(result.m_neighbours.end(), out.cbegin(), out.cend());
+
+                for (auto i = chunk * kGrainSize; i < std::min((chunk + 1) * kGrainSize, count); ++i)
+                    result.m_offsets[i + 1] += base;
+            }
+        }
+
+        /// Scene graph
+        SceneGraph &m_sg;
+        /// Position parameter
+        Key m_key;
+        /// Size of grid cells
+        float m_cell_size;
+        /// Task pool or nullptr
+        TaskPool *m_pool;
+        /// Poller of scene changes
+        typename SceneGraph::ChangePoller m_poller;
+        /// Changes since the last update
+        typename SceneGraph::ChangeLog m_changes;
+        /// Non-empty cells by their keys
+        std::unordered_map<std::uint64_t, Cell> m_cells;
+        /// Bounds of cell coordinates ever occupied
+        std::int32_t m_min_cell[3];
+        std::int32_t m_max_cell[3];
+        /// Objects and their indices by nodes
+        std::vector<Object> m_objects;
+        std::unordered_map<Node const *, std::uint32_t> m_index;
+    };
+
+    template<typename SceneGraph>
+    std::size_t const PositionIndex<SceneGraph>::kGrainSize;
+
+    using DefaultPositionIndex = PositionIndex<DefaultSceneGraph>;
+}
@@ -0,0 +1,184 @@
+/**
+    \file render_queue.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing render queue extraction for Gravity scene graph nodes.
+
+    Extraction turns a list of visible nodes into draw items tagged with 64-bit sort keys and sorts them with
+    a least significant digit radix sort. Buffers are kept between frames, so once they have grown to the size
+    of the scene, extraction makes no allocations.
+ */
+#pragma once
+
+#include "sg.h"
+#include "span.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Gravity
+{
+    /**
+        \brief Draw items of visible nodes sorted by user-defined keys.
+
+        Keys are typically packed from a pass or layer, material, mesh and quantized depth, most significant
+        fields first. Items with equal keys keep the order of visible nodes.
+
+        Given a task pool, keys are computed and items are sorted in parallel: every radix pass builds digit
+        histograms of chunks of items and scatters the chunks in parallel. Passes over digits which are the
+        same for all items are skipped.
+     */
+    template<typename SceneGraph>
+    class RenderQueue
+    {
+    public:
+        using Node = typename SceneGraph::Node;
+
+        /// Node to draw and its sort key.
+        struct DrawItem
+        {
+            std::uint64_t m_key;
+            Node *m_node;
+        };
+
+        /// Number of items processed by a task.
+        static std::size_t const kGrainSize = 16384;
+
+        /// \brief Create the queue.
+        /// \param pool Task pool running extraction in parallel or nullptr to run it on the calling thread.
+        explicit RenderQueue(TaskPool *pool = nullptr)
+                : m_pool(pool)
+        {
+        }
+
+        RenderQueue(RenderQueue const &) = delete;
+
+        RenderQueue &operator=(RenderQueue const &) = delete;
+
+        /// \brief Replace the items with ones for visible nodes sorted by keys.
+        /// \param make_key Function returning the key of a node: std::uint64_t(Node *), given a task pool it is
+        /// called concurrently and must not change the scene.
+        template<typename MakeKey>
+        void Extract(Span<Node *const> visible, MakeKey &&make_key)
+        {
+            auto count = visible.GetSize();
+            m_items.resize(count);
+
+            ForEachChunk(count, [&](std::size_t, std::size_t begin, std::size_t end)
+            {
+                for (auto i = begin; i < end; ++i)
+                    m_items[i] = DrawItem{make_key(visible[i]), visible[i]};
+            });
+
+            Sort();
+        }
+
+        /// Return the items sorted by keys.
+        Span<DrawItem const> GetItems() const
+        { return Span<DrawItem const>(m_items.data(), m_items.size()); }
+
+    private:
+        /// Number of bits and values of a radix digit.
+        static int const kDigitBits = 8;
+        static std::size_t const kNumDigits = 256;
+
+        /// Call func(chunk, begin, end) for chunks of kGrainSize items, in parallel given a task pool.
+        template<typename Func>
+        void ForEachChunk(std::size_t count, Func &&func)
+        {
+            auto num_chunks = GetNumChunks(count);
+
+            auto run = [&](std::size_t begin, std::size_t end)
+            {
+                for (auto chunk = begin; chunk < end; ++chunk)
+                    func(chunk, chunk * kGrainSize, std::min((chunk + 1) * kGrainSize, count));
+            };
+
+            if (m_pool)
+                m_pool->ParallelFor(num_chunks, 1, run);
+            else
+                run(0, num_chunks);
+        }
+
+        static std::size_t GetNumChunks(std::size_t count)
+        { return (count + kGrainSize - 1) / kGrainSize; }
+
+        /// Stable radix sort of m_items by keys.
+        void Sort()
+        {
+            auto count = m_items.size();
+            auto num_chunks = GetNumChunks(count);
+
+            m_scratch.resize(count);
+            m_histograms.resize(num_chunks * kNumDigits);
+
+            for (int shift = 0; shift < 64; shift += kDigitBits)
+            {
+                // Digit counts per chunk
+                ForEachChunk(count, [this, shift](std::size_t chunk, std::size_t begin, std::size_t end)
+                {
+                    auto items = m_items.data();
+                    auto histogram = m_histograms.data() + chunk * kNumDigits;
+                    std::fill(histogram, histogram + kNumDigits, std::size_t(0));
+
+                    for (auto i = begin; i < end; ++i)
+                        ++histogram[(items[i].m_key >> shift) & (kNumDigits - 1)];
+                });
+
+                // Turn counts into output offsets: by digit, then by chunk
+                std::size_t offset = 0;
+                auto uniform = false;
+
+                for (std::size_t digit = 0; digit < kNumDigits && !uniform; ++digit)
+                {
+                    auto first = offset;
+
+                    for (std::size_t chunk = 0; chunk < num_chunks; ++chunk)
+                    {
+                        auto &entry = m_histograms[chunk * kNumDigits + digit];
+                        auto size = entry;
+                        entry = offset;
+                        offset += size;
+                    }
+
+                    uniform = offset - first == count;
+                }
+
+                // All items share the digit, the pass would not move anything
+                if (uniform)
+                    continue;
+
+                ForEachChunk(count, [this, shift](std::size_t chunk, std::size_t begin, std::size_t end)
+                {
+                    auto items = m_items.data();
+                    auto scratch = m_scratch.data();
+                    auto offsets = m_histograms.data() + chunk * kNumDigits;
+
+                    for (auto i = begin; i < end; ++i)
+                        scratch[offsets[(items[i].m_key >> shift) & (kNumDigits - 1)]++] = items[i];
+                });
+
+                m_items.swap(m_scratch);
+            }
+        }
+
+        /// Task pool or nullptr
+        TaskPool *m_pool;
+        /// Sorted items and the sort buffer
+        std::vector<DrawItem> m_items;
+        std::vector<DrawItem> m_scratch;
+        /// Digit histograms of chunks turned into their output offsets
+        std::vector<std::size_t> m_histograms;
+    };
+
+    template<typename SceneGraph>
+    std::size_t const RenderQueue<SceneGraph>::kGrainSize;
+
+    template<typename SceneGraph>
+    std::size_t const RenderQueue<SceneGraph>::kNumDigits;
+
+    using DefaultRenderQueue = RenderQueue<DefaultSceneGraph>;
+}
@@ -10,15 +10,31 @@
 #pragma once
 
 #include <map>
+#include <unordered_map>
+#include <vector>
 #include <set>
 #include <memory>
 #include <iostream>
-#include <list>
 #include <functional>
 #include <algorithm>
+#include <iterator>
 #include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <thread>
+#include <unordered_set>
+#include <tuple>
 
 #include "parameter.h"
+#include "callback_list.h"
+#include "delegate.h"
+#include "event_queue.h"
+#include "span.h"
+#include "persistent_array.h"
+#include "threading.h"
 
 namespace Gravity
 {
@@ -36,17 +52,25 @@ namespace Gravity
             * Client uses scene graph: creates nodes, manipulates them, etc.
             * Creator register observers to react on scene changes.
     */
-    template<typename Key, typename NodeType, typename Parameter>
+    template<typename Key, typename NodeType, typename Parameter, typename ThreadingPolicy = MultiThreaded>
     class SceneGraph
     {
     public:
+        /// Mutex types defined by the threading policy.
+        using Mutex = typename ThreadingPolicy::Mutex;
+        using RecursiveMutex = typename ThreadingPolicy::RecursiveMutex;
+        /// Parameter key type.
+        using KeyType = Key;
+        /// Node type type.
+        using NodeTypeType = NodeType;
+
 
         /**
             \brief Scene graph node class.
 
             Scene graph node represents single scene graph entity and can have parameters of an arbitrary type.
         */
-        class Node
+        class Node : private MutexStorage<RecursiveMutex>
         {
         public:
             /**
@@ -56,15 +80,28 @@ namespace Gravity
                 \param type Node type.
                 \param param_set The set of parameters for this node
              */
-            Node(SceneGraph<Key, NodeType, Parameter> &sg, NodeType const &type, std::map<Key, Parameter> &&param_set)
-                    : m_sg(sg), m_type(type), m_paramset(std::move(param_set))
+            Node(SceneGraph<Key, NodeType, Parameter, ThreadingPolicy> &sg, NodeType const &type, std::map<Key, Parameter> &&param_set)
+                    : m_sg(sg), m_type(type), m_dirty_index(kNotDirty), m_version(0), m_created_version(0)
+                    , m_prev(nullptr), m_next(nullptr), m_slot(0), m_id(0)
+                    , m_parent(nullptr), m_first_child(nullptr), m_last_child(nullptr), m_prev_sibling(nullptr)
+                    , m_next_sibling(nullptr), m_hierarchy_index(0)
             {
+                for (auto &param: param_set)
+                {
+                    m_paramset.emplace_hint(m_paramset.cend(), std::piecewise_construct,
+                                            std::forward_as_tuple(param.first),
+                                            std::forward_as_tuple(std::move(param.second)));
+                }
             }
 
             /// Return Node type.
             NodeType GetType() const
             { return m_type; }
 
+            /// Return identifier unique within the scene graph (unlike node addresses, identifiers are not reused).
+            std::uint64_t GetId() const
+            { return m_id; }
+
             /// \brief Set parameter value.
             /// \details If a key does not exist std::runtime_error is thrown.
             /// \param key Parameter key
@@ -72,19 +109,28 @@ namespace Gravity
             template<typename T>
             void SetValue(Key const &key, T &&value)
             {
-                std::unique_lock<std::recursive_mutex> lock(m_paramset_mutex);
+                Key const *changed_key = nullptr;
+                Slot *changed_slot = nullptr;
 
-                // Try to find the parameter
-                auto iter = m_paramset.find(key);
+                {
+                    std::unique_lock<RecursiveMutex> lock(this->GetMutex());
 
-                if (iter == m_paramset.cend())
-                    throw std::runtime_error("Requested parameter not found");
+                    // Try to find the parameter
+                    auto iter = m_paramset.find(key);
+
+                    if (iter == m_paramset.cend())
+                        throw std::runtime_error("Requested parameter not found");
 
-                // Forward the value
-                iter->second = std::forward<T>(value);
+                    // Forward the value
+                    iter->second.m_value = std::forward<T>(value);
+
+                    // Keys stored in the node outlive any pending notification
+                    changed_key = &iter->first;
+                    changed_slot = &iter->second;
+                }
 
-                // Trigger scene graph notification
-                m_sg.FireOnNodeParameterChange(this, key);
+                // Trigger scene graph notification once the lock is released
+                m_sg.NotifyParameterChanges(this, &changed_key, &changed_slot, 1);
             }
 
             /// \brief Modify parameter value by passing a lambda modifier.
@@ -95,26 +141,41 @@ namespace Gravity
             template<typename T, typename Func>
             void ModifyValue(Key const &key, Func &&func)
             {
-                std::unique_lock<std::recursive_mutex> lock(m_paramset_mutex);
+                Key const *changed_key = nullptr;
+                Slot *changed_slot = nullptr;
 
-                // Try to find the parameter
-                auto iter = m_paramset.find(key);
+                {
+                    std::unique_lock<RecursiveMutex> lock(this->GetMutex());
 
-                if (iter == m_paramset.cend())
-                    throw std::runtime_error("Requested parameter not found");
+                    // Try to find the parameter
+                    auto iter = m_paramset.find(key);
+
+                    if (iter == m_paramset.cend())
+                        throw std::runtime_error("Requested parameter not found");
 
-                func(iter->second.template As<T>());
+                    func(iter->second.m_value.template As<T>());
+
+                    changed_key = &iter->first;
+                    changed_slot = &iter->second;
+                }
 
-                // Trigger scene graph notification
-                m_sg.FireOnNodeParameterChange(this, key);
+                // Trigger scene graph notification once the lock is released
+                m_sg.NotifyParameterChanges(this, &changed_key, &changed_slot, 1);
             };
 
+            /// Check if the node has a parameter with a given key.
+            bool HasValue(Key const &key) const
+            {
+                // Parameter sets do not change after construction
+                return m_paramset.find(key) != m_paramset.cend();
+            }
+
             /// \brief Get parameter value for a given key.
             /// \details If the key does not exist in this node std::runtime_error is thrown.
             template <typename T>
             typename std::decay<T>::type& GetValue(Key const& key)
             {
-                std::unique_lock<std::recursive_mutex> lock(m_paramset_mutex);
+                std::unique_lock<RecursiveMutex> lock(this->GetMutex());
 
                 // Try to find the parameter
                 auto iter = m_paramset.find(key);
@@ -122,19 +183,106 @@ namespace Gravity
                 if (iter == m_paramset.cend())
                     throw std::runtime_error("Requested parameter not found");
 
-                return iter->second.template As<T>();
+                return iter->second.m_value.template As<T>();
+            }
+
+            /// Return the scene graph version of the last change of the node (including its creation).
+            std::uint64_t GetVersion() const
+            { return m_version.load(); }
+
+            /// \brief Return the scene graph version of the last change of a given parameter.
+            /// \details If the key does not exist in this node std::runtime_error is thrown.
+            std::uint64_t GetVersion(Key const &key) const
+            {
+                // Parameter sets do not change after construction
+                auto iter = m_paramset.find(key);
+
+                if (iter == m_paramset.cend())
+                    throw std::runtime_error("Requested parameter not found");
+
+                return iter->second.m_version.load();
+            }
+
+            /// Return the parent node or nullptr for a root node.
+            Node *GetParent() const
+            {
+                std::unique_lock<RecursiveMutex> lock(m_sg.m_nodes_mutex);
+                return m_parent;
+            }
+
+            /// Return the first child node or nullptr if the node has no children.
+            Node *GetFirstChild() const
+            {
+                std::unique_lock<RecursiveMutex> lock(m_sg.m_nodes_mutex);
+                return m_first_child;
             }
 
+            /// Return the next child of the parent (the next root for a root node) or nullptr.
+            Node *GetNextSibling() const
+            {
+                std::unique_lock<RecursiveMutex> lock(m_sg.m_nodes_mutex);
+                return m_next_sibling;
+            }
 
         private:
+            friend class SceneGraph<Key, NodeType, Parameter, ThreadingPolicy>;
+
+            /// Values of a parameter published by SwapBuffers (see FrontReader).
+            struct FrontValues
+            {
+                Parameter m_values[2];
+                bool m_published[2];
+            };
+
+            /// Parameter value and its version.
+            struct Slot
+            {
+                explicit Slot(Parameter &&value)
+                        : m_value(std::move(value)), m_version(0), m_front(nullptr)
+                {
+                }
+
+                ~Slot()
+                {
+                    delete m_front.load();
+                }
+
+                /// Value (guarded by the node mutex)
+                Parameter m_value;
+                /// Version of the last change (written under the change shard mutex of the node)
+                std::atomic<std::uint64_t> m_version;
+                /// Published values, allocated once SwapBuffers publishes the parameter
+                std::atomic<FrontValues *> m_front;
+            };
+
             /// Scene graph
-            SceneGraph<Key, NodeType, Parameter> &m_sg;
+            SceneGraph<Key, NodeType, Parameter, ThreadingPolicy> &m_sg;
             /// Node type
             NodeType m_type;
             /// Parameter set
-            std::map<Key, Parameter> m_paramset;
-            /// Parameter guard mutex
-            std::recursive_mutex m_paramset_mutex;
+            std::map<Key, Slot> m_paramset;
+            /// Keys changed since the last flush in kCoalesced mode (guarded by the scene graph event mutex)
+            std::vector<Key const *> m_dirty_keys;
+            /// Position in the scene graph dirty set or kNotDirty
+            std::size_t m_dirty_index;
+            /// Versions of the last change and of the creation (written under the change shard mutex of the node)
+            std::atomic<std::uint64_t> m_version;
+            std::uint64_t m_created_version;
+            /// Neighbours in the change shard list of nodes ordered by version
+            Node *m_prev;
+            Node *m_next;
+            /// Dense index of the node in the scene graph (reused after deletion)
+            std::size_t m_slot;
+            /// Unique identifier
+            std::uint64_t m_id;
+            /// Hierarchy links, roots are linked as siblings (guarded by the scene graph nodes mutex)
+            Node *m_parent;
+            Node *m_first_child;
+            Node *m_last_child;
+            Node *m_prev_sibling;
+            Node *m_next_sibling;
+            /// Position in the flattened hierarchy (valid while it is up to date)
+            std::size_t m_hierarchy_index;
         };
 
         /**
@@ -153,86 +301,472 @@ namespace Gravity
         };
 
 
-        // Callback typedefs
+        /**
+            \brief Keys of a node changed by a single update.
+
+            Change set lists every changed key once. It is only valid for the duration of the callback it is
+            passed to.
+         */
+        class ChangeSet
+        {
+        public:
+            /// Iterator over changed keys.
+            class Iterator
+            {
+            public:
+                using iterator_category = std::forward_iterator_tag;
+                using value_type = Key;
+                using difference_type = std::ptrdiff_t;
+                using pointer = Key const *;
+                using reference = Key const &;
+
+                explicit Iterator(Key const *const *key)
+                        : m_key(key)
+                {
+                }
+
+                Key const &operator*() const
+                { return **m_key; }
+
+                Iterator &operator++()
+                {
+                    ++m_key;
+                    return *this;
+                }
+
+                Iterator operator++(int)
+                {
+                    Iterator result(*this);
+                    ++m_key;
+                    return result;
+                }
+
+                bool operator==(Iterator const &rhs) const
+                { return m_key == rhs.m_key; }
+
+                bool operator!=(Iterator const &rhs) const
+                { return m_key != rhs.m_key; }
+
+            private:
+                Key const *const *m_key;
+            };
+
+            ChangeSet(Key const *const *keys, std::size_t size)
+                    : m_keys(keys), m_size(size)
+            {
+            }
+
+            /// Return the number of changed keys.
+            std::size_t GetSize() const
+            { return m_size; }
+
+            /// Return i-th changed key.
+            Key const &operator[](std::size_t i) const
+            { return *m_keys[i]; }
+
+            /// Check if a given key has been changed.
+            bool Contains(Key const &key) const
+            {
+                for (std::size_t i = 0; i < m_size; ++i)
+                {
+                    if (*m_keys[i] == key)
+                        return true;
+                }
+
+                return false;
+            }
+
+            Iterator begin() const
+            { return Iterator(m_keys); }
+
+            Iterator end() const
+            { return Iterator(m_keys + m_size); }
+
+        private:
+            /// Keys (point into the node)
+            Key const *const *m_keys;
+            /// Number of keys
+            std::size_t m_size;
+        };
+
+        /// Node creation or deletion record of an EventBatch.
+        struct NodeRecord
+        {
+            /// Node
+            Node *m_node;
+            /// Node type
+            NodeType m_type;
+        };
+
+        /// Parameter change record of an EventBatch.
+        struct ChangeRecord
+        {
+            /// Return changed keys.
+            ChangeSet GetChangeSet() const
+            { return ChangeSet(m_keys, m_num_keys); }
+
+            /// Node
+            Node *m_node;
+            /// Node type
+            NodeType m_type;
+            /// Changed keys (point into the node)
+            Key const *const *m_keys;
+            /// Number of changed keys
+            std::size_t m_num_keys;
+        };
+
+        /**
+            \brief Events delivered to batch observers at once.
+
+            Each array is sorted by node type and then by node, so records of a type are contiguous. Changes of the
+            same node keep the order they have been made in. The batch and the nodes it refers to (including
+            deleted ones) are only valid for the duration of the callback it is passed to.
+         */
+        class EventBatch
+        {
+        public:
+            EventBatch(Span<NodeRecord const> created, Span<NodeRecord const> deleted, Span<ChangeRecord const> changed)
+                    : m_created(created), m_deleted(deleted), m_changed(changed)
+            {
+            }
+
+            /// Return created nodes.
+            Span<NodeRecord const> GetCreated() const
+            { return m_created; }
+
+            /// Return deleted nodes.
+            Span<NodeRecord const> GetDeleted() const
+            { return m_deleted; }
+
+            /// Return parameter changes.
+            Span<ChangeRecord const> GetChanged() const
+            { return m_changed; }
+
+        private:
+            /// Created nodes
+            Span<NodeRecord const> m_created;
+            /// Deleted nodes
+            Span<NodeRecord const> m_deleted;
+            /// Parameter changes
+            Span<ChangeRecord const> m_changed;
+        };
+
+        // Callback typedefs (see Delegate for the limit on callable size)
         using OnNodeCreateCallback =
-        std::function<void(Node *)>;
+        Delegate<void(Node *)>;
         using OnNodeDeleteCallback =
-        std::function<void(Node *)>;
+        Delegate<void(Node *)>;
         using OnNodeParameterChangeCallback =
-        std::function<void(Node *, Key)>;
+        Delegate<void(Node *, Key const &)>;
+        using OnNodeChangeSetCallback =
+        Delegate<void(Node *, ChangeSet const &)>;
+        using OnEventBatchCallback =
+        Delegate<void(EventBatch const &)>;
+
+        /// Filtered callback (see Gravity::FilteredCallback).
+        template<typename Func>
+        using FilteredCallback = Gravity::FilteredCallback<Func, NodeType>;
 
         /**
-            \brief Listener callback class
+            \brief Defines when observers are notified.
 
-            FilteredCallback wraps callback function and adds a filter
-            functionality to it. It checks the type of the node calling
-            it and matches it versus m_filter internal set. It calls
-            the function if either m_filter is empty (non-filtered) or
-            node type is contained within m_filter
-        */
-        template<typename Func>
-        struct FilteredCallback
+            In all modes observers are called without any scene graph lock held, so they are free to block
+            or to access the graph.
+         */
+        enum class DispatchMode
+        {
+            /// Observers are called right after the change, on the thread making it.
+            kImmediate,
+            /// Events are queued and observers are called on Flush().
+            kDeferred,
+            /// Events are pushed to lock-free queues and observers are called by dispatcher threads.
+            kAsync,
+            /// Like kDeferred, but each changed (node, key) pair is reported once per Flush() no matter how
+            /// many times it has been changed. Changes are reported after node creations and deletions, changes
+            /// of deleted nodes are discarded.
+            kCoalesced
+        };
+
+        /// What editing threads do when an asynchronous dispatch queue is full.
+        enum class BackpressurePolicy
+        {
+            /// Wait for the dispatcher to make room.
+            kBlock,
+            /// Evict the oldest parameter change event from the queue.
+            kDropOldest,
+            /// Merge parameter changes into a per (node, key) overflow set delivered once the queue catches up.
+            kCoalesce
+        };
+
+        /**
+            \brief Asynchronous dispatch settings.
+
+            Each dispatcher thread owns a queue and nodes are assigned to queues by address, so events of a
+            node are always delivered in order by the same thread. Node creation and deletion events are never
+            dropped or coalesced: they block if the queue is full regardless of the policy.
+         */
+        struct AsyncDispatchOptions
         {
-            /// Creates a filtered callback from a given function and the set of event types.
-            FilteredCallback(Func func, std::set<NodeType> filter)
-                    : m_func(func), m_filter(filter)
+            AsyncDispatchOptions()
+                    : m_num_threads(1), m_capacity(4096), m_policy(BackpressurePolicy::kBlock)
             {
             }
 
-            /// Perfect-forward parameters to the callback function.
-            template<typename... Args>
-            void operator()(Node *node, Args &&... args)
+            /// Number of dispatcher threads
+            std::size_t m_num_threads;
+            /// Capacity of each queue
+            std::size_t m_capacity;
+            /// Behaviour on a full queue
+            BackpressurePolicy m_policy;
+        };
+
+        /// Asynchronous dispatch counters (summed over all the queues).
+        struct AsyncDispatchStats
+        {
+            /// Events accepted by the queues
+            std::uint64_t m_enqueued;
+            /// Events delivered to observers
+            std::uint64_t m_delivered;
+            /// Parameter change events evicted by kDropOldest policy
+            std::uint64_t m_dropped;
+            /// Parameter change events merged into already pending ones by kCoalesce policy
+            std::uint64_t m_coalesced;
+            /// Events currently waiting for delivery
+            std::size_t m_depth;
+            /// Maximum queue depth observed
+            std::size_t m_max_depth;
+            /// Mean time between an event being raised and delivered
+            double m_mean_latency_ns;
+            /// Maximum time between an event being raised and delivered
+            double m_max_latency_ns;
+        };
+
+        /**
+            \brief Batch of parameter updates applied at once.
+
+            Updates are recorded without touching the scene and applied on Commit(). Each node is locked once
+            and observers get one change set per node listing all the keys changed by the transaction, which
+            is delivered after all the updates have been applied. Per-key change callbacks are still called
+            once for every changed key. Missing keys are detected before anything is applied.
+
+            Updates of different nodes are not atomic with respect to concurrent readers.
+         */
+        class Transaction
+        {
+        public:
+            /// Start a transaction for a given scene graph.
+            explicit Transaction(SceneGraph &sg)
+                    : m_sg(sg)
             {
-                // Call if the filter is empty
-                if (m_filter.empty())
-                {
-                    m_func(node, std::forward<Args...>(args...));
-                }
-                else
-                {
-                    // Otherwise check the type
-                    auto type = node->GetType();
+            }
 
-                    // and call if the type is contained within m_filter
-                    if (m_filter.find(type) != std::end(m_filter))
-                    {
-                        m_func(node, std::forward<Args...>(args...));
-                    }
-                }
+            /// Record parameter value update.
+            template<typename T>
+            Transaction &SetValue(Node *node, Key const &key, T &&value)
+            {
+                m_updates.emplace_back(node, key);
+                m_updates.back().m_value = Parameter(std::forward<T>(value));
+                return *this;
+            }
+
+            /// Record parameter modification by a lambda modifier (see Node::ModifyValue).
+            template<typename T, typename Func>
+            Transaction &ModifyValue(Node *node, Key const &key, Func func)
+            {
+                m_updates.emplace_back(node, key);
+                m_updates.back().m_modifier = [func](Parameter &value) mutable
+                { func(value.template As<T>()); };
+                return *this;
+            }
+
+            /// \brief Apply recorded updates and notify observers.
+            /// \details If any of the keys does not exist std::runtime_error is thrown and nothing is applied.
+            void Commit()
+            {
+                m_sg.ApplyUpdates(m_updates);
+                m_updates.clear();
             }
 
-            /// Call applying a filter.
-            void operator()(Node *node)
+            /// Discard recorded updates.
+            void Clear()
+            { m_updates.clear(); }
+
+            /// Check if there is anything to commit.
+            bool IsEmpty() const
+            { return m_updates.empty(); }
+
+        private:
+            friend class SceneGraph<Key, NodeType, Parameter, ThreadingPolicy>;
+
+            /// Recorded update.
+            struct Update
             {
-                // Call if the filter is empty
-                if (m_filter.empty())
+                Update(Node *node, Key const &key)
+                        : m_node(node), m_key(key), m_target(nullptr), m_target_key(nullptr)
                 {
-                    m_func(node);
                 }
-                else
+
+                /// Node to update
+                Node *m_node;
+                /// Parameter key
+                Key m_key;
+                /// New value (used if there is no modifier)
+                Parameter m_value;
+                /// Modifier
+                std::function<void(Parameter &)> m_modifier;
+                /// Resolved parameter
+                typename Node::Slot *m_target;
+                /// Resolved key stored in the node
+                Key const *m_target_key;
+            };
+
+            /// Scene graph
+            SceneGraph &m_sg;
+            /// Recorded updates
+            std::vector<Update> m_updates;
+        };
+
+        /**
+            \brief Recorded scene edits applied in bulk by Submit.
+
+            Recording does not touch the scene graph, so every thread or task can fill its own buffer without any
+            synchronization. Nodes created by the buffer can be referred to by subsequent commands through the
+            returned NodeRef.
+         */
+        class CommandBuffer
+        {
+        public:
+            /// Reference to an existing node or to a node created by the buffer.
+            class NodeRef
+            {
+            public:
+                NodeRef(Node *node)
+                        : m_node(node), m_created(0)
                 {
-                    // Otherwise check the type
-                    auto type = node->GetType();
+                }
 
-                    // and call if the type is contained within m_filter
-                    if (m_filter.find(type) != std::end(m_filter))
-                    {
-                        m_func(node);
-                    }
+            private:
+                friend class SceneGraph<Key, NodeType, Parameter, ThreadingPolicy>;
+                friend class CommandBuffer;
+
+                explicit NodeRef(std::size_t created)
+                        : m_node(nullptr), m_created(created)
+                {
                 }
+
+                /// Existing node
+                Node *m_node;
+                /// Index of the node among created by the buffer plus one (zero for existing nodes)
+                std::size_t m_created;
+            };
+
+            /// Record node creation.
+            NodeRef CreateNode(NodeType const &type)
+            {
+                m_commands.push_back(Command{CommandType::kCreate, NodeRef(nullptr), m_types.size()});
+                m_types.push_back(type);
+                return NodeRef(m_types.size());
+            }
+
+            /// Record node deletion.
+            CommandBuffer &DeleteNode(NodeRef node)
+            {
+                m_commands.push_back(Command{CommandType::kDelete, node, 0});
+                return *this;
+            }
+
+            /// Record parameter value update.
+            template<typename T>
+            CommandBuffer &SetValue(NodeRef node, Key const &key, T &&value)
+            {
+                m_commands.push_back(Command{CommandType::kUpdate, node, m_updates.size()});
+                m_updates.emplace_back(nullptr, key);
+                m_updates.back().m_value = Parameter(std::forward<T>(value));
+                return *this;
+            }
+
+            /// Record parameter modification by a lambda modifier (see Node::ModifyValue).
+            template<typename T, typename Func>
+            CommandBuffer &ModifyValue(NodeRef node, Key const &key, Func func)
+            {
+                m_commands.push_back(Command{CommandType::kUpdate, node, m_updates.size()});
+                m_updates.emplace_back(nullptr, key);
+                m_updates.back().m_modifier = [func](Parameter &value) mutable
+                { func(value.template As<T>()); };
+                return *this;
+            }
+
+            /// Return nodes created by the last submission of the buffer in the order of CreateNode calls.
+            std::vector<Node *> const &GetCreatedNodes() const
+            { return m_created; }
+
+            /// Resolve a reference after the buffer has been submitted.
+            Node *GetNode(NodeRef node) const
+            { return node.m_created ? m_created[node.m_created - 1] : node.m_node; }
+
+            /// Discard recorded commands.
+            void Clear()
+            {
+                m_commands.clear();
+                m_types.clear();
+                m_updates.clear();
             }
 
-            /// Callback
-            Func m_func;
-            /// Filter set
-            std::set<NodeType> m_filter;
+            /// Check if there is anything to submit.
+            bool IsEmpty() const
+            { return m_commands.empty(); }
+
+        private:
+            friend class SceneGraph<Key, NodeType, Parameter, ThreadingPolicy>;
+
+            /// Command kinds.
+            enum class CommandType
+            {
+                kCreate,
+                kDelete,
+                kUpdate
+            };
+
+            /// Recorded command.
+            struct Command
+            {
+                /// Command kind
+                CommandType m_type;
+                /// Target node
+                NodeRef m_node;
+                /// Index in m_types for kCreate, in m_updates for kUpdate
+                std::size_t m_index;
+            };
+
+            /// Commands in the order of recording
+            std::vector<Command> m_commands;
+            /// Types of created nodes
+            std::vector<NodeType> m_types;
+            /// Parameter updates
+            std::vector<typename Transaction::Update> m_updates;
+            /// Nodes created by the last submission
+            std::vector<Node *> m_created;
         };
 
         /// Create a scene graph with a given parameter factory.
-        SceneGraph(ParameterFactory *param_factory) : m_param_factory(param_factory)
-        { }
+        SceneGraph(ParameterFactory *param_factory)
+                : m_param_factory(param_factory), m_last_subscription(0), m_dispatch_mode(DispatchMode::kImmediate)
+                , m_num_slots(0), m_last_node_id(0), m_first_root(nullptr), m_last_root(nullptr)
+                , m_hierarchy_dirty(false), m_version(0), m_front_index(0), m_snapshot_version(0)
+                , m_snapshot_taken(false), m_async_policy(BackpressurePolicy::kBlock)
+                , m_async_pending(0), m_async_stop(false)
+        {
+            m_front_readers[0] = m_front_readers[1] = 0;
+            m_buffer_version[0] = m_buffer_version[1] = 0;
+            m_front_enabled = false;
+        }
 
-        ~SceneGraph() = default;
+        /// Asynchronous dispatchers are stopped after delivering pending events.
+        ~SceneGraph()
+        {
+            if (m_dispatch_mode == DispatchMode::kAsync)
+                StopAsyncDispatch();
+        }
 
         SceneGraph(SceneGraph const &) = delete;
 
@@ -242,108 +776,2273 @@ namespace Gravity
         Node *CreateNode(NodeType const &type)
         {
             // Allocate and construct the node
-            auto node = new Node(*this, type, m_param_factory->GetParameterSet(type));
+            std::unique_ptr<Node> created(new Node(*this, type, m_param_factory->GetParameterSet(type)));
+            auto node = created.get();
 
             {
-                std::unique_lock<std::recursive_mutex> lock(m_nodes_mutex);
+                std::unique_lock<RecursiveMutex> lock(m_nodes_mutex);
                 // Emplace it into the scene
-                m_nodes.emplace(node);
-                // Notify the observers
-                FireOnNodeCreate(node);
+                InsertNode(std::move(created));
             }
 
+            TrackCreate(node);
+
+            // Notify the observers
+            NotifyCreate(node);
+
             // Return node pointer (clients use it as ID, no need to delete)
             return node;
         }
 
-        /// Delete the node.
+        /// \brief Delete the node.
+        /// \details The node is removed from the scene right away, but its memory is only released after
+        /// delete observers have been notified. Children of the node are passed to its parent (become roots if
+        /// the node is a root), see DeleteSubtree to delete them as well.
         void DeleteNode(Node *node)
         {
-            std::unique_lock<std::recursive_mutex> lock(m_nodes_mutex);
+            std::unique_ptr<Node> deleted;
 
-            // Try to find the node in our scene
-            auto iter = std::find_if(m_nodes.cbegin(), m_nodes.cend(), [node](std::unique_ptr<Node> const &ptr)
-            { return ptr.get() == node; });
+            {
+                std::unique_lock<RecursiveMutex> lock(m_nodes_mutex);
 
-            if (iter == m_nodes.cend())
-                throw std::runtime_error("There is no such node to delete");
+                // Try to find the node in our scene
+                auto iter = m_nodes.find(node);
 
-            // Notify observers
-            FireOnNodeDelete(node);
+                if (iter == m_nodes.cend())
+                    throw std::runtime_error("There is no such node to delete");
 
-            // Erase the node (automatically disposed by unique_ptr)
-            m_nodes.erase(iter);
-        }
+                RemoveFromHierarchy(node);
+                deleted = EraseNode(iter);
 
-        /// Register callback for a node creation.
-        void RegisterOnNodeCreateCallback(OnNodeCreateCallback cb, std::set<NodeType> filter = {})
-        {
-            m_cb_create.emplace_back(cb, filter);
-        }
+                // Snapshot relies on nodes being unlinked before they leave the lock
+                TrackDelete(deleted.get());
+            }
 
-        /// Register callback for a node deletion.
-        void RegisterOnNodeDeleteCallback(OnNodeDeleteCallback cb, std::set<NodeType> filter = {})
-        {
-            m_cb_delete.emplace_back(cb, filter);
+            // Notify observers (the node is disposed afterwards)
+            NotifyDelete(std::move(deleted));
         }
 
-        /// Register parameter change callback.
-        void RegisterOnNodeParameterChangeCallback(OnNodeParameterChangeCallback cb, std::set<NodeType> filter = {})
+        /// \brief Apply command buffers in bulk.
+        /// \details The result is deterministic: buffers are applied in the order given and commands in the order
+        /// of recording, nodes get identifiers in that order and notifications are ordered by node identifiers.
+        /// Node creations are applied first, then parameter updates, then deletions. Every node is locked once,
+        /// and the scene is locked once for the whole submission. Observers are notified once everything has
+        /// been applied: one change set per node, and in kImmediate mode a single batch for batch observers.
+        /// If a key or a node to delete does not exist std::runtime_error is thrown and nothing is applied.
+        /// Submitted buffers are cleared and remember the nodes they have created.
+        void Submit(std::vector<CommandBuffer *> const &buffers)
         {
-            m_cb_change.emplace_back(cb, filter);
-        }
+            using Update = typename Transaction::Update;
+            using CommandType = typename CommandBuffer::CommandType;
 
+            // Construct nodes outside of any lock
+            std::vector<std::unique_ptr<Node>> created;
 
-    private:
-        /// Trigger OnNodeCreate callbacks.
-        void FireOnNodeCreate(Node *node)
-        {
-            for (auto &cb: m_cb_create) cb(node);
-        }
+            for (auto buffer: buffers)
+            {
+                for (auto &type: buffer->m_types)
+                    created.emplace_back(new Node(*this, type, m_param_factory->GetParameterSet(type)));
+            }
 
-        /// Trigger OnNodeDelete callbacks.
-        void FireOnNodeDelete(Node *node)
-        {
-            for (auto &cb: m_cb_delete) cb(node);
-        }
+            // Resolve node references and parameters
+            std::vector<Update *> updates;
+            std::vector<Node *> deletions;
+            std::size_t offset = 0;
 
-        /// Trigger OnNodeParameterChange callbacks.
-        void FireOnNodeParameterChange(Node *node, Key key)
-        {
-            for (auto &cb: m_cb_change) cb(node, key);
-        }
+            for (auto buffer: buffers)
+            {
+                for (auto &command: buffer->m_commands)
+                {
+                    auto node = command.m_node.m_created ? created[offset + command.m_node.m_created - 1].get()
+                                                         : command.m_node.m_node;
 
+                    switch (command.m_type)
+                    {
+                        case CommandType::kCreate:
+                            break;
+                        case CommandType::kDelete:
+                            deletions.push_back(node);
+                            break;
+                        case CommandType::kUpdate:
+                            buffer->m_updates[command.m_index].m_node = node;
+                            updates.push_back(&buffer->m_updates[command.m_index]);
+                            break;
+                    }
+                }
 
-    private:
-        using NodeSet = std::set<std::unique_ptr<Node>>;
-        /// Set of nodes for the scene.
-        NodeSet m_nodes;
-        /// Nodes guard mutex
-        std::recursive_mutex m_nodes_mutex;
-        // Parameter factory.
-        std::unique_ptr<ParameterFactory> m_param_factory;
-        // Callback containers.
-        std::list<FilteredCallback<OnNodeCreateCallback>> m_cb_create;
-        std::list<FilteredCallback<OnNodeDeleteCallback>> m_cb_delete;
-        std::list<FilteredCallback<OnNodeParameterChangeCallback>> m_cb_change;
-    };
+                offset += buffer->m_types.size();
+            }
 
-    template<typename Key, typename NodeType, typename Parameter>
-    std::ostream &operator<<(std::ostream &out, typename SceneGraph<Key, NodeType, Parameter>::Node const &node)
-    {
-        // TODO: implement me
-        return out; //node.StreamOut(out);
-    }
+            ResolveUpdates(updates);
 
+            std::vector<Event> events;
+            std::vector<Key const *> keys;
+            std::vector<Slot *> slots;
+            std::vector<std::unique_ptr<Node>> deleted;
 
-    template<typename Key, typename NodeType, typename Parameter>
-    std::ostream &operator<<(std::ostream &out, SceneGraph<Key, NodeType, Parameter> const &sg)
-    {
-        // TODO: implement me
-        return out; //sg.StreamOut(out);
+            {
+                std::unique_lock<RecursiveMutex> nodes_lock(m_nodes_mutex);
+
+                ValidateDeletions(deletions, created);
+
+                for (auto &node: created)
+                {
+                    events.push_back(Event{EventType::kCreate, node.get(), 0, 0});
+                    InsertNode(std::move(node));
+                }
+
+                ApplyResolvedUpdates(updates, events, keys, slots);
+
+                for (auto node: deletions)
+                {
+                    RemoveFromHierarchy(node);
+                    deleted.push_back(EraseNode(m_nodes.find(node)));
+                    events.push_back(Event{EventType::kDelete, node, 0, 0});
+                }
+
+                // Version bookkeeping while the structure is still locked
+                for (auto &event: events)
+                {
+                    switch (event.m_type)
+                    {
+                        case EventType::kCreate:
+                            TrackCreate(event.m_node);
+                            break;
+                        case EventType::kDelete:
+                            TrackDelete(event.m_node);
+                            break;
+                        case EventType::kChange:
+                            TrackChanges(event.m_node, slots.data() + event.m_first_key, event.m_num_keys);
+                            break;
+                    }
+                }
+            }
+
+            // Created nodes are listed first, in submission order
+            auto event = events.cbegin();
+
+            for (auto buffer: buffers)
+            {
+                buffer->m_created.clear();
+
+                for (std::size_t i = 0; i < buffer->m_types.size(); ++i, ++event)
+                    buffer->m_created.push_back(event->m_node);
+
+                buffer->Clear();
+            }
+
+            DispatchEvents(events, keys, deleted);
+        }
+
+        /// Apply a single command buffer (see Submit(std::vector<CommandBuffer *> const &)).
+        void Submit(CommandBuffer &buffer)
+        {
+            Submit(std::vector<CommandBuffer *>{&buffer});
+        }
+
+        /// \brief Set dispatch mode.
+        /// \details Events pending in the current mode are delivered before switching. Switching to kAsync
+        /// starts dispatcher threads configured by SetAsyncDispatchOptions. The mode must not be changed
+        /// concurrently with scene edits. kAsync mode requires thread safe threading policy.
+        void SetDispatchMode(DispatchMode mode)
+        {
+            if (mode == m_dispatch_mode)
+                return;
+
+            if (mode == DispatchMode::kAsync && !ThreadingPolicy::kThreadSafe)
+                throw std::runtime_error("Asynchronous dispatch requires thread safe scene graph");
+
+            Flush();
+
+            if (m_dispatch_mode == DispatchMode::kAsync)
+                StopAsyncDispatch();
+
+            if (mode == DispatchMode::kAsync)
+                StartAsyncDispatch();
+
+            m_dispatch_mode = mode;
+        }
+
+        /// \brief Configure asynchronous dispatch.
+        /// \details Takes effect next time kAsync mode is entered.
+        void SetAsyncDispatchOptions(AsyncDispatchOptions const &options)
+        {
+            if (options.m_num_threads == 0 || options.m_capacity == 0)
+                throw std::invalid_argument("Asynchronous dispatch needs at least one thread and a non-empty queue");
+
+            m_async_options = options;
+        }
+
+        /// Return asynchronous dispatch counters accumulated since kAsync mode has been entered.
+        AsyncDispatchStats GetAsyncDispatchStats() const
+        {
+            AsyncDispatchStats stats = {};
+            std::uint64_t total_latency = 0;
+
+            for (auto &shard: m_shards)
+            {
+                stats.m_enqueued += shard->m_enqueued.load();
+                stats.m_delivered += shard->m_delivered.load();
+                stats.m_dropped += shard->m_dropped.load();
+                stats.m_coalesced += shard->m_coalesced.load();
+                stats.m_depth += shard->m_queue.GetSize() + shard->m_overflow_size.load();
+                stats.m_max_depth = std::max(stats.m_max_depth, shard->m_max_depth.load());
+                stats.m_max_latency_ns = std::max(stats.m_max_latency_ns,
+                                                  static_cast<double>(shard->m_max_latency.load()));
+                total_latency += shard->m_total_latency.load();
+            }
+
+            stats.m_mean_latency_ns = stats.m_delivered ? static_cast<double>(total_latency) / stats.m_delivered : 0.0;
+
+            return stats;
+        }
+
+        /// Get dispatch mode.
+        DispatchMode GetDispatchMode() const
+        { return m_dispatch_mode; }
+
+        /// \brief Notify observers about all the events queued so far.
+        /// \details Events raised by observers during the flush are queued for the next one. Nodes deleted
+        /// since the previous flush are disposed once their delete observers have been called. In kAsync mode
+        /// waits until dispatchers have delivered everything raised before the call, so it must not be called
+        /// from an observer.
+        void Flush()
+        {
+            if (m_dispatch_mode == DispatchMode::kAsync)
+            {
+                while (m_async_pending.load() > 0)
+                    std::this_thread::yield();
+            }
+
+            std::unique_lock<Mutex> flush_lock(m_flush_mutex);
+
+            {
+                std::unique_lock<Mutex> lock(m_events_mutex);
+                std::swap(m_events, m_flush_events);
+                std::swap(m_event_keys, m_flush_event_keys);
+                std::swap(m_retired, m_flush_retired);
+
+                // Turn the dirty set into one change event per node
+                for (auto node: m_dirty_nodes)
+                {
+                    m_flush_events.push_back(Event{EventType::kChange, node, m_flush_event_keys.size(),
+                                                   node->m_dirty_keys.size()});
+                    m_flush_event_keys.insert(m_flush_event_keys.end(), node->m_dirty_keys.cbegin(),
+                                              node->m_dirty_keys.cend());
+                    node->m_dirty_keys.clear();
+                    node->m_dirty_index = kNotDirty;
+                }
+
+                m_dirty_nodes.clear();
+            }
+
+            for (auto &event: m_flush_events)
+                FireOnEvent(event, m_flush_event_keys);
+
+            if (!m_flush_events.empty())
+                FireOnEventBatch(m_flush_events, m_flush_event_keys, m_flush_batch);
+
+            // Buffers keep their capacity for the next flush
+            m_flush_events.clear();
+            m_flush_event_keys.clear();
+            Dispose(m_flush_retired);
+        }
+
+        /// \brief Changes reported by CollectChangesSince.
+        struct ChangeLog
+        {
+            /// Changed node.
+            struct NodeChange
+            {
+                /// Node
+                Node *m_node;
+                /// Set if the node has been created after the queried version (all its keys are listed)
+                bool m_created;
+                /// Version of the last change of the node
+                std::uint64_t m_version;
+                /// Changed keys: offset in m_keys and the number of keys
+                std::size_t m_first_key;
+                std::size_t m_num_keys;
+            };
+
+            /// Return keys changed in a given node.
+            ChangeSet GetChangeSet(NodeChange const &change) const
+            { return ChangeSet(m_keys.data() + change.m_first_key, change.m_num_keys); }
+
+            /// Discard contents keeping the capacity.
+            void Clear()
+            {
+                m_nodes.clear();
+                m_keys.clear();
+                m_deleted.clear();
+            }
+
+            /// Version the log is complete up to, pass it to the next query
+            std::uint64_t m_version;
+            /// Changed nodes, most recently changed first
+            std::vector<NodeChange> m_nodes;
+            /// Changed keys (point into the nodes)
+            std::vector<Key const *> m_keys;
+            /// Deleted nodes (identifiers only, must not be dereferenced), most recently deleted first
+            std::vector<Node *> m_deleted;
+        };
+
+        /// Return the current scene graph version, which is incremented by every node creation, deletion and change.
+        std::uint64_t GetVersion() const
+        { return m_version.load(); }
+
+        /// \brief Collect nodes and keys changed after a given version.
+        /// \details Takes time proportional to the number of changes reported rather than to the number of
+        /// nodes. Nodes created and deleted after the version are not reported. Deletions are only recorded while
+        /// a ChangePoller is registered or once TakeSnapshot has been called, and only kept until all of them
+        /// have collected them (see ChangePoller), so callers interested in deletions should register a poller.
+        /// \param version Version returned by GetVersion or by the previous query.
+        /// \param changes Log to fill (cleared first).
+        void CollectChangesSince(std::uint64_t version, ChangeLog &changes) const
+        {
+            changes.Clear();
+
+            // Versions issued before this are visible once their shard is locked, newer ones are left for the
+            // next query
+            auto last = m_version.load();
+
+            for (auto &shard: m_change_shards)
+            {
+                std::unique_lock<Mutex> lock(shard.m_mutex);
+
+                // Nodes of a shard are kept in the order of their versions, most recent at the tail
+                for (auto node = shard.m_last_changed; node; node = node->m_prev)
+                {
+                    auto node_version = node->m_version.load(std::memory_order_relaxed);
+
+                    if (node_version <= version)
+                        break;
+
+                    if (node_version > last)
+                        continue;
+
+                    auto created = node->m_created_version > version;
+                    auto first_key = changes.m_keys.size();
+
+                    for (auto &param: node->m_paramset)
+                    {
+                        if (param.second.m_version.load(std::memory_order_relaxed) > version)
+                            changes.m_keys.push_back(&param.first);
+                    }
+
+                    changes.m_nodes.push_back(typename ChangeLog::NodeChange{node, created, node_version, first_key,
+                                                                              changes.m_keys.size() - first_key});
+                }
+            }
+
+            // Merge shards
+            std::sort(changes.m_nodes.begin(), changes.m_nodes.end(),
+                      [](typename ChangeLog::NodeChange const &lhs, typename ChangeLog::NodeChange const &rhs)
+                      { return lhs.m_version > rhs.m_version; });
+
+            std::unique_lock<Mutex> lock(m_changes_mutex);
+
+            for (auto iter = m_deletions.crbegin(); iter != m_deletions.crend() && iter->m_version > version; ++iter)
+            {
+                if (iter->m_version <= last && iter->m_created_version <= version)
+                    changes.m_deleted.push_back(iter->m_node);
+            }
+
+            changes.m_version = last;
+        }
+
+        /// \brief Collect nodes and keys changed after a given version.
+        /// \details See CollectChangesSince(std::uint64_t, ChangeLog &).
+        ChangeLog CollectChangesSince(std::uint64_t version) const
+        {
+            ChangeLog changes;
+            CollectChangesSince(version, changes);
+            return changes;
+        }
+
+        /// \brief Forget deletions up to a given version.
+        /// \details Deletions collected by all the registered pollers are discarded automatically, this forgets
+        /// them earlier. Deletions newer than the last TakeSnapshot() are kept.
+        void DiscardDeletionsBefore(std::uint64_t version)
+        {
+            std::unique_lock<Mutex> lock(m_changes_mutex);
+            DiscardDeletions(version);
+        }
+
+        /**
+            \brief Registered poller of CollectChangesSince.
+
+            Every Collect() reports changes made since the previous one (since the creation of the scene for the
+            first one). The scene graph remembers how far its pollers have got and discards deletions all of them
+            (and the last snapshot) have collected. Deletions are not recorded at all while there is neither
+            a poller nor a snapshot, so a long running scene never keeps a record of every node ever deleted.
+         */
+        class ChangePoller
+        {
+        public:
+            /// Register the poller.
+            explicit ChangePoller(SceneGraph &sg)
+                    : m_sg(sg), m_id(++sg.m_last_subscription), m_version(0)
+            {
+                std::unique_lock<Mutex> lock(m_sg.m_changes_mutex);
+                m_sg.m_poller_versions.emplace(m_id, 0);
+            }
+
+            /// Unregister the poller, deletions it has been holding back are discarded.
+            ~ChangePoller()
+            {
+                std::unique_lock<Mutex> lock(m_sg.m_changes_mutex);
+                m_sg.m_poller_versions.erase(m_id);
+                m_sg.DiscardCollectedDeletions();
+            }
+
+            ChangePoller(ChangePoller const &) = delete;
+
+            ChangePoller &operator=(ChangePoller const &) = delete;
+
+            /// \brief Collect changes made since the previous call.
+            /// \param changes Log to fill (cleared first).
+            void Collect(ChangeLog &changes)
+            {
+                m_sg.CollectChangesSince(m_version, changes);
+                m_version = changes.m_version;
+
+                std::unique_lock<Mutex> lock(m_sg.m_changes_mutex);
+                m_sg.m_poller_versions[m_id] = m_version;
+                m_sg.DiscardCollectedDeletions();
+            }
+
+            /// Return the version the poller has collected changes up to.
+            std::uint64_t GetVersion() const
+            { return m_version; }
+
+        private:
+            /// Scene graph
+            SceneGraph &m_sg;
+            /// Poller identifier
+            std::uint64_t m_id;
+            /// Version of the last collection
+            std::uint64_t m_version;
+        };
+
+        /// Return the number of deletions remembered for CollectChangesSince.
+        std::size_t GetNumDeletions() const
+        {
+            std::unique_lock<Mutex> lock(m_changes_mutex);
+            return m_deletions.size();
+        }
+
+        /**
+            \brief Immutable state of a node captured by Snapshot().
+
+            States are shared between snapshots as long as the node does not change, and parameter values are
+            shared between states as long as the parameter does not change.
+         */
+        class NodeState
+        {
+        public:
+            /// Return the node (identifier only, the node might have been deleted since).
+            Node const *GetNode() const
+            { return m_node; }
+
+            /// Return node identifier.
+            std::uint64_t GetId() const
+            { return m_id; }
+
+            /// Return node type.
+            NodeType GetType() const
+            { return m_type; }
+
+            /// Return the version of the last change of the node.
+            std::uint64_t GetVersion() const
+            { return m_version; }
+
+            /// Return parameter keys in ascending order.
+            std::vector<Key> const &GetKeys() const
+            { return *m_keys; }
+
+            /// \brief Get parameter value for a given key.
+            /// \details If the key does not exist std::runtime_error is thrown.
+            template<typename T>
+            typename std::decay<T>::type const &GetValue(Key const &key) const
+            {
+                auto iter = std::lower_bound(m_keys->cbegin(), m_keys->cend(), key);
+
+                if (iter == m_keys->cend() || key < *iter)
+                    throw std::runtime_error("Requested parameter not found");
+
+                return m_values[iter - m_keys->cbegin()]->template As<T>();
+            }
+
+        private:
+            friend class SceneGraph<Key, NodeType, Parameter, ThreadingPolicy>;
+
+            /// Node
+            Node const *m_node;
+            /// Node identifier
+            std::uint64_t m_id;
+            /// Node type
+            NodeType m_type;
+            /// Version of the last change
+            std::uint64_t m_version;
+            /// Keys (shared by all the states of the node)
+            std::shared_ptr<std::vector<Key> const> m_keys;
+            /// Values in the order of keys
+            std::vector<std::shared_ptr<Parameter const>> m_values;
+        };
+
+        /**
+            \brief Immutable point-in-time view of the scene.
+
+            Snapshots are cheap to copy and safe to read from any thread without locking, the live scene graph
+            is never touched.
+         */
+        class Snapshot
+        {
+        public:
+            Snapshot()
+                    : m_version(0)
+            {
+            }
+
+            /// Return scene graph version the snapshot has been taken at.
+            std::uint64_t GetVersion() const
+            { return m_version; }
+
+            /// Return the number of nodes.
+            std::size_t GetSize() const
+            { return m_states.GetSize(); }
+
+            /// \brief Find the state of a node.
+            /// \details The node has to be alive, use ForEach to get to the state of nodes deleted since.
+            /// \return nullptr if the node did not exist when the snapshot has been taken.
+            NodeState const *Find(Node const *node) const
+            {
+                auto &state = m_states.Get(node->m_slot);
+                return state && state->m_id == node->m_id ? state.get() : nullptr;
+            }
+
+            /// Invoke a functor for the state of every node.
+            template<typename Visitor>
+            void ForEach(Visitor &&visitor) const
+            {
+                m_states.ForEach([&visitor](std::size_t, std::shared_ptr<NodeState const> const &state)
+                                 { visitor(*state); });
+            }
+
+        private:
+            friend class SceneGraph<Key, NodeType, Parameter, ThreadingPolicy>;
+
+            /// Node states by node slot
+            PersistentArray<std::shared_ptr<NodeState const>> m_states;
+            /// Scene graph version
+            std::uint64_t m_version;
+        };
+
+        /// \brief Take an immutable snapshot of the scene.
+        /// \details Takes time proportional to the number of changes since the previous snapshot: node states
+        /// and parameter values which have not changed are shared with it. Blocks node creation and deletion
+        /// for that time.
+        Snapshot TakeSnapshot()
+        {
+            std::unique_lock<Mutex> snapshot_lock(m_snapshot_mutex);
+            // Nodes listed by CollectChangesSince can not be deleted while we copy them
+            std::unique_lock<RecursiveMutex> nodes_lock(m_nodes_mutex);
+
+            auto since = m_snapshot.m_version;
+
+            CollectChangesSince(since, m_snapshot_changes);
+
+            {
+                std::unique_lock<Mutex> lock(m_changes_mutex);
+
+                m_snapshot_deleted.clear();
+
+                for (auto iter = m_deletions.crbegin(); iter != m_deletions.crend() &&
+                                                        iter->m_version > since; ++iter)
+                {
+                    if (iter->m_created_version <= since)
+                        m_snapshot_deleted.push_back(iter->m_slot);
+                }
+
+                m_snapshot_version = m_snapshot_changes.m_version;
+                m_snapshot_taken = true;
+                DiscardCollectedDeletions();
+            }
+
+            typename PersistentArray<std::shared_ptr<NodeState const>>::Builder builder(m_snapshot.m_states);
+
+            // Slots of deleted nodes might have been reused by the changed ones
+            for (auto slot: m_snapshot_deleted)
+                builder.Erase(slot);
+
+            for (auto &change: m_snapshot_changes.m_nodes)
+            {
+                auto node = change.m_node;
+                auto &previous = m_snapshot.m_states.Get(node->m_slot);
+                auto reuse = !change.m_created && previous && previous->m_id == node->m_id;
+
+                std::shared_ptr<NodeState> state(new NodeState);
+                state->m_node = node;
+                state->m_id = node->m_id;
+                state->m_type = node->m_type;
+                state->m_version = change.m_version;
+
+                if (reuse)
+                {
+                    state->m_keys = previous->m_keys;
+                    state->m_values = previous->m_values;
+                }
+                else
+                {
+                    std::shared_ptr<std::vector<Key>> keys(new std::vector<Key>);
+
+                    for (auto &param: node->m_paramset)
+                        keys->push_back(param.first);
+
+                    state->m_keys = std::move(keys);
+                    state->m_values.resize(node->m_paramset.size());
+                }
+
+                {
+                    std::unique_lock<RecursiveMutex> lock(node->GetMutex());
+
+                    auto changed = m_snapshot_changes.GetChangeSet(change);
+                    std::size_t index = 0;
+
+                    // Only changed values are copied, the rest is shared with the previous state
+                    for (auto &param: node->m_paramset)
+                    {
+                        if (!reuse || std::find(changed.begin(), changed.end(), param.first) != changed.end())
+                            state->m_values[index].reset(new Parameter(param.second.m_value));
+
+                        ++index;
+                    }
+                }
+
+                builder.Set(node->m_slot, std::move(state));
+            }
+
+            m_snapshot.m_states = builder.Build();
+            m_snapshot.m_version = m_snapshot_changes.m_version;
+
+            return m_snapshot;
+        }
+
+        /**
+            \brief Lock-free access to the state published by SwapBuffers.
+
+            Reader pins the front buffer for its lifetime: values it returns do not change until the reader is
+            destroyed, even if writers keep updating parameters or SwapBuffers is called meanwhile. Readers
+            should be short lived (one per frame), since the second SwapBuffers after the reader has been
+            created waits for it. Once a reader has been created or SwapBuffers has been called, deleted nodes are
+            disposed by the second SwapBuffers after their deletion, so readers may still read nodes deleted
+            while they exist.
+         */
+        class FrontReader
+        {
+        public:
+            explicit FrontReader(SceneGraph &sg)
+                    : m_sg(sg)
+            {
+                if (!m_sg.m_front_enabled.load())
+                    m_sg.m_front_enabled = true;
+
+                // Retry if the buffer has been swapped before we announced ourselves
+                for (;;)
+                {
+                    m_index = m_sg.m_front_index.load();
+                    ++m_sg.m_front_readers[m_index];
+
+                    if (m_index == m_sg.m_front_index.load())
+                        break;
+
+                    --m_sg.m_front_readers[m_index];
+                }
+            }
+
+            ~FrontReader()
+            {
+                --m_sg.m_front_readers[m_index];
+            }
+
+            FrontReader(FrontReader const &) = delete;
+
+            FrontReader &operator=(FrontReader const &) = delete;
+
+            /// \brief Get published parameter value.
+            /// \details If the key does not exist in the node or the value has not been published yet (the node
+            /// has been created after the last SwapBuffers call) std::runtime_error is thrown.
+            template<typename T>
+            typename std::decay<T>::type const &GetValue(Node *node, Key const &key) const
+            {
+                // Parameter sets do not change after node construction, so no locking is needed here
+                auto iter = node->m_paramset.find(key);
+
+                if (iter == node->m_paramset.cend())
+                    throw std::runtime_error("Requested parameter not found");
+
+                auto front = iter->second.m_front.load(std::memory_order_acquire);
+
+                if (!front || !front->m_published[m_index])
+                    throw std::runtime_error("Requested parameter has not been published");
+
+                return front->m_values[m_index].template As<T>();
+            }
+
+        private:
+            /// Scene graph
+            SceneGraph &m_sg;
+            /// Pinned buffer
+            unsigned m_index;
+        };
+
+        /// \brief Publish current parameter values to FrontReader.
+        /// \details Only parameters changed since the target buffer has been published last time are copied.
+        /// The call is meant to be made by the writer between frames: changes made concurrently with it might
+        /// be published partially. Waits for readers created before the previous swap and disposes nodes deleted
+        /// before it.
+        void SwapBuffers()
+        {
+            std::unique_lock<Mutex> swap_lock(m_swap_mutex);
+
+            m_front_enabled = true;
+
+            auto back = 1 - m_front_index.load();
+
+            while (m_front_readers[back].load() > 0)
+                std::this_thread::yield();
+
+            // Readers which might have seen nodes retired before the previous swap are gone
+            std::vector<std::unique_ptr<Node>> disposed;
+
+            {
+                std::unique_lock<Mutex> lock(m_front_retired_mutex);
+                disposed.swap(m_front_retired[1]);
+                std::swap(m_front_retired[0], m_front_retired[1]);
+            }
+
+            // The back buffer has missed changes of the last two frames
+            CollectChangesSince(m_buffer_version[back], m_swap_changes);
+
+            for (auto &change: m_swap_changes.m_nodes)
+            {
+                auto node = change.m_node;
+
+                std::unique_lock<RecursiveMutex> lock(node->GetMutex());
+
+                for (auto &key: m_swap_changes.GetChangeSet(change))
+                {
+                    auto &slot = node->m_paramset.find(key)->second;
+                    auto front = slot.m_front.load(std::memory_order_relaxed);
+
+                    if (front)
+                    {
+                        front->m_values[back] = slot.m_value;
+                        front->m_published[back] = true;
+                        continue;
+                    }
+
+                    // Readers may look for values of the other buffer meanwhile
+                    front = new typename Node::FrontValues;
+                    front->m_values[back] = slot.m_value;
+                    front->m_published[back] = true;
+                    front->m_published[1 - back] = false;
+                    slot.m_front.store(front, std::memory_order_release);
+                }
+            }
+
+            m_buffer_version[back] = m_swap_changes.m_version;
+            m_front_index = back;
+        }
+
+        /// Parent index of root nodes in Hierarchy.
+        static std::size_t const kNoParent = static_cast<std::size_t>(-1);
+
+        /**
+            \brief Scene hierarchy flattened in depth-first order.
+
+            Every node is immediately followed by its subtree, so the subtree of the node at index i occupies
+            indices [i, i + GetSubtreeSize(i)) and parents always precede their children. Traversing the whole
+            scene is a linear pass over the arrays. Roots are ordered by the time they became roots, children by
+            the time they were attached.
+         */
+        class Hierarchy
+        {
+        public:
+            /// Return the number of nodes.
+            std::size_t GetSize() const
+            { return m_nodes.size(); }
+
+            /// Return the node at a given index.
+            Node *GetNode(std::size_t index) const
+            { return m_nodes[index]; }
+
+            /// Return the index of the parent of the node at a given index or kNoParent.
+            std::size_t GetParentIndex(std::size_t index) const
+            { return m_parents[index]; }
+
+            /// Return the number of nodes in the subtree of the node at a given index (including the node).
+            std::size_t GetSubtreeSize(std::size_t index) const
+            { return m_sizes[index]; }
+
+            /// Return the index of a node.
+            std::size_t GetIndex(Node const *node) const
+            { return node->m_hierarchy_index; }
+
+            /// Return nodes in depth-first order.
+            Span<Node *const> GetNodes() const
+            { return Span<Node *const>(m_nodes.data(), m_nodes.size()); }
+
+            /// Return parent indices in depth-first order.
+            Span<std::size_t const> GetParentIndices() const
+            { return Span<std::size_t const>(m_parents.data(), m_parents.size()); }
+
+            /// Return subtree sizes in depth-first order.
+            Span<std::size_t const> GetSubtreeSizes() const
+            { return Span<std::size_t const>(m_sizes.data(), m_sizes.size()); }
+
+            /// \brief Return the number of times the hierarchy has been rebuilt.
+            /// \details Indices of nodes do not change while the generation stays the same, nodes are only
+            /// appended to or removed from the end.
+            std::uint64_t GetGeneration() const
+            { return m_generation; }
+
+        private:
+            friend class SceneGraph<Key, NodeType, Parameter, ThreadingPolicy>;
+
+            Hierarchy()
+                    : m_generation(0)
+            {
+            }
+
+            /// Nodes
+            std::vector<Node *> m_nodes;
+            /// Parent indices
+            std::vector<std::size_t> m_parents;
+            /// Subtree sizes
+            std::vector<std::size_t> m_sizes;
+            /// Number of rebuilds
+            std::uint64_t m_generation;
+        };
+
+        /// \brief Attach the node to a new parent as its last child.
+        /// \details Passing nullptr as the parent makes the node the last root. The subtree of the node moves
+        /// together with it. If either node is not in the scene or the parent belongs to the subtree of the node
+        /// std::runtime_error is thrown.
+        void SetParent(Node *node, Node *parent)
+        {
+            std::unique_lock<RecursiveMutex> lock(m_nodes_mutex);
+
+            if (m_nodes.find(node) == m_nodes.cend() || (parent && m_nodes.find(parent) == m_nodes.cend()))
+                throw std::runtime_error("There is no such node in the scene");
+
+            for (auto ancestor = parent; ancestor; ancestor = ancestor->m_parent)
+            {
+                if (ancestor == node)
+                    throw std::runtime_error("The node can not be attached to its own subtree");
+            }
+
+            DetachNode(node);
+            AttachNode(node, parent);
+            m_hierarchy_dirty = true;
+        }
+
+        /// \brief Delete the node together with its subtree.
+        /// \details Observers are notified about deletions in depth-first order, see DeleteNode.
+        void DeleteSubtree(Node *node)
+        {
+            std::vector<Event> events;
+            std::vector<Key const *> keys;
+            std::vector<std::unique_ptr<Node>> deleted;
+
+            {
+                std::unique_lock<RecursiveMutex> nodes_lock(m_nodes_mutex);
+
+                if (m_nodes.find(node) == m_nodes.cend())
+                    throw std::runtime_error("There is no such node to delete");
+
+                VisitSubtree(node, [&events](Node *descendant)
+                { events.push_back(Event{EventType::kDelete, descendant, 0, 0}); });
+
+                // The subtree of the last root is the tail of the flattened hierarchy
+                if (node->m_parent || node->m_next_sibling)
+                    m_hierarchy_dirty = true;
+                else if (!m_hierarchy_dirty)
+                    TruncateHierarchy(node->m_hierarchy_index);
+
+                DetachNode(node);
+
+                for (auto &event: events)
+                {
+                    auto descendant = event.m_node;
+                    descendant->m_first_child = descendant->m_last_child = nullptr;
+                    descendant->m_parent = descendant->m_prev_sibling = descendant->m_next_sibling = nullptr;
+                    deleted.push_back(EraseNode(m_nodes.find(descendant)));
+                }
+
+                for (auto &event: events)
+                    TrackDelete(event.m_node);
+            }
+
+            DispatchEvents(events, keys, deleted);
+        }
+
+        /// \brief Return the hierarchy flattened in depth-first order.
+        /// \details The hierarchy is rebuilt after structural changes (SetParent, deletion of a node having a
+        /// parent or children), creating nodes only appends to it. The result stays valid until the next change
+        /// of the scene structure, which must not be made concurrently with reading it.
+        Hierarchy const &GetHierarchy()
+        {
+            std::unique_lock<RecursiveMutex> lock(m_nodes_mutex);
+
+            if (m_hierarchy_dirty)
+                RebuildHierarchy();
+
+            return m_hierarchy;
+        }
+
+        /// \brief Register callback for a node creation.
+        /// \details Safe to call concurrently with scene edits.
+        /// \return Subscription token which can be passed to UnregisterCallback.
+        Subscription RegisterOnNodeCreateCallback(OnNodeCreateCallback cb, std::set<NodeType> filter = {})
+        {
+            Subscription subscription(++m_last_subscription);
+            m_cb_create.Add(subscription, FilteredCallback<OnNodeCreateCallback>(cb, filter));
+            return subscription;
+        }
+
+        /// \brief Register callback for a node deletion.
+        /// \details Safe to call concurrently with scene edits.
+        /// \return Subscription token which can be passed to UnregisterCallback.
+        Subscription RegisterOnNodeDeleteCallback(OnNodeDeleteCallback cb, std::set<NodeType> filter = {})
+        {
+            Subscription subscription(++m_last_subscription);
+            m_cb_delete.Add(subscription, FilteredCallback<OnNodeDeleteCallback>(cb, filter));
+            return subscription;
+        }
+
+        /// \brief Register parameter change callback.
+        /// \details Safe to call concurrently with scene edits. The callback can be restricted to particular
+        /// parameter keys in addition to node types, in this case it is only called for changes of those keys.
+        /// \param cb Callback.
+        /// \param filter Node types of interest (empty means all types).
+        /// \param keys Parameter keys of interest (empty means all keys).
+        /// \return Subscription token which can be passed to UnregisterCallback.
+        Subscription RegisterOnNodeParameterChangeCallback(OnNodeParameterChangeCallback cb,
+                                                           std::set<NodeType> filter = {},
+                                                           std::set<Key> keys = {})
+        {
+            Subscription subscription(++m_last_subscription);
+            m_cb_change.Add(subscription, FilteredCallback<OnNodeParameterChangeCallback>(cb, filter), keys);
+            return subscription;
+        }
+
+        /// \brief Register callback receiving all the keys changed by a single update of a node at once.
+        /// \details Called once per node for a committed Transaction and once per SetValue / ModifyValue
+        /// otherwise. Safe to call concurrently with scene edits.
+        /// \return Subscription token which can be passed to UnregisterCallback.
+        Subscription RegisterOnNodeChangeSetCallback(OnNodeChangeSetCallback cb, std::set<NodeType> filter = {})
+        {
+            Subscription subscription(++m_last_subscription);
+            m_cb_change_set.Add(subscription, FilteredCallback<OnNodeChangeSetCallback>(cb, filter));
+            return subscription;
+        }
+
+        /// \brief Register callback receiving events in batches.
+        /// \details In kDeferred and kCoalesced modes every Flush() delivers a single batch with all the flushed
+        /// events, in other modes every event is delivered as a batch of one record. Batch callbacks are called
+        /// after per-event callbacks. Safe to call concurrently with scene edits.
+        /// \return Subscription token which can be passed to UnregisterCallback.
+        Subscription RegisterOnEventBatchCallback(OnEventBatchCallback cb)
+        {
+            Subscription subscription(++m_last_subscription);
+            m_cb_batch.Add(subscription, FilteredCallback<OnEventBatchCallback>(cb, {}));
+            return subscription;
+        }
+
+        /// \brief Unregister previously registered callback.
+        /// \details Takes constant time and is safe to call concurrently with scene edits, including from within
+        /// a callback. The callback might still be executing on other threads when the call returns.
+        /// \return true if the callback has been found and unregistered.
+        bool UnregisterCallback(Subscription const &subscription)
+        {
+            return m_cb_create.Remove(subscription) ||
+                   m_cb_delete.Remove(subscription) ||
+                   m_cb_change.Remove(subscription) ||
+                   m_cb_change_set.Remove(subscription) ||
+                   m_cb_batch.Remove(subscription);
+        }
+
+
+    private:
+        /// Node::m_dirty_index value for nodes not in the dirty set.
+        static std::size_t const kNotDirty = static_cast<std::size_t>(-1);
+
+        /// Event kinds.
+        enum class EventType
+        {
+            kCreate,
+            kDelete,
+            kChange
+        };
+
+        using Slot = typename Node::Slot;
+
+        /// Number of shards of the version ordered list of nodes.
+        static std::size_t const kNumChangeShards = 16;
+
+        /// Part of the version ordered list of nodes, nodes belong to shards by their slots.
+        struct ChangeShard
+        {
+            ChangeShard()
+                    : m_last_changed(nullptr)
+            {
+            }
+
+            /// Most recently changed node, the tail of the list
+            Node *m_last_changed;
+            /// Guards the list and versions of its nodes
+            mutable Mutex m_mutex;
+            /// Keeps shards on separate cache lines
+            char m_pad[64];
+        };
+
+        /// Forget deletions up to a given version (m_changes_mutex has to be locked).
+        void DiscardDeletions(std::uint64_t version)
+        {
+            if (m_snapshot_taken)
+                version = std::min(version, m_snapshot_version);
+
+            auto iter = std::upper_bound(m_deletions.begin(), m_deletions.end(), version,
+                                         [](std::uint64_t version, Deletion const &deletion)
+                                         { return version < deletion.m_version; });
+            m_deletions.erase(m_deletions.begin(), iter);
+        }
+
+        /// Forget deletions collected by all the registered pollers and the snapshot (m_changes_mutex has to be
+        /// locked).
+        void DiscardCollectedDeletions()
+        {
+            if (m_deletions.empty())
+                return;
+
+            auto version = m_deletions.back().m_version;
+
+            for (auto &poller: m_poller_versions)
+                version = std::min(version, poller.second);
+
+            DiscardDeletions(version);
+        }
+
+        /// Batch record arrays.
+        struct BatchBuffers
+        {
+            std::vector<NodeRecord> m_created;
+            std::vector<NodeRecord> m_deleted;
+            std::vector<ChangeRecord> m_changed;
+        };
+
+        /// Queued event.
+        struct Event
+        {
+            /// Event kind
+            EventType m_type;
+            /// Node
+            Node *m_node;
+            /// Changed keys: offset in the key buffer and the number of keys
+            std::size_t m_first_key;
+            std::size_t m_num_keys;
+        };
+
+        /// Apply transaction updates.
+        void ApplyUpdates(std::vector<typename Transaction::Update> &recorded)
+        {
+            std::vector<typename Transaction::Update *> updates;
+            updates.reserve(recorded.size());
+
+            for (auto &update: recorded)
+                updates.push_back(&update);
+
+            // A missing key does not leave the scene half-updated
+            ResolveUpdates(updates);
+
+            std::vector<Event> events;
+            std::vector<Key const *> keys;
+            std::vector<Slot *> slots;
+            ApplyResolvedUpdates(updates, events, keys, slots);
+
+            for (auto &event: events)
+                TrackChanges(event.m_node, slots.data() + event.m_first_key, event.m_num_keys);
+
+            std::vector<std::unique_ptr<Node>> deleted;
+            DispatchEvents(events, keys, deleted);
+        }
+
+        /// \brief Find parameters targeted by updates.
+        /// \details Throws std::runtime_error if any of the keys does not exist.
+        static void ResolveUpdates(std::vector<typename Transaction::Update *> const &updates)
+        {
+            // Parameter sets do not change after node construction, so no locking is needed here
+            for (auto update: updates)
+            {
+                auto iter = update->m_node->m_paramset.find(update->m_key);
+
+                if (iter == update->m_node->m_paramset.end())
+                    throw std::runtime_error("Requested parameter not found");
+
+                update->m_target = &iter->second;
+                update->m_target_key = &iter->first;
+            }
+        }
+
+        /// \brief Apply resolved updates locking every node once.
+        /// \details Appends a change event per node, nodes are ordered by identifier and keys are listed once
+        /// along with their slots.
+        static void ApplyResolvedUpdates(std::vector<typename Transaction::Update *> &updates,
+                                         std::vector<Event> &events, std::vector<Key const *> &keys,
+                                         std::vector<Slot *> &slots)
+        {
+            using Update = typename Transaction::Update;
+
+            // Group updates by node preserving their order within the node
+            std::stable_sort(updates.begin(), updates.end(), [](Update const *lhs, Update const *rhs)
+            { return lhs->m_node->m_id < rhs->m_node->m_id; });
+
+            for (auto first = updates.cbegin(); first != updates.cend();)
+            {
+                auto node = (*first)->m_node;
+                auto last = first;
+
+                // Apply all the updates of the node under a single lock
+                {
+                    std::unique_lock<RecursiveMutex> lock(node->GetMutex());
+
+                    for (; last != updates.cend() && (*last)->m_node == node; ++last)
+                    {
+                        auto update = *last;
+
+                        if (update->m_modifier)
+                            update->m_modifier(update->m_target->m_value);
+                        else
+                            update->m_target->m_value = std::move(update->m_value);
+                    }
+                }
+
+                // Collect unique keys of the node
+                auto first_key = keys.size();
+
+                for (auto update = first; update != last; ++update)
+                {
+                    if (std::find(keys.cbegin() + first_key, keys.cend(), (*update)->m_target_key) == keys.cend())
+                    {
+                        keys.push_back((*update)->m_target_key);
+                        slots.push_back((*update)->m_target);
+                    }
+                }
+
+                events.push_back(Event{EventType::kChange, node, first_key, keys.size() - first_key});
+
+                first = last;
+            }
+        }
+
+        /// \brief Dispatch tracked events according to the dispatch mode.
+        /// \details In kImmediate mode batch observers receive all the events at once. Deleted nodes are listed
+        /// in the order of their delete events and get disposed once observers are done.
+        void DispatchEvents(std::vector<Event> const &events, std::vector<Key const *> const &keys,
+                            std::vector<std::unique_ptr<Node>> &deleted)
+        {
+            if (m_dispatch_mode == DispatchMode::kImmediate)
+            {
+                for (auto &event: events)
+                    FireOnEvent(event, keys);
+
+                if (!events.empty() && !m_cb_batch.IsEmpty())
+                {
+                    // Borrow the spare buffers, nested or concurrent dispatches get buffers of their own
+                    BatchBuffers batch;
+
+                    {
+                        std::unique_lock<Mutex> lock(m_events_mutex);
+                        std::swap(batch, m_spare_batch);
+                    }
+
+                    FireOnEventBatch(events, keys, batch);
+
+                    std::unique_lock<Mutex> lock(m_events_mutex);
+                    std::swap(batch, m_spare_batch);
+                }
+
+                Dispose(deleted);
+                return;
+            }
+
+            auto retired = deleted.begin();
+
+            for (auto &event: events)
+            {
+                switch (event.m_type)
+                {
+                    case EventType::kCreate:
+                        NotifyCreate(event.m_node);
+                        break;
+                    case EventType::kDelete:
+                        NotifyDelete(std::move(*retired++));
+                        break;
+                    case EventType::kChange:
+                        DispatchParameterChanges(event.m_node, keys.data() + event.m_first_key, event.m_num_keys);
+                        break;
+                }
+            }
+
+            deleted.clear();
+        }
+
+        /// \brief Check that nodes to delete exist and are listed once (m_nodes_mutex has to be held).
+        /// \details Throws std::runtime_error otherwise.
+        void ValidateDeletions(std::vector<Node *> const &deletions, std::vector<std::unique_ptr<Node>> const &created)
+        {
+            std::vector<Node *> sorted(deletions);
+            std::sort(sorted.begin(), sorted.end(), std::less<Node *>());
+
+            if (std::adjacent_find(sorted.cbegin(), sorted.cend()) != sorted.cend())
+                throw std::runtime_error("The node is deleted more than once");
+
+            // Nodes created by the same transaction are sorted once the first of them is deleted
+            std::vector<Node *> sorted_created;
+
+            for (auto node: deletions)
+            {
+                if (m_nodes.find(node) != m_nodes.cend())
+                    continue;
+
+                if (sorted_created.empty() && !created.empty())
+                {
+                    sorted_created.reserve(created.size());
+
+                    for (auto &ptr: created)
+                        sorted_created.push_back(ptr.get());
+
+                    std::sort(sorted_created.begin(), sorted_created.end(), std::less<Node *>());
+                }
+
+                if (!std::binary_search(sorted_created.cbegin(), sorted_created.cend(), node, std::less<Node *>()))
+                    throw std::runtime_error("There is no such node to delete");
+            }
+        }
+
+        /// Add the node to the scene assigning its slot and identifier (m_nodes_mutex has to be held).
+        void InsertNode(std::unique_ptr<Node> node)
+        {
+            node->m_id = ++m_last_node_id;
+
+            if (m_free_slots.empty())
+            {
+                node->m_slot = m_num_slots++;
+            }
+            else
+            {
+                node->m_slot = m_free_slots.back();
+                m_free_slots.pop_back();
+            }
+
+            auto ptr = node.get();
+            m_nodes.emplace(ptr, std::move(node));
+
+            AttachNode(ptr, nullptr);
+
+            // New roots go to the end of the flattened hierarchy
+            if (!m_hierarchy_dirty)
+                AppendToHierarchy(ptr, kNoParent);
+        }
+
+        using NodeSet = std::unordered_map<Node *, std::unique_ptr<Node>>;
+
+        /// Remove the node from the scene releasing its slot (m_nodes_mutex has to be held).
+        std::unique_ptr<Node> EraseNode(typename NodeSet::iterator iter)
+        {
+            m_free_slots.push_back(iter->first->m_slot);
+
+            auto erased = std::move(iter->second);
+            m_nodes.erase(iter);
+            return erased;
+        }
+
+        /// \brief Unlink the node from the hierarchy (m_nodes_mutex has to be held).
+        /// \details Children of the node take its place among the children of its parent.
+        void RemoveFromHierarchy(Node *node)
+        {
+            if (node->m_first_child)
+            {
+                for (auto child = node->m_first_child; child; child = child->m_next_sibling)
+                    child->m_parent = node->m_parent;
+
+                auto &first = node->m_parent ? node->m_parent->m_first_child : m_first_root;
+                auto &last = node->m_parent ? node->m_parent->m_last_child : m_last_root;
+
+                node->m_first_child->m_prev_sibling = node->m_prev_sibling;
+                node->m_last_child->m_next_sibling = node->m_next_sibling;
+                (node->m_prev_sibling ? node->m_prev_sibling->m_next_sibling : first) = node->m_first_child;
+                (node->m_next_sibling ? node->m_next_sibling->m_prev_sibling : last) = node->m_last_child;
+
+                node->m_first_child = node->m_last_child = nullptr;
+                node->m_parent = node->m_prev_sibling = node->m_next_sibling = nullptr;
+                m_hierarchy_dirty = true;
+            }
+            else
+            {
+                // Only a trailing root can be dropped without rebuilding the hierarchy
+                if (node->m_parent || node->m_next_sibling)
+                    m_hierarchy_dirty = true;
+                else if (!m_hierarchy_dirty)
+                    TruncateHierarchy(node->m_hierarchy_index);
+
+                DetachNode(node);
+            }
+        }
+
+        /// Unlink the node from its parent or from the list of roots (m_nodes_mutex has to be held).
+        void DetachNode(Node *node)
+        {
+            auto &first = node->m_parent ? node->m_parent->m_first_child : m_first_root;
+            auto &last = node->m_parent ? node->m_parent->m_last_child : m_last_root;
+
+            (node->m_prev_sibling ? node->m_prev_sibling->m_next_sibling : first) = node->m_next_sibling;
+            (node->m_next_sibling ? node->m_next_sibling->m_prev_sibling : last) = node->m_prev_sibling;
+
+            node->m_parent = node->m_prev_sibling = node->m_next_sibling = nullptr;
+        }
+
+        /// Link the node as the last child of the parent or as the last root (m_nodes_mutex has to be held).
+        void AttachNode(Node *node, Node *parent)
+        {
+            auto &first = parent ? parent->m_first_child : m_first_root;
+            auto &last = parent ? parent->m_last_child : m_last_root;
+
+            node->m_parent = parent;
+            node->m_prev_sibling = last;
+            node->m_next_sibling = nullptr;
+
+            (last ? last->m_next_sibling : first) = node;
+            last = node;
+        }
+
+        /// Visit the subtree of the node in depth-first order following hierarchy links.
+        template<typename Visitor>
+        static void VisitSubtree(Node *root, Visitor &&visitor)
+        {
+            auto node = root;
+
+            for (;;)
+            {
+                visitor(node);
+
+                if (node->m_first_child)
+                {
+                    node = node->m_first_child;
+                    continue;
+                }
+
+                while (node != root && !node->m_next_sibling)
+                    node = node->m_parent;
+
+                if (node == root)
+                    return;
+
+                node = node->m_next_sibling;
+            }
+        }
+
+        /// Add the node to the end of the flattened hierarchy (m_nodes_mutex has to be held).
+        void AppendToHierarchy(Node *node, std::size_t parent)
+        {
+            node->m_hierarchy_index = m_hierarchy.m_nodes.size();
+            m_hierarchy.m_nodes.push_back(node);
+            m_hierarchy.m_parents.push_back(parent);
+            m_hierarchy.m_sizes.push_back(1);
+        }
+
+        /// Drop the tail of the flattened hierarchy (m_nodes_mutex has to be held).
+        void TruncateHierarchy(std::size_t size)
+        {
+            m_hierarchy.m_nodes.resize(size);
+            m_hierarchy.m_parents.resize(size);
+            m_hierarchy.m_sizes.resize(size);
+        }
+
+        /// Flatten the hierarchy following its links (m_nodes_mutex has to be held).
+        void RebuildHierarchy()
+        {
+            TruncateHierarchy(0);
+
+            for (auto root = m_first_root; root; root = root->m_next_sibling)
+            {
+                VisitSubtree(root, [this](Node *node)
+                {
+                    AppendToHierarchy(node, node->m_parent ? node->m_parent->m_hierarchy_index : kNoParent);
+                });
+            }
+
+            // Children follow their parents, so a backward pass accumulates subtree sizes
+            auto &parents = m_hierarchy.m_parents;
+            auto &sizes = m_hierarchy.m_sizes;
+
+            for (auto index = parents.size(); index-- > 0;)
+            {
+                if (parents[index] != kNoParent)
+                    sizes[parents[index]] += sizes[index];
+            }
+
+            ++m_hierarchy.m_generation;
+            m_hierarchy_dirty = false;
+        }
+
+        /// Event record passed through asynchronous dispatch queues.
+        struct AsyncEvent
+        {
+            /// Event kind
+            EventType m_type;
+            /// Number of changed keys
+            std::uint32_t m_num_keys;
+            /// Node (owned by the record for kDelete)
+            Node *m_node;
+            /// Changed key if there is one, otherwise array of changed keys (owned by the record)
+            union
+            {
+                Key const *m_key;
+                Key const **m_keys;
+            };
+            /// Time the event has been raised
+            std::int64_t m_timestamp;
+
+            /// Return changed keys.
+            Key const *const *GetKeys() const
+            { return m_num_keys == 1 ? &m_key : m_keys; }
+        };
+
+        /// Parameter change waiting in the overflow set.
+        struct OverflowEvent
+        {
+            /// Queue position the change has been raised at
+            std::size_t m_position;
+            /// Node
+            Node *m_node;
+            /// Changed key
+            Key const *m_key;
+            /// Time the change has been raised first
+            std::int64_t m_timestamp;
+        };
+
+        /// Asynchronous dispatch queue and its dispatcher thread.
+        struct AsyncShard
+        {
+            explicit AsyncShard(std::size_t capacity)
+                    : m_queue(capacity), m_sleeping(false), m_overflow_size(0), m_enqueued(0), m_delivered(0)
+                    , m_dropped(0), m_coalesced(0), m_max_depth(0), m_total_latency(0), m_max_latency(0)
+            {
+            }
+
+            /// Lock-free event queue
+            BoundedQueue<AsyncEvent> m_queue;
+            /// Dispatcher thread
+            std::thread m_thread;
+            /// Dispatcher wake up
+            std::mutex m_wake_mutex;
+            std::condition_variable m_wake;
+            std::atomic<bool> m_sleeping;
+            /// Coalesced parameter changes which did not fit into the queue, in the order of positions
+            std::deque<OverflowEvent> m_overflow;
+            std::unordered_set<Key const *> m_overflow_keys;
+            std::atomic<std::size_t> m_overflow_size;
+            std::mutex m_overflow_mutex;
+            /// Overflow events being delivered
+            std::vector<OverflowEvent> m_overflow_batch;
+            /// Counters
+            std::atomic<std::uint64_t> m_enqueued;
+            std::atomic<std::uint64_t> m_delivered;
+            std::atomic<std::uint64_t> m_dropped;
+            std::atomic<std::uint64_t> m_coalesced;
+            std::atomic<std::size_t> m_max_depth;
+            std::atomic<std::uint64_t> m_total_latency;
+            std::atomic<std::uint64_t> m_max_latency;
+        };
+
+        /// Current time for latency measurements.
+        static std::int64_t GetTimestamp()
+        {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        /// Start dispatcher threads.
+        void StartAsyncDispatch()
+        {
+            m_async_stop = false;
+            m_async_pending = 0;
+
+            for (std::size_t i = 0; i < m_async_options.m_num_threads; ++i)
+            {
+                m_shards.emplace_back(new AsyncShard(m_async_options.m_capacity));
+            }
+
+            m_async_policy = m_async_options.m_policy;
+
+            for (auto &shard: m_shards)
+            {
+                auto ptr = shard.get();
+                shard->m_thread = std::thread([this, ptr]()
+                                              { RunDispatcher(*ptr); });
+            }
+        }
+
+        /// Stop dispatcher threads once all the events are delivered.
+        void StopAsyncDispatch()
+        {
+            m_async_stop = true;
+
+            for (auto &shard: m_shards)
+            {
+                {
+                    std::unique_lock<std::mutex> lock(shard->m_wake_mutex);
+                    shard->m_wake.notify_one();
+                }
+
+                shard->m_thread.join();
+            }
+
+            m_shards.clear();
+        }
+
+        /// Pick a queue for the node: all the events of the node go through the same queue.
+        AsyncShard &GetShard(Node *node)
+        {
+            auto hash = static_cast<std::uint64_t>(reinterpret_cast<std::uintptr_t>(node)) * 0x9E3779B97F4A7C15ull;
+            return *m_shards[(hash >> 32) % m_shards.size()];
+        }
+
+        /// Push the event to the queue of its node applying backpressure policy.
+        void PublishAsync(AsyncEvent event)
+        {
+            auto &shard = GetShard(event.m_node);
+            auto droppable = event.m_type == EventType::kChange;
+
+            // Overflowed changes of a deleted node have to go before it gets disposed by the dispatcher
+            if (event.m_type == EventType::kDelete && shard.m_overflow_size.load() > 0)
+                PruneOverflow(shard, event.m_node);
+
+            event.m_timestamp = GetTimestamp();
+
+            // Account for the event before the dispatcher can see it
+            ++m_async_pending;
+
+            while (!shard.m_queue.TryPush(event, droppable))
+            {
+                if (droppable && m_async_policy == BackpressurePolicy::kDropOldest)
+                {
+                    AsyncEvent oldest;
+
+                    if (shard.m_queue.TryPopDroppable(oldest))
+                    {
+                        ReleaseAsyncEvent(oldest);
+                        ++shard.m_dropped;
+                        --m_async_pending;
+                        continue;
+                    }
+                }
+                else if (droppable && m_async_policy == BackpressurePolicy::kCoalesce)
+                {
+                    Overflow(shard, event);
+                    return;
+                }
+
+                WakeDispatcher(shard);
+                std::this_thread::yield();
+            }
+
+            ++shard.m_enqueued;
+
+            WakeDispatcher(shard);
+        }
+
+        /// Put parameter changes which do not fit into the queue into the overflow set.
+        void Overflow(AsyncShard &shard, AsyncEvent const &event)
+        {
+            {
+                std::unique_lock<std::mutex> lock(shard.m_overflow_mutex);
+
+                // Changes get delivered once everything raised before them has been delivered
+                auto position = shard.m_queue.GetEnqueuePosition();
+                auto keys = event.GetKeys();
+
+                for (std::uint32_t i = 0; i < event.m_num_keys; ++i)
+                {
+                    if (shard.m_overflow_keys.insert(keys[i]).second)
+                    {
+                        shard.m_overflow.push_back(OverflowEvent{position, event.m_node, keys[i], event.m_timestamp});
+                        ++shard.m_enqueued;
+                    }
+                    else
+                    {
+                        ++shard.m_coalesced;
+                    }
+                }
+
+                m_async_pending += static_cast<std::int64_t>(shard.m_overflow.size() - shard.m_overflow_size) - 1;
+                shard.m_overflow_size = shard.m_overflow.size();
+            }
+
+            ReleaseAsyncEvent(event);
+            WakeDispatcher(shard);
+        }
+
+        /// Remove overflowed changes of a given node.
+        void PruneOverflow(AsyncShard &shard, Node *node)
+        {
+            std::unique_lock<std::mutex> lock(shard.m_overflow_mutex);
+
+            auto iter = std::remove_if(shard.m_overflow.begin(), shard.m_overflow.end(),
+                                       [node](OverflowEvent const &event)
+                                       { return event.m_node == node; });
+
+            for (auto event = iter; event != shard.m_overflow.end(); ++event)
+                shard.m_overflow_keys.erase(event->m_key);
+
+            m_async_pending -= static_cast<std::int64_t>(std::distance(iter, shard.m_overflow.end()));
+            shard.m_overflow.erase(iter, shard.m_overflow.end());
+            shard.m_overflow_size = shard.m_overflow.size();
+        }
+
+        /// Wake up the dispatcher if it is waiting for events.
+        void WakeDispatcher(AsyncShard &shard)
+        {
+            if (shard.m_sleeping.load())
+            {
+                std::unique_lock<std::mutex> lock(shard.m_wake_mutex);
+                shard.m_wake.notify_one();
+            }
+        }
+
+        /// Free memory owned by an event which is not going to be delivered.
+        static void ReleaseAsyncEvent(AsyncEvent const &event)
+        {
+            if (event.m_type == EventType::kChange && event.m_num_keys != 1)
+                delete[] event.m_keys;
+        }
+
+        /// Dispatcher thread loop.
+        void RunDispatcher(AsyncShard &shard)
+        {
+            for (;;)
+            {
+                AsyncEvent event;
+
+                if (shard.m_queue.TryPop(event))
+                {
+                    // Sample depth including the event being delivered
+                    auto depth = shard.m_queue.GetSize() + 1;
+
+                    if (depth > shard.m_max_depth.load(std::memory_order_relaxed))
+                        shard.m_max_depth.store(depth, std::memory_order_relaxed);
+
+                    DeliverAsync(shard, event);
+                }
+
+                if (shard.m_overflow_size.load() > 0 && DeliverOverflow(shard))
+                    continue;
+
+                if (shard.m_queue.GetSize() > 0)
+                    continue;
+
+                if (m_async_stop)
+                    break;
+
+                // Nothing to do: sleep until a producer wakes us up
+                std::unique_lock<std::mutex> lock(shard.m_wake_mutex);
+                shard.m_sleeping = true;
+
+                if (shard.m_queue.GetSize() == 0 && shard.m_overflow_size.load() == 0 && !m_async_stop)
+                    shard.m_wake.wait_for(lock, std::chrono::milliseconds(10));
+
+                shard.m_sleeping = false;
+            }
+        }
+
+        /// Deliver an event popped from the queue.
+        void DeliverAsync(AsyncShard &shard, AsyncEvent const &event)
+        {
+            FireEvent(event.m_type, event.m_node, event.GetKeys(), event.m_num_keys);
+
+            // Delete records own the node, change records might own keys
+            if (event.m_type == EventType::kDelete)
+                Dispose(std::unique_ptr<Node>(event.m_node));
+            else
+                ReleaseAsyncEvent(event);
+
+            RecordDelivery(shard, event.m_timestamp);
+        }
+
+        /// \brief Deliver overflowed changes for which all the preceding events have been delivered.
+        /// \return true if anything has been delivered.
+        bool DeliverOverflow(AsyncShard &shard)
+        {
+            auto position = shard.m_queue.GetDequeuePosition();
+            auto &batch = shard.m_overflow_batch;
+
+            {
+                std::unique_lock<std::mutex> lock(shard.m_overflow_mutex);
+
+                while (!shard.m_overflow.empty() && shard.m_overflow.front().m_position <= position)
+                {
+                    batch.push_back(shard.m_overflow.front());
+                    shard.m_overflow_keys.erase(batch.back().m_key);
+                    shard.m_overflow.pop_front();
+                }
+
+                shard.m_overflow_size = shard.m_overflow.size();
+            }
+
+            for (auto &event: batch)
+            {
+                FireEvent(EventType::kChange, event.m_node, &event.m_key, 1);
+                RecordDelivery(shard, event.m_timestamp);
+            }
+
+            auto delivered = !batch.empty();
+            batch.clear();
+            return delivered;
+        }
+
+        /// Update counters after an event has been delivered.
+        void RecordDelivery(AsyncShard &shard, std::int64_t timestamp)
+        {
+            auto latency = static_cast<std::uint64_t>(GetTimestamp() - timestamp);
+
+            shard.m_total_latency.fetch_add(latency, std::memory_order_relaxed);
+
+            if (latency > shard.m_max_latency.load(std::memory_order_relaxed))
+                shard.m_max_latency.store(latency, std::memory_order_relaxed);
+
+            shard.m_delivered.fetch_add(1, std::memory_order_relaxed);
+            --m_async_pending;
+        }
+
+        /// Issue the next scene graph version.
+        std::uint64_t NextVersion()
+        {
+            // Without concurrent writers there is no need for an atomic increment
+            if (!ThreadingPolicy::kThreadSafe)
+            {
+                auto version = m_version.load(std::memory_order_relaxed) + 1;
+                m_version.store(version, std::memory_order_relaxed);
+                return version;
+            }
+
+            return ++m_version;
+        }
+
+        /// Return the change shard of a node.
+        ChangeShard &GetChangeShard(Node const *node)
+        { return m_change_shards[node->m_slot % kNumChangeShards]; }
+
+        /// \brief Assign the next version to the node and move it to the tail of its shard list.
+        /// \details The shard mutex has to be held, so versions grow along every shard list.
+        /// \return The version.
+        std::uint64_t Touch(ChangeShard &shard, Node *node)
+        {
+            auto version = NextVersion();
+            node->m_version.store(version, std::memory_order_relaxed);
+
+            if (shard.m_last_changed == node)
+                return version;
+
+            Unlink(shard, node);
+
+            node->m_prev = shard.m_last_changed;
+            node->m_next = nullptr;
+
+            if (shard.m_last_changed)
+                shard.m_last_changed->m_next = node;
+
+            shard.m_last_changed = node;
+            return version;
+        }
+
+        /// Remove the node from its shard list (the shard mutex has to be held).
+        static void Unlink(ChangeShard &shard, Node *node)
+        {
+            if (node->m_prev)
+                node->m_prev->m_next = node->m_next;
+
+            if (node->m_next)
+                node->m_next->m_prev = node->m_prev;
+
+            if (shard.m_last_changed == node)
+                shard.m_last_changed = node->m_prev;
+
+            node->m_prev = node->m_next = nullptr;
+        }
+
+        /// Record node creation.
+        void TrackCreate(Node *node)
+        {
+            auto &shard = GetChangeShard(node);
+            std::unique_lock<Mutex> lock(shard.m_mutex);
+
+            auto version = Touch(shard, node);
+            node->m_created_version = version;
+
+            for (auto &param: node->m_paramset)
+                param.second.m_version.store(version, std::memory_order_relaxed);
+        }
+
+        /// Record node deletion.
+        void TrackDelete(Node *node)
+        {
+            auto &shard = GetChangeShard(node);
+            std::unique_lock<Mutex> lock(shard.m_mutex);
+            Unlink(shard, node);
+
+            // The deletion is recorded before the shard is unlocked, so collectors see either the node or it
+            std::unique_lock<Mutex> changes_lock(m_changes_mutex);
+            auto version = NextVersion();
+
+            // Without pollers and snapshots nobody is ever going to collect the deletion
+            if (!m_poller_versions.empty() || m_snapshot_taken)
+                m_deletions.push_back(Deletion{version, node->m_created_version, node, node->m_slot});
+        }
+
+        /// Record changes of resolved parameters (slots have to point into the node).
+        void TrackChanges(Node *node, Slot *const *slots, std::size_t num_slots)
+        {
+            auto &shard = GetChangeShard(node);
+            std::unique_lock<Mutex> lock(shard.m_mutex);
+
+            auto version = Touch(shard, node);
+
+            for (std::size_t i = 0; i < num_slots; ++i)
+                slots[i]->m_version.store(version, std::memory_order_relaxed);
+        }
+
+        /// Dispatch node creation.
+        void NotifyCreate(Node *node)
+        {
+            if (m_dispatch_mode == DispatchMode::kImmediate)
+            {
+                FireEvent(EventType::kCreate, node, nullptr, 0);
+                return;
+            }
+
+            if (m_dispatch_mode == DispatchMode::kAsync)
+            {
+                AsyncEvent event;
+                event.m_type = EventType::kCreate;
+                event.m_num_keys = 0;
+                event.m_node = node;
+                event.m_key = nullptr;
+                PublishAsync(event);
+                return;
+            }
+
+            std::unique_lock<Mutex> lock(m_events_mutex);
+            m_events.push_back(Event{EventType::kCreate, node, 0, 0});
+        }
+
+        /// Dispatch node deletion and dispose the node once observers are done.
+        void NotifyDelete(std::unique_ptr<Node> node)
+        {
+            if (m_dispatch_mode == DispatchMode::kImmediate)
+            {
+                FireEvent(EventType::kDelete, node.get(), nullptr, 0);
+                Dispose(std::move(node));
+                return;
+            }
+
+            if (m_dispatch_mode == DispatchMode::kAsync)
+            {
+                // The dispatcher disposes the node after delivery
+                AsyncEvent event;
+                event.m_type = EventType::kDelete;
+                event.m_num_keys = 0;
+                event.m_node = node.release();
+                event.m_key = nullptr;
+                PublishAsync(event);
+                return;
+            }
+
+            std::unique_lock<Mutex> lock(m_events_mutex);
+
+            if (node->m_dirty_index != kNotDirty)
+                RemoveDirty(node.get());
+
+            m_events.push_back(Event{EventType::kDelete, node.get(), 0, 0});
+            m_retired.push_back(std::move(node));
+        }
+
+        /// Free a deleted node or retire it until FrontReader instances which might read it are gone.
+        void Dispose(std::unique_ptr<Node> node)
+        {
+            if (!m_front_enabled.load())
+                return;
+
+            std::unique_lock<Mutex> lock(m_front_retired_mutex);
+            m_front_retired[0].push_back(std::move(node));
+        }
+
+        /// Dispose deleted nodes keeping the capacity of the vector.
+        void Dispose(std::vector<std::unique_ptr<Node>> &nodes)
+        {
+            if (m_front_enabled.load() && !nodes.empty())
+            {
+                std::unique_lock<Mutex> lock(m_front_retired_mutex);
+
+                for (auto &node: nodes)
+                    m_front_retired[0].push_back(std::move(node));
+            }
+
+            nodes.clear();
+        }
+
+        /// Add changed keys to the dirty set (m_events_mutex has to be held).
+        void AddDirty(Node *node, Key const *const *keys, std::size_t num_keys)
+        {
+            if (node->m_dirty_index == kNotDirty)
+            {
+                node->m_dirty_index = m_dirty_nodes.size();
+                m_dirty_nodes.push_back(node);
+            }
+
+            // Nodes have few parameters, so linear search beats hashing here
+            auto &dirty_keys = node->m_dirty_keys;
+
+            for (std::size_t i = 0; i < num_keys; ++i)
+            {
+                if (std::find(dirty_keys.cbegin(), dirty_keys.cend(), keys[i]) == dirty_keys.cend())
+                    dirty_keys.push_back(keys[i]);
+            }
+        }
+
+        /// Remove the node from the dirty set (m_events_mutex has to be held).
+        void RemoveDirty(Node *node)
+        {
+            auto last = m_dirty_nodes.back();
+            last->m_dirty_index = node->m_dirty_index;
+            m_dirty_nodes[node->m_dirty_index] = last;
+            m_dirty_nodes.pop_back();
+
+            node->m_dirty_keys.clear();
+            node->m_dirty_index = kNotDirty;
+        }
+
+        /// Dispatch changes of node parameters (keys and slots have to point into the node).
+        void NotifyParameterChanges(Node *node, Key const *const *keys, Slot *const *slots, std::size_t num_keys)
+        {
+            TrackChanges(node, slots, num_keys);
+            DispatchParameterChanges(node, keys, num_keys);
+        }
+
+        /// Dispatch already tracked changes of node parameters.
+        void DispatchParameterChanges(Node *node, Key const *const *keys, std::size_t num_keys)
+        {
+            if (m_dispatch_mode == DispatchMode::kImmediate)
+            {
+                FireEvent(EventType::kChange, node, keys, num_keys);
+                return;
+            }
+
+            if (m_dispatch_mode == DispatchMode::kAsync)
+            {
+                // Single key fits into the record, larger change sets need a copy
+                AsyncEvent event;
+                event.m_type = EventType::kChange;
+                event.m_num_keys = static_cast<std::uint32_t>(num_keys);
+                event.m_node = node;
+
+                if (num_keys == 1)
+                {
+                    event.m_key = keys[0];
+                }
+                else
+                {
+                    event.m_keys = new Key const *[num_keys];
+                    std::copy(keys, keys + num_keys, event.m_keys);
+                }
+
+                PublishAsync(event);
+                return;
+            }
+
+            std::unique_lock<Mutex> lock(m_events_mutex);
+
+            if (m_dispatch_mode == DispatchMode::kCoalesced)
+            {
+                AddDirty(node, keys, num_keys);
+                return;
+            }
+
+            m_events.push_back(Event{EventType::kChange, node, m_event_keys.size(), num_keys});
+            m_event_keys.insert(m_event_keys.end(), keys, keys + num_keys);
+        }
+
+        /// Trigger per-event callbacks and batch callbacks with a batch of a single record.
+        void FireEvent(EventType type, Node *node, Key const *const *keys, std::size_t num_keys)
+        {
+            NodeRecord record{node, node->GetType()};
+            ChangeRecord change{node, node->GetType(), keys, num_keys};
+
+            switch (type)
+            {
+                case EventType::kCreate:
+                    FireOnNodeCreate(node);
+                    FireOnEventBatch(EventBatch(Span<NodeRecord const>(&record, 1), {}, {}));
+                    break;
+                case EventType::kDelete:
+                    FireOnNodeDelete(node);
+                    FireOnEventBatch(EventBatch({}, Span<NodeRecord const>(&record, 1), {}));
+                    break;
+                case EventType::kChange:
+                    FireOnNodeParameterChanges(node, keys, num_keys);
+                    FireOnEventBatch(EventBatch({}, {}, Span<ChangeRecord const>(&change, 1)));
+                    break;
+            }
+        }
+
+        /// Trigger per-event callbacks for a queued event.
+        void FireOnEvent(Event const &event, std::vector<Key const *> const &keys)
+        {
+            switch (event.m_type)
+            {
+                case EventType::kCreate:
+                    FireOnNodeCreate(event.m_node);
+                    break;
+                case EventType::kDelete:
+                    FireOnNodeDelete(event.m_node);
+                    break;
+                case EventType::kChange:
+                    FireOnNodeParameterChanges(event.m_node, keys.data() + event.m_first_key, event.m_num_keys);
+                    break;
+            }
+        }
+
+        /// Sort events into batch arrays and trigger batch callbacks.
+        void FireOnEventBatch(std::vector<Event> const &events, std::vector<Key const *> const &keys,
+                              BatchBuffers &batch)
+        {
+            // Nobody to sort for
+            if (m_cb_batch.IsEmpty())
+                return;
+
+            for (auto &event: events)
+            {
+                auto node = event.m_node;
+
+                switch (event.m_type)
+                {
+                    case EventType::kCreate:
+                        batch.m_created.push_back(NodeRecord{node, node->GetType()});
+                        break;
+                    case EventType::kDelete:
+                        batch.m_deleted.push_back(NodeRecord{node, node->GetType()});
+                        break;
+                    case EventType::kChange:
+                        batch.m_changed.push_back(ChangeRecord{node, node->GetType(), keys.data() + event.m_first_key,
+                                                               event.m_num_keys});
+                        break;
+                }
+            }
+
+            // Keys are laid out in event order, so comparing them keeps changes of a node in order
+            std::sort(batch.m_created.begin(), batch.m_created.end(), RecordLess());
+            std::sort(batch.m_deleted.begin(), batch.m_deleted.end(), RecordLess());
+            std::sort(batch.m_changed.begin(), batch.m_changed.end(), RecordLess());
+
+            FireOnEventBatch(EventBatch(Span<NodeRecord const>(batch.m_created.data(), batch.m_created.size()),
+                                        Span<NodeRecord const>(batch.m_deleted.data(), batch.m_deleted.size()),
+                                        Span<ChangeRecord const>(batch.m_changed.data(), batch.m_changed.size())));
+
+            batch.m_created.clear();
+            batch.m_deleted.clear();
+            batch.m_changed.clear();
+        }
+
+        /// Trigger OnEventBatch callbacks.
+        void FireOnEventBatch(EventBatch const &batch)
+        {
+            m_cb_batch.ForEach([&batch](OnEventBatchCallback const &cb)
+                               { cb(batch); });
+        }
+
+        /// Orders batch records by node type and node identifier.
+        struct RecordLess
+        {
+            bool operator()(NodeRecord const &lhs, NodeRecord const &rhs) const
+            {
+                if (lhs.m_type < rhs.m_type) return true;
+                if (rhs.m_type < lhs.m_type) return false;
+                return lhs.m_node->m_id < rhs.m_node->m_id;
+            }
+
+            bool operator()(ChangeRecord const &lhs, ChangeRecord const &rhs) const
+            {
+                if (lhs.m_type < rhs.m_type) return true;
+                if (rhs.m_type < lhs.m_type) return false;
+                if (lhs.m_node != rhs.m_node) return lhs.m_node->m_id < rhs.m_node->m_id;
+                return std::less<Key const *const *>()(lhs.m_keys, rhs.m_keys);
+            }
+        };
+
+        /// Trigger OnNodeCreate callbacks.
+        void FireOnNodeCreate(Node *node)
+        {
+            m_cb_create.ForEach(node->GetType(), [node](OnNodeCreateCallback const &cb)
+            { cb(node); });
+        }
+
+        /// Trigger OnNodeDelete callbacks.
+        void FireOnNodeDelete(Node *node)
+        {
+            m_cb_delete.ForEach(node->GetType(), [node](OnNodeDeleteCallback const &cb)
+            { cb(node); });
+        }
+
+        /// Trigger OnNodeParameterChange callbacks for every key and OnNodeChangeSet callbacks.
+        void FireOnNodeParameterChanges(Node *node, Key const *const *keys, std::size_t num_keys)
+        {
+            for (std::size_t i = 0; i < num_keys; ++i)
+            {
+                auto &key = *keys[i];
+
+                m_cb_change.ForEach(node->GetType(), key, [node, &key](OnNodeParameterChangeCallback const &cb)
+                { cb(node, key); });
+            }
+
+            ChangeSet change_set(keys, num_keys);
+
+            m_cb_change_set.ForEach(node->GetType(), [node, &change_set](OnNodeChangeSetCallback const &cb)
+            { cb(node, change_set); });
+        }
+
+
+    private:
+        /// Set of nodes for the scene.
+        NodeSet m_nodes;
+        /// Nodes guard mutex
+        RecursiveMutex m_nodes_mutex;
+        // Parameter factory.
+        std::unique_ptr<ParameterFactory> m_param_factory;
+        // Callback containers (lock-free for readers, copy-on-write for writers).
+        CallbackList<OnNodeCreateCallback, NodeType, Key, ThreadingPolicy> m_cb_create;
+        CallbackList<OnNodeDeleteCallback, NodeType, Key, ThreadingPolicy> m_cb_delete;
+        CallbackList<OnNodeParameterChangeCallback, NodeType, Key, ThreadingPolicy> m_cb_change;
+        CallbackList<OnNodeChangeSetCallback, NodeType, Key, ThreadingPolicy> m_cb_change_set;
+        CallbackList<OnEventBatchCallback, NodeType, Key, ThreadingPolicy> m_cb_batch;
+        // Last issued subscription identifier.
+        std::atomic<std::uint64_t> m_last_subscription;
+        // Dispatch mode.
+        std::atomic<DispatchMode> m_dispatch_mode;
+        // Events queued in deferred and coalesced modes, their keys and nodes deleted since the last flush.
+        std::vector<Event> m_events;
+        std::vector<Key const *> m_event_keys;
+        std::vector<std::unique_ptr<Node>> m_retired;
+        // Nodes changed since the last flush in coalesced mode.
+        std::vector<Node *> m_dirty_nodes;
+        // Events, keys and nodes being flushed.
+        std::vector<Event> m_flush_events;
+        std::vector<Key const *> m_flush_event_keys;
+        std::vector<std::unique_ptr<Node>> m_flush_retired;
+        // Batch records being flushed and spare ones for immediate dispatch (guarded by m_events_mutex).
+        BatchBuffers m_flush_batch;
+        BatchBuffers m_spare_batch;
+        // Queued events guard mutex.
+        Mutex m_events_mutex;
+        // Serializes flushes.
+        Mutex m_flush_mutex;
+        // Deletion record.
+        struct Deletion
+        {
+            std::uint64_t m_version;
+            std::uint64_t m_created_version;
+            Node *m_node;
+            std::size_t m_slot;
+        };
+        // Free node slots and the number of slots ever used.
+        std::vector<std::size_t> m_free_slots;
+        std::size_t m_num_slots;
+        // Last issued node identifier.
+        std::uint64_t m_last_node_id;
+        // Ends of the list of root nodes (guarded by m_nodes_mutex as well as the hierarchy links).
+        Node *m_first_root;
+        Node *m_last_root;
+        // Flattened hierarchy and whether it has to be rebuilt.
+        Hierarchy m_hierarchy;
+        bool m_hierarchy_dirty;
+        // Scene graph version.
+        std::atomic<std::uint64_t> m_version;
+        // Lists of nodes ordered by version, sharded so edits of unrelated nodes do not contend.
+        ChangeShard m_change_shards[kNumChangeShards];
+        // Deletions in the order of versions.
+        std::vector<Deletion> m_deletions;
+        // Versions registered pollers have collected changes up to.
+        std::unordered_map<std::uint64_t, std::uint64_t> m_poller_versions;
+        // Guards deletions, poller versions and the snapshot version.
+        mutable Mutex m_changes_mutex;
+        // Published buffer index and the number of readers of each buffer.
+        std::atomic<unsigned> m_front_index;
+        std::atomic<std::size_t> m_front_readers[2];
+        // Versions buffers have been published at.
+        std::uint64_t m_buffer_version[2];
+        // Changes being published.
+        ChangeLog m_swap_changes;
+        // Serializes swaps.
+        Mutex m_swap_mutex;
+        // Set once front buffers are in use, deleted nodes are retired from then on.
+        std::atomic<bool> m_front_enabled;
+        // Nodes retired since the last swap and before it (guarded by m_front_retired_mutex).
+        std::vector<std::unique_ptr<Node>> m_front_retired[2];
+        Mutex m_front_retired_mutex;
+        // The last snapshot, its version and whether it has been taken (guarded by m_snapshot_mutex and
+        // m_changes_mutex respectively).
+        Snapshot m_snapshot;
+        std::uint64_t m_snapshot_version;
+        bool m_snapshot_taken;
+        // Changes and deleted slots being applied to the snapshot.
+        ChangeLog m_snapshot_changes;
+        std::vector<std::size_t> m_snapshot_deleted;
+        // Serializes snapshots.
+        Mutex m_snapshot_mutex;
+        // Asynchronous dispatch settings.
+        AsyncDispatchOptions m_async_options;
+        BackpressurePolicy m_async_policy;
+        // Asynchronous dispatch queues.
+        std::vector<std::unique_ptr<AsyncShard>> m_shards;
+        // Number of events raised but not yet delivered in kAsync mode.
+        std::atomic<std::int64_t> m_async_pending;
+        // Set to stop dispatcher threads.
+        std::atomic<bool> m_async_stop;
+    };
+
+    template<typename Key, typename NodeType, typename Parameter, typename ThreadingPolicy>
+    std::size_t const SceneGraph<Key, NodeType, Parameter, ThreadingPolicy>::kNoParent;
+
+    template<typename Key, typename NodeType, typename Parameter, typename ThreadingPolicy>
+    std::ostream &operator<<(std::ostream &out, typename SceneGraph<Key, NodeType, Parameter, ThreadingPolicy>::Node const &node)
+    {
+        // TODO: implement me
+        return out; //node.StreamOut(out);
+    }
+
+
+    template<typename Key, typename NodeType, typename Parameter, typename ThreadingPolicy>
+    std::ostream &operator<<(std::ostream &out, SceneGraph<Key, NodeType, Parameter, ThreadingPolicy> const &sg)
+    {
+        // TODO: implement me
+        return out; //sg.StreamOut(out);
     }
 
     using DefaultSceneGraph = SceneGraph<std::string, std::uint32_t, Parameter>;
 
+    /// Scene graph with the same parameters as the default one but without any locking.
+    using SingleThreadedSceneGraph = SceneGraph<std::string, std::uint32_t, Parameter, SingleThreaded>;
+
     DefaultSceneGraph* CreateDefaultSceneGraph(DefaultSceneGraph::ParameterFactory *factory);
 }
@@ -0,0 +1,62 @@
+/**
+    \file span.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing non-owning view of a contiguous array.
+ */
+#pragma once
+
+#include <cstddef>
+
+namespace Gravity
+{
+    /**
+        \brief Non-owning view of a contiguous array.
+
+        Span does not manage the lifetime of the elements, it is only valid while the underlying array is.
+     */
+    template<typename T>
+    class Span
+    {
+    public:
+        /// Create an empty span.
+        Span()
+                : m_data(nullptr), m_size(0)
+        {
+        }
+
+        /// Create a span of size elements starting at data.
+        Span(T *data, std::size_t size)
+                : m_data(data), m_size(size)
+        {
+        }
+
+        /// Return the number of elements.
+        std::size_t GetSize() const
+        { return m_size; }
+
+        /// Check if the span is empty.
+        bool IsEmpty() const
+        { return m_size == 0; }
+
+        /// Return pointer to the first element.
+        T *GetData() const
+        { return m_data; }
+
+        /// Return i-th element.
+        T &operator[](std::size_t i) const
+        { return m_data[i]; }
+
+        T *begin() const
+        { return m_data; }
+
+        T *end() const
+        { return m_data + m_size; }
+
+    private:
+        /// Elements
+        T *m_data;
+        /// Number of elements
+        std::size_t m_size;
+    };
+}
@@ -0,0 +1,182 @@
+/**
+    \file task_pool.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing thread pool used by Gravity scene passes.
+
+    The pool runs data parallel loops: the range of indices is split into chunks which worker threads and the
+    calling thread claim one by one until the range is exhausted.
+ */
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace Gravity
+{
+    /**
+        \brief Pool of worker threads running parallel loops.
+
+        Only one loop runs at a time: concurrent ParallelFor calls are serialized and loops must not be nested.
+        Loop bodies must not throw.
+     */
+    class TaskPool
+    {
+    public:
+        /// Create a pool running loops on num_threads threads including the calling one.
+        explicit TaskPool(std::size_t num_threads = std::max(std::thread::hardware_concurrency(), 1u))
+                : m_generation(0), m_busy(0), m_stop(false), m_invoke(nullptr), m_context(nullptr), m_count(0)
+                , m_grain(1), m_next(0)
+        {
+            for (std::size_t i = 1; i < num_threads; ++i)
+                m_threads.emplace_back(&TaskPool::Run, this);
+        }
+
+        /// Workers are stopped and joined.
+        ~TaskPool()
+        {
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_stop = true;
+            }
+
+            m_wake.notify_all();
+
+            for (auto &thread: m_threads)
+                thread.join();
+        }
+
+        TaskPool(TaskPool const &) = delete;
+
+        TaskPool &operator=(TaskPool const &) = delete;
+
+        /// Return the number of threads running loops including the calling one.
+        std::size_t GetNumThreads() const
+        { return m_threads.size() + 1; }
+
+        /// \brief Call func(begin, end) for chunks of at most grain indices covering [0, count).
+        /// \details Returns once all the chunks have been processed.
+        template<typename Func>
+        void ParallelFor(std::size_t count, std::size_t grain, Func &&func)
+        {
+            if (count == 0)
+                return;
+
+            grain = std::max<std::size_t>(grain, 1);
+
+            if (m_threads.empty() || count <= grain)
+            {
+                func(std::size_t(0), count);
+                return;
+            }
+
+            std::unique_lock<std::mutex> loop_lock(m_loop_mutex);
+
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_invoke = &Invoke<typename std::remove_reference<Func>::type>;
+                m_context = &func;
+                m_count = count;
+                m_grain = grain;
+                m_next = 0;
+                ++m_generation;
+            }
+
+            m_wake.notify_all();
+
+            RunChunks(m_invoke, m_context, count, grain);
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_done.wait(lock, [this]()
+            { return m_busy == 0; });
+        }
+
+    private:
+        using InvokeFunc = void (*)(void *, std::size_t, std::size_t);
+
+        template<typename Func>
+        static void Invoke(void *context, std::size_t begin, std::size_t end)
+        {
+            (*static_cast<Func *>(context))(begin, end);
+        }
+
+        /// Claim and process chunks until the range is exhausted.
+        void RunChunks(InvokeFunc invoke, void *context, std::size_t count, std::size_t grain)
+        {
+            for (;;)
+            {
+                auto begin = m_next.fetch_add(grain);
+
+                if (begin >= count)
+                    return;
+
+                invoke(context, begin, std::min(begin + grain, count));
+            }
+        }
+
+        /// Worker thread body.
+        void Run()
+        {
+            std::uint64_t seen = 0;
+
+            for (;;)
+            {
+                std::unique_lock<std::mutex> lock(m_mutex);
+                m_wake.wait(lock, [this, seen]()
+                { return m_stop || m_generation != seen; });
+
+                if (m_stop)
+                    return;
+
+                seen = m_generation;
+
+                // Do not join a loop which is over, its body might be gone already
+                if (m_next.load() >= m_count)
+                    continue;
+
+                auto invoke = m_invoke;
+                auto context = m_context;
+                auto count = m_count;
+                auto grain = m_grain;
+                ++m_busy;
+                lock.unlock();
+
+                RunChunks(invoke, context, count, grain);
+
+                lock.lock();
+
+                if (--m_busy == 0)
+                    m_done.notify_all();
+            }
+        }
+
+        /// Worker threads
+        std::vector<std::thread> m_threads;
+        /// Serializes loops
+        std::mutex m_loop_mutex;
+        /// Guards the loop description and worker accounting
+        std::mutex m_mutex;
+        std::condition_variable m_wake;
+        std::condition_variable m_done;
+        /// Loop counter, workers join the loop when it changes
+        std::uint64_t m_generation;
+        /// Number of workers processing the current loop
+        std::size_t m_busy;
+        /// Set to stop workers
+        bool m_stop;
+        /// Current loop
+        InvokeFunc m_invoke;
+        void *m_context;
+        std::size_t m_count;
+        std::size_t m_grain;
+        /// Next index to claim
+        std::atomic<std::size_t> m_next;
+    };
+}
@@ -0,0 +1,82 @@
+/**
+    \file threading.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing threading policies for Gravity scene graph.
+
+    Threading policy defines mutex types the scene graph uses. MultiThreaded policy makes the scene graph safe to
+    use from several threads, SingleThreaded policy compiles all the locking out.
+ */
+#pragma once
+
+#include <mutex>
+
+namespace Gravity
+{
+    /// Mutex which does nothing.
+    class NullMutex
+    {
+    public:
+        void lock()
+        {
+        }
+
+        bool try_lock()
+        { return true; }
+
+        void unlock()
+        {
+        }
+    };
+
+    /// Policy for scene graphs shared between threads.
+    struct MultiThreaded
+    {
+        using Mutex = std::mutex;
+        using RecursiveMutex = std::recursive_mutex;
+
+        /// Set if the scene graph can be accessed from several threads.
+        static bool const kThreadSafe = true;
+    };
+
+    /// Policy for scene graphs used by a single thread.
+    struct SingleThreaded
+    {
+        using Mutex = NullMutex;
+        using RecursiveMutex = NullMutex;
+
+        /// Set if the scene graph can be accessed from several threads.
+        static bool const kThreadSafe = false;
+    };
+
+    /**
+        \brief Base class storing a mutex.
+
+        NullMutex specialization is empty, so classes deriving from MutexStorage do not pay for the mutex they
+        do not need (empty base optimization).
+     */
+    template<typename Mutex>
+    class MutexStorage
+    {
+    protected:
+        /// Return the mutex.
+        Mutex &GetMutex() const
+        { return m_mutex; }
+
+    private:
+        /// Mutex
+        mutable Mutex m_mutex;
+    };
+
+    template<>
+    class MutexStorage<NullMutex>
+    {
+    protected:
+        /// Return the mutex (all the instances share one as it has no state).
+        NullMutex &GetMutex() const
+        {
+            static NullMutex mutex;
+            return mutex;
+        }
+    };
+}
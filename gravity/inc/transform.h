@@ -0,0 +1,321 @@
+/**
+    \file transform.h
+    \author Dmitry Kozlov
+    \version 1.0
+    \brief Header file containing world transform system for Gravity scene graph.
+
+    Transform system caches world matrices of scene graph nodes in the depth-first order of the scene hierarchy
+    and recomputes them incrementally, only for subtrees of nodes whose local transforms have changed.
+ */
+#pragma once
+
+#include "matrix.h"
+#include "sg.h"
+#include "task_pool.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+namespace Gravity
+{
+    /// Type of a local transform parameter.
+    enum class LocalTransform
+    {
+        /// Matrix4
+        kMatrix,
+        /// Trs
+        kTrs
+    };
+
+    /**
+        \brief Cached world transforms of scene graph nodes.
+
+        Local transforms are kept in a designated parameter of type Matrix4 or Trs, nodes which do not have the
+        parameter have identity local transforms. World transform of a node is the product of world transform
+        of its parent and its local transform.
+
+        Update() picks nodes whose local transform has changed (or which have been created) since the previous
+        update and recomputes their subtrees only, so the cost is proportional to the size of moved subtrees.
+        Restructuring the hierarchy (see SceneGraph::Hierarchy::GetGeneration) makes the next update recompute
+        everything.
+
+        Given a task pool the update runs in parallel. Subtrees to recompute are independent of each other, large
+        ones are split below their roots into runs of sibling subtrees, so no locking is needed between tasks.
+        Chains of single children can not be split and are processed by one thread.
+     */
+    template<typename SceneGraph>
+    class TransformSystem
+    {
+    public:
+        using Key = typename SceneGraph::KeyType;
+        using Node = typename SceneGraph::Node;
+
+        /// Maximum number of nodes processed by a task.
+        static std::size_t const kGrainSize = 1024;
+
+        /// \brief Create the system for a scene graph using a given local transform parameter.
+        /// \param pool Task pool running updates in parallel or nullptr to update on the calling thread.
+        TransformSystem(SceneGraph &sg, Key const &key, LocalTransform type = LocalTransform::kMatrix,
+                        TaskPool *pool = nullptr)
+                : m_sg(sg), m_key(key), m_type(type), m_pool(pool), m_hierarchy(nullptr), m_generation(0)
+                , m_poller(sg), m_num_updates(0)
+        {
+        }
+
+        TransformSystem(TransformSystem const &) = delete;
+
+        TransformSystem &operator=(TransformSystem const &) = delete;
+
+        /// \brief Bring world transforms up to date.
+        /// \details Meant to be called by the writer between frames like SceneGraph::SwapBuffers, it must not run
+        /// concurrently with changes of the scene structure.
+        /// \return The number of world transforms recomputed.
+        std::size_t Update()
+        {
+            m_poller.Collect(m_changes);
+
+            auto &hierarchy = m_sg.GetHierarchy();
+            auto size = hierarchy.GetSize();
+
+            m_local.resize(size);
+            m_world.resize(size);
+
+            auto sizes = hierarchy.GetSubtreeSizes().GetData();
+
+            m_ranges.clear();
+            m_updated.clear();
+            ++m_num_updates;
+
+            if (m_hierarchy != &hierarchy || m_generation != hierarchy.GetGeneration())
+            {
+                m_hierarchy = &hierarchy;
+                m_generation = hierarchy.GetGeneration();
+
+                auto read = [this, &hierarchy](std::size_t begin, std::size_t end)
+                {
+                    for (auto index = begin; index < end; ++index)
+                        m_local[index] = ReadLocal(hierarchy.GetNode(index));
+                };
+
+                if (m_pool)
+                    m_pool->ParallelFor(size, kGrainSize, read);
+                else
+                    read(0, size);
+
+                // Every root subtree
+                for (std::size_t index = 0; index < size; index += sizes[index])
+                    m_ranges.emplace_back(index, index + sizes[index]);
+
+                m_updated.emplace_back(0, size);
+
+                ComputeRanges();
+                return size;
+            }
+
+            m_dirty.clear();
+
+            for (auto &change: m_changes.m_nodes)
+            {
+                auto dirty = change.m_created;
+
+                for (auto &key: m_changes.GetChangeSet(change))
+                    dirty = dirty || key == m_key;
+
+                if (!dirty)
+                    continue;
+
+                auto index = hierarchy.GetIndex(change.m_node);
+                m_local[index] = ReadLocal(change.m_node);
+                m_dirty.push_back(index);
+            }
+
+            // Parents precede their children, so visiting dirty nodes in order skips nested subtrees
+            std::sort(m_dirty.begin(), m_dirty.end());
+
+            std::size_t end = 0;
+            std::size_t num_updated = 0;
+
+            for (auto index: m_dirty)
+            {
+                if (index < end)
+                    continue;
+
+                end = index + sizes[index];
+                num_updated += sizes[index];
+                m_ranges.emplace_back(index, end);
+            }
+
+            m_updated = m_ranges;
+            ComputeRanges();
+            return num_updated;
+        }
+
+        /// Return world transform of a node as of the last update.
+        Matrix4 const &GetWorldTransform(Node const *node) const
+        { return m_world[m_hierarchy->GetIndex(node)]; }
+
+        /// \brief Check if the last update has computed the world transform of a node.
+        /// \details Nodes created after the update or a hierarchy restructured since then are not covered.
+        bool HasWorldTransform(Node const *node) const
+        {
+            return m_hierarchy && m_generation == m_hierarchy->GetGeneration() &&
+                   m_hierarchy->GetIndex(node) < m_world.size();
+        }
+
+        /// Return world transforms as of the last update in the order of SceneGraph::GetHierarchy().
+        Span<Matrix4 const> GetWorldTransforms() const
+        { return Span<Matrix4 const>(m_world.data(), m_world.size()); }
+
+        /// Range of hierarchy indices [first, second).
+        using Range = std::pair<std::size_t, std::size_t>;
+
+        /// Return the number of updates made so far.
+        std::uint64_t GetUpdateCount() const
+        { return m_num_updates; }
+
+        /// \brief Return ranges of hierarchy indices recomputed by the last update.
+        /// \details Lets dependent systems refresh only what has moved, see GetUpdateCount to tell whether they
+        /// have missed an update.
+        Span<Range const> GetUpdatedRanges() const
+        { return Span<Range const>(m_updated.data(), m_updated.size()); }
+
+    private:
+        /// \brief Recompute world transforms of subtrees listed in m_ranges.
+        /// \details Parents of the subtrees must not be in any of them.
+        void ComputeRanges()
+        {
+            auto parents = m_hierarchy->GetParentIndices().GetData();
+
+            if (!m_pool)
+            {
+                for (auto &range: m_ranges)
+                    ComputeWorldMatrices(m_local.data(), parents, SceneGraph::kNoParent, range.first, range.second,
+                                         m_world.data());
+                return;
+            }
+
+            SplitRanges();
+
+            // Tasks are grouped into batches of about kGrainSize nodes
+            m_batches.clear();
+            std::size_t batch_size = kGrainSize;
+
+            for (std::size_t task = 0; task < m_tasks.size(); ++task)
+            {
+                if (batch_size >= kGrainSize)
+                {
+                    m_batches.push_back(task);
+                    batch_size = 0;
+                }
+
+                batch_size += m_tasks[task].second - m_tasks[task].first;
+            }
+
+            m_batches.push_back(m_tasks.size());
+
+            m_pool->ParallelFor(m_batches.size() - 1, 1, [this, parents](std::size_t begin, std::size_t end)
+            {
+                for (auto task = m_batches[begin]; task < m_batches[end]; ++task)
+                    ComputeWorldMatrices(m_local.data(), parents, SceneGraph::kNoParent, m_tasks[task].first,
+                                         m_tasks[task].second, m_world.data());
+            });
+        }
+
+        /// \brief Split subtrees listed in m_ranges into m_tasks of at most kGrainSize nodes where possible.
+        /// \details Roots of large subtrees are computed right away, then their children subtrees become
+        /// independent. Adjacent small children subtrees are merged into a single task.
+        void SplitRanges()
+        {
+            auto parents = m_hierarchy->GetParentIndices().GetData();
+            auto sizes = m_hierarchy->GetSubtreeSizes().GetData();
+
+            m_tasks.clear();
+
+            while (!m_ranges.empty())
+            {
+                auto range = m_ranges.back();
+                m_ranges.pop_back();
+
+                if (range.second - range.first <= kGrainSize)
+                {
+                    m_tasks.push_back(range);
+                    continue;
+                }
+
+                // Large ranges are single subtrees
+                auto root = range.first;
+                ComputeWorldMatrices(m_local.data(), parents, SceneGraph::kNoParent, root, root + 1, m_world.data());
+
+                Range merged(root + 1, root + 1);
+
+                for (auto child = root + 1; child < range.second; child += sizes[child])
+                {
+                    if (sizes[child] > kGrainSize)
+                    {
+                        m_ranges.emplace_back(child, child + sizes[child]);
+                        continue;
+                    }
+
+                    if (merged.second != child || merged.second - merged.first + sizes[child] > kGrainSize)
+                    {
+                        if (merged.first != merged.second)
+                            m_tasks.push_back(merged);
+
+                        merged.first = child;
+                    }
+
+                    merged.second = child + sizes[child];
+                }
+
+                if (merged.first != merged.second)
+                    m_tasks.push_back(merged);
+            }
+        }
+
+        /// Read local transform of a node.
+        Matrix4 ReadLocal(Node *node) const
+        {
+            if (!node->HasValue(m_key))
+                return Matrix4::Identity();
+
+            if (m_type == LocalTransform::kTrs)
+                return node->template GetValue<Trs>(m_key).ToMatrix();
+
+            return node->template GetValue<Matrix4>(m_key);
+        }
+
+        /// Scene graph
+        SceneGraph &m_sg;
+        /// Local transform parameter and its type
+        Key m_key;
+        LocalTransform m_type;
+        /// Task pool or nullptr
+        TaskPool *m_pool;
+        /// Hierarchy and its generation world transforms have been computed for
+        typename SceneGraph::Hierarchy const *m_hierarchy;
+        std::uint64_t m_generation;
+        /// Poller of scene changes
+        typename SceneGraph::ChangePoller m_poller;
+        /// Changes since the last update
+        typename SceneGraph::ChangeLog m_changes;
+        /// Local and world transforms in hierarchy order
+        std::vector<Matrix4> m_local;
+        std::vector<Matrix4> m_world;
+        /// Indices of nodes with changed local transforms
+        std::vector<std::size_t> m_dirty;
+        /// Subtrees to recompute and recomputed by the last update
+        std::vector<Range> m_ranges;
+        std::vector<Range> m_updated;
+        /// Number of updates
+        std::uint64_t m_num_updates;
+        /// Ranges processed by parallel tasks and the first task of every batch
+        std::vector<Range> m_tasks;
+        std::vector<std::size_t> m_batches;
+    };
+
+    template<typename SceneGraph>
+    std::size_t const TransformSystem<SceneGraph>::kGrainSize;
+
+    using DefaultTransformSystem = TransformSystem<DefaultSceneGraph>;
+}
@@ -2,12 +2,104 @@
 
 #include "gtest/gtest.h"
 #include "sg.h"
+#include "transform.h"
+#include "bvh.h"
+#include "culling.h"
+#include "position_index.h"
+#include "render_queue.h"
+#include "instancing.h"
+#include "lod.h"
 
 #include <map>
+#include <unordered_map>
 #include <cstdint>
 #include <thread>
 #include <mutex>
 #include <random>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Number of heap allocations made by the test executable
+static std::atomic<std::size_t> g_allocation_count(0);
+
+// Allocation functions below go through helpers the compiler can not see into, otherwise it pairs inlined
+// std::free calls with new expressions and reports mismatched deallocations
+#if defined(_MSC_VER)
+#define GRAVITY_TEST_NOINLINE __declspec(noinline)
+#else
+#define GRAVITY_TEST_NOINLINE __attribute__((noinline))
+#endif
+
+GRAVITY_TEST_NOINLINE static void *CountedAllocate(std::size_t size) noexcept
+{
+    ++g_allocation_count;
+    return std::malloc(size ? size : 1);
+}
+
+GRAVITY_TEST_NOINLINE static void CountedFree(void *ptr) noexcept
+{
+    std::free(ptr);
+}
+
+void *operator new(std::size_t size)
+{
+    if (auto ptr = CountedAllocate(size))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void *operator new[](std::size_t size)
+{
+    if (auto ptr = CountedAllocate(size))
+        return ptr;
+
+    throw std::bad_alloc();
+}
+
+void *operator new(std::size_t size, std::nothrow_t const &) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void *operator new[](std::size_t size, std::nothrow_t const &) noexcept
+{
+    return CountedAllocate(size);
+}
+
+void operator delete(void *ptr) noexcept
+{
+    CountedFree(ptr);
+}
+
+void operator delete[](void *ptr) noexcept
+{
+    CountedFree(ptr);
+}
+
+void operator delete(void *ptr, std::size_t) noexcept
+{
+    CountedFree(ptr);
+}
+
+void operator delete[](void *ptr, std::size_t) noexcept
+{
+    CountedFree(ptr);
+}
+
+void operator delete(void *ptr, std::nothrow_t const &) noexcept
+{
+    CountedFree(ptr);
+}
+
+void operator delete[](void *ptr, std::nothrow_t const &) noexcept
+{
+    CountedFree(ptr);
+}
 
 class ParameterFactory : public Gravity::DefaultSceneGraph::ParameterFactory
 {
@@ -30,6 +122,30 @@ public:
     }
 };
 
+// Parameter sets listed per node type, types without an entry get the set of type 0
+template<typename SceneGraph>
+class BasicTypeParameterFactory : public SceneGraph::ParameterFactory
+{
+public:
+    using ParameterSet = std::map<std::string, Gravity::Parameter>;
+
+    BasicTypeParameterFactory(std::initializer_list<std::pair<std::uint32_t const, ParameterSet>> sets)
+        : m_sets(sets)
+    {
+    }
+
+    ParameterSet GetParameterSet(std::uint32_t const &type) const override
+    {
+        auto iter = m_sets.find(type);
+        return iter != m_sets.end() ? iter->second : m_sets.at(0);
+    }
+
+private:
+    std::map<std::uint32_t, ParameterSet> m_sets;
+};
+
+using TypeParameterFactory = BasicTypeParameterFactory<Gravity::DefaultSceneGraph>;
+
 // Api creation fixture, prepares api_ for further tests
 class App : public ::testing::Test
 {
@@ -332,3 +448,2262 @@ TEST_F(App, SceneGraph_Multithreaded_Consistency)
 }
 
 
+
+TEST_F(App, SceneGraph_Callback_ConcurrentRegistration)
+{
+    // Number of callbacks to register while the scene is being edited
+    int const kNumCallbacks = 100;
+    // Number of edits
+    int const kNumEdits = 10000;
+
+    std::atomic<int> update_count(0);
+
+    auto node = m_sg->CreateNode(0);
+    ASSERT_NE(node, nullptr);
+
+    // Edit the scene concurrently with callback registration
+    std::thread editor([node, kNumEdits]()
+                       {
+                           for (int i = 0; i < kNumEdits; ++i)
+                           {
+                               node->SetValue("type", i);
+                           }
+                       });
+
+    // EXPECT rather than ASSERT, returning early would leave the editor joinable
+    for (int i = 0; i < kNumCallbacks; ++i)
+    {
+        EXPECT_NO_THROW(m_sg->RegisterOnNodeParameterChangeCallback(
+                [&update_count](Gravity::DefaultSceneGraph::Node *, const std::string &)
+                { ++update_count; }));
+    }
+
+    editor.join();
+
+    // All callbacks have to be visible once registration is complete
+    update_count = 0;
+    ASSERT_NO_THROW(node->SetValue("type", 0));
+    ASSERT_EQ(update_count, kNumCallbacks);
+
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+}
+
+TEST_F(App, SceneGraph_Callback_Unregister)
+{
+    // Callbacks fired counters
+    int create_count = 0;
+    int update_count = 0;
+
+    Gravity::Subscription create_subscription;
+    Gravity::Subscription update_subscription;
+
+    ASSERT_NO_THROW(create_subscription = m_sg->RegisterOnNodeCreateCallback(
+            [&create_count](Gravity::DefaultSceneGraph::Node *)
+            { ++create_count; }));
+    ASSERT_NO_THROW(update_subscription = m_sg->RegisterOnNodeParameterChangeCallback(
+            [&update_count](Gravity::DefaultSceneGraph::Node *, const std::string &)
+            { ++update_count; }));
+    ASSERT_TRUE(static_cast<bool>(create_subscription));
+    ASSERT_NE(create_subscription, update_subscription);
+
+    auto node = m_sg->CreateNode(0);
+    ASSERT_EQ(create_count, 1);
+    ASSERT_NO_THROW(node->SetValue("type", 10));
+    ASSERT_EQ(update_count, 1);
+
+    ASSERT_TRUE(m_sg->UnregisterCallback(update_subscription));
+    ASSERT_FALSE(m_sg->UnregisterCallback(update_subscription));
+
+    ASSERT_NO_THROW(node->SetValue("type", 11));
+    ASSERT_EQ(update_count, 1);
+
+    ASSERT_TRUE(m_sg->UnregisterCallback(create_subscription));
+    auto other = m_sg->CreateNode(0);
+    ASSERT_EQ(create_count, 1);
+
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+    ASSERT_NO_THROW(m_sg->DeleteNode(other));
+}
+
+TEST_F(App, SceneGraph_Callback_UnregisterDuringDispatch)
+{
+    int const kNumCallbacks = 10;
+
+    int update_count = 0;
+    std::vector<Gravity::Subscription> subscriptions;
+
+    // Every callback unregisters all the callbacks, so only the first one should be called
+    for (int i = 0; i < kNumCallbacks; ++i)
+    {
+        subscriptions.push_back(m_sg->RegisterOnNodeParameterChangeCallback(
+                [this, &update_count, &subscriptions](Gravity::DefaultSceneGraph::Node *,
+                                                      const std::string &)
+                {
+                    ++update_count;
+
+                    for (auto &subscription: subscriptions)
+                    {
+                        m_sg->UnregisterCallback(subscription);
+                    }
+                }));
+    }
+
+    auto node = m_sg->CreateNode(0);
+    ASSERT_NO_THROW(node->SetValue("type", 10));
+    ASSERT_EQ(update_count, 1);
+    ASSERT_NO_THROW(node->SetValue("type", 11));
+    ASSERT_EQ(update_count, 1);
+
+    // Subscription churn should not leave dead callbacks behind
+    for (int i = 0; i < 1000; ++i)
+    {
+        auto subscription = m_sg->RegisterOnNodeParameterChangeCallback(
+                [&update_count](Gravity::DefaultSceneGraph::Node *, const std::string &)
+                { ++update_count; });
+        ASSERT_TRUE(m_sg->UnregisterCallback(subscription));
+    }
+
+    ASSERT_NO_THROW(node->SetValue("type", 12));
+    ASSERT_EQ(update_count, 1);
+
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+}
+
+TEST_F(App, SceneGraph_Callback_NoAllocations)
+{
+    int const kNumCallbacks = 10;
+
+    int update_count = 0;
+    std::set<std::uint32_t> filters = {0, 1};
+
+    for (int i = 0; i < kNumCallbacks; ++i)
+    {
+        m_sg->RegisterOnNodeParameterChangeCallback(
+                [&update_count](Gravity::DefaultSceneGraph::Node *, const std::string &)
+                { ++update_count; },
+                i % 2 ? filters : std::set<std::uint32_t>());
+    }
+
+    auto node = m_sg->CreateNode(0);
+    node->SetValue("type", 1);
+    ASSERT_EQ(update_count, kNumCallbacks);
+
+    // Neither the value assignment nor the dispatch should allocate
+    auto allocation_count = g_allocation_count.load();
+    node->SetValue("type", 2);
+    node->SetValue("float_value", 1.f);
+    ASSERT_EQ(g_allocation_count.load(), allocation_count);
+    ASSERT_EQ(update_count, 3 * kNumCallbacks);
+    ASSERT_EQ(node->GetValue<int>("type"), 2);
+
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+}
+
+TEST_F(App, Delegate_Callables)
+{
+    struct Local
+    {
+        static int Twice(int value)
+        { return 2 * value; }
+    };
+
+    // Function pointer
+    Gravity::Delegate<int(int)> delegate = &Local::Twice;
+    ASSERT_EQ(delegate(2), 4);
+
+    // Stateful callable
+    int offset = 3;
+    delegate = [offset](int value)
+    { return value + offset; };
+    ASSERT_EQ(delegate(2), 5);
+
+    // Copies are independent
+    auto copy = delegate;
+    delegate = &Local::Twice;
+    ASSERT_EQ(copy(2), 5);
+    ASSERT_EQ(delegate(2), 4);
+
+    // Empty delegate
+    Gravity::Delegate<int(int)> empty;
+    ASSERT_FALSE(static_cast<bool>(empty));
+    ASSERT_THROW(empty(1), std::bad_function_call);
+}
+
+TEST_F(App, SceneGraph_Callback_SparseFilter)
+{
+    // Callbacks counters
+    int dense_count = 0;
+    int sparse_count = 0;
+    int all_count = 0;
+
+    // Dense types are kept in a bit mask, large types fall back to a hash set
+    std::set<std::uint32_t> dense_filter = {0, 63};
+    std::set<std::uint32_t> sparse_filter = {64, 100000};
+
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&dense_count](Gravity::DefaultSceneGraph::Node *, const std::string &)
+            { ++dense_count; }, dense_filter);
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&sparse_count](Gravity::DefaultSceneGraph::Node *, const std::string &)
+            { ++sparse_count; }, sparse_filter);
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&all_count](Gravity::DefaultSceneGraph::Node *, const std::string &)
+            { ++all_count; });
+
+    std::uint32_t types[] = {0, 1, 63, 64, 65, 100000};
+
+    for (auto type: types)
+    {
+        auto node = m_sg->CreateNode(type);
+        ASSERT_NO_THROW(node->SetValue("type", 10));
+        ASSERT_NO_THROW(m_sg->DeleteNode(node));
+    }
+
+    ASSERT_EQ(dense_count, 2);
+    ASSERT_EQ(sparse_count, 2);
+    ASSERT_EQ(all_count, 6);
+
+    Gravity::TypeFilter<std::uint32_t> filter(dense_filter);
+    ASSERT_TRUE(filter.Contains(63));
+    ASSERT_FALSE(filter.Contains(64));
+    ASSERT_TRUE(filter.Matches(0));
+    ASSERT_TRUE(Gravity::TypeFilter<std::uint32_t>().Matches(12345));
+
+    // Non-integral types always use the hash set
+    Gravity::TypeFilter<std::string> named_filter(std::set<std::string>{"mesh"});
+    ASSERT_TRUE(named_filter.Contains("mesh"));
+    ASSERT_FALSE(named_filter.Matches("light"));
+}
+
+TEST_F(App, SceneGraph_Callback_KeyFilter)
+{
+    // Callbacks counters
+    int type_count = 0;
+    int values_count = 0;
+    int filtered_count = 0;
+
+    std::set<std::uint32_t> filters = {0};
+
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&type_count](Gravity::DefaultSceneGraph::Node *, const std::string &key)
+            {
+                ASSERT_EQ(key, "type");
+                ++type_count;
+            }, {}, {"type"});
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&values_count](Gravity::DefaultSceneGraph::Node *, const std::string &key)
+            {
+                ASSERT_NE(key, "type");
+                ++values_count;
+            }, {}, {"float_value", "vector_value"});
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&filtered_count](Gravity::DefaultSceneGraph::Node *, const std::string &)
+            { ++filtered_count; }, filters, {"type"});
+
+    for (std::uint32_t type = 0; type < 2; ++type)
+    {
+        auto node = m_sg->CreateNode(type);
+        ASSERT_NO_THROW(node->SetValue("type", 10));
+        ASSERT_NO_THROW(node->SetValue("float_value", 1.f));
+        ASSERT_NO_THROW(node->SetValue("float_value", 2.f));
+        ASSERT_NO_THROW(node->SetValue("vector_value", std::vector<int>{}));
+        ASSERT_NO_THROW(m_sg->DeleteNode(node));
+    }
+
+    ASSERT_EQ(type_count, 2);
+    ASSERT_EQ(values_count, 6);
+    ASSERT_EQ(filtered_count, 1);
+}
+
+TEST_F(App, SceneGraph_Callback_NoLocksHeld)
+{
+    // Observers must be able to wait for other threads accessing the same node and the registry
+    auto accessible = [](std::function<void()> func)
+    {
+        auto future = std::async(std::launch::async, func);
+        return future.wait_for(std::chrono::seconds(5)) == std::future_status::ready;
+    };
+
+    int update_count = 0;
+    int create_count = 0;
+    int delete_count = 0;
+
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&](Gravity::DefaultSceneGraph::Node *node, const std::string &)
+            {
+                ++update_count;
+                ASSERT_TRUE(accessible([node]()
+                                       { node->GetValue<int>("type"); }));
+            });
+    m_sg->RegisterOnNodeCreateCallback(
+            [&](Gravity::DefaultSceneGraph::Node *)
+            {
+                ++create_count;
+                ASSERT_TRUE(accessible([this]()
+                                       { m_sg->DeleteNode(m_sg->CreateNode(1)); }));
+            }, {0});
+    m_sg->RegisterOnNodeDeleteCallback(
+            [&](Gravity::DefaultSceneGraph::Node *)
+            {
+                ++delete_count;
+                ASSERT_TRUE(accessible([this]()
+                                       { m_sg->DeleteNode(m_sg->CreateNode(1)); }));
+            }, {0});
+
+    auto node = m_sg->CreateNode(0);
+    ASSERT_NO_THROW(node->SetValue("type", 10));
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+
+    ASSERT_EQ(create_count, 1);
+    ASSERT_EQ(update_count, 1);
+    ASSERT_EQ(delete_count, 1);
+}
+
+TEST_F(App, SceneGraph_DeferredDispatch)
+{
+    std::vector<std::string> events;
+
+    m_sg->RegisterOnNodeCreateCallback(
+            [&events](Gravity::DefaultSceneGraph::Node *)
+            { events.push_back("create"); });
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&events](Gravity::DefaultSceneGraph::Node *, const std::string &key)
+            { events.push_back(key); });
+    m_sg->RegisterOnNodeDeleteCallback(
+            [&events](Gravity::DefaultSceneGraph::Node *node)
+            {
+                // Deleted node is still accessible from the observer
+                ASSERT_EQ(node->GetValue<int>("type"), 10);
+                events.push_back("delete");
+            });
+
+    m_sg->SetDispatchMode(Gravity::DefaultSceneGraph::DispatchMode::kDeferred);
+
+    auto node = m_sg->CreateNode(0);
+    ASSERT_NO_THROW(node->SetValue("type", 10));
+    ASSERT_NO_THROW(node->SetValue("float_value", 1.f));
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+    ASSERT_ANY_THROW(m_sg->DeleteNode(node));
+    ASSERT_TRUE(events.empty());
+
+    m_sg->Flush();
+    ASSERT_EQ(events, (std::vector<std::string>{"create", "type", "float_value", "delete"}));
+
+    // Switching back to immediate mode flushes pending events
+    events.clear();
+    node = m_sg->CreateNode(0);
+    ASSERT_TRUE(events.empty());
+    m_sg->SetDispatchMode(Gravity::DefaultSceneGraph::DispatchMode::kImmediate);
+    ASSERT_EQ(events, (std::vector<std::string>{"create"}));
+    ASSERT_NO_THROW(node->SetValue("type", 10));
+    ASSERT_EQ(events.size(), 2u);
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+}
+
+TEST_F(App, SceneGraph_Transaction)
+{
+    int update_count = 0;
+    std::map<Gravity::DefaultSceneGraph::Node *, std::vector<std::set<std::string>>> change_sets;
+
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&update_count](Gravity::DefaultSceneGraph::Node *, const std::string &)
+            { ++update_count; });
+    m_sg->RegisterOnNodeChangeSetCallback(
+            [&change_sets](Gravity::DefaultSceneGraph::Node *node,
+                           Gravity::DefaultSceneGraph::ChangeSet const &change_set)
+            {
+                // All the values are already applied
+                ASSERT_EQ(node->GetValue<int>("type"), 20);
+                change_sets[node].emplace_back(change_set.begin(), change_set.end());
+            });
+
+    auto first = m_sg->CreateNode(0);
+    auto second = m_sg->CreateNode(0);
+
+    Gravity::DefaultSceneGraph::Transaction transaction(*m_sg);
+    transaction.SetValue(first, "type", 10)
+               .SetValue(second, "type", 20)
+               .SetValue(first, "float_value", 1.f)
+               .SetValue(first, "type", 20)
+               .ModifyValue<std::vector<int>>(first, "vector_value", [](std::vector<int> &value)
+               { value.push_back(4); });
+    ASSERT_FALSE(transaction.IsEmpty());
+    ASSERT_TRUE(change_sets.empty());
+
+    ASSERT_NO_THROW(transaction.Commit());
+    ASSERT_TRUE(transaction.IsEmpty());
+
+    // One change set per node listing every changed key once
+    ASSERT_EQ(change_sets[first].size(), 1u);
+    ASSERT_EQ(change_sets[first][0], (std::set<std::string>{"type", "float_value", "vector_value"}));
+    ASSERT_EQ(change_sets[second].size(), 1u);
+    ASSERT_EQ(change_sets[second][0], (std::set<std::string>{"type"}));
+    ASSERT_EQ(update_count, 4);
+
+    ASSERT_EQ(first->GetValue<float>("float_value"), 1.f);
+    ASSERT_EQ(first->GetValue<std::vector<int>>("vector_value"), (std::vector<int>{1, 2, 3, 4}));
+
+    // A missing key fails the whole transaction
+    transaction.SetValue(first, "type", 30).SetValue(second, "no_such_key", 30);
+    ASSERT_ANY_THROW(transaction.Commit());
+    ASSERT_EQ(first->GetValue<int>("type"), 20);
+
+    // Plain updates produce single key change sets
+    transaction.Clear();
+    change_sets.clear();
+    ASSERT_NO_THROW(second->SetValue("float_value", 2.f));
+    ASSERT_EQ(change_sets[second].size(), 1u);
+    ASSERT_EQ(change_sets[second][0], (std::set<std::string>{"float_value"}));
+
+    ASSERT_NO_THROW(m_sg->DeleteNode(first));
+    ASSERT_NO_THROW(m_sg->DeleteNode(second));
+}
+
+TEST_F(App, SceneGraph_AsyncDispatch)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    std::mutex mutex;
+    std::map<SceneGraph::Node *, std::vector<int>> values;
+    std::atomic<int> deleted(0);
+
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&mutex, &values](SceneGraph::Node *node, const std::string &)
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                values[node].push_back(node->GetValue<int>("type"));
+            });
+    m_sg->RegisterOnNodeDeleteCallback(
+            [&deleted](SceneGraph::Node *)
+            { ++deleted; });
+
+    SceneGraph::AsyncDispatchOptions options;
+    options.m_num_threads = 2;
+    options.m_capacity = 16;
+    m_sg->SetAsyncDispatchOptions(options);
+    m_sg->SetDispatchMode(SceneGraph::DispatchMode::kAsync);
+
+    // Each node is changed by its own thread so delivered values have to be increasing
+    std::vector<SceneGraph::Node *> nodes;
+    for (auto i = 0; i < 4; ++i)
+        nodes.push_back(m_sg->CreateNode(0));
+
+    std::vector<std::thread> threads;
+    for (auto node: nodes)
+    {
+        threads.emplace_back([node]()
+                             {
+                                 for (auto i = 0; i < 100; ++i)
+                                     node->SetValue("type", i);
+                             });
+    }
+
+    for (auto &thread: threads)
+        thread.join();
+
+    m_sg->Flush();
+
+    for (auto node: nodes)
+    {
+        ASSERT_EQ(values[node].size(), 100u);
+        ASSERT_TRUE(std::is_sorted(values[node].begin(), values[node].end()));
+        ASSERT_NO_THROW(m_sg->DeleteNode(node));
+    }
+
+    m_sg->Flush();
+    ASSERT_EQ(deleted, 4);
+
+    auto stats = m_sg->GetAsyncDispatchStats();
+    ASSERT_EQ(stats.m_enqueued, 408u);
+    ASSERT_EQ(stats.m_delivered, 408u);
+    ASSERT_EQ(stats.m_depth, 0u);
+    ASSERT_LE(stats.m_max_depth, 32u);
+    ASSERT_LE(stats.m_mean_latency_ns, stats.m_max_latency_ns);
+
+    m_sg->SetDispatchMode(SceneGraph::DispatchMode::kImmediate);
+}
+
+TEST_F(App, SceneGraph_AsyncBackpressure)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    std::vector<std::string> events;
+    std::atomic<bool> entered(false);
+    std::atomic<bool> released(false);
+
+    // The first change blocks the dispatcher until released
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&](SceneGraph::Node *, const std::string &key)
+            {
+                events.push_back(key);
+                entered = true;
+                while (!released)
+                    std::this_thread::yield();
+            });
+
+    SceneGraph::AsyncDispatchOptions options;
+    options.m_capacity = 2;
+
+    auto block_dispatcher = [&](SceneGraph::Node *node)
+    {
+        events.clear();
+        entered = released = false;
+        node->SetValue("type", 0);
+        while (!entered)
+            std::this_thread::yield();
+    };
+
+    // Drop oldest: the queue keeps two latest changes
+    options.m_policy = SceneGraph::BackpressurePolicy::kDropOldest;
+    m_sg->SetAsyncDispatchOptions(options);
+    m_sg->SetDispatchMode(SceneGraph::DispatchMode::kAsync);
+
+    auto node = m_sg->CreateNode(0);
+    block_dispatcher(node);
+    node->SetValue("type", 1);
+    node->SetValue("float_value", 1.f);
+    node->SetValue("vector_value", std::vector<int>{});
+    node->SetValue("type", 2);
+    released = true;
+    m_sg->Flush();
+
+    ASSERT_EQ(events, (std::vector<std::string>{"type", "vector_value", "type"}));
+    auto stats = m_sg->GetAsyncDispatchStats();
+    ASSERT_EQ(stats.m_dropped, 2u);
+    ASSERT_EQ(stats.m_delivered, 4u);
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+
+    // Coalesce: changes which do not fit are merged per key and delivered after the queued ones
+    options.m_policy = SceneGraph::BackpressurePolicy::kCoalesce;
+    m_sg->SetDispatchMode(SceneGraph::DispatchMode::kImmediate);
+    m_sg->SetAsyncDispatchOptions(options);
+    m_sg->SetDispatchMode(SceneGraph::DispatchMode::kAsync);
+
+    node = m_sg->CreateNode(0);
+    block_dispatcher(node);
+    node->SetValue("type", 1);
+    node->SetValue("float_value", 1.f);
+    node->SetValue("type", 2);
+    node->SetValue("type", 3);
+    node->SetValue("float_value", 2.f);
+    node->SetValue("vector_value", std::vector<int>{});
+    released = true;
+    m_sg->Flush();
+
+    ASSERT_EQ(events, (std::vector<std::string>{"type", "type", "float_value", "type", "float_value", "vector_value"}));
+    stats = m_sg->GetAsyncDispatchStats();
+    ASSERT_EQ(stats.m_coalesced, 1u);
+    ASSERT_EQ(stats.m_delivered, 7u);
+
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+}
+
+TEST_F(App, SceneGraph_CoalescedDispatch)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    std::vector<std::string> events;
+    std::map<SceneGraph::Node *, std::vector<std::set<std::string>>> change_sets;
+
+    m_sg->RegisterOnNodeCreateCallback(
+            [&events](SceneGraph::Node *)
+            { events.push_back("create"); });
+    m_sg->RegisterOnNodeDeleteCallback(
+            [&events](SceneGraph::Node *)
+            { events.push_back("delete"); });
+    m_sg->RegisterOnNodeParameterChangeCallback(
+            [&events](SceneGraph::Node *node, const std::string &key)
+            {
+                // Observers see the latest value
+                ASSERT_EQ(node->GetValue<int>("type"), 9);
+                events.push_back(key);
+            });
+    m_sg->RegisterOnNodeChangeSetCallback(
+            [&change_sets](SceneGraph::Node *node, SceneGraph::ChangeSet const &change_set)
+            { change_sets[node].emplace_back(change_set.begin(), change_set.end()); });
+
+    m_sg->SetDispatchMode(SceneGraph::DispatchMode::kCoalesced);
+
+    auto first = m_sg->CreateNode(0);
+    auto second = m_sg->CreateNode(0);
+
+    for (auto i = 0; i < 10; ++i)
+    {
+        first->SetValue("type", i);
+        second->SetValue("type", i);
+    }
+
+    first->SetValue("float_value", 1.f);
+    SceneGraph::Transaction(*m_sg).SetValue(first, "type", 9).SetValue(first, "float_value", 2.f).Commit();
+
+    // Changes of a deleted node are pruned
+    ASSERT_NO_THROW(m_sg->DeleteNode(second));
+    ASSERT_TRUE(events.empty());
+
+    m_sg->Flush();
+    ASSERT_EQ(events, (std::vector<std::string>{"create", "create", "delete", "type", "float_value"}));
+    ASSERT_EQ(change_sets.size(), 1u);
+    ASSERT_EQ(change_sets[first].size(), 1u);
+    ASSERT_EQ(change_sets[first][0], (std::set<std::string>{"type", "float_value"}));
+
+    // The dirty set is cleared by the flush
+    events.clear();
+    m_sg->Flush();
+    ASSERT_TRUE(events.empty());
+
+    first->SetValue("type", 9);
+    m_sg->SetDispatchMode(SceneGraph::DispatchMode::kImmediate);
+    ASSERT_EQ(events, (std::vector<std::string>{"type"}));
+    ASSERT_NO_THROW(m_sg->DeleteNode(first));
+}
+
+TEST_F(App, SceneGraph_EventBatch)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    int num_batches = 0;
+    std::vector<std::uint32_t> created_types;
+    std::vector<SceneGraph::Node *> deleted;
+    std::vector<std::pair<SceneGraph::Node *, std::size_t>> changed;
+
+    m_sg->RegisterOnEventBatchCallback(
+            [&](SceneGraph::EventBatch const &batch)
+            {
+                ++num_batches;
+
+                for (auto &record: batch.GetCreated())
+                    created_types.push_back(record.m_type);
+
+                for (auto &record: batch.GetDeleted())
+                    deleted.push_back(record.m_node);
+
+                for (auto &record: batch.GetChanged())
+                    changed.emplace_back(record.m_node, record.GetChangeSet().GetSize());
+            });
+
+    m_sg->SetDispatchMode(SceneGraph::DispatchMode::kDeferred);
+
+    auto first = m_sg->CreateNode(2);
+    auto second = m_sg->CreateNode(1);
+    auto third = m_sg->CreateNode(1);
+
+    first->SetValue("type", 1);
+    second->SetValue("type", 1);
+    SceneGraph::Transaction(*m_sg).SetValue(first, "type", 2).SetValue(first, "float_value", 1.f).Commit();
+    ASSERT_NO_THROW(m_sg->DeleteNode(third));
+
+    m_sg->Flush();
+    ASSERT_EQ(num_batches, 1);
+
+    // Records are sorted by type, changes of a node keep their order
+    ASSERT_EQ(created_types, (std::vector<std::uint32_t>{1, 1, 2}));
+    ASSERT_EQ(deleted, (std::vector<SceneGraph::Node *>{third}));
+    ASSERT_EQ(changed.size(), 3u);
+    ASSERT_EQ(changed[0], std::make_pair(second, std::size_t(1)));
+    ASSERT_EQ(changed[1], std::make_pair(first, std::size_t(1)));
+    ASSERT_EQ(changed[2], std::make_pair(first, std::size_t(2)));
+
+    // Immediate mode delivers single record batches
+    m_sg->SetDispatchMode(SceneGraph::DispatchMode::kImmediate);
+    changed.clear();
+    first->SetValue("type", 3);
+    ASSERT_EQ(num_batches, 2);
+    ASSERT_EQ(changed.size(), 1u);
+
+    ASSERT_NO_THROW(m_sg->DeleteNode(first));
+    ASSERT_NO_THROW(m_sg->DeleteNode(second));
+    ASSERT_EQ(num_batches, 4);
+}
+
+TEST_F(App, SceneGraph_CollectChangesSince)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    // Deletions are only recorded while somebody is going to collect them
+    std::unique_ptr<SceneGraph::ChangePoller> recorder(new SceneGraph::ChangePoller(*m_sg));
+
+    auto first = m_sg->CreateNode(0);
+    auto second = m_sg->CreateNode(0);
+    auto third = m_sg->CreateNode(0);
+    auto version = m_sg->GetVersion();
+    ASSERT_EQ(first->GetVersion("type"), first->GetVersion());
+
+    // Nothing changed yet
+    SceneGraph::ChangeLog changes;
+    m_sg->CollectChangesSince(version, changes);
+    ASSERT_TRUE(changes.m_nodes.empty());
+    ASSERT_EQ(changes.m_version, version);
+
+    second->SetValue("type", 1);
+    second->SetValue("type", 2);
+    first->SetValue("float_value", 1.f);
+    ASSERT_GT(first->GetVersion("float_value"), first->GetVersion("type"));
+    ASSERT_NO_THROW(m_sg->DeleteNode(third));
+    auto fourth = m_sg->CreateNode(0);
+    auto fifth = m_sg->CreateNode(0);
+    ASSERT_NO_THROW(m_sg->DeleteNode(fifth));
+
+    m_sg->CollectChangesSince(version, changes);
+    ASSERT_EQ(changes.m_version, m_sg->GetVersion());
+
+    // Most recent first, deleted nodes are not listed as changed
+    ASSERT_EQ(changes.m_nodes.size(), 3u);
+    ASSERT_EQ(changes.m_nodes[0].m_node, fourth);
+    ASSERT_TRUE(changes.m_nodes[0].m_created);
+    ASSERT_EQ(changes.GetChangeSet(changes.m_nodes[0]).GetSize(), 3u);
+    ASSERT_EQ(changes.m_nodes[1].m_node, first);
+    ASSERT_FALSE(changes.m_nodes[1].m_created);
+    ASSERT_EQ(changes.GetChangeSet(changes.m_nodes[1])[0], "float_value");
+    ASSERT_EQ(changes.m_nodes[2].m_node, second);
+    ASSERT_EQ(changes.GetChangeSet(changes.m_nodes[2]).GetSize(), 1u);
+
+    // Nodes both created and deleted since the version are not reported
+    ASSERT_EQ(changes.m_deleted, (std::vector<SceneGraph::Node *>{third}));
+
+    // Polling from the returned version only reports new changes
+    version = changes.m_version;
+    second->SetValue("float_value", 2.f);
+    changes = m_sg->CollectChangesSince(version);
+    ASSERT_EQ(changes.m_nodes.size(), 1u);
+    ASSERT_EQ(changes.GetChangeSet(changes.m_nodes[0])[0], "float_value");
+    ASSERT_TRUE(changes.m_deleted.empty());
+
+    m_sg->DiscardDeletionsBefore(m_sg->GetVersion());
+    ASSERT_TRUE(m_sg->CollectChangesSince(0).m_deleted.empty());
+    ASSERT_EQ(m_sg->GetNumDeletions(), 0u);
+    recorder.reset();
+
+    // Registered pollers discard deletions once all of them have collected them
+    {
+        SceneGraph::ChangePoller fast(*m_sg), slow(*m_sg);
+        fast.Collect(changes);
+        slow.Collect(changes);
+
+        for (int i = 0; i < 100; ++i)
+            m_sg->DeleteNode(m_sg->CreateNode(0));
+
+        ASSERT_NO_THROW(m_sg->DeleteNode(first));
+        fast.Collect(changes);
+        ASSERT_EQ(changes.m_deleted, (std::vector<SceneGraph::Node *>{first}));
+        ASSERT_EQ(m_sg->GetNumDeletions(), 101u);
+
+        slow.Collect(changes);
+        ASSERT_EQ(changes.m_deleted, (std::vector<SceneGraph::Node *>{first}));
+        ASSERT_EQ(m_sg->GetNumDeletions(), 0u);
+
+        // A poller which stops collecting holds deletions back until it is gone
+        ASSERT_NO_THROW(m_sg->DeleteNode(second));
+        fast.Collect(changes);
+        ASSERT_EQ(m_sg->GetNumDeletions(), 1u);
+    }
+
+    ASSERT_EQ(m_sg->GetNumDeletions(), 0u);
+
+    // Without pollers deletions are not recorded at all
+    version = m_sg->GetVersion();
+
+    for (int i = 0; i < 1000; ++i)
+        m_sg->DeleteNode(m_sg->CreateNode(0));
+
+    ASSERT_NO_THROW(m_sg->DeleteNode(fourth));
+    ASSERT_EQ(m_sg->GetNumDeletions(), 0u);
+    ASSERT_TRUE(m_sg->CollectChangesSince(version).m_deleted.empty());
+}
+
+TEST_F(App, SceneGraph_ConcurrentChangeTracking)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (auto i = 0; i < 64; ++i)
+        nodes.push_back(m_sg->CreateNode(0));
+
+    SceneGraph::ChangePoller poller(*m_sg);
+    SceneGraph::ChangeLog changes;
+    std::map<SceneGraph::Node *, std::uint64_t> reported;
+
+    auto collect = [&]()
+    {
+        poller.Collect(changes);
+
+        // Shards are merged most recent first, nothing newer than the returned version is reported.
+        // EXPECT rather than ASSERT, returning early would leave the writers joinable.
+        for (std::size_t i = 0; i < changes.m_nodes.size(); ++i)
+        {
+            auto &change = changes.m_nodes[i];
+            EXPECT_LE(change.m_version, changes.m_version);
+            EXPECT_GT(change.m_version, reported[change.m_node]);
+            EXPECT_TRUE(i == 0 || changes.m_nodes[i - 1].m_version > change.m_version);
+            reported[change.m_node] = change.m_version;
+        }
+    };
+
+    // Writers edit their own nodes while the poller keeps collecting
+    std::vector<std::thread> writers;
+    for (auto t = 0; t < 4; ++t)
+    {
+        writers.emplace_back([&nodes, t]()
+                             {
+                                 for (auto i = 0; i < 2000; ++i)
+                                     nodes[t + 4 * (i % 16)]->SetValue("type", i);
+                             });
+    }
+
+    for (auto i = 0; i < 100; ++i)
+        collect();
+
+    for (auto &writer: writers)
+        writer.join();
+
+    collect();
+
+    // Every last change has been reported
+    for (auto node: nodes)
+    {
+        ASSERT_EQ(reported[node], node->GetVersion());
+        ASSERT_EQ(node->GetVersion("type"), node->GetVersion());
+        m_sg->DeleteNode(node);
+    }
+}
+
+TEST_F(App, SceneGraph_SwapBuffers)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    auto node = m_sg->CreateNode(0);
+    node->SetValue("type", 1);
+    m_sg->SwapBuffers();
+
+    {
+        // The reader keeps seeing the published frame while the node is being changed
+        SceneGraph::FrontReader reader(*m_sg);
+        ASSERT_EQ(reader.GetValue<int>(node, "type"), 1);
+        ASSERT_EQ(reader.GetValue<float>(node, "float_value"), 3.8f);
+
+        node->SetValue("type", 2);
+        ASSERT_EQ(reader.GetValue<int>(node, "type"), 1);
+
+        m_sg->SwapBuffers();
+        ASSERT_EQ(reader.GetValue<int>(node, "type"), 1);
+        ASSERT_ANY_THROW(reader.GetValue<int>(node, "no_such_key"));
+    }
+
+    ASSERT_EQ(SceneGraph::FrontReader(*m_sg).GetValue<int>(node, "type"), 2);
+
+    // Unchanged values survive swaps
+    node->SetValue("type", 3);
+    m_sg->SwapBuffers();
+    m_sg->SwapBuffers();
+    ASSERT_EQ(SceneGraph::FrontReader(*m_sg).GetValue<int>(node, "type"), 3);
+    ASSERT_EQ(SceneGraph::FrontReader(*m_sg).GetValue<float>(node, "float_value"), 3.8f);
+
+    // Nodes created after the last swap have nothing published yet
+    auto other = m_sg->CreateNode(0);
+    ASSERT_ANY_THROW(SceneGraph::FrontReader(*m_sg).GetValue<int>(other, "type"));
+    m_sg->SwapBuffers();
+    ASSERT_EQ(SceneGraph::FrontReader(*m_sg).GetValue<int>(other, "type"), 5);
+
+    // Nodes deleted while a reader exists stay readable until it is gone
+    {
+        SceneGraph::FrontReader reader(*m_sg);
+        other->SetValue("type", 6);
+        ASSERT_NO_THROW(m_sg->DeleteNode(other));
+        ASSERT_EQ(reader.GetValue<int>(other, "type"), 5);
+        m_sg->SwapBuffers();
+        ASSERT_EQ(reader.GetValue<int>(other, "type"), 5);
+    }
+
+    m_sg->SwapBuffers();
+    m_sg->SwapBuffers();
+
+    // Readers see whole frames: the writer keeps both values equal between swaps
+    SceneGraph::Transaction(*m_sg).SetValue(node, "type", 0).SetValue(node, "float_value", 0.f).Commit();
+    m_sg->SwapBuffers();
+
+    std::atomic<bool> done(false);
+    std::thread writer([&]()
+                       {
+                           for (auto i = 0; i < 1000; ++i)
+                           {
+                               SceneGraph::Transaction(*m_sg).SetValue(node, "type", i)
+                                                             .SetValue(node, "float_value", static_cast<float>(i))
+                                                             .Commit();
+                               m_sg->SwapBuffers();
+                           }
+
+                           done = true;
+                       });
+
+    // EXPECT rather than ASSERT, returning early would leave the writer joinable
+    while (!done)
+    {
+        SceneGraph::FrontReader reader(*m_sg);
+        EXPECT_EQ(static_cast<float>(reader.GetValue<int>(node, "type")), reader.GetValue<float>(node, "float_value"));
+    }
+
+    writer.join();
+    ASSERT_NO_THROW(m_sg->DeleteNode(node));
+}
+
+TEST_F(App, SceneGraph_Snapshot)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    std::vector<SceneGraph::Node *> nodes;
+    for (auto i = 0; i < 100; ++i)
+    {
+        nodes.push_back(m_sg->CreateNode(i % 3));
+        nodes.back()->SetValue("type", i);
+    }
+
+    auto first = m_sg->TakeSnapshot();
+    ASSERT_EQ(first.GetSize(), 100u);
+    ASSERT_EQ(first.GetVersion(), m_sg->GetVersion());
+    ASSERT_EQ(first.Find(nodes[42])->GetValue<int>("type"), 42);
+    ASSERT_EQ(first.Find(nodes[42])->GetType(), 0u);
+
+    // Live changes do not affect the snapshot
+    nodes[42]->SetValue("type", -1);
+    ASSERT_EQ(first.Find(nodes[42])->GetValue<int>("type"), 42);
+    auto deleted_id = nodes[7]->GetId();
+    ASSERT_NO_THROW(m_sg->DeleteNode(nodes[7]));
+    auto created = m_sg->CreateNode(5);
+
+    // Deletions are kept for the next snapshot only
+    ASSERT_EQ(m_sg->GetNumDeletions(), 1u);
+    auto second = m_sg->TakeSnapshot();
+    ASSERT_EQ(m_sg->GetNumDeletions(), 0u);
+    ASSERT_EQ(second.GetSize(), 100u);
+    ASSERT_EQ(second.Find(nodes[42])->GetValue<int>("type"), -1);
+    ASSERT_EQ(second.Find(created)->GetType(), 5u);
+    ASSERT_EQ(first.Find(created), nullptr);
+
+    // Unchanged nodes and parameters are shared between snapshots
+    ASSERT_EQ(first.Find(nodes[41]), second.Find(nodes[41]));
+    ASSERT_NE(first.Find(nodes[42]), second.Find(nodes[42]));
+    ASSERT_EQ(&first.Find(nodes[42])->GetValue<float>("float_value"),
+              &second.Find(nodes[42])->GetValue<float>("float_value"));
+
+    // The deleted node is only present in the first snapshot (node addresses can be reused, identifiers can not)
+    int count = 0;
+    bool found = false;
+    first.ForEach([&](SceneGraph::NodeState const &state)
+                  {
+                      ++count;
+                      found = found || state.GetId() == deleted_id;
+                  });
+    ASSERT_EQ(count, 100);
+    ASSERT_TRUE(found);
+    found = false;
+    second.ForEach([&](SceneGraph::NodeState const &state)
+                   { found = found || state.GetId() == deleted_id; });
+    ASSERT_FALSE(found);
+
+    // Reading a snapshot from another thread does not touch the live graph
+    std::thread reader([&first, &nodes]()
+                       {
+                           for (auto i = 0; i < 100; ++i)
+                               ASSERT_EQ(first.Find(nodes[10])->GetValue<int>("type"), 10);
+                       });
+    for (auto i = 0; i < 100; ++i)
+        nodes[10]->SetValue("type", i + 1000);
+    reader.join();
+
+    nodes.erase(nodes.begin() + 7);
+    nodes.push_back(created);
+    for (auto node: nodes)
+        ASSERT_NO_THROW(m_sg->DeleteNode(node));
+    ASSERT_EQ(m_sg->TakeSnapshot().GetSize(), 0u);
+}
+
+TEST_F(App, SceneGraph_CommandBuffers)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    std::vector<std::string> events;
+    int num_batches = 0;
+
+    m_sg->RegisterOnNodeCreateCallback(
+            [&events](SceneGraph::Node *node)
+            { events.push_back("create " + std::to_string(node->GetValue<int>("type"))); });
+    m_sg->RegisterOnNodeDeleteCallback(
+            [&events](SceneGraph::Node *)
+            { events.push_back("delete"); });
+    m_sg->RegisterOnNodeChangeSetCallback(
+            [&events](SceneGraph::Node *node, SceneGraph::ChangeSet const &)
+            { events.push_back("change " + std::to_string(node->GetValue<int>("type"))); });
+    m_sg->RegisterOnEventBatchCallback(
+            [&num_batches](SceneGraph::EventBatch const &)
+            { ++num_batches; });
+
+    auto existing = m_sg->CreateNode(0);
+    events.clear();
+    num_batches = 0;
+
+    // Buffers are recorded concurrently without synchronization
+    std::vector<SceneGraph::CommandBuffer> buffers(4);
+    std::vector<std::thread> threads;
+
+    for (auto i = 0; i < 4; ++i)
+    {
+        threads.emplace_back([&buffers, existing, i]()
+                             {
+                                 auto &buffer = buffers[i];
+                                 auto node = buffer.CreateNode(1);
+                                 buffer.SetValue(node, "type", 10 + i);
+                                 buffer.ModifyValue<std::vector<int>>(node, "vector_value", [](std::vector<int> &value)
+                                 { value.clear(); });
+
+                                 if (i == 2)
+                                     buffer.SetValue(existing, "type", 100);
+                             });
+    }
+
+    for (auto &thread: threads)
+        thread.join();
+
+    std::vector<SceneGraph::CommandBuffer *> submission;
+    for (auto &buffer: buffers)
+        submission.push_back(&buffer);
+
+    m_sg->Submit(submission);
+
+    // Creations come first, changes are ordered by node identifier
+    ASSERT_EQ(events, (std::vector<std::string>{"create 10", "create 11", "create 12", "create 13", "change 100",
+                                                "change 10", "change 11", "change 12", "change 13"}));
+    ASSERT_EQ(num_batches, 1);
+
+    std::vector<SceneGraph::Node *> created;
+    for (auto &buffer: buffers)
+    {
+        ASSERT_TRUE(buffer.IsEmpty());
+        ASSERT_EQ(buffer.GetCreatedNodes().size(), 1u);
+        created.push_back(buffer.GetCreatedNodes()[0]);
+        ASSERT_TRUE(created.back()->GetValue<std::vector<int>>("vector_value").empty());
+    }
+
+    ASSERT_EQ(created[3]->GetId(), created[0]->GetId() + 3);
+
+    // A failing submission applies nothing
+    events.clear();
+    SceneGraph::CommandBuffer buffer;
+    buffer.CreateNode(0);
+    buffer.SetValue(existing, "type", 200);
+    buffer.DeleteNode(existing).DeleteNode(existing);
+    ASSERT_ANY_THROW(m_sg->Submit(buffer));
+    ASSERT_EQ(existing->GetValue<int>("type"), 100);
+    ASSERT_TRUE(events.empty());
+
+    // Deletions, including nodes created by the same buffer, come last
+    buffer.Clear();
+    auto temporary = buffer.CreateNode(0);
+    buffer.DeleteNode(temporary);
+    for (auto node: created)
+        buffer.DeleteNode(node);
+    buffer.DeleteNode(existing);
+    m_sg->Submit(buffer);
+    ASSERT_EQ(events.size(), 7u);
+    ASSERT_EQ(events[0], "create 5");
+    ASSERT_EQ(events[6], "delete");
+}
+
+TEST(SceneGraph, SingleThreadedPolicy)
+{
+    using Node = Gravity::SingleThreadedSceneGraph::Node;
+
+    // Single threaded nodes do not carry a mutex
+    ASSERT_LT(sizeof(Node), sizeof(Gravity::DefaultSceneGraph::Node));
+
+    Gravity::SingleThreadedSceneGraph sg(new BasicTypeParameterFactory<Gravity::SingleThreadedSceneGraph>({
+            {0, {{"type", 5}, {"float_value", 3.8f}}}}));
+
+    int num_changes = 0;
+    sg.RegisterOnNodeChangeSetCallback([&num_changes](Node *, Gravity::SingleThreadedSceneGraph::ChangeSet const &)
+                                       { ++num_changes; });
+
+    auto node = sg.CreateNode(0);
+    node->SetValue("type", 7);
+    ASSERT_EQ(node->GetValue<int>("type"), 7);
+    ASSERT_EQ(num_changes, 1);
+
+    Gravity::SingleThreadedSceneGraph::Transaction(sg).SetValue(node, "float_value", 1.f).Commit();
+    ASSERT_EQ(node->GetValue<float>("float_value"), 1.f);
+    ASSERT_EQ(num_changes, 2);
+
+    sg.SetDispatchMode(Gravity::SingleThreadedSceneGraph::DispatchMode::kCoalesced);
+    node->SetValue("type", 8);
+    node->SetValue("type", 9);
+    sg.Flush();
+    ASSERT_EQ(num_changes, 3);
+
+    ASSERT_THROW(sg.SetDispatchMode(Gravity::SingleThreadedSceneGraph::DispatchMode::kAsync), std::runtime_error);
+    sg.SetDispatchMode(Gravity::SingleThreadedSceneGraph::DispatchMode::kImmediate);
+
+    // Callbacks registered and unregistered during dispatch take effect from the next one
+    int num_nested = 0;
+    Gravity::Subscription outer;
+    outer = sg.RegisterOnNodeParameterChangeCallback([&](Node *, std::string const &)
+                                                     {
+                                                         sg.UnregisterCallback(outer);
+                                                         sg.RegisterOnNodeParameterChangeCallback(
+                                                                 [&num_nested](Node *, std::string const &)
+                                                                 { ++num_nested; });
+                                                     });
+    node->SetValue("type", 10);
+    ASSERT_EQ(num_nested, 0);
+    node->SetValue("type", 11);
+    ASSERT_EQ(num_nested, 1);
+
+    auto snapshot = sg.TakeSnapshot();
+    ASSERT_EQ(snapshot.GetSize(), 1u);
+
+    sg.DeleteNode(node);
+}
+
+TEST_F(App, SceneGraph_Hierarchy)
+{
+    using SceneGraph = Gravity::DefaultSceneGraph;
+
+    auto a = m_sg->CreateNode(0);
+    auto b = m_sg->CreateNode(0);
+    auto c = m_sg->CreateNode(0);
+    auto d = m_sg->CreateNode(0);
+    auto e = m_sg->CreateNode(0);
+
+    // a(b(d), c), e
+    m_sg->SetParent(b, a);
+    m_sg->SetParent(c, a);
+    m_sg->SetParent(d, b);
+
+    ASSERT_EQ(d->GetParent(), b);
+    ASSERT_EQ(a->GetFirstChild(), b);
+    ASSERT_EQ(b->GetNextSibling(), c);
+    ASSERT_THROW(m_sg->SetParent(a, d), std::runtime_error);
+
+    auto check = [this](std::vector<Gravity::DefaultSceneGraph::Node *> const &nodes,
+                        std::vector<std::size_t> const &parents, std::vector<std::size_t> const &sizes)
+    {
+        auto &hierarchy = m_sg->GetHierarchy();
+        ASSERT_EQ(hierarchy.GetSize(), nodes.size());
+
+        for (std::size_t i = 0; i < nodes.size(); ++i)
+        {
+            ASSERT_EQ(hierarchy.GetNode(i), nodes[i]);
+            ASSERT_EQ(hierarchy.GetIndex(nodes[i]), i);
+            ASSERT_EQ(hierarchy.GetParentIndex(i), parents[i]);
+            ASSERT_EQ(hierarchy.GetSubtreeSize(i), sizes[i]);
+        }
+    };
+
+    auto const kRoot = SceneGraph::kNoParent;
+
+    check({a, b, d, c, e}, {kRoot, 0, 1, 0, kRoot}, {4, 2, 1, 1, 1});
+
+    // Reparenting moves the subtree, new nodes are appended
+    m_sg->SetParent(b, e);
+    auto f = m_sg->CreateNode(0);
+    check({a, c, e, b, d, f}, {kRoot, 0, kRoot, 2, 3, kRoot}, {2, 1, 3, 2, 1, 1});
+
+    // Children of a deleted node are passed to its parent
+    m_sg->DeleteNode(b);
+    ASSERT_EQ(d->GetParent(), e);
+    check({a, c, e, d, f}, {kRoot, 0, kRoot, 2, kRoot}, {2, 1, 2, 1, 1});
+
+    m_sg->DeleteNode(a);
+    ASSERT_EQ(c->GetParent(), nullptr);
+    check({c, e, d, f}, {kRoot, kRoot, 1, kRoot}, {1, 2, 1, 1});
+
+    // Subtree deletion notifies about every node
+    std::vector<SceneGraph::Node *> deleted;
+    m_sg->RegisterOnNodeDeleteCallback([&deleted](SceneGraph::Node *node)
+                                       { deleted.push_back(node); });
+
+    m_sg->SetParent(f, d);
+    m_sg->DeleteSubtree(e);
+    ASSERT_EQ(deleted, (std::vector<SceneGraph::Node *>{e, d, f}));
+    check({c}, {kRoot}, {1});
+
+    m_sg->DeleteNode(c);
+    check({}, {}, {});
+}
+
+// Plain, matrix, decomposed and bounded nodes shared by the transform and bounding volume tests
+static TypeParameterFactory *CreateTransformParameterFactory()
+{
+    using Gravity::Matrix4;
+
+    Gravity::Aabb const bounds{{-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f}};
+
+    return new TypeParameterFactory({
+            {0, {{"type", 5}}},
+            {1, {{"type", 5}, {"local", Matrix4::Identity()}}},
+            {2, {{"type", 5}, {"local", Gravity::Trs{{0.f, 0.f, 0.f}, {0.f, 0.f, 0.f, 1.f}, {1.f, 1.f, 1.f}}}}},
+            {3, {{"type", 5}, {"local", Matrix4::Identity()}, {"bounds", bounds}}},
+            {4, {{"type", 5}, {"local", Matrix4::Identity()}, {"bounds", bounds}}}});
+}
+
+TEST(SceneGraph, TransformSystem)
+{
+    using Gravity::Matrix4;
+    using Gravity::Vector3;
+
+    Gravity::DefaultSceneGraph sg(CreateTransformParameterFactory());
+    Gravity::DefaultTransformSystem transforms(sg, "local");
+
+    auto expect_position = [&transforms](Gravity::DefaultSceneGraph::Node *node, Vector3 const &expected)
+    {
+        auto position = transforms.GetWorldTransform(node).TransformPoint(Vector3{0.f, 0.f, 0.f});
+        ASSERT_FLOAT_EQ(position.m_x, expected.m_x);
+        ASSERT_FLOAT_EQ(position.m_y, expected.m_y);
+        ASSERT_FLOAT_EQ(position.m_z, expected.m_z);
+    };
+
+    // root(child(plain(grandchild))), other
+    auto root = sg.CreateNode(1);
+    auto child = sg.CreateNode(1);
+    auto plain = sg.CreateNode(0);
+    auto grandchild = sg.CreateNode(1);
+    auto other = sg.CreateNode(1);
+
+    sg.SetParent(child, root);
+    sg.SetParent(plain, child);
+    sg.SetParent(grandchild, plain);
+
+    root->SetValue("local", Matrix4::Translation(Vector3{1.f, 0.f, 0.f}));
+    child->SetValue("local", Matrix4::Translation(Vector3{0.f, 2.f, 0.f}));
+    grandchild->SetValue("local", Matrix4::Translation(Vector3{0.f, 0.f, 3.f}));
+
+    ASSERT_EQ(transforms.Update(), 5u);
+    expect_position(child, Vector3{1.f, 2.f, 0.f});
+    expect_position(grandchild, Vector3{1.f, 2.f, 3.f});
+    expect_position(other, Vector3{0.f, 0.f, 0.f});
+
+    // Nothing has moved
+    ASSERT_EQ(transforms.Update(), 0u);
+
+    // Only the moved subtree is recomputed
+    child->SetValue("local", Matrix4::Translation(Vector3{0.f, 4.f, 0.f}));
+    other->SetValue("local", Matrix4::Translation(Vector3{5.f, 0.f, 0.f}));
+    plain->SetValue("type", 1);
+    ASSERT_EQ(transforms.Update(), 4u);
+    expect_position(grandchild, Vector3{1.f, 4.f, 3.f});
+    expect_position(other, Vector3{5.f, 0.f, 0.f});
+
+    // Created nodes are computed, restructuring recomputes everything
+    auto created = sg.CreateNode(1);
+    ASSERT_EQ(transforms.Update(), 1u);
+
+    sg.SetParent(grandchild, other);
+    ASSERT_EQ(transforms.Update(), 6u);
+    expect_position(grandchild, Vector3{5.f, 0.f, 3.f});
+
+    // TRS local transforms: rotation by 90 degrees around z turns the x axis into y
+    Gravity::DefaultTransformSystem trs_transforms(sg, "local", Gravity::LocalTransform::kTrs);
+    sg.DeleteSubtree(root);
+    sg.DeleteSubtree(other);
+    sg.DeleteNode(created);
+
+    auto pivot = sg.CreateNode(2);
+    auto arm = sg.CreateNode(2);
+    sg.SetParent(arm, pivot);
+
+    auto const kHalfSqrt2 = 0.70710678f;
+    pivot->SetValue("local", Gravity::Trs{{0.f, 0.f, 1.f}, {0.f, 0.f, kHalfSqrt2, kHalfSqrt2}, {2.f, 2.f, 2.f}});
+    arm->SetValue("local", Gravity::Trs{{1.f, 0.f, 0.f}, {0.f, 0.f, 0.f, 1.f}, {1.f, 1.f, 1.f}});
+
+    ASSERT_EQ(trs_transforms.Update(), 2u);
+
+    auto position = trs_transforms.GetWorldTransform(arm).TransformPoint(Vector3{0.f, 0.f, 0.f});
+    ASSERT_NEAR(position.m_x, 0.f, 1e-5f);
+    ASSERT_NEAR(position.m_y, 2.f, 1e-5f);
+    ASSERT_NEAR(position.m_z, 1.f, 1e-5f);
+
+    // Matrix products agree with the scalar definition
+    auto a = Gravity::Trs{{1.f, 2.f, 3.f}, {0.f, 0.f, kHalfSqrt2, kHalfSqrt2}, {1.f, 2.f, 3.f}}.ToMatrix();
+    auto b = Gravity::Trs{{4.f, 5.f, 6.f}, {kHalfSqrt2, 0.f, 0.f, kHalfSqrt2}, {3.f, 2.f, 1.f}}.ToMatrix();
+    auto product = a * b;
+
+    for (int column = 0; column < 4; ++column)
+    {
+        for (int row = 0; row < 4; ++row)
+        {
+            float expected = 0.f;
+            for (int k = 0; k < 4; ++k)
+                expected += a.m_data[k * 4 + row] * b.m_data[column * 4 + k];
+
+            ASSERT_NEAR(product.m_data[column * 4 + row], expected, 1e-5f);
+        }
+    }
+}
+
+TEST(SceneGraph, ParallelTransformUpdate)
+{
+    using Gravity::Matrix4;
+    using Gravity::Vector3;
+
+    Gravity::DefaultSceneGraph sg(CreateTransformParameterFactory());
+    Gravity::TaskPool pool(4);
+    Gravity::DefaultTransformSystem serial(sg, "local");
+    Gravity::DefaultTransformSystem parallel(sg, "local", Gravity::LocalTransform::kMatrix, &pool);
+
+    // A wide subtree, a deep chain and a random forest
+    std::vector<Gravity::DefaultSceneGraph::Node *> nodes;
+    std::mt19937 rng(7);
+
+    for (int i = 0; i < 20000; ++i)
+    {
+        auto node = sg.CreateNode(1);
+        node->SetValue("local", Matrix4::Translation(Vector3{static_cast<float>(i % 7), 1.f, 0.f}));
+
+        if (i > 0 && i < 5000)
+            sg.SetParent(node, nodes[0]);
+        else if (i > 5000 && i < 8000)
+            sg.SetParent(node, nodes[i - 1]);
+        else if (i > 8000)
+            sg.SetParent(node, nodes[std::uniform_int_distribution<int>(0, i - 1)(rng)]);
+
+        nodes.push_back(node);
+    }
+
+    auto expect_equal = [&]()
+    {
+        auto a = serial.GetWorldTransforms();
+        auto b = parallel.GetWorldTransforms();
+        ASSERT_EQ(a.GetSize(), b.GetSize());
+
+        for (std::size_t i = 0; i < a.GetSize(); ++i)
+            ASSERT_EQ(std::memcmp(a[i].m_data, b[i].m_data, sizeof(a[i].m_data)), 0);
+    };
+
+    ASSERT_EQ(serial.Update(), 20000u);
+    ASSERT_EQ(parallel.Update(), 20000u);
+    expect_equal();
+
+    for (int frame = 0; frame < 4; ++frame)
+    {
+        for (int i = 0; i < 200; ++i)
+        {
+            auto node = nodes[std::uniform_int_distribution<int>(0, 19999)(rng)];
+            node->SetValue("local", Matrix4::Translation(Vector3{static_cast<float>(frame), 0.f, 2.f}));
+        }
+
+        auto num_updated = serial.Update();
+        ASSERT_EQ(parallel.Update(), num_updated);
+        expect_equal();
+    }
+
+    // Everything moves
+    nodes[0]->SetValue("local", Matrix4::Translation(Vector3{0.f, 3.f, 0.f}));
+    nodes[5000]->SetValue("local", Matrix4::Translation(Vector3{0.f, 3.f, 0.f}));
+    serial.Update();
+    parallel.Update();
+    expect_equal();
+}
+
+TEST(SceneGraph, BoundingVolumeHierarchy)
+{
+    using Gravity::Aabb;
+    using Gravity::Matrix4;
+    using Gravity::Vector3;
+    using Node = Gravity::DefaultSceneGraph::Node;
+
+    Gravity::DefaultSceneGraph sg(CreateTransformParameterFactory());
+    Gravity::DefaultTransformSystem transforms(sg, "local");
+    Gravity::DefaultBoundingVolumeHierarchy bvh(sg, "bounds", &transforms);
+
+    std::mt19937 rng(3);
+    std::uniform_real_distribution<float> coordinate(-50.f, 50.f);
+    auto random_point = [&]()
+    { return Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}; };
+
+    std::vector<Node *> nodes;
+    auto create = [&]()
+    {
+        // Every tenth node has no bounds, some nodes are children of others
+        auto node = sg.CreateNode(nodes.size() % 10 ? 3 : 1);
+        node->SetValue("local", Matrix4::Translation(random_point()));
+
+        if (nodes.size() % 3 == 0 && !nodes.empty())
+            sg.SetParent(node, nodes[std::uniform_int_distribution<std::size_t>(0, nodes.size() - 1)(rng)]);
+
+        nodes.push_back(node);
+    };
+
+    auto update = [&]()
+    {
+        transforms.Update();
+        bvh.Update();
+    };
+
+    // Compare queries with brute force
+    auto check = [&]()
+    {
+        std::size_t num_tracked = 0;
+
+        for (auto node: nodes)
+        {
+            ASSERT_EQ(bvh.Contains(node), node->GetType() == 3);
+
+            if (node->GetType() != 3)
+                continue;
+
+            ++num_tracked;
+
+            auto center = transforms.GetWorldTransform(node).TransformPoint(Vector3{0.f, 0.f, 0.f});
+            auto bounds = bvh.GetBounds(node);
+            ASSERT_NEAR(bounds.GetCenter().m_x, center.m_x, 1e-3f);
+            ASSERT_NEAR(bounds.GetCenter().m_y, center.m_y, 1e-3f);
+        }
+
+        ASSERT_EQ(bvh.GetSize(), num_tracked);
+
+        for (int query = 0; query < 20; ++query)
+        {
+            auto c = random_point();
+            Aabb box{{c.m_x - 10.f, c.m_y - 5.f, c.m_z - 10.f}, {c.m_x + 10.f, c.m_y + 5.f, c.m_z + 10.f}};
+            Gravity::Sphere sphere{random_point(), 12.f};
+            Gravity::Ray ray{random_point(), Vector3{coordinate(rng), coordinate(rng), 1.f}};
+
+            std::set<Node *> expected_box, expected_sphere, expected_ray, found_box, found_sphere, found_ray;
+
+            for (auto node: nodes)
+            {
+                if (node->GetType() != 3)
+                    continue;
+
+                auto bounds = bvh.GetBounds(node);
+                float t;
+
+                if (Gravity::Overlaps(bounds, box))
+                    expected_box.insert(node);
+                if (Gravity::Overlaps(bounds, sphere))
+                    expected_sphere.insert(node);
+                if (Gravity::Intersect(bounds, ray, Gravity::GetInverseDirection(ray), 2.f, t))
+                    expected_ray.insert(node);
+            }
+
+            bvh.QueryBox(box, [&found_box](Node *node)
+            { found_box.insert(node); });
+            bvh.QuerySphere(sphere, [&found_sphere](Node *node)
+            { found_sphere.insert(node); });
+            bvh.QueryRay(ray, 2.f, [&found_ray](Node *node, float t)
+            {
+                ASSERT_GE(t, 0.f);
+                found_ray.insert(node);
+            });
+
+            ASSERT_EQ(found_box, expected_box);
+            ASSERT_EQ(found_sphere, expected_sphere);
+            ASSERT_EQ(found_ray, expected_ray);
+        }
+    };
+
+    for (int i = 0; i < 2000; ++i)
+        create();
+
+    update();
+    check();
+
+    auto built_cost = bvh.GetCost();
+
+    for (int frame = 0; frame < 10; ++frame)
+    {
+        // Move, add and delete some nodes
+        for (int i = 0; i < 100; ++i)
+            nodes[std::uniform_int_distribution<std::size_t>(0, nodes.size() - 1)(rng)]->SetValue(
+                    "local", Matrix4::Translation(random_point()));
+
+        for (int i = 0; i < 20; ++i)
+            create();
+
+        for (int i = 0; i < 20; ++i)
+        {
+            auto index = std::uniform_int_distribution<std::size_t>(0, nodes.size() - 1)(rng);
+            sg.DeleteNode(nodes[index]);
+            nodes.erase(nodes.begin() + index);
+        }
+
+        nodes[5]->SetValue("bounds", Aabb{{-2.f, -2.f, -2.f}, {2.f, 2.f, 2.f}});
+
+        update();
+        check();
+
+        // Degradation triggers a rebuild
+        ASSERT_LE(bvh.GetCost(), built_cost * 2.f);
+    }
+
+    ASSERT_EQ(bvh.GetBounds(nodes[5]).m_max.m_x - bvh.GetBounds(nodes[5]).m_min.m_x, 4.f);
+
+    // Nodes the transform system has not seen yet keep local bounds until it catches up
+    auto late = sg.CreateNode(3);
+    late->SetValue("local", Matrix4::Translation(Vector3{100.f, 0.f, 0.f}));
+    bvh.Update();
+    ASSERT_TRUE(bvh.GetBounds(late) == late->GetValue<Aabb>("bounds"));
+
+    update();
+    ASSERT_NEAR(bvh.GetBounds(late).GetCenter().m_x, 100.f, 1e-3f);
+}
+
+TEST(SceneGraph, FrustumCulling)
+{
+    using Gravity::Matrix4;
+    using Gravity::Vector3;
+    using Node = Gravity::DefaultSceneGraph::Node;
+
+    Gravity::DefaultSceneGraph sg(CreateTransformParameterFactory());
+    Gravity::DefaultTransformSystem transforms(sg, "local");
+    Gravity::DefaultBoundingVolumeHierarchy bvh(sg, "bounds", &transforms);
+    Gravity::TaskPool pool(4);
+    Gravity::DefaultFrustumCuller culler(bvh), parallel_culler(bvh, &pool);
+
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> coordinate(-100.f, 100.f);
+
+    // Enough nodes for several parallel chunks, types 3 and 4 have bounds
+    std::vector<Node *> nodes;
+    for (int i = 0; i < 40000; ++i)
+    {
+        auto node = sg.CreateNode(i % 2 ? 3 : 4);
+        node->SetValue("local", Matrix4::Translation(Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}));
+        nodes.push_back(node);
+    }
+
+    transforms.Update();
+    bvh.Update();
+
+    // Perspective projection looking down -z
+    auto n = 1.f, f = 80.f, t = 1.f / std::tan(0.5f);
+    Matrix4 projection{{t, 0.f, 0.f, 0.f,
+                        0.f, t, 0.f, 0.f,
+                        0.f, 0.f, (f + n) / (n - f), -1.f,
+                        0.f, 0.f, 2.f * f * n / (n - f), 0.f}};
+
+    // Node right in front of the camera at the origin is visible, the one behind it is not
+    auto front = sg.CreateNode(3), back = sg.CreateNode(3);
+    front->SetValue("local", Matrix4::Translation(Vector3{0.f, 0.f, -10.f}));
+    back->SetValue("local", Matrix4::Translation(Vector3{0.f, 0.f, 10.f}));
+    nodes.push_back(front);
+    nodes.push_back(back);
+
+    transforms.Update();
+    bvh.Update();
+
+    std::vector<Node *> visible;
+    culler.Cull(Gravity::Frustum::FromMatrix(projection), visible);
+    ASSERT_NE(std::find(visible.begin(), visible.end(), front), visible.end());
+    ASSERT_EQ(std::find(visible.begin(), visible.end(), back), visible.end());
+
+    for (int view = 0; view < 10; ++view)
+    {
+        auto eye = Vector3{coordinate(rng), coordinate(rng), coordinate(rng)};
+        auto frustum = Gravity::Frustum::FromMatrix(
+                projection * Matrix4::Translation(Vector3{-eye.m_x, -eye.m_y, -eye.m_z}));
+
+        for (auto &types: {std::set<std::uint32_t>{}, std::set<std::uint32_t>{4}})
+        {
+            std::set<Node *> expected;
+
+            for (auto node: nodes)
+            {
+                if (frustum.Classify(bvh.GetBounds(node)) != Gravity::Containment::kOutside &&
+                    (types.empty() || types.count(node->GetType())))
+                    expected.insert(node);
+            }
+
+            ASSERT_FALSE(expected.empty());
+
+            culler.Cull(frustum, visible, types);
+            ASSERT_EQ(visible.size(), expected.size());
+            ASSERT_EQ(std::set<Node *>(visible.begin(), visible.end()), expected);
+
+            parallel_culler.Cull(frustum, visible, types);
+            ASSERT_EQ(visible.size(), expected.size());
+            ASSERT_EQ(std::set<Node *>(visible.begin(), visible.end()), expected);
+
+            culler.CullHierarchy(frustum, visible, types);
+            ASSERT_EQ(visible.size(), expected.size());
+            ASSERT_EQ(std::set<Node *>(visible.begin(), visible.end()), expected);
+        }
+    }
+}
+
+TEST(SceneGraph, Raycast)
+{
+    using Gravity::Matrix4;
+    using Gravity::Ray;
+    using Gravity::Vector3;
+    using Node = Gravity::DefaultSceneGraph::Node;
+    using Hit = Gravity::DefaultBoundingVolumeHierarchy::Hit;
+
+    Gravity::DefaultSceneGraph sg(CreateTransformParameterFactory());
+    Gravity::DefaultTransformSystem transforms(sg, "local");
+    Gravity::DefaultBoundingVolumeHierarchy bvh(sg, "bounds", &transforms);
+
+    std::mt19937 rng(7);
+    std::uniform_real_distribution<float> coordinate(-20.f, 20.f);
+    auto random_point = [&]()
+    { return Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}; };
+
+    std::vector<Node *> nodes;
+    for (int i = 0; i < 3000; ++i)
+    {
+        auto node = sg.CreateNode(i % 2 ? 3 : 4);
+        node->SetValue("local", Matrix4::Translation(random_point()));
+        nodes.push_back(node);
+    }
+
+    transforms.Update();
+    bvh.Update();
+
+    // Rays from a common origin like picking, some miss everything
+    std::vector<Ray> rays;
+    auto eye = Vector3{0.f, 0.f, 40.f};
+    for (int i = 0; i < 203; ++i)
+    {
+        auto target = random_point();
+        rays.push_back(Ray{eye, Vector3{target.m_x - eye.m_x, target.m_y - eye.m_y + (i % 5 ? 0.f : 100.f),
+                                        target.m_z - eye.m_z}});
+    }
+
+    for (auto &types: {std::set<std::uint32_t>{}, std::set<std::uint32_t>{4}})
+    {
+        std::vector<Hit> packet_hits(rays.size()), all_hits;
+        bvh.RaycastPacket(rays.data(), rays.size(), 2.f, packet_hits.data(), types);
+
+        std::size_t num_hit = 0;
+
+        for (std::size_t i = 0; i < rays.size(); ++i)
+        {
+            auto &ray = rays[i];
+            auto inv_direction = Gravity::GetInverseDirection(ray);
+
+            // Brute force
+            std::vector<float> expected;
+            for (auto node: nodes)
+            {
+                float t;
+
+                if ((types.empty() || types.count(node->GetType())) &&
+                    Gravity::Intersect(bvh.GetBounds(node), ray, inv_direction, 2.f, t))
+                    expected.push_back(t);
+            }
+
+            std::sort(expected.begin(), expected.end());
+
+            bvh.RaycastAll(ray, 2.f, all_hits, types);
+            ASSERT_EQ(all_hits.size(), expected.size());
+
+            for (std::size_t hit = 0; hit < expected.size(); ++hit)
+            {
+                ASSERT_EQ(all_hits[hit].m_distance, expected[hit]);
+                ASSERT_TRUE(types.empty() || types.count(all_hits[hit].m_node->GetType()));
+            }
+
+            Hit nearest;
+            ASSERT_EQ(bvh.Raycast(ray, 2.f, nearest, types), !expected.empty());
+            ASSERT_EQ(packet_hits[i].m_node != nullptr, !expected.empty());
+
+            if (expected.empty())
+                continue;
+
+            ++num_hit;
+            ASSERT_EQ(nearest.m_distance, expected.front());
+            ASSERT_EQ(packet_hits[i].m_distance, expected.front());
+
+            float t;
+            ASSERT_TRUE(Gravity::Intersect(bvh.GetBounds(nearest.m_node), ray, inv_direction, 2.f, t));
+            ASSERT_EQ(t, nearest.m_distance);
+            ASSERT_TRUE(types.empty() || types.count(nearest.m_node->GetType()));
+        }
+
+        ASSERT_GT(num_hit, rays.size() / 4);
+        ASSERT_LT(num_hit, rays.size());
+    }
+}
+
+TEST(SceneGraph, PositionIndex)
+{
+    using Gravity::Vector3;
+    using Node = Gravity::DefaultSceneGraph::Node;
+    using Neighbour = Gravity::DefaultPositionIndex::Neighbour;
+
+    Vector3 const origin{0.f, 0.f, 0.f};
+    Gravity::DefaultSceneGraph sg(new TypeParameterFactory({
+            {0, {{"type", 5}}},
+            {1, {{"type", 5}, {"position", origin}}},
+            {2, {{"type", 5}, {"position", origin}}}}));
+    Gravity::TaskPool pool(4);
+    Gravity::DefaultPositionIndex index(sg, "position", 3.f), parallel_index(sg, "position", 7.f, &pool);
+
+    ASSERT_THROW(Gravity::DefaultPositionIndex(sg, "position", 0.f), std::runtime_error);
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> coordinate(-50.f, 50.f);
+    auto random_point = [&]()
+    { return Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}; };
+
+    std::vector<Node *> nodes;
+    auto create = [&]()
+    {
+        // Every tenth node has no position
+        auto node = sg.CreateNode(nodes.size() % 10 ? 1 + nodes.size() % 2 : 0);
+
+        if (node->GetType() != 0)
+            node->SetValue("position", random_point());
+
+        nodes.push_back(node);
+    };
+
+    auto distance = [](Vector3 const &a, Vector3 const &b)
+    {
+        auto dx = a.m_x - b.m_x, dy = a.m_y - b.m_y, dz = a.m_z - b.m_z;
+        return std::sqrt(dx * dx + dy * dy + dz * dz);
+    };
+
+    // Compare queries with brute force
+    auto check = [&]()
+    {
+        std::size_t num_tracked = 0;
+        for (auto node: nodes)
+        {
+            ASSERT_EQ(index.Contains(node), node->GetType() != 0);
+            num_tracked += node->GetType() != 0 ? 1 : 0;
+        }
+
+        ASSERT_EQ(index.GetSize(), num_tracked);
+
+        std::vector<std::pair<Node *, Vector3>> positions;
+        for (auto node: nodes)
+        {
+            if (node->GetType() != 0)
+                positions.emplace_back(node, node->GetValue<Vector3>("position"));
+        }
+
+        std::vector<Vector3> centers;
+        for (int i = 0; i < 100; ++i)
+            centers.push_back(i % 10 ? random_point() : Vector3{500.f, 0.f, 0.f});
+
+        for (auto &types: {std::set<std::uint32_t>{}, std::set<std::uint32_t>{2}})
+        {
+            Gravity::DefaultPositionIndex::BatchResult radius_batch, nearest_batch;
+            parallel_index.FindInRadius(Gravity::Span<Vector3 const>(centers.data(), centers.size()), 8.f,
+                                        radius_batch, types);
+            parallel_index.FindNearest(Gravity::Span<Vector3 const>(centers.data(), centers.size()), 5,
+                                       nearest_batch, types);
+            ASSERT_EQ(radius_batch.GetSize(), centers.size());
+
+            for (std::size_t query = 0; query < centers.size(); ++query)
+            {
+                auto &center = centers[query];
+                std::vector<std::pair<float, Node *>> expected;
+
+                for (auto &position: positions)
+                {
+                    if (types.empty() || types.count(position.first->GetType()))
+                        expected.emplace_back(distance(position.second, center), position.first);
+                }
+
+                std::sort(expected.begin(), expected.end());
+
+                std::set<Node *> expected_radius;
+                for (auto &e: expected)
+                {
+                    if (e.first <= 8.f)
+                        expected_radius.insert(e.second);
+                }
+
+                std::vector<Neighbour> found;
+                index.FindInRadius(center, 8.f, found, types);
+
+                std::set<Node *> found_radius;
+                for (auto &neighbour: found)
+                {
+                    ASSERT_LE(neighbour.m_distance, 8.f);
+                    found_radius.insert(neighbour.m_node);
+                }
+
+                ASSERT_EQ(found.size(), expected_radius.size());
+                ASSERT_EQ(found_radius, expected_radius);
+
+                std::set<Node *> batch_radius;
+                for (auto &neighbour: radius_batch.Get(query))
+                    batch_radius.insert(neighbour.m_node);
+
+                ASSERT_EQ(radius_batch.Get(query).GetSize(), expected_radius.size());
+                ASSERT_EQ(batch_radius, expected_radius);
+
+                index.FindNearest(center, 5, found, types);
+                ASSERT_EQ(found.size(), std::min<std::size_t>(5, expected.size()));
+                ASSERT_EQ(nearest_batch.Get(query).GetSize(), found.size());
+
+                for (std::size_t i = 0; i < found.size(); ++i)
+                {
+                    ASSERT_EQ(found[i].m_distance, expected[i].first);
+                    ASSERT_EQ(nearest_batch.Get(query)[i].m_distance, expected[i].first);
+                    ASSERT_TRUE(types.empty() || types.count(found[i].m_node->GetType()));
+                }
+            }
+        }
+    };
+
+    for (int i = 0; i < 5000; ++i)
+        create();
+
+    ASSERT_EQ(index.Update(), 4500u);
+    parallel_index.Update();
+    check();
+
+    for (int frame = 0; frame < 5; ++frame)
+    {
+        // Move some nodes a little and some far, add and delete some
+        for (int i = 0; i < 300; ++i)
+        {
+            auto node = nodes[std::uniform_int_distribution<std::size_t>(0, nodes.size() - 1)(rng)];
+
+            if (node->GetType() == 0)
+                continue;
+
+            auto p = node->GetValue<Vector3>("position");
+            node->SetValue("position", i % 2 ? Vector3{p.m_x + 0.1f, p.m_y, p.m_z} : random_point());
+        }
+
+        for (int i = 0; i < 50; ++i)
+            create();
+
+        for (int i = 0; i < 50; ++i)
+        {
+            auto victim = std::uniform_int_distribution<std::size_t>(0, nodes.size() - 1)(rng);
+            sg.DeleteNode(nodes[victim]);
+            nodes.erase(nodes.begin() + victim);
+        }
+
+        index.Update();
+        parallel_index.Update();
+        check();
+    }
+}
+
+TEST_F(App, SceneGraph_RenderQueue)
+{
+    using Node = Gravity::DefaultSceneGraph::Node;
+    using DrawItem = Gravity::DefaultRenderQueue::DrawItem;
+
+    auto &sg = *m_sg;
+    Gravity::TaskPool pool(4);
+    Gravity::DefaultRenderQueue queue, parallel_queue(&pool);
+
+    std::mt19937_64 rng(13);
+
+    // Keys with few distinct values in the high bits and ties
+    std::vector<Node *> nodes;
+    std::unordered_map<Node *, std::uint64_t> keys;
+    for (int i = 0; i < 50000; ++i)
+    {
+        auto node = sg.CreateNode(0);
+        node->SetValue("float_value", static_cast<float>(rng() % 1000));
+        nodes.push_back(node);
+        keys.emplace(node, (rng() % 4) << 60 | (rng() % 64) << 20 | (i % 7 ? rng() % 512 : 0));
+    }
+
+    auto make_key = [&keys](Node *node)
+    {
+        return keys.find(node)->second ^ static_cast<std::uint64_t>(node->GetValue<float>("float_value"));
+    };
+
+    // Reference: stable sort in the order of nodes
+    std::vector<DrawItem> expected;
+    for (auto node: nodes)
+        expected.push_back(DrawItem{make_key(node), node});
+
+    std::stable_sort(expected.begin(), expected.end(), [](DrawItem const &a, DrawItem const &b)
+    { return a.m_key < b.m_key; });
+
+    Gravity::Span<Node *const> visible(nodes.data(), nodes.size());
+
+    for (auto q: {&queue, &parallel_queue})
+    {
+        q->Extract(visible, make_key);
+
+        // Buffers are reused
+        auto allocations = g_allocation_count.load();
+        q->Extract(visible, make_key);
+        ASSERT_EQ(g_allocation_count.load(), allocations);
+
+        auto items = q->GetItems();
+        ASSERT_EQ(items.GetSize(), expected.size());
+
+        for (std::size_t i = 0; i < expected.size(); ++i)
+        {
+            ASSERT_EQ(items[i].m_key, expected[i].m_key);
+            ASSERT_EQ(items[i].m_node, expected[i].m_node);
+        }
+
+        // Smaller lists and equal keys
+        q->Extract(Gravity::Span<Node *const>(nodes.data(), 3), [](Node *)
+        { return std::uint64_t(42); });
+        ASSERT_EQ(q->GetItems().GetSize(), 3u);
+        ASSERT_EQ(q->GetItems()[2].m_node, nodes[2]);
+
+        q->Extract(Gravity::Span<Node *const>(), make_key);
+        ASSERT_TRUE(q->GetItems().IsEmpty());
+    }
+}
+
+TEST(SceneGraph, InstanceGroups)
+{
+    using Gravity::Matrix4;
+    using Gravity::Vector3;
+    using Node = Gravity::DefaultSceneGraph::Node;
+
+    Gravity::DefaultSceneGraph sg(new TypeParameterFactory({
+            {0, {{"local", Matrix4::Identity()}}},
+            {1, {{"local", Matrix4::Identity()}, {"mesh", std::uint32_t(0)}, {"material", std::uint32_t(0)}}}}));
+    Gravity::DefaultTransformSystem transforms(sg, "local");
+    Gravity::DefaultInstanceGroups groups(sg, {"mesh", "material"}, &transforms);
+    Gravity::DefaultInstanceGroups plain_groups(sg, {"mesh"});
+
+    ASSERT_THROW(Gravity::DefaultInstanceGroups(sg, {}), std::runtime_error);
+
+    std::mt19937 rng(17);
+    std::uniform_real_distribution<float> coordinate(-10.f, 10.f);
+    auto random_int = [&rng](std::uint32_t n)
+    { return std::uniform_int_distribution<std::uint32_t>(0, n - 1)(rng); };
+
+    std::vector<Node *> nodes;
+    auto create = [&]()
+    {
+        // Every fifth node is not instanced, some nodes are children of others
+        auto node = sg.CreateNode(nodes.size() % 5 ? 1 : 0);
+        node->SetValue("local", Matrix4::Translation(Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}));
+
+        if (node->GetType() == 1)
+        {
+            node->SetValue("mesh", random_int(5));
+            node->SetValue("material", random_int(3));
+        }
+
+        if (nodes.size() % 4 == 0 && !nodes.empty())
+            sg.SetParent(node, nodes[random_int(static_cast<std::uint32_t>(nodes.size()))]);
+
+        nodes.push_back(node);
+    };
+
+    auto update = [&]()
+    {
+        transforms.Update();
+        groups.Update();
+        plain_groups.Update();
+    };
+
+    auto check = [&]()
+    {
+        ASSERT_LE(groups.GetNumGroups(), 15u);
+        ASSERT_LE(plain_groups.GetNumGroups(), 5u);
+
+        std::size_t num_instanced = 0, num_grouped = 0;
+
+        for (auto node: nodes)
+        {
+            auto index = groups.GetGroupIndex(node);
+            ASSERT_EQ(index != Gravity::DefaultInstanceGroups::kInvalid, node->GetType() == 1);
+
+            if (node->GetType() != 1)
+                continue;
+
+            ++num_instanced;
+
+            auto key = groups.GetGroup(index).GetKey();
+            ASSERT_EQ(key.GetSize(), 2u);
+            ASSERT_EQ(key[0], node->GetValue<std::uint32_t>("mesh"));
+            ASSERT_EQ(key[1], node->GetValue<std::uint32_t>("material"));
+            ASSERT_EQ(plain_groups.GetGroup(plain_groups.GetGroupIndex(node)).GetKey()[0],
+                      node->GetValue<std::uint32_t>("mesh"));
+        }
+
+        for (std::size_t index = 0; index < groups.GetNumGroups(); ++index)
+        {
+            auto &group = groups.GetGroup(index);
+            ASSERT_EQ(group.GetTransforms().GetSize(), group.GetSize());
+            num_grouped += group.GetSize();
+
+            for (std::size_t slot = 0; slot < group.GetSize(); ++slot)
+            {
+                auto node = group.GetNodes()[slot];
+                ASSERT_EQ(groups.GetGroupIndex(node), index);
+                ASSERT_EQ(std::memcmp(&group.GetTransforms()[slot], &transforms.GetWorldTransform(node),
+                                      sizeof(Matrix4)), 0);
+            }
+        }
+
+        for (std::size_t index = 0; index < plain_groups.GetNumGroups(); ++index)
+            ASSERT_TRUE(plain_groups.GetGroup(index).GetTransforms().IsEmpty());
+
+        ASSERT_EQ(num_grouped, num_instanced);
+    };
+
+    for (int i = 0; i < 1000; ++i)
+        create();
+
+    update();
+    check();
+
+    for (int frame = 0; frame < 10; ++frame)
+    {
+        std::vector<std::uint64_t> versions;
+        for (std::size_t index = 0; index < groups.GetNumGroups(); ++index)
+            versions.push_back(groups.GetGroup(index).GetVersion());
+
+        // Nothing changes without scene changes
+        update();
+        for (std::size_t index = 0; index < groups.GetNumGroups(); ++index)
+            ASSERT_EQ(groups.GetGroup(index).GetVersion(), versions[index]);
+
+        // Regroup, move, add and delete some nodes
+        for (int i = 0; i < 30; ++i)
+        {
+            auto node = nodes[random_int(static_cast<std::uint32_t>(nodes.size()))];
+
+            if (node->GetType() == 1)
+                node->SetValue(i % 2 ? "mesh" : "material", random_int(3));
+        }
+
+        for (int i = 0; i < 50; ++i)
+            nodes[random_int(static_cast<std::uint32_t>(nodes.size()))]->SetValue(
+                    "local", Matrix4::Translation(Vector3{coordinate(rng), coordinate(rng), coordinate(rng)}));
+
+        for (int i = 0; i < 20; ++i)
+            create();
+
+        for (int i = 0; i < 20; ++i)
+        {
+            auto victim = random_int(static_cast<std::uint32_t>(nodes.size()));
+            sg.DeleteNode(nodes[victim]);
+            nodes.erase(nodes.begin() + victim);
+        }
+
+        update();
+        check();
+    }
+
+    // Nodes created after the transform update get the identity until the next one
+    transforms.Update();
+    auto late = sg.CreateNode(1);
+    late->SetValue("local", Matrix4::Translation(Vector3{1.f, 2.f, 3.f}));
+    nodes.push_back(late);
+    groups.Update();
+
+    auto &group = groups.GetGroup(groups.GetGroupIndex(late));
+    auto identity = Matrix4::Identity();
+    ASSERT_EQ(std::memcmp(&group.GetTransforms()[group.GetSize() - 1], &identity, sizeof(Matrix4)), 0);
+
+    update();
+    check();
+}
+
+TEST(SceneGraph, LodSelection)
+{
+    using Gravity::Aabb;
+    using Gravity::LodThresholds;
+    using Gravity::LodView;
+    using Gravity::Vector3;
+    using Node = Gravity::DefaultSceneGraph::Node;
+    using Change = Gravity::DefaultLodSelector::LodChange;
+
+    float const kHysteresis = 0.1f;
+
+    // Every node is bounded, type 1 nodes switch levels of detail
+    Aabb const bounds{{-0.5f, -0.5f, -0.5f}, {0.5f, 0.5f, 0.5f}};
+    auto create_factory = [&bounds]()
+    {
+        return new TypeParameterFactory({
+                {0, {{"bounds", bounds}}},
+                {1, {{"bounds", bounds}, {"lod", LodThresholds{{0.5f, 0.2f, 0.05f}}}}}});
+    };
+
+    Gravity::DefaultSceneGraph sg(create_factory());
+    Gravity::DefaultBoundingVolumeHierarchy bvh(sg, "bounds");
+    Gravity::TaskPool pool(4);
+    Gravity::DefaultLodSelector selector(sg, bvh, "lod", kHysteresis);
+    Gravity::DefaultLodSelector parallel_selector(sg, bvh, "lod", kHysteresis, &pool);
+
+    ASSERT_THROW(Gravity::DefaultLodSelector(sg, bvh, "lod", 1.f), std::runtime_error);
+
+    // Hysteresis around the first threshold with a single node of radius 1 at the origin
+    {
+        Gravity::DefaultSceneGraph single_sg(create_factory());
+        Gravity::DefaultBoundingVolumeHierarchy single_bvh(single_sg, "bounds");
+        Gravity::DefaultLodSelector single(single_sg, single_bvh, "lod", kHysteresis);
+
+        auto node = single_sg.CreateNode(1);
+        auto half = 1.f / std::sqrt(3.f);
+        node->SetValue("bounds", Aabb{{-half, -half, -half}, {half, half, half}});
+        single_bvh.Update();
+        single.Update();
+
+        std::vector<Change> changes;
+
+        // Screen size of the node seen from a distance with unit scale is 1 / distance
+        auto select = [&](float size)
+        {
+            LodView view{{0.f, 0.f, 1.f / size}, 1.f};
+            single.Select(Gravity::Span<LodView const>(&view, 1), changes);
+            return single.GetLevel(node);
+        };
+
+        ASSERT_EQ(select(1.f), 0u);
+        ASSERT_TRUE(changes.empty());
+        ASSERT_EQ(select(0.47f), 0u);
+        ASSERT_EQ(select(0.44f), 1u);
+        ASSERT_EQ(changes.size(), 1u);
+        ASSERT_EQ(changes[0].m_node, node);
+        ASSERT_EQ(changes[0].m_level, 1u);
+        ASSERT_EQ(changes[0].m_previous, 0u);
+        ASSERT_EQ(select(0.53f), 1u);
+        ASSERT_TRUE(changes.empty());
+        ASSERT_EQ(select(0.56f), 0u);
+        ASSERT_EQ(select(0.01f), 3u);
+        ASSERT_EQ(changes[0].m_previous, 0u);
+        ASSERT_EQ(single.GetLevels().GetSize(), 1u);
+        ASSERT_EQ(single.GetLevels()[0], 3u);
+    }
+
+    std::mt19937 rng(11);
+    std::uniform_real_distribution<float> coordinate(-100.f, 100.f);
+    std::uniform_real_distribution<float> extent(0.1f, 5.f);
+
+    auto random_bounds = [&]()
+    {
+        Vector3 center{coordinate(rng), coordinate(rng), coordinate(rng)};
+        auto e = extent(rng);
+        return Aabb{{center.m_x - e, center.m_y - e, center.m_z - e}, {center.m_x + e, center.m_y + e, center.m_z + e}};
+    };
+
+    // Enough nodes for several parallel chunks, every third one has no thresholds
+    std::vector<Node *> nodes;
+    auto create = [&]()
+    {
+        auto node = sg.CreateNode(nodes.size() % 3 ? 1 : 0);
+        node->SetValue("bounds", random_bounds());
+        nodes.push_back(node);
+    };
+
+    for (int i = 0; i < 20000; ++i)
+        create();
+
+    // Expected levels computed from levels as of the previous frame
+    std::unordered_map<Node const *, std::uint32_t> levels;
+
+    auto expected_level = [&](Node *node, std::vector<LodView> const &views)
+    {
+        if (node->GetType() != 1)
+            return 0u;
+
+        auto box = node->GetValue<Aabb>("bounds");
+        auto thresholds = node->GetValue<LodThresholds>("lod");
+        float center[3] = {(box.m_min.m_x + box.m_max.m_x) * 0.5f, (box.m_min.m_y + box.m_max.m_y) * 0.5f,
+                           (box.m_min.m_z + box.m_max.m_z) * 0.5f};
+        float e[3] = {box.m_max.m_x - box.m_min.m_x, box.m_max.m_y - box.m_min.m_y, box.m_max.m_z - box.m_min.m_z};
+        auto radius2 = (e[0] * e[0] + e[1] * e[1] + e[2] * e[2]) * 0.25f;
+
+        auto distance2 = std::numeric_limits<float>::max();
+        for (auto &view: views)
+        {
+            auto dx = center[0] - view.m_position.m_x;
+            auto dy = center[1] - view.m_position.m_y;
+            auto dz = center[2] - view.m_position.m_z;
+            distance2 = std::min(distance2, (dx * dx + dy * dy + dz * dz) * (1.f / (view.m_scale * view.m_scale)));
+        }
+
+        auto previous = levels[node];
+        std::uint32_t level = 0;
+        for (std::uint32_t k = 0; k < 3; ++k)
+        {
+            auto margin = previous > k ? 1.f + kHysteresis : 1.f - kHysteresis;
+            level += radius2 < thresholds.m_sizes[k] * thresholds.m_sizes[k] * distance2 * (margin * margin) ? 1 : 0;
+        }
+
+        return level;
+    };
+
+    std::vector<Change> changes, parallel_changes;
+
+    for (int frame = 0; frame < 10; ++frame)
+    {
+        bvh.Update();
+        selector.Update();
+        parallel_selector.Update();
+
+        std::vector<LodView> views{LodView{{coordinate(rng), coordinate(rng), coordinate(rng)}, 1.5f}};
+        if (frame % 2)
+            views.push_back(LodView{{coordinate(rng), coordinate(rng), coordinate(rng)}, 1.f});
+
+        Gravity::Span<LodView const> span(views.data(), views.size());
+        selector.Select(span, changes);
+        parallel_selector.Select(span, parallel_changes);
+
+        ASSERT_EQ(changes.size(), parallel_changes.size());
+        for (std::size_t i = 0; i < changes.size(); ++i)
+        {
+            ASSERT_EQ(changes[i].m_node, parallel_changes[i].m_node);
+            ASSERT_EQ(changes[i].m_level, parallel_changes[i].m_level);
+            ASSERT_NE(changes[i].m_level, changes[i].m_previous);
+        }
+
+        // Every node with a new level is reported once
+        std::unordered_map<Node const *, Change> changed;
+        for (auto &change: changes)
+            ASSERT_TRUE(changed.emplace(change.m_node, change).second);
+
+        auto bvh_nodes = bvh.GetNodes();
+        ASSERT_EQ(selector.GetLevels().GetSize(), bvh_nodes.GetSize());
+
+        for (std::size_t i = 0; i < bvh_nodes.GetSize(); ++i)
+            ASSERT_EQ(selector.GetLevels()[i], selector.GetLevel(bvh_nodes[i]));
+
+        std::size_t num_changed = 0;
+        for (auto node: nodes)
+        {
+            auto level = expected_level(node, views);
+            ASSERT_EQ(selector.GetLevel(node), level);
+            ASSERT_EQ(parallel_selector.GetLevel(node), level);
+
+            auto iter = changed.find(node);
+            if (level != levels[node])
+            {
+                ASSERT_TRUE(iter != changed.cend());
+                ASSERT_EQ(iter->second.m_previous, levels[node]);
+                ++num_changed;
+            }
+
+            levels[node] = level;
+        }
+
+        ASSERT_EQ(num_changed, changes.size());
+        if (frame > 0)
+        {
+            ASSERT_GT(num_changed, 0u);
+        }
+
+        // Move nodes, change thresholds, add and delete nodes
+        for (int i = 0; i < 500; ++i)
+            nodes[rng() % nodes.size()]->SetValue("bounds", random_bounds());
+
+        for (int i = 0; i < 200; ++i)
+        {
+            auto node = nodes[rng() % nodes.size()];
+            if (node->GetType() == 1)
+                node->SetValue("lod", LodThresholds{{0.3f, 0.1f, 0.f}});
+        }
+
+        for (int i = 0; i < 200; ++i)
+            create();
+
+        for (int i = 0; i < 200; ++i)
+        {
+            auto victim = rng() % nodes.size();
+            levels.erase(nodes[victim]);
+            sg.DeleteNode(nodes[victim]);
+            nodes.erase(nodes.begin() + victim);
+        }
+    }
+}